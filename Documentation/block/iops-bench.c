@@ -0,0 +1,175 @@
+/*
+ * Measure how random read IOPS on a block device scale with the number
+ * of submitting cpus.
+ *
+ * For 1, 2, 4, ... up to the number of online cpus, one thread per cpu,
+ * each pinned to its cpu, issues O_DIRECT reads of one block at random
+ * offsets for the given time.  Prints the total IOPS and the IOPS per
+ * thread of each run.  Point it at a null_blk device to see what the
+ * block layer itself can do:
+ *
+ *   modprobe null_blk queue_mode=1 irqmode=0	# request_fn, queue_lock
+ *   iops-bench /dev/nullb0
+ *   rmmod null_blk
+ *   modprobe null_blk queue_mode=2 irqmode=0	# multi-queue
+ *   iops-bench /dev/nullb0
+ *
+ * Usage: iops-bench [-b block_size] [-d seconds] [-t max_threads] device
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <linux/fs.h>
+
+static const char *device;
+static unsigned long block_size = 4096;
+static unsigned long long nr_blocks;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	int cpu;
+	unsigned long ios;
+};
+
+static void *read_worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int seed = w->cpu + 1;
+	unsigned long long block;
+	cpu_set_t set;
+	void *buf;
+	int fd;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+
+	fd = open(device, O_RDONLY | O_DIRECT);
+	if (fd < 0) {
+		perror(device);
+		exit(1);
+	}
+	if (posix_memalign(&buf, 4096, block_size)) {
+		perror("posix_memalign");
+		exit(1);
+	}
+
+	while (!stop) {
+		block = ((unsigned long long)rand_r(&seed) << 31 |
+			 rand_r(&seed)) % nr_blocks;
+		if (pread(fd, buf, block_size, block * block_size) !=
+		    (ssize_t)block_size) {
+			perror("pread");
+			exit(1);
+		}
+		w->ios++;
+	}
+
+	free(buf);
+	close(fd);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void run(int nr, int seconds)
+{
+	struct worker *workers;
+	unsigned long total = 0;
+	double start, elapsed;
+	int i;
+
+	workers = calloc(nr, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		exit(1);
+	}
+
+	stop = 0;
+	start = now();
+	for (i = 0; i < nr; i++) {
+		workers[i].cpu = i;
+		pthread_create(&workers[i].thread, NULL,
+			       read_worker, &workers[i]);
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nr; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].ios;
+	}
+	elapsed = now() - start;
+
+	printf("%8d %14.0f %14.0f\n", nr, total / elapsed,
+	       total / elapsed / nr);
+	fflush(stdout);
+	free(workers);
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long long bytes;
+	int seconds = 5;
+	int c, nr, fd;
+
+	while ((c = getopt(argc, argv, "b:d:t:")) != -1) {
+		switch (c) {
+		case 'b':
+			block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1)
+		goto usage;
+	device = argv[optind];
+
+	fd = open(device, O_RDONLY);
+	if (fd < 0 || ioctl(fd, BLKGETSIZE64, &bytes)) {
+		perror(device);
+		return 1;
+	}
+	close(fd);
+
+	nr_blocks = bytes / block_size;
+	if (!nr_blocks) {
+		fprintf(stderr, "%s is smaller than a block\n", device);
+		return 1;
+	}
+
+	printf("%s, %lu byte random reads, %d seconds per run\n",
+	       device, block_size, seconds);
+	printf("%8s %14s %14s\n", "threads", "IOPS", "IOPS/thread");
+
+	for (nr = 1; nr < max_threads; nr *= 2)
+		run(nr, seconds);
+	run(max_threads, seconds);
+
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-b block_size] [-d seconds] "
+		"[-t max_threads] device\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,182 @@
+/*
+ * Measure how page faults scale with the number of faulting threads,
+ * optionally while another thread keeps changing the address space.
+ *
+ * Every thread repeatedly touches all pages of its own private anonymous
+ * area and discards them with MADV_DONTNEED, so that each touch is a
+ * fresh anonymous page fault.  With -w, one more thread loops over mmap,
+ * mprotect and munmap of a small unrelated area: without speculative page
+ * faults, each of those holds mmap_sem for writing and stalls all of the
+ * faulting threads.
+ *
+ * Usage: fault-scale [-t max_threads] [-s MB_per_thread] [-d seconds] [-w]
+ *
+ * For 1 to max_threads threads, prints the faults per second overall
+ * and per thread, and how many faults the kernel handled speculatively
+ * according to /proc/vmstat.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+static unsigned long area_size = 16UL << 20;
+static volatile int stop;
+static long page_size;
+
+struct worker {
+	pthread_t thread;
+	unsigned long faults;
+};
+
+static void *fault_worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long faults = 0;
+	unsigned long i;
+	char *area;
+
+	area = mmap(NULL, area_size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+
+	while (!stop) {
+		for (i = 0; i < area_size && !stop; i += page_size) {
+			area[i] = 1;
+			faults++;
+		}
+		madvise(area, area_size, MADV_DONTNEED);
+	}
+
+	munmap(area, area_size);
+	w->faults = faults;
+	return NULL;
+}
+
+static void *mmap_worker(void *arg)
+{
+	unsigned long len = 16 * page_size;
+	char *p;
+
+	while (!stop) {
+		p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			continue;
+		mprotect(p, len, PROT_READ);
+		munmap(p, len);
+	}
+	return NULL;
+}
+
+static unsigned long vmstat(const char *name)
+{
+	char key[64];
+	unsigned long val, ret = 0;
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return 0;
+	while (fscanf(f, "%63s %lu", key, &val) == 2) {
+		if (!strcmp(key, name)) {
+			ret = val;
+			break;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int seconds = 5;
+	int writer = 0;
+	int nr, i, c;
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	while ((c = getopt(argc, argv, "t:s:d:w")) != -1) {
+		switch (c) {
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			area_size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'w':
+			writer = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t max_threads] "
+				"[-s MB_per_thread] [-d seconds] [-w]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	printf("%8s %14s %14s %10s\n",
+	       "threads", "faults/s", "faults/s/thr", "spec %");
+
+	for (nr = 1; nr <= max_threads; nr++) {
+		struct worker *workers;
+		pthread_t mmap_thread;
+		unsigned long total = 0, spf, spf_abort;
+		double start, elapsed;
+
+		workers = calloc(nr, sizeof(*workers));
+		if (!workers)
+			return 1;
+
+		stop = 0;
+		spf = vmstat("speculative_pgfault");
+		spf_abort = vmstat("speculative_pgfault_abort");
+		start = now();
+
+		for (i = 0; i < nr; i++)
+			pthread_create(&workers[i].thread, NULL,
+				       fault_worker, &workers[i]);
+		if (writer)
+			pthread_create(&mmap_thread, NULL, mmap_worker, NULL);
+
+		sleep(seconds);
+		stop = 1;
+
+		for (i = 0; i < nr; i++) {
+			pthread_join(workers[i].thread, NULL);
+			total += workers[i].faults;
+		}
+		if (writer)
+			pthread_join(mmap_thread, NULL);
+
+		elapsed = now() - start;
+		spf = vmstat("speculative_pgfault") - spf;
+		spf_abort = vmstat("speculative_pgfault_abort") - spf_abort;
+
+		printf("%8d %14.0f %14.0f %9.1f%%\n", nr,
+		       total / elapsed, total / elapsed / nr,
+		       spf + spf_abort ?
+				100.0 * spf / (spf + spf_abort) : 0.0);
+		free(workers);
+	}
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * Measure what MADV_FREE saves a malloc-like allocator, and check that
+ * reclaim drops lazily freed pages instead of swapping them out.
+ *
+ * An allocator that gives memory back with madvise() and soon reuses it
+ * pays for that on every reuse with MADV_DONTNEED: one page fault and one
+ * zeroed page per page.  With MADV_FREE the pages stay mapped, so only the
+ * madvise() call itself costs something, until memory gets tight.
+ *
+ * The first part writes a chunk of -c KB and gives it back, -n times in
+ * a row with each advice, and prints the time and the page faults that
+ * one such cycle takes.
+ *
+ * With -p, the second part fills an area of -s MB, frees all of it with
+ * MADV_FREE, and then touches -p MB of new memory to push it out.  It
+ * prints how many of the freed pages reclaim dropped, which read back as
+ * zero, next to the pglazyfreed and pswpout deltas from /proc/vmstat:
+ * dropped pages should show up in the former, not in the latter.  Run it
+ * in a memory cgroup with a limit below -s plus -p to keep that cheap.
+ *
+ * Usage: madv-free-churn [-c KB_per_chunk] [-n cycles] [-s MB] [-p MB]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#ifndef MADV_FREE
+#define MADV_FREE	8
+#endif
+
+static long page_size;
+
+struct vm_counters {
+	unsigned long lazyfreed;
+	unsigned long pswpout;
+};
+
+static void read_vm_counters(struct vm_counters *vc)
+{
+	char line[128];
+	FILE *f;
+
+	memset(vc, 0, sizeof(*vc));
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		sscanf(line, "pglazyfreed %lu", &vc->lazyfreed);
+		sscanf(line, "pswpout %lu", &vc->pswpout);
+	}
+	fclose(f);
+}
+
+static char *map_anon(size_t size)
+{
+	char *p;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return p;
+}
+
+static void touch(char *p, size_t size)
+{
+	size_t off;
+
+	for (off = 0; off < size; off += page_size)
+		p[off] = 1;
+}
+
+static void advise(char *p, size_t size, int advice)
+{
+	if (madvise(p, size, advice)) {
+		perror(advice == MADV_FREE ? "madvise(MADV_FREE)" :
+					     "madvise(MADV_DONTNEED)");
+		exit(1);
+	}
+}
+
+static long minor_faults(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_minflt;
+}
+
+/* Reuse one chunk @cycles times, giving it back with @advice in between */
+static void time_reuse(const char *name, int advice, size_t chunk,
+		       unsigned long cycles)
+{
+	struct timespec t0, t1;
+	unsigned long n;
+	double ns;
+	long faults;
+	char *p;
+
+	p = map_anon(chunk);
+	touch(p, chunk);		/* the first faults happen either way */
+
+	faults = minor_faults();
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (n = 0; n < cycles; n++) {
+		advise(p, chunk, advice);
+		touch(p, chunk);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	faults = minor_faults() - faults;
+
+	ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+	printf("%-14s %14.0f %14.2f\n", name, ns / cycles,
+	       (double)faults / cycles);
+	munmap(p, chunk);
+}
+
+/* Lazily free @size bytes, then make reclaim deal with them */
+static void check_reclaim(size_t size, size_t pressure)
+{
+	struct vm_counters before, after;
+	unsigned long dropped = 0, kept = 0;
+	char *area, *hog;
+	size_t off;
+
+	area = map_anon(size);
+	touch(area, size);
+	advise(area, size, MADV_FREE);
+
+	read_vm_counters(&before);
+	hog = map_anon(pressure);
+	touch(hog, pressure);
+	read_vm_counters(&after);
+
+	for (off = 0; off < size; off += page_size) {
+		if (area[off])
+			kept++;
+		else
+			dropped++;
+	}
+
+	printf("\n%lu of %lu lazily freed pages dropped by reclaim\n",
+	       dropped, dropped + kept);
+	printf("pglazyfreed +%lu, pswpout +%lu\n",
+	       after.lazyfreed - before.lazyfreed,
+	       after.pswpout - before.pswpout);
+
+	munmap(hog, pressure);
+	munmap(area, size);
+}
+
+int main(int argc, char **argv)
+{
+	size_t chunk = 256UL << 10;
+	unsigned long cycles = 100000;
+	size_t size = 64UL << 20;
+	size_t pressure = 0;
+	int c;
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	while ((c = getopt(argc, argv, "c:n:s:p:")) != -1) {
+		switch (c) {
+		case 'c':
+			chunk = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 'n':
+			cycles = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'p':
+			pressure = strtoul(optarg, NULL, 0) << 20;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-c KB_per_chunk] "
+				"[-n cycles] [-s MB] [-p MB]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (chunk < (size_t)page_size || !cycles || !size) {
+		fprintf(stderr, "need a chunk of at least a page, "
+			"a cycle and an area\n");
+		return 1;
+	}
+
+	printf("%lu KB chunk, %lu cycles\n", (unsigned long)chunk >> 10,
+	       cycles);
+	printf("%-14s %14s %14s\n", "advice", "ns/cycle", "faults/cycle");
+	time_reuse("MADV_DONTNEED", MADV_DONTNEED, chunk, cycles);
+	time_reuse("MADV_FREE", MADV_FREE, chunk, cycles);
+
+	if (pressure)
+		check_reclaim(size, pressure);
+
+	return 0;
+}
@@ -0,0 +1,230 @@
+/*
+ * Watch automatic NUMA balancing move memory and tasks between nodes.
+ *
+ * The test faults in a private anonymous area while running on the cpus
+ * of node A, so that the default local policy places it there, then
+ * keeps reading and writing it from the cpus of node B.  Every second it
+ * prints how much of the area sits on each of the two nodes, according
+ * to move_pages(), along with the NUMA balancing counters of /proc/vmstat.
+ * With -t, the task may run on any cpu after starting on node B; the
+ * output then also shows the node it runs on, which should become node A
+ * if the scheduler follows the memory instead.
+ *
+ * Usage: numa-balance-test [-a node] [-b node] [-s MB] [-d seconds] [-t]
+ *
+ * Without a NUMA machine at hand, boot a guest with an emulated topology:
+ *   qemu-system-x86_64 -smp 4 -m 2G \
+ *	-numa node,cpus=0-1,mem=1G -numa node,cpus=2-3,mem=1G ...
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+
+#define MAX_NODES	64
+
+static long page_size;
+
+static int node_cpus(int node, cpu_set_t *set)
+{
+	char path[64], buf[1024], *p = buf;
+	FILE *f;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%d/cpulist", node);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	if (!fgets(buf, sizeof(buf), f))
+		buf[0] = '\0';
+	fclose(f);
+
+	CPU_ZERO(set);
+	while (*p && *p != '\n') {
+		int first, last, n;
+
+		if (sscanf(p, "%d%n", &first, &n) != 1)
+			break;
+		p += n;
+		last = first;
+		if (*p == '-') {
+			if (sscanf(++p, "%d%n", &last, &n) != 1)
+				break;
+			p += n;
+		}
+		while (first <= last)
+			CPU_SET(first++, set);
+		if (*p == ',')
+			p++;
+	}
+	return CPU_COUNT(set) ? 0 : -1;
+}
+
+static int cpu_node(int cpu)
+{
+	cpu_set_t set;
+	int node;
+
+	for (node = 0; node < MAX_NODES; node++)
+		if (!node_cpus(node, &set) && CPU_ISSET(cpu, &set))
+			return node;
+	return -1;
+}
+
+static void run_on(int node)
+{
+	cpu_set_t set;
+
+	if (node_cpus(node, &set)) {
+		fprintf(stderr, "node %d has no cpus\n", node);
+		exit(1);
+	}
+	if (sched_setaffinity(0, sizeof(set), &set)) {
+		perror("sched_setaffinity");
+		exit(1);
+	}
+}
+
+static void count_nodes(char *area, unsigned long nr_pages, int *status,
+			void **pages, unsigned long *on_a, unsigned long *on_b,
+			int a, int b)
+{
+	unsigned long i;
+
+	for (i = 0; i < nr_pages; i++)
+		pages[i] = area + i * page_size;
+	if (syscall(__NR_move_pages, 0, nr_pages, pages, NULL, status, 0)) {
+		perror("move_pages");
+		exit(1);
+	}
+	*on_a = *on_b = 0;
+	for (i = 0; i < nr_pages; i++) {
+		if (status[i] == a)
+			(*on_a)++;
+		else if (status[i] == b)
+			(*on_b)++;
+	}
+}
+
+static unsigned long vmstat(const char *name)
+{
+	char key[64];
+	unsigned long val, ret = 0;
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return 0;
+	while (fscanf(f, "%63s %lu", key, &val) == 2) {
+		if (!strcmp(key, name)) {
+			ret = val;
+			break;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long size = 256UL << 20;
+	unsigned long nr_pages, on_a, on_b, i;
+	unsigned long faults, local, migrated;
+	int a = 0, b = 1, seconds = 30, move_task = 0;
+	int c, sec, *status;
+	void **pages;
+	double next;
+	char *area;
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	while ((c = getopt(argc, argv, "a:b:s:d:t")) != -1) {
+		switch (c) {
+		case 'a':
+			a = atoi(optarg);
+			break;
+		case 'b':
+			b = atoi(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 't':
+			move_task = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-a node] [-b node] [-s MB] "
+				"[-d seconds] [-t]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	nr_pages = size / page_size;
+	status = calloc(nr_pages, sizeof(*status));
+	pages = calloc(nr_pages, sizeof(*pages));
+	area = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (!status || !pages || area == MAP_FAILED) {
+		perror("allocating the test area");
+		return 1;
+	}
+
+	run_on(a);
+	memset(area, 1, size);
+	count_nodes(area, nr_pages, status, pages, &on_a, &on_b, a, b);
+	printf("faulted %lu MB on node %d: %lu pages on node %d, "
+	       "%lu on node %d\n", size >> 20, a, on_a, a, on_b, b);
+
+	run_on(b);
+	if (move_task) {
+		cpu_set_t all;
+
+		CPU_ZERO(&all);
+		for (i = 0; i < CPU_SETSIZE; i++)
+			CPU_SET(i, &all);
+		sched_setaffinity(0, sizeof(all), &all);
+	}
+
+	printf("%4s %10s %10s %6s %12s %12s %12s\n", "sec", "node A %",
+	       "node B %", "runs", "hint_faults", "local", "migrated");
+	faults = vmstat("numa_hint_faults");
+	local = vmstat("numa_hint_faults_local");
+	migrated = vmstat("numa_pages_migrated");
+	next = now() + 1;
+
+	for (sec = 1; sec <= seconds; ) {
+		for (i = 0; i < size; i += page_size)
+			area[i]++;
+		if (now() < next)
+			continue;
+
+		count_nodes(area, nr_pages, status, pages, &on_a, &on_b, a, b);
+		printf("%4d %9.1f%% %9.1f%% %6d %12lu %12lu %12lu\n", sec,
+		       100.0 * on_a / nr_pages, 100.0 * on_b / nr_pages,
+		       cpu_node(sched_getcpu()),
+		       vmstat("numa_hint_faults") - faults,
+		       vmstat("numa_hint_faults_local") - local,
+		       vmstat("numa_pages_migrated") - migrated);
+		fflush(stdout);
+		next += 1;
+		sec++;
+	}
+
+	return 0;
+}
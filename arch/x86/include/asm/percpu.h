@@ -284,6 +284,28 @@ do {									\
 #define irqsafe_cpu_or_8(pcp, val)	percpu_to_op("or", (pcp), val)
 #define irqsafe_cpu_xor_8(pcp, val)	percpu_to_op("xor", (pcp), val)
 
+/*
+ * cmpxchg16b on a per cpu double word. The instruction is missing on
+ * early AMD64 processors, which fall back to the generic version that
+ * disables interrupts. pcp1 must be 16 byte aligned.
+ */
+#define percpu_cmpxchg16b_double(pcp1, o1, o2, n1, n2)			\
+({									\
+	char __ret;							\
+	typeof(o1) __o1 = (o1);						\
+	typeof(o2) __o2 = (o2);						\
+	asm volatile("cmpxchg16b "__percpu_arg(1)"\n\tsetz %0"		\
+		     : "=qm" (__ret), "+m" (pcp1), "+a" (__o1), "+d" (__o2) \
+		     : "b" (n1), "c" (n2)				\
+		     : "memory");					\
+	__ret;								\
+})
+
+#define irqsafe_cpu_cmpxchg_double_8(pcp1, pcp2, o1, o2, n1, n2)	\
+	(boot_cpu_has(X86_FEATURE_CX16) ?				\
+	 percpu_cmpxchg16b_double(pcp1, o1, o2, n1, n2) :		\
+	 irqsafe_generic_cpu_cmpxchg_double(pcp1, pcp2, o1, o2, n1, n2))
+
 #endif
 
 /* This is not atomic against other CPUs -- CPU preemption needs to be off */
@@ -0,0 +1,124 @@
+/*
+ * Tag allocation for multi-queue block devices.  Tags index the requests
+ * preallocated for each hardware queue, so getting a tag is getting a
+ * request.
+ */
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/bitops.h>
+#include <linux/blk-mq.h>
+
+#include "blk-mq.h"
+
+struct blk_mq_tags {
+	unsigned int		nr_tags;
+
+	/*
+	 * Where each cpu looks for a free tag first: right after the one
+	 * it got last time, so that cpus do not fight over the same words
+	 * of the bitmap.
+	 */
+	unsigned int __percpu	*hint;
+
+	wait_queue_head_t	wait;
+	unsigned long		map[0];
+};
+
+struct blk_mq_tags *blk_mq_init_tags(unsigned int nr_tags, int node)
+{
+	struct blk_mq_tags *tags;
+	unsigned int cpu;
+
+	tags = kzalloc_node(sizeof(*tags) +
+			    BITS_TO_LONGS(nr_tags) * sizeof(unsigned long),
+			    GFP_KERNEL, node);
+	if (!tags)
+		return NULL;
+
+	tags->hint = alloc_percpu(unsigned int);
+	if (!tags->hint) {
+		kfree(tags);
+		return NULL;
+	}
+
+	/* spread the cpus over the map */
+	for_each_possible_cpu(cpu)
+		*per_cpu_ptr(tags->hint, cpu) = (cpu * 8) % nr_tags;
+
+	tags->nr_tags = nr_tags;
+	init_waitqueue_head(&tags->wait);
+	return tags;
+}
+
+void blk_mq_free_tags(struct blk_mq_tags *tags)
+{
+	free_percpu(tags->hint);
+	kfree(tags);
+}
+
+static unsigned int __blk_mq_get_tag(struct blk_mq_tags *tags)
+{
+	unsigned int *hint, start, tag;
+
+	hint = per_cpu_ptr(tags->hint, raw_smp_processor_id());
+	start = *hint;
+	tag = start;
+
+	do {
+		tag = find_next_zero_bit(tags->map, tags->nr_tags, tag);
+		if (tag >= tags->nr_tags) {
+			if (!start)
+				return BLK_MQ_TAG_FAIL;
+			/* wrap around once */
+			tag = 0;
+			start = 0;
+			continue;
+		}
+		if (!test_and_set_bit_lock(tag, tags->map))
+			break;
+	} while (1);
+
+	*hint = tag + 1 < tags->nr_tags ? tag + 1 : 0;
+	return tag;
+}
+
+/*
+ * Returns BLK_MQ_TAG_FAIL if all tags are in use, unless @gfp allows
+ * waiting for one to be released.
+ */
+unsigned int blk_mq_get_tag(struct blk_mq_tags *tags, gfp_t gfp)
+{
+	unsigned int tag;
+	DEFINE_WAIT(wait);
+
+	tag = __blk_mq_get_tag(tags);
+	if (tag != BLK_MQ_TAG_FAIL || !(gfp & __GFP_WAIT))
+		return tag;
+
+	do {
+		prepare_to_wait_exclusive(&tags->wait, &wait,
+					  TASK_UNINTERRUPTIBLE);
+		tag = __blk_mq_get_tag(tags);
+		if (tag != BLK_MQ_TAG_FAIL)
+			break;
+		io_schedule();
+	} while (1);
+	finish_wait(&tags->wait, &wait);
+
+	return tag;
+}
+
+void blk_mq_put_tag(struct blk_mq_tags *tags, unsigned int tag)
+{
+	BUG_ON(tag >= tags->nr_tags);
+
+	clear_bit_unlock(tag, tags->map);
+
+	/* pairs with the set_current_state() in prepare_to_wait */
+	smp_mb__after_clear_bit();
+	if (waitqueue_active(&tags->wait))
+		wake_up(&tags->wait);
+}
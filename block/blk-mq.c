@@ -0,0 +1,544 @@
+/*
+ * Multi-queue request submission.  Bios are turned into requests and
+ * queued on a per-cpu software queue, without ever taking the queue
+ * lock.  Each software queue is mapped to one of the hardware dispatch
+ * queues of the device, which moves the requests of its software queues
+ * to the driver.  Requests are preallocated per hardware queue and
+ * indexed by tag.
+ */
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/slab.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/cpu.h>
+#include <linux/blk-mq.h>
+
+#include <trace/events/block.h>
+
+#include "blk.h"
+#include "blk-mq.h"
+
+static struct blk_mq_ctx *__blk_mq_get_ctx(struct request_queue *q,
+					   unsigned int cpu)
+{
+	return per_cpu_ptr(q->queue_ctx, cpu);
+}
+
+/*
+ * Disables preemption until blk_mq_put_ctx(), so that the software queue
+ * used is the one of the cpu we run on.
+ */
+static struct blk_mq_ctx *blk_mq_get_ctx(struct request_queue *q)
+{
+	return __blk_mq_get_ctx(q, get_cpu());
+}
+
+static void blk_mq_put_ctx(struct blk_mq_ctx *ctx)
+{
+	put_cpu();
+}
+
+/*
+ * Default cpu to hardware queue mapping: the possible cpus are spread
+ * evenly over the hardware queues, neighbouring cpu numbers sharing a
+ * queue.
+ */
+struct blk_mq_hw_ctx *blk_mq_map_queue(struct request_queue *q, const int cpu)
+{
+	return q->queue_hw_ctx[q->mq_map[cpu]];
+}
+EXPORT_SYMBOL(blk_mq_map_queue);
+
+static void blk_mq_update_queue_map(unsigned int *map,
+				    unsigned int nr_queues)
+{
+	unsigned int cpu, i = 0;
+
+	for_each_possible_cpu(cpu)
+		map[cpu] = i++ * nr_queues / num_possible_cpus();
+}
+
+static void blk_mq_rq_ctx_init(struct blk_mq_ctx *ctx, struct request *rq,
+			       unsigned int rw_flags)
+{
+	struct request_queue *q = ctx->queue;
+	int tag = rq->tag;
+
+	blk_rq_init(q, rq);
+	rq->tag = tag;
+	rq->mq_ctx = ctx;
+	rq->cmd_flags = rw_flags;
+	if (blk_queue_io_stat(q))
+		rq->cmd_flags |= REQ_IO_STAT;
+}
+
+static struct request *blk_mq_alloc_request(struct blk_mq_hw_ctx *hctx,
+					    gfp_t gfp)
+{
+	unsigned int tag;
+
+	tag = blk_mq_get_tag(hctx->tags, gfp);
+	if (tag == BLK_MQ_TAG_FAIL)
+		return NULL;
+	return hctx->rqs[tag];
+}
+
+static void blk_mq_free_request(struct request *rq)
+{
+	struct request_queue *q = rq->q;
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = q->mq_ops->map_queue(q, rq->mq_ctx->cpu);
+	blk_mq_put_tag(hctx->tags, rq->tag);
+}
+
+/**
+ * blk_mq_end_io - complete a request
+ * @rq:		the request being completed
+ * @error:	%0 for success, < %0 for error
+ *
+ * Description:
+ *     Ends all of the I/O of @rq and gives its tag back.  May be called
+ *     from any context, including hard interrupts.
+ */
+void blk_mq_end_io(struct request *rq, int error)
+{
+	if (blk_update_request(rq, error, blk_rq_bytes(rq)))
+		BUG();
+
+	blk_account_io_done(rq);
+	blk_mq_free_request(rq);
+}
+EXPORT_SYMBOL(blk_mq_end_io);
+
+/*
+ * Move the requests of all software queues mapped to @hctx to the driver,
+ * after those it refused last time.  Requests the driver is busy for are
+ * kept on hctx->dispatch for the next run.
+ */
+static void __blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	struct request_queue *q = hctx->queue;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	LIST_HEAD(rq_list);
+	int bit, ret;
+
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	for_each_set_bit(bit, hctx->ctx_map, hctx->nr_ctx) {
+		if (!test_and_clear_bit(bit, hctx->ctx_map))
+			continue;
+		ctx = hctx->ctxs[bit];
+		spin_lock(&ctx->lock);
+		list_splice_tail_init(&ctx->rq_list, &rq_list);
+		spin_unlock(&ctx->lock);
+	}
+
+	if (!list_empty(&hctx->dispatch)) {
+		spin_lock(&hctx->lock);
+		list_splice_init(&hctx->dispatch, &rq_list);
+		spin_unlock(&hctx->lock);
+	}
+
+	while (!list_empty(&rq_list)) {
+		rq = list_first_entry(&rq_list, struct request, queuelist);
+		list_del_init(&rq->queuelist);
+
+		trace_block_rq_issue(q, rq);
+		ret = q->mq_ops->queue_rq(hctx, rq);
+		if (ret == BLK_MQ_RQ_QUEUE_OK)
+			continue;
+
+		if (ret == BLK_MQ_RQ_QUEUE_BUSY) {
+			list_add(&rq->queuelist, &rq_list);
+			break;
+		}
+
+		WARN_ON_ONCE(ret != BLK_MQ_RQ_QUEUE_ERROR);
+		rq->errors = -EIO;
+		blk_mq_end_io(rq, rq->errors);
+	}
+
+	if (!list_empty(&rq_list)) {
+		spin_lock(&hctx->lock);
+		list_splice(&rq_list, &hctx->dispatch);
+		spin_unlock(&hctx->lock);
+	}
+}
+
+static void blk_mq_run_work_fn(struct work_struct *work)
+{
+	struct blk_mq_hw_ctx *hctx;
+
+	hctx = container_of(work, struct blk_mq_hw_ctx, run_work);
+	__blk_mq_run_hw_queue(hctx);
+}
+
+/**
+ * blk_mq_run_hw_queue - dispatch the queued requests of a hardware queue
+ * @hctx:	the hardware queue
+ * @async:	leave it to kblockd
+ *
+ * Description:
+ *     Without @async, the requests are passed to the driver right away,
+ *     from the caller's context.
+ */
+void blk_mq_run_hw_queue(struct blk_mq_hw_ctx *hctx, bool async)
+{
+	if (unlikely(test_bit(BLK_MQ_S_STOPPED, &hctx->state)))
+		return;
+
+	if (async)
+		kblockd_schedule_work(hctx->queue, &hctx->run_work);
+	else
+		__blk_mq_run_hw_queue(hctx);
+}
+EXPORT_SYMBOL(blk_mq_run_hw_queue);
+
+void blk_mq_run_queues(struct request_queue *q, bool async)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i)
+		blk_mq_run_hw_queue(hctx, async);
+}
+EXPORT_SYMBOL(blk_mq_run_queues);
+
+/*
+ * A driver that runs out of resources stops the hardware queue before
+ * returning BLK_MQ_RQ_QUEUE_BUSY, and starts it again on completion.
+ */
+void blk_mq_stop_hw_queue(struct blk_mq_hw_ctx *hctx)
+{
+	set_bit(BLK_MQ_S_STOPPED, &hctx->state);
+}
+EXPORT_SYMBOL(blk_mq_stop_hw_queue);
+
+void blk_mq_start_stopped_hw_queues(struct request_queue *q)
+{
+	struct blk_mq_hw_ctx *hctx;
+	int i;
+
+	queue_for_each_hw_ctx(q, hctx, i) {
+		if (!test_bit(BLK_MQ_S_STOPPED, &hctx->state))
+			continue;
+		clear_bit(BLK_MQ_S_STOPPED, &hctx->state);
+		blk_mq_run_hw_queue(hctx, true);
+	}
+}
+EXPORT_SYMBOL(blk_mq_start_stopped_hw_queues);
+
+static void blk_mq_unplug(struct request_queue *q)
+{
+	blk_mq_run_queues(q, false);
+}
+
+/*
+ * There is no elevator to ask, so this is elv_rq_merge_ok() minus the
+ * io scheduler hook.
+ */
+static bool blk_mq_rq_merge_ok(struct request *rq, struct bio *bio)
+{
+	if (!rq_mergeable(rq))
+		return false;
+	if (bio_rw_flagged(bio, BIO_RW_DISCARD) !=
+	    bio_rw_flagged(rq->bio, BIO_RW_DISCARD))
+		return false;
+	if (bio_data_dir(bio) != rq_data_dir(rq))
+		return false;
+	if (rq->rq_disk != bio->bi_bdev->bd_disk)
+		return false;
+	if (bio_integrity(bio) != blk_integrity_rq(rq))
+		return false;
+	return true;
+}
+
+/*
+ * Try to append @bio to the last request queued on @ctx.  Requests are
+ * only left on the software queues while the hardware queue is busy or
+ * its run was deferred, which is when merging pays off.
+ */
+static bool blk_mq_attempt_merge(struct request_queue *q,
+				 struct blk_mq_ctx *ctx, struct bio *bio)
+{
+	struct request *rq;
+	bool merged = false;
+
+	spin_lock(&ctx->lock);
+	if (list_empty(&ctx->rq_list))
+		goto out;
+
+	rq = list_entry(ctx->rq_list.prev, struct request, queuelist);
+	if (!blk_mq_rq_merge_ok(rq, bio) ||
+	    blk_rq_pos(rq) + blk_rq_sectors(rq) != bio->bi_sector ||
+	    !ll_back_merge_fn(q, rq, bio))
+		goto out;
+
+	trace_block_bio_backmerge(q, bio);
+
+	if ((rq->cmd_flags & REQ_FAILFAST_MASK) !=
+	    (bio->bi_rw & REQ_FAILFAST_MASK))
+		blk_rq_set_mixed_merge(rq);
+
+	rq->biotail->bi_next = bio;
+	rq->biotail = bio;
+	rq->__data_len += bio->bi_size;
+	rq->ioprio = ioprio_best(rq->ioprio, bio_prio(bio));
+	drive_stat_acct(rq, 0);
+	merged = true;
+out:
+	spin_unlock(&ctx->lock);
+	return merged;
+}
+
+static int blk_mq_make_request(struct request_queue *q, struct bio *bio)
+{
+	const bool sync = bio_rw_flagged(bio, BIO_RW_SYNCIO) ||
+			  bio_rw_flagged(bio, BIO_RW_UNPLUG);
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	struct request *rq;
+	int rw_flags;
+
+	/* no ordered sequences, flush requests or queue draining here */
+	if (bio_rw_flagged(bio, BIO_RW_BARRIER)) {
+		bio_endio(bio, -EOPNOTSUPP);
+		return 0;
+	}
+
+	blk_queue_bounce(q, &bio);
+
+	rw_flags = bio_data_dir(bio);
+	if (bio_rw_flagged(bio, BIO_RW_SYNCIO))
+		rw_flags |= REQ_RW_SYNC;
+
+	ctx = blk_mq_get_ctx(q);
+	hctx = q->mq_ops->map_queue(q, ctx->cpu);
+
+	if ((hctx->flags & BLK_MQ_F_SHOULD_MERGE) &&
+	    !blk_queue_nomerges(q) && blk_mq_attempt_merge(q, ctx, bio)) {
+		blk_mq_put_ctx(ctx);
+		goto run;
+	}
+
+	rq = blk_mq_alloc_request(hctx, GFP_ATOMIC);
+	if (unlikely(!rq)) {
+		/*
+		 * Out of tags: kick the queue so that requests complete,
+		 * and sleep for a tag.  We may come back on another cpu,
+		 * but the request stays with the software queue of the
+		 * hardware queue it was allocated from.
+		 */
+		blk_mq_put_ctx(ctx);
+		blk_mq_run_hw_queue(hctx, false);
+		rq = blk_mq_alloc_request(hctx, GFP_NOIO);
+	} else
+		blk_mq_put_ctx(ctx);
+
+	blk_mq_rq_ctx_init(ctx, rq, rw_flags);
+	init_request_from_bio(rq, bio);
+	drive_stat_acct(rq, 1);
+	trace_block_rq_insert(q, rq);
+
+	spin_lock(&ctx->lock);
+	list_add_tail(&rq->queuelist, &ctx->rq_list);
+	spin_unlock(&ctx->lock);
+	set_bit(ctx->index_hw, hctx->ctx_map);
+run:
+	blk_mq_run_hw_queue(hctx, !sync);
+	return 0;
+}
+
+static void blk_mq_free_rqs(struct blk_mq_hw_ctx *hctx)
+{
+	unsigned int i;
+
+	if (!hctx->rqs)
+		return;
+	for (i = 0; i < hctx->queue_depth; i++)
+		kfree(hctx->rqs[i]);
+	kfree(hctx->rqs);
+}
+
+static int blk_mq_init_rqs(struct blk_mq_hw_ctx *hctx, unsigned int cmd_size)
+{
+	size_t rq_size = sizeof(struct request) + cmd_size;
+	unsigned int i;
+
+	hctx->rqs = kzalloc_node(hctx->queue_depth * sizeof(struct request *),
+				 GFP_KERNEL, hctx->numa_node);
+	if (!hctx->rqs)
+		return -ENOMEM;
+
+	for (i = 0; i < hctx->queue_depth; i++) {
+		hctx->rqs[i] = kzalloc_node(L1_CACHE_ALIGN(rq_size),
+					    GFP_KERNEL, hctx->numa_node);
+		if (!hctx->rqs[i])
+			return -ENOMEM;
+		hctx->rqs[i]->tag = i;
+	}
+	return 0;
+}
+
+static void blk_mq_free_hw_queues(struct request_queue *q,
+				  unsigned int nr_inited)
+{
+	struct blk_mq_hw_ctx *hctx;
+	unsigned int i;
+
+	for (i = 0; i < q->nr_hw_queues; i++) {
+		hctx = q->queue_hw_ctx[i];
+		if (!hctx)
+			continue;
+
+		cancel_work_sync(&hctx->run_work);
+		if (i < nr_inited && q->mq_ops->exit_hctx)
+			q->mq_ops->exit_hctx(hctx, i);
+
+		blk_mq_free_rqs(hctx);
+		if (hctx->tags)
+			blk_mq_free_tags(hctx->tags);
+		kfree(hctx->ctx_map);
+		kfree(hctx->ctxs);
+		kfree(hctx);
+	}
+	kfree(q->queue_hw_ctx);
+	q->queue_hw_ctx = NULL;
+}
+
+static int blk_mq_init_hw_queues(struct request_queue *q,
+				 struct blk_mq_reg *reg, void *driver_data,
+				 unsigned int *nr_inited)
+{
+	struct blk_mq_hw_ctx *hctx;
+	struct blk_mq_ctx *ctx;
+	unsigned int i;
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = kzalloc_node(sizeof(*hctx), GFP_KERNEL, reg->numa_node);
+		if (!hctx)
+			return -ENOMEM;
+		q->queue_hw_ctx[i] = hctx;
+
+		spin_lock_init(&hctx->lock);
+		INIT_LIST_HEAD(&hctx->dispatch);
+		INIT_WORK(&hctx->run_work, blk_mq_run_work_fn);
+		hctx->queue = q;
+		hctx->queue_num = i;
+		hctx->queue_depth = reg->queue_depth;
+		hctx->numa_node = reg->numa_node;
+		hctx->flags = reg->flags;
+
+		hctx->ctxs = kzalloc_node(nr_cpu_ids * sizeof(void *),
+					  GFP_KERNEL, reg->numa_node);
+		hctx->ctx_map = kzalloc_node(BITS_TO_LONGS(nr_cpu_ids) *
+					     sizeof(unsigned long),
+					     GFP_KERNEL, reg->numa_node);
+		hctx->tags = blk_mq_init_tags(reg->queue_depth,
+					      reg->numa_node);
+		if (!hctx->ctxs || !hctx->ctx_map || !hctx->tags ||
+		    blk_mq_init_rqs(hctx, reg->cmd_size))
+			return -ENOMEM;
+	}
+
+	for_each_possible_cpu(i) {
+		ctx = __blk_mq_get_ctx(q, i);
+		spin_lock_init(&ctx->lock);
+		INIT_LIST_HEAD(&ctx->rq_list);
+		ctx->cpu = i;
+		ctx->queue = q;
+
+		hctx = reg->ops->map_queue(q, i);
+		ctx->index_hw = hctx->nr_ctx;
+		hctx->ctxs[hctx->nr_ctx++] = ctx;
+	}
+
+	for (i = 0; i < reg->nr_hw_queues; i++) {
+		hctx = q->queue_hw_ctx[i];
+		if (reg->ops->init_hctx &&
+		    reg->ops->init_hctx(hctx, driver_data, i))
+			return -ENODEV;
+		(*nr_inited)++;
+	}
+	return 0;
+}
+
+/**
+ * blk_mq_init_queue - set up a multi-queue request queue
+ * @reg:		number and depth of the hardware queues, and driver ops
+ * @driver_data:	passed to ->init_hctx() of each hardware queue
+ *
+ * Description:
+ *     Returns a queue whose requests are passed to @reg->ops->queue_rq(),
+ *     or %NULL on failure.  The driver tears it down with
+ *     blk_cleanup_queue() as usual.
+ */
+struct request_queue *blk_mq_init_queue(struct blk_mq_reg *reg,
+					void *driver_data)
+{
+	struct request_queue *q;
+	unsigned int nr_inited = 0;
+
+	if (!reg->nr_hw_queues || !reg->ops->queue_rq ||
+	    !reg->ops->map_queue || !reg->queue_depth ||
+	    reg->queue_depth > BLK_MQ_MAX_DEPTH)
+		return NULL;
+
+	q = blk_alloc_queue_node(GFP_KERNEL, reg->numa_node);
+	if (!q)
+		return NULL;
+
+	q->queue_flags = QUEUE_FLAG_DEFAULT;
+	q->nr_hw_queues = reg->nr_hw_queues;
+	q->queue_ctx = alloc_percpu(struct blk_mq_ctx);
+	q->queue_hw_ctx = kzalloc_node(reg->nr_hw_queues * sizeof(void *),
+				       GFP_KERNEL, reg->numa_node);
+	q->mq_map = kzalloc_node(nr_cpu_ids * sizeof(unsigned int),
+				 GFP_KERNEL, reg->numa_node);
+	if (!q->queue_ctx || !q->queue_hw_ctx || !q->mq_map)
+		goto err;
+
+	blk_mq_update_queue_map(q->mq_map, reg->nr_hw_queues);
+
+	if (blk_mq_init_hw_queues(q, reg, driver_data, &nr_inited))
+		goto err;
+
+	blk_queue_make_request(q, blk_mq_make_request);
+	q->unplug_fn = blk_mq_unplug;
+	q->nr_requests = reg->queue_depth;
+	q->nr_queues = nr_cpu_ids;
+	q->mq_ops = reg->ops;
+
+	return q;
+err:
+	q->mq_ops = reg->ops;
+	if (q->queue_hw_ctx)
+		blk_mq_free_hw_queues(q, nr_inited);
+	q->mq_ops = NULL;
+	free_percpu(q->queue_ctx);
+	kfree(q->mq_map);
+	blk_cleanup_queue(q);
+	return NULL;
+}
+EXPORT_SYMBOL(blk_mq_init_queue);
+
+/*
+ * Called from blk_cleanup_queue(), once the queue is dead and all I/O is
+ * done, so that ->exit_hctx() still runs while the driver is around.
+ */
+void blk_mq_free_queue(struct request_queue *q)
+{
+	blk_mq_free_hw_queues(q, q->nr_hw_queues);
+	free_percpu(q->queue_ctx);
+	kfree(q->mq_map);
+	q->queue_ctx = NULL;
+	q->mq_map = NULL;
+	q->mq_ops = NULL;
+}
@@ -0,0 +1,271 @@
+/*
+ * Null block device driver.
+ *
+ * Completes every I/O right away without touching its data, so that what
+ * gets measured is the block layer itself.  Devices can sit behind a
+ * plain make_request function, a request_fn queue, or a multi-queue
+ * queue with one software queue per cpu, to compare the submission paths.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/slab.h>
+#include <linux/blk-mq.h>
+
+struct nullb {
+	struct list_head list;
+	unsigned int index;
+	struct request_queue *q;
+	struct gendisk *disk;
+	spinlock_t lock;
+};
+
+static LIST_HEAD(nullb_list);
+static int null_major;
+static unsigned int nullb_indexes;
+
+enum {
+	NULL_IRQ_NONE		= 0,
+	NULL_IRQ_SOFTIRQ	= 1,
+};
+
+enum {
+	NULL_Q_BIO		= 0,
+	NULL_Q_RQ		= 1,
+	NULL_Q_MQ		= 2,
+};
+
+static int queue_mode = NULL_Q_MQ;
+module_param(queue_mode, int, S_IRUGO);
+MODULE_PARM_DESC(queue_mode, "Block interface to use (0=bio,1=rq,2=multiqueue)");
+
+static int submit_queues;
+module_param(submit_queues, int, S_IRUGO);
+MODULE_PARM_DESC(submit_queues, "Number of hardware queues in multiqueue mode (default: one per cpu)");
+
+static int home_node = -1;
+module_param(home_node, int, S_IRUGO);
+MODULE_PARM_DESC(home_node, "Home node for the device");
+
+static int gb = 250;
+module_param(gb, int, S_IRUGO);
+MODULE_PARM_DESC(gb, "Size in GB");
+
+static int bs = 512;
+module_param(bs, int, S_IRUGO);
+MODULE_PARM_DESC(bs, "Block size (in bytes)");
+
+static int nr_devices = 2;
+module_param(nr_devices, int, S_IRUGO);
+MODULE_PARM_DESC(nr_devices, "Number of devices to register");
+
+static int irqmode = NULL_IRQ_SOFTIRQ;
+module_param(irqmode, int, S_IRUGO);
+MODULE_PARM_DESC(irqmode, "IRQ completion handler (0=none,1=softirq)");
+
+static int hw_queue_depth = 64;
+module_param(hw_queue_depth, int, S_IRUGO);
+MODULE_PARM_DESC(hw_queue_depth, "Queue depth of each hardware queue in multiqueue mode");
+
+static void null_end_request(struct request *rq, int error)
+{
+	if (queue_mode == NULL_Q_MQ)
+		blk_mq_end_io(rq, error);
+	else
+		blk_end_request_all(rq, error);
+}
+
+static void null_softirq_done_fn(struct request *rq)
+{
+	null_end_request(rq, 0);
+}
+
+static void null_handle_rq(struct request *rq)
+{
+	if (irqmode == NULL_IRQ_SOFTIRQ)
+		blk_complete_request(rq);
+	else
+		null_end_request(rq, 0);
+}
+
+static int null_queue_bio(struct request_queue *q, struct bio *bio)
+{
+	bio_endio(bio, 0);
+	return 0;
+}
+
+static void null_request_fn(struct request_queue *q)
+{
+	struct request *rq;
+
+	while ((rq = blk_fetch_request(q)) != NULL) {
+		if (irqmode == NULL_IRQ_SOFTIRQ) {
+			blk_complete_request(rq);
+			continue;
+		}
+		__blk_end_request_all(rq, 0);
+	}
+}
+
+static int null_queue_rq(struct blk_mq_hw_ctx *hctx, struct request *rq)
+{
+	null_handle_rq(rq);
+	return BLK_MQ_RQ_QUEUE_OK;
+}
+
+static struct blk_mq_ops null_mq_ops = {
+	.queue_rq	= null_queue_rq,
+	.map_queue	= blk_mq_map_queue,
+};
+
+static struct blk_mq_reg null_mq_reg = {
+	.ops		= &null_mq_ops,
+	.flags		= BLK_MQ_F_SHOULD_MERGE,
+};
+
+static void null_del_dev(struct nullb *nullb)
+{
+	list_del_init(&nullb->list);
+
+	del_gendisk(nullb->disk);
+	blk_cleanup_queue(nullb->q);
+	put_disk(nullb->disk);
+	kfree(nullb);
+}
+
+static int null_open(struct block_device *bdev, fmode_t mode)
+{
+	return 0;
+}
+
+static int null_release(struct gendisk *disk, fmode_t mode)
+{
+	return 0;
+}
+
+static const struct block_device_operations null_fops = {
+	.owner		= THIS_MODULE,
+	.open		= null_open,
+	.release	= null_release,
+};
+
+static int null_add_dev(void)
+{
+	struct gendisk *disk;
+	struct nullb *nullb;
+	sector_t size;
+
+	nullb = kzalloc_node(sizeof(*nullb), GFP_KERNEL, home_node);
+	if (!nullb)
+		return -ENOMEM;
+
+	spin_lock_init(&nullb->lock);
+
+	switch (queue_mode) {
+	case NULL_Q_MQ:
+		null_mq_reg.numa_node = home_node;
+		null_mq_reg.queue_depth = hw_queue_depth;
+		null_mq_reg.nr_hw_queues = submit_queues;
+		nullb->q = blk_mq_init_queue(&null_mq_reg, nullb);
+		break;
+	case NULL_Q_BIO:
+		nullb->q = blk_alloc_queue_node(GFP_KERNEL, home_node);
+		if (nullb->q)
+			blk_queue_make_request(nullb->q, null_queue_bio);
+		break;
+	default:
+		nullb->q = blk_init_queue_node(null_request_fn, &nullb->lock,
+					       home_node);
+		break;
+	}
+	if (!nullb->q)
+		goto out_free;
+
+	nullb->q->queuedata = nullb;
+	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, nullb->q);
+	if (queue_mode != NULL_Q_BIO)
+		blk_queue_softirq_done(nullb->q, null_softirq_done_fn);
+
+	disk = nullb->disk = alloc_disk_node(1, home_node);
+	if (!disk)
+		goto out_cleanup;
+
+	nullb->index = nullb_indexes++;
+	list_add_tail(&nullb->list, &nullb_list);
+
+	blk_queue_logical_block_size(nullb->q, bs);
+	blk_queue_physical_block_size(nullb->q, bs);
+
+	size = gb * 1024 * 1024 * 1024ULL;
+	sector_div(size, bs);
+	set_capacity(disk, size * (bs >> 9));
+
+	disk->flags |= GENHD_FL_EXT_DEVT;
+	disk->major		= null_major;
+	disk->first_minor	= nullb->index;
+	disk->fops		= &null_fops;
+	disk->private_data	= nullb;
+	disk->queue		= nullb->q;
+	sprintf(disk->disk_name, "nullb%d", nullb->index);
+	add_disk(disk);
+	return 0;
+
+out_cleanup:
+	blk_cleanup_queue(nullb->q);
+out_free:
+	kfree(nullb);
+	return -ENOMEM;
+}
+
+static int __init null_init(void)
+{
+	unsigned int i;
+
+	if (bs > PAGE_SIZE || bs < 512 || !is_power_of_2(bs)) {
+		pr_warning("null_blk: invalid block size %d, using 512\n", bs);
+		bs = 512;
+	}
+
+	if (queue_mode == NULL_Q_MQ) {
+		if (submit_queues <= 0 || submit_queues > nr_cpu_ids)
+			submit_queues = nr_cpu_ids;
+		if (hw_queue_depth <= 0 || hw_queue_depth > BLK_MQ_MAX_DEPTH)
+			hw_queue_depth = 64;
+	}
+
+	null_major = register_blkdev(0, "nullb");
+	if (null_major < 0)
+		return null_major;
+
+	for (i = 0; i < nr_devices; i++) {
+		if (null_add_dev()) {
+			struct nullb *nullb, *next;
+
+			list_for_each_entry_safe(nullb, next, &nullb_list, list)
+				null_del_dev(nullb);
+			unregister_blkdev(null_major, "nullb");
+			return -EINVAL;
+		}
+	}
+
+	pr_info("null_blk: module loaded\n");
+	return 0;
+}
+
+static void __exit null_exit(void)
+{
+	struct nullb *nullb, *next;
+
+	list_for_each_entry_safe(nullb, next, &nullb_list, list)
+		null_del_dev(nullb);
+
+	unregister_blkdev(null_major, "nullb");
+}
+
+module_init(null_init);
+module_exit(null_exit);
+
+MODULE_LICENSE("GPL");
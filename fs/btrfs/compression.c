@@ -72,6 +72,12 @@ struct compressed_bio {
 	/* for reads, this is the bio we are copying the data into */
 	struct bio *orig_bio;
 
+	/* for reads, where the extent starts on disk */
+	u64 disk_start;
+
+	/* for reads, csum checks and decompression run from this work */
+	struct btrfs_work work;
+
 	/*
 	 * the start of a variable length array of checksums only
 	 * used by reads
@@ -151,43 +157,41 @@ fail:
 	return ret;
 }
 
-/* when we finish reading compressed pages from the disk, we
- * decompress them and then run the bio end_io routines on the
- * decompressed pages (in the inode address space).
+/*
+ * the second half of a compressed read, run by the endio-decomp workers.
+ * We check the csums of the compressed pages, decompress them and then run
+ * the bio end_io routines on the decompressed pages (in the inode address
+ * space).
  *
  * This allows the checksumming and other IO error handling routines
  * to work normally
  *
- * The compressed pages are freed here, and it must be run
- * in process context
+ * The compressed pages are freed here.  Each extent gets its own work item,
+ * so a large read of a compressed file is decompressed on as many CPUs as
+ * it has extents in flight.
  */
-static void end_compressed_bio_read(struct bio *bio, int err)
+static void end_compressed_read_work(struct btrfs_work *work)
 {
-	struct extent_io_tree *tree;
-	struct compressed_bio *cb = bio->bi_private;
+	struct compressed_bio *cb;
 	struct inode *inode;
 	struct page *page;
 	unsigned long index;
+	ktime_t start;
 	int ret;
 
-	if (err)
-		cb->errors = 1;
+	cb = container_of(work, struct compressed_bio, work);
+	inode = cb->inode;
+	start = btrfs_stage_start(BTRFS_I(inode)->root->fs_info);
 
-	/* if there are more bios still pending for this compressed
-	 * extent, just exit
-	 */
-	if (!atomic_dec_and_test(&cb->pending_bios))
-		goto out;
+	if (cb->errors) {
+		ret = -EIO;
+		goto csum_failed;
+	}
 
-	inode = cb->inode;
-	ret = check_compressed_csum(inode, cb, (u64)bio->bi_sector << 9);
+	ret = check_compressed_csum(inode, cb, cb->disk_start);
 	if (ret)
 		goto csum_failed;
 
-	/* ok, we're the last bio for this extent, lets start
-	 * the decompression.
-	 */
-	tree = &BTRFS_I(inode)->io_tree;
 	ret = btrfs_zlib_decompress_biovec(cb->compressed_pages,
 					cb->start,
 					cb->orig_bio->bi_io_vec,
@@ -205,6 +209,9 @@ csum_failed:
 		page_cache_release(page);
 	}
 
+	btrfs_stage_account(BTRFS_I(inode)->root->fs_info,
+			    BTRFS_STAGE_DECOMPRESS, start);
+
 	/* do io completion on the original bio */
 	if (cb->errors) {
 		bio_io_error(cb->orig_bio);
@@ -227,6 +234,34 @@ csum_failed:
 	/* finally free the cb struct */
 	kfree(cb->compressed_pages);
 	kfree(cb);
+}
+
+/* when we finish reading compressed pages from the disk, we hand the
+ * extent to the endio-decomp workers once the last of its bios is done.
+ *
+ * This is run in process context by the endio workers
+ */
+static void end_compressed_bio_read(struct bio *bio, int err)
+{
+	struct compressed_bio *cb = bio->bi_private;
+	struct btrfs_fs_info *fs_info;
+
+	if (err)
+		cb->errors = 1;
+
+	/* if there are more bios still pending for this compressed
+	 * extent, just exit
+	 */
+	if (!atomic_dec_and_test(&cb->pending_bios))
+		goto out;
+
+	/* ok, we're the last bio for this extent, lets start
+	 * the decompression.
+	 */
+	fs_info = BTRFS_I(cb->inode)->root->fs_info;
+	cb->work.func = end_compressed_read_work;
+	cb->work.flags = 0;
+	btrfs_queue_worker(&fs_info->endio_decomp_workers, &cb->work);
 out:
 	bio_put(bio);
 }
@@ -469,7 +504,7 @@ static noinline int add_ra_bio_pages(struct inode *inode,
 		rcu_read_lock();
 		page = radix_tree_lookup(&mapping->page_tree, page_index);
 		rcu_read_unlock();
-		if (page) {
+		if (page && !radix_tree_exceptional_entry(page)) {
 			misses++;
 			if (misses > 4)
 				break;
@@ -592,6 +627,7 @@ int btrfs_submit_compressed_read(struct inode *inode, struct bio *bio,
 	cb->errors = 0;
 	cb->inode = inode;
 	cb->mirror_num = mirror_num;
+	cb->disk_start = cur_disk_byte;
 	sums = &cb->sums;
 
 	cb->start = em->orig_start;
@@ -31,6 +31,7 @@
 #include "extent_io.h"
 #include "extent_map.h"
 #include "async-thread.h"
+#include "stats.h"
 
 struct btrfs_trans_handle;
 struct btrfs_transaction;
@@ -928,6 +929,16 @@ struct btrfs_fs_info {
 	struct btrfs_workers endio_write_workers;
 	struct btrfs_workers submit_workers;
 	struct btrfs_workers enospc_workers;
+
+	/*
+	 * the endio workers hand the CPU heavy parts of a read completion
+	 * to these pools: checksumming of large data bios is split into
+	 * chunks that are verified in parallel, and each compressed extent
+	 * is decompressed on its own.  Nothing queued here ever waits on
+	 * other work in the same pool.
+	 */
+	struct btrfs_workers endio_csum_workers;
+	struct btrfs_workers endio_decomp_workers;
 	/*
 	 * fixup workers take dirty pages that didn't properly go through
 	 * the cow mechanism and make them safe to write.  It happens
@@ -940,6 +951,10 @@ struct btrfs_fs_info {
 
 	struct kobject super_kobj;
 	struct completion kobj_unregister;
+
+	/* latency of the read and write path stages, see stats.c */
+	struct btrfs_stage_stats *stage_stats;
+	struct proc_dir_entry *proc_dir;
 	int do_barriers;
 	int closing;
 	int log_root_recovering;
@@ -1164,6 +1179,7 @@ struct btrfs_root {
 #define BTRFS_MOUNT_NOSSD		(1 << 9)
 #define BTRFS_MOUNT_DISCARD		(1 << 10)
 #define BTRFS_MOUNT_FORCE_COMPRESS      (1 << 11)
+#define BTRFS_MOUNT_STAGE_STATS		(1 << 12)
 
 #define btrfs_clear_opt(o, opt)		((o) &= ~BTRFS_MOUNT_##opt)
 #define btrfs_set_opt(o, opt)		((o) |= BTRFS_MOUNT_##opt)
@@ -1184,6 +1200,17 @@ struct btrfs_root {
 #define BTRFS_INODE_NOATIME		(1 << 9)
 #define BTRFS_INODE_DIRSYNC		(1 << 10)
 
+/*
+ * start time of a stage for btrfs_stage_account(), zero when the stats
+ * are off so that we don't read the clock for nothing
+ */
+static inline ktime_t btrfs_stage_start(struct btrfs_fs_info *fs_info)
+{
+	if (!fs_info->stage_stats)
+		return ktime_set(0, 0);
+	return ktime_get();
+}
+
 /* some macros to generate set/get funcs for the struct fields.  This
  * assumes there is a lefoo_to_cpu for every type, so lets make a simple
  * one for u8:
@@ -2311,6 +2338,7 @@ int btrfs_truncate_inode_items(struct btrfs_trans_handle *trans,
 			       u32 min_type);
 
 int btrfs_start_delalloc_inodes(struct btrfs_root *root, int delay_iput);
+void btrfs_verify_bio_csums(struct btrfs_fs_info *fs_info, struct bio *bio);
 int btrfs_set_extent_delalloc(struct inode *inode, u64 start, u64 end,
 			      struct extent_state **cached_state);
 int btrfs_writepages(struct address_space *mapping,
@@ -56,6 +56,7 @@ struct end_io_wq {
 	struct btrfs_fs_info *info;
 	int error;
 	int metadata;
+	ktime_t queued;
 	struct list_head list;
 	struct btrfs_work work;
 };
@@ -474,16 +475,17 @@ static void end_workqueue_bio(struct bio *bio, int err)
 	end_io_wq->error = err;
 	end_io_wq->work.func = end_workqueue_fn;
 	end_io_wq->work.flags = 0;
+	end_io_wq->queued = btrfs_stage_start(fs_info);
 
 	if (bio->bi_rw & (1 << BIO_RW)) {
-		if (end_io_wq->metadata)
+		if (end_io_wq->metadata == BTRFS_WQ_ENDIO_METADATA)
 			btrfs_queue_worker(&fs_info->endio_meta_write_workers,
 					   &end_io_wq->work);
 		else
 			btrfs_queue_worker(&fs_info->endio_write_workers,
 					   &end_io_wq->work);
 	} else {
-		if (end_io_wq->metadata)
+		if (end_io_wq->metadata == BTRFS_WQ_ENDIO_METADATA)
 			btrfs_queue_worker(&fs_info->endio_meta_workers,
 					   &end_io_wq->work);
 		else
@@ -1443,13 +1445,19 @@ static void end_workqueue_fn(struct btrfs_work *work)
 	 * ram and up to date before trying to verify things.  For
 	 * blocksize <= pagesize, it is basically a noop
 	 */
-	if (!(bio->bi_rw & (1 << BIO_RW)) && end_io_wq->metadata &&
+	if (!(bio->bi_rw & (1 << BIO_RW)) &&
+	    end_io_wq->metadata == BTRFS_WQ_ENDIO_METADATA &&
 	    !bio_ready_for_csum(bio)) {
 		btrfs_queue_worker(&fs_info->endio_meta_workers,
 				   &end_io_wq->work);
 		return;
 	}
+	btrfs_stage_account(fs_info, BTRFS_STAGE_ENDIO_WAIT,
+			    end_io_wq->queued);
+
 	error = end_io_wq->error;
+	if (!error && end_io_wq->metadata == BTRFS_WQ_ENDIO_DATA_CSUM)
+		btrfs_verify_bio_csums(fs_info, bio);
 	bio->bi_private = end_io_wq->private;
 	bio->bi_end_io = end_io_wq->end_io;
 	kfree(end_io_wq);
@@ -1789,6 +1797,12 @@ struct btrfs_root *open_ctree(struct super_block *sb,
 	btrfs_init_workers(&fs_info->endio_write_workers, "endio-write",
 			   fs_info->thread_pool_size,
 			   &fs_info->generic_worker);
+	btrfs_init_workers(&fs_info->endio_csum_workers, "endio-csum",
+			   fs_info->thread_pool_size,
+			   &fs_info->generic_worker);
+	btrfs_init_workers(&fs_info->endio_decomp_workers, "endio-decomp",
+			   fs_info->thread_pool_size,
+			   &fs_info->generic_worker);
 
 	/*
 	 * endios are largely parallel and should have a very
@@ -1800,6 +1814,13 @@ struct btrfs_root *open_ctree(struct super_block *sb,
 	fs_info->endio_write_workers.idle_thresh = 2;
 	fs_info->endio_meta_write_workers.idle_thresh = 2;
 
+	/*
+	 * csum chunks and compressed extents are queued so that they
+	 * run in parallel, spread them over as many threads as we can
+	 */
+	fs_info->endio_csum_workers.idle_thresh = 1;
+	fs_info->endio_decomp_workers.idle_thresh = 1;
+
 	btrfs_start_workers(&fs_info->workers, 1);
 	btrfs_start_workers(&fs_info->generic_worker, 1);
 	btrfs_start_workers(&fs_info->submit_workers, 1);
@@ -1809,6 +1830,8 @@ struct btrfs_root *open_ctree(struct super_block *sb,
 	btrfs_start_workers(&fs_info->endio_meta_workers, 1);
 	btrfs_start_workers(&fs_info->endio_meta_write_workers, 1);
 	btrfs_start_workers(&fs_info->endio_write_workers, 1);
+	btrfs_start_workers(&fs_info->endio_csum_workers, 1);
+	btrfs_start_workers(&fs_info->endio_decomp_workers, 1);
 	btrfs_start_workers(&fs_info->enospc_workers, 1);
 
 	fs_info->bdi.ra_pages *= btrfs_super_num_devices(disk_super);
@@ -2000,6 +2023,9 @@ struct btrfs_root *open_ctree(struct super_block *sb,
 		up_read(&fs_info->cleanup_work_sem);
 	}
 
+	if (btrfs_stats_register(fs_info))
+		printk(KERN_WARNING "btrfs: failed to register stats\n");
+
 	return tree_root;
 
 fail_trans_kthread:
@@ -2039,6 +2065,8 @@ fail_sb_buffer:
 	btrfs_stop_workers(&fs_info->endio_meta_workers);
 	btrfs_stop_workers(&fs_info->endio_meta_write_workers);
 	btrfs_stop_workers(&fs_info->endio_write_workers);
+	btrfs_stop_workers(&fs_info->endio_csum_workers);
+	btrfs_stop_workers(&fs_info->endio_decomp_workers);
 	btrfs_stop_workers(&fs_info->submit_workers);
 	btrfs_stop_workers(&fs_info->enospc_workers);
 fail_iput:
@@ -2426,6 +2454,8 @@ int close_ctree(struct btrfs_root *root)
 	fs_info->closing = 1;
 	smp_mb();
 
+	btrfs_stats_unregister(fs_info);
+
 	kthread_stop(root->fs_info->transaction_kthread);
 	kthread_stop(root->fs_info->cleaner_kthread);
 
@@ -2472,8 +2502,11 @@ int close_ctree(struct btrfs_root *root)
 	btrfs_stop_workers(&fs_info->endio_meta_workers);
 	btrfs_stop_workers(&fs_info->endio_meta_write_workers);
 	btrfs_stop_workers(&fs_info->endio_write_workers);
+	btrfs_stop_workers(&fs_info->endio_csum_workers);
+	btrfs_stop_workers(&fs_info->endio_decomp_workers);
 	btrfs_stop_workers(&fs_info->submit_workers);
 	btrfs_stop_workers(&fs_info->enospc_workers);
+	btrfs_stage_stats_free(fs_info);
 
 	btrfs_close_devices(fs_info->fs_devices);
 	btrfs_mapping_tree_free(&fs_info->mapping_tree);
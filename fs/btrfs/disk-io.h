@@ -83,6 +83,15 @@ void btrfs_csum_final(u32 crc, char *result);
 int btrfs_open_device(struct btrfs_device *dev);
 int btrfs_verify_block_csum(struct btrfs_root *root,
 			    struct extent_buffer *buf);
+/*
+ * what kind of bio btrfs_bio_wq_end_io is handed.  Data reads that carry
+ * checksums get their csums verified in parallel before the end_io hooks
+ * run, see btrfs_verify_bio_csums
+ */
+#define BTRFS_WQ_ENDIO_DATA		0
+#define BTRFS_WQ_ENDIO_METADATA		1
+#define BTRFS_WQ_ENDIO_DATA_CSUM	2
+
 int btrfs_bio_wq_end_io(struct btrfs_fs_info *info, struct bio *bio,
 			int metadata);
 int btrfs_wq_submit_bio(struct btrfs_fs_info *fs_info, struct inode *inode,
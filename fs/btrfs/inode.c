@@ -333,6 +333,7 @@ static noinline int compress_file_range(struct inode *inode,
 	unsigned long max_uncompressed = 128 * 1024;
 	int i;
 	int will_compress;
+	ktime_t compress_start;
 
 	orig_start = start;
 
@@ -385,12 +386,15 @@ again:
 		WARN_ON(pages);
 		pages = kzalloc(sizeof(struct page *) * nr_pages, GFP_NOFS);
 
+		compress_start = btrfs_stage_start(root->fs_info);
 		ret = btrfs_zlib_compress_pages(inode->i_mapping, start,
 						total_compressed, pages,
 						nr_pages, &nr_pages_ret,
 						&total_in,
 						&total_compressed,
 						max_compressed);
+		btrfs_stage_account(root->fs_info, BTRFS_STAGE_COMPRESS,
+				    compress_start);
 
 		if (!ret) {
 			unsigned long offset = total_compressed &
@@ -1422,7 +1426,13 @@ static int btrfs_submit_bio_hook(struct inode *inode, int rw, struct bio *bio,
 
 	skip_sum = BTRFS_I(inode)->flags & BTRFS_INODE_NODATASUM;
 
-	ret = btrfs_bio_wq_end_io(root->fs_info, bio, 0);
+	if (!(rw & (1 << BIO_RW)) && !skip_sum &&
+	    !(bio_flags & EXTENT_BIO_COMPRESSED))
+		ret = btrfs_bio_wq_end_io(root->fs_info, bio,
+					  BTRFS_WQ_ENDIO_DATA_CSUM);
+	else
+		ret = btrfs_bio_wq_end_io(root->fs_info, bio,
+					  BTRFS_WQ_ENDIO_DATA);
 	BUG_ON(ret);
 
 	if (!(rw & (1 << BIO_RW))) {
@@ -1944,6 +1954,129 @@ zeroit:
 	return -EIO;
 }
 
+/*
+ * data read bios bigger than this many pages have their csums verified
+ * in chunks of this size by the endio-csum workers
+ */
+#define BTRFS_CSUM_CHUNK_PAGES 16
+
+struct csum_verify_ctx {
+	atomic_t pending;
+	struct completion done;
+};
+
+struct csum_verify_chunk {
+	struct csum_verify_ctx *ctx;
+	struct bio_vec *bvec;
+	int nr;
+	struct btrfs_work work;
+};
+
+/*
+ * verify the csums of a run of bio_vecs.  Pages that pass get PageChecked
+ * so btrfs_readpage_end_io_hook can skip them.  Anything else, including
+ * the reloc tree special case, is left for the end_io hook to sort out.
+ */
+static void verify_csum_bvecs(struct bio_vec *bvec, int nr)
+{
+	struct page *page;
+	struct inode *inode;
+	struct btrfs_root *root;
+	struct extent_io_tree *io_tree;
+	char *kaddr;
+	u64 start;
+	u64 end;
+	u64 private;
+	u32 csum;
+	int i;
+
+	for (i = 0; i < nr; i++, bvec++) {
+		page = bvec->bv_page;
+		inode = page->mapping->host;
+		root = BTRFS_I(inode)->root;
+		io_tree = &BTRFS_I(inode)->io_tree;
+		start = ((u64)page->index << PAGE_CACHE_SHIFT) +
+			bvec->bv_offset;
+		end = start + bvec->bv_len - 1;
+
+		if (BTRFS_I(inode)->flags & BTRFS_INODE_NODATASUM)
+			continue;
+		if (root->root_key.objectid == BTRFS_DATA_RELOC_TREE_OBJECTID &&
+		    test_range_bit(io_tree, start, end, EXTENT_NODATASUM,
+				   1, NULL))
+			continue;
+		if (get_state_private(io_tree, start, &private))
+			continue;
+
+		csum = ~(u32)0;
+		kaddr = kmap_atomic(page, KM_USER0);
+		csum = btrfs_csum_data(root, kaddr + bvec->bv_offset, csum,
+				       bvec->bv_len);
+		kunmap_atomic(kaddr, KM_USER0);
+		btrfs_csum_final(csum, (char *)&csum);
+		if (csum == private)
+			SetPageChecked(page);
+	}
+}
+
+static void csum_verify_work(struct btrfs_work *work)
+{
+	struct csum_verify_chunk *chunk;
+	struct csum_verify_ctx *ctx;
+
+	chunk = container_of(work, struct csum_verify_chunk, work);
+	ctx = chunk->ctx;
+	verify_csum_bvecs(chunk->bvec, chunk->nr);
+	if (atomic_dec_and_test(&ctx->pending))
+		complete(&ctx->done);
+}
+
+/*
+ * called by the endio workers for data reads before the bio's end_io
+ * runs.  Large bios are split into chunks and the chunks are verified
+ * in parallel on the endio-csum workers, while the caller does the first
+ * chunk itself.  Smaller bios and allocation failures fall back to the
+ * serial checks in btrfs_readpage_end_io_hook.
+ */
+void btrfs_verify_bio_csums(struct btrfs_fs_info *fs_info, struct bio *bio)
+{
+	struct csum_verify_ctx ctx;
+	struct csum_verify_chunk *chunks;
+	ktime_t start;
+	int nr_chunks;
+	int i;
+
+	if (bio->bi_vcnt <= BTRFS_CSUM_CHUNK_PAGES)
+		return;
+
+	start = btrfs_stage_start(fs_info);
+
+	nr_chunks = DIV_ROUND_UP(bio->bi_vcnt, BTRFS_CSUM_CHUNK_PAGES);
+	chunks = kmalloc(sizeof(*chunks) * nr_chunks, GFP_NOFS);
+	if (!chunks)
+		return;
+
+	atomic_set(&ctx.pending, nr_chunks);
+	init_completion(&ctx.done);
+
+	for (i = 0; i < nr_chunks; i++) {
+		chunks[i].ctx = &ctx;
+		chunks[i].bvec = bio->bi_io_vec + i * BTRFS_CSUM_CHUNK_PAGES;
+		chunks[i].nr = min_t(int, BTRFS_CSUM_CHUNK_PAGES,
+				     bio->bi_vcnt - i * BTRFS_CSUM_CHUNK_PAGES);
+		chunks[i].work.func = csum_verify_work;
+		chunks[i].work.flags = 0;
+		if (i)
+			btrfs_queue_worker(&fs_info->endio_csum_workers,
+					   &chunks[i].work);
+	}
+	csum_verify_work(&chunks[0].work);
+
+	wait_for_completion(&ctx.done);
+	kfree(chunks);
+	btrfs_stage_account(fs_info, BTRFS_STAGE_CSUM, start);
+}
+
 struct delayed_iput {
 	struct list_head list;
 	struct inode *inode;
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2010 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/blkdev.h>
+#include "ctree.h"
+#include "volumes.h"
+
+static struct proc_dir_entry *proc_btrfs_stats;
+
+static const char *btrfs_stage_names[BTRFS_STAGE_NR] = {
+	[BTRFS_STAGE_ENDIO_WAIT]	= "endio_wait",
+	[BTRFS_STAGE_CSUM]		= "csum",
+	[BTRFS_STAGE_DECOMPRESS]	= "decompress",
+	[BTRFS_STAGE_COMPRESS]		= "compress",
+};
+
+/*
+ * account one pass through 'stage' that started at 'start'.  A zero
+ * start means the stats were off when the stage began.
+ *
+ * The numbers are kept per cpu and only summed up when they are read,
+ * so the endio and compression workers don't bounce a shared lock
+ * around.  None of the stages end in interrupt context, disabling
+ * preemption is enough to update them.
+ */
+void btrfs_stage_account(struct btrfs_fs_info *fs_info,
+			 enum btrfs_stage stage, ktime_t start)
+{
+	struct btrfs_stage_stat *st;
+	u64 delta;
+
+	if (!ktime_to_ns(start) || !fs_info->stage_stats)
+		return;
+
+	delta = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	st = &per_cpu_ptr(fs_info->stage_stats, get_cpu())->stage[stage];
+	st->count++;
+	st->total_ns += delta;
+	if (delta > st->max_ns)
+		st->max_ns = delta;
+	put_cpu();
+}
+
+static int btrfs_stages_show(struct seq_file *m, void *v)
+{
+	struct btrfs_fs_info *fs_info = m->private;
+	struct btrfs_stage_stat stage[BTRFS_STAGE_NR];
+	struct btrfs_stage_stat *st;
+	u64 avg;
+	int cpu;
+	int i;
+
+	memset(stage, 0, sizeof(stage));
+	for_each_possible_cpu(cpu) {
+		st = per_cpu_ptr(fs_info->stage_stats, cpu)->stage;
+		for (i = 0; i < BTRFS_STAGE_NR; i++) {
+			stage[i].count += st[i].count;
+			stage[i].total_ns += st[i].total_ns;
+			if (st[i].max_ns > stage[i].max_ns)
+				stage[i].max_ns = st[i].max_ns;
+		}
+	}
+
+	seq_printf(m, "%-12s %12s %12s %12s\n", "stage", "count",
+		   "avg_us", "max_us");
+	for (i = 0; i < BTRFS_STAGE_NR; i++) {
+		avg = stage[i].total_ns;
+		if (stage[i].count)
+			do_div(avg, stage[i].count);
+		do_div(avg, NSEC_PER_USEC);
+		do_div(stage[i].max_ns, NSEC_PER_USEC);
+		seq_printf(m, "%-12s %12llu %12llu %12llu\n",
+			   btrfs_stage_names[i],
+			   (unsigned long long)stage[i].count,
+			   (unsigned long long)avg,
+			   (unsigned long long)stage[i].max_ns);
+	}
+	return 0;
+}
+
+static int btrfs_stages_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, btrfs_stages_show, PDE(inode)->data);
+}
+
+static const struct file_operations btrfs_stages_fops = {
+	.owner		= THIS_MODULE,
+	.open		= btrfs_stages_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * the stats are only kept when the fs is mounted with -o stage_stats.
+ * The per-fs directory is named after the latest device, the same one
+ * the super block is read from
+ */
+int btrfs_stats_register(struct btrfs_fs_info *fs_info)
+{
+	char b[BDEVNAME_SIZE];
+
+	if (!proc_btrfs_stats ||
+	    !btrfs_test_opt(fs_info->tree_root, STAGE_STATS))
+		return 0;
+
+	fs_info->stage_stats = alloc_percpu(struct btrfs_stage_stats);
+	if (!fs_info->stage_stats)
+		return -ENOMEM;
+
+	bdevname(fs_info->fs_devices->latest_bdev, b);
+	fs_info->proc_dir = proc_mkdir(b, proc_btrfs_stats);
+	if (!fs_info->proc_dir)
+		goto fail;
+
+	if (!proc_create_data("stages", S_IRUGO, fs_info->proc_dir,
+			      &btrfs_stages_fops, fs_info)) {
+		remove_proc_entry(b, proc_btrfs_stats);
+		fs_info->proc_dir = NULL;
+		goto fail;
+	}
+	return 0;
+fail:
+	free_percpu(fs_info->stage_stats);
+	fs_info->stage_stats = NULL;
+	return -ENOMEM;
+}
+
+void btrfs_stats_unregister(struct btrfs_fs_info *fs_info)
+{
+	if (!fs_info->proc_dir)
+		return;
+	remove_proc_entry("stages", fs_info->proc_dir);
+	remove_proc_entry(fs_info->proc_dir->name, proc_btrfs_stats);
+	fs_info->proc_dir = NULL;
+}
+
+/*
+ * called once the workers that account stages are stopped
+ */
+void btrfs_stage_stats_free(struct btrfs_fs_info *fs_info)
+{
+	free_percpu(fs_info->stage_stats);
+	fs_info->stage_stats = NULL;
+}
+
+int btrfs_init_procfs(void)
+{
+	proc_btrfs_stats = proc_mkdir("fs/btrfs", NULL);
+	return 0;
+}
+
+void btrfs_exit_procfs(void)
+{
+	if (proc_btrfs_stats)
+		remove_proc_entry("fs/btrfs", NULL);
+	proc_btrfs_stats = NULL;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2010 Oracle.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public
+ * License v2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 021110-1307, USA.
+ */
+
+
+#ifndef __BTRFS_STATS_
+#define __BTRFS_STATS_
+
+#include <linux/ktime.h>
+
+struct btrfs_fs_info;
+
+/*
+ * the stages of the data read and write paths that we keep latency
+ * numbers for, when mounted with -o stage_stats.  They are reported in
+ * /proc/fs/btrfs/<dev>/stages
+ */
+enum btrfs_stage {
+	/* bio completion until an endio worker picks it up */
+	BTRFS_STAGE_ENDIO_WAIT,
+	/* parallel checksum verification of a large data read bio */
+	BTRFS_STAGE_CSUM,
+	/* checksum and decompression of one compressed extent */
+	BTRFS_STAGE_DECOMPRESS,
+	/* compression of one delalloc range */
+	BTRFS_STAGE_COMPRESS,
+	BTRFS_STAGE_NR,
+};
+
+struct btrfs_stage_stat {
+	u64 count;
+	u64 total_ns;
+	u64 max_ns;
+};
+
+/* one per cpu, allocated only when stats are enabled */
+struct btrfs_stage_stats {
+	struct btrfs_stage_stat stage[BTRFS_STAGE_NR];
+};
+
+void btrfs_stage_account(struct btrfs_fs_info *fs_info,
+			 enum btrfs_stage stage, ktime_t start);
+int btrfs_stats_register(struct btrfs_fs_info *fs_info);
+void btrfs_stats_unregister(struct btrfs_fs_info *fs_info);
+void btrfs_stage_stats_free(struct btrfs_fs_info *fs_info);
+int btrfs_init_procfs(void);
+void btrfs_exit_procfs(void);
+#endif
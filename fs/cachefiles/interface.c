@@ -465,6 +465,7 @@ const struct fscache_cache_ops cachefiles_cache_ops = {
 	.allocate_page		= cachefiles_allocate_page,
 	.allocate_pages		= cachefiles_allocate_pages,
 	.write_page		= cachefiles_write_page,
+	.write_pages		= cachefiles_write_pages,
 	.uncache_page		= cachefiles_uncache_page,
 	.dissociate_pages	= cachefiles_dissociate_pages,
 };
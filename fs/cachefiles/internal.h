@@ -203,6 +203,8 @@ extern int cachefiles_allocate_page(struct fscache_retrieval *, struct page *,
 extern int cachefiles_allocate_pages(struct fscache_retrieval *,
 				     struct list_head *, unsigned *, gfp_t);
 extern int cachefiles_write_page(struct fscache_storage *, struct page *);
+extern int cachefiles_write_pages(struct fscache_storage *, struct page **,
+				  unsigned);
 extern void cachefiles_uncache_page(struct fscache_object *, struct page *);
 
 /*
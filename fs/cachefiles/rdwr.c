@@ -879,13 +879,16 @@ int cachefiles_allocate_pages(struct fscache_retrieval *op,
 }
 
 /*
- * request a page be stored in the cache
+ * request a run of pages with consecutive indices be stored in the cache
  * - cache withdrawal is prevented by the caller
  * - this request may be ignored if there's no cache block available, in which
  *   case -ENOBUFS will be returned
  * - if the op is in progress, 0 will be returned
+ * - the backing file is opened once for the whole run and written
+ *   sequentially, leaving the backing filesystem to turn it into large I/O
  */
-int cachefiles_write_page(struct fscache_storage *op, struct page *page)
+int cachefiles_write_pages(struct fscache_storage *op, struct page **pages,
+			   unsigned nr_pages)
 {
 	struct cachefiles_object *object;
 	struct cachefiles_cache *cache;
@@ -893,16 +896,17 @@ int cachefiles_write_page(struct fscache_storage *op, struct page *page)
 	struct file *file;
 	loff_t pos, eof;
 	size_t len;
+	unsigned loop;
 	void *data;
 	int ret;
 
 	ASSERT(op != NULL);
-	ASSERT(page != NULL);
+	ASSERT(nr_pages > 0);
 
 	object = container_of(op->op.object,
 			      struct cachefiles_object, fscache);
 
-	_enter("%p,%p{%lx},,,", object, page, page->index);
+	_enter("%p,{%lx},%u,,", object, pages[0]->index, nr_pages);
 
 	if (!object->backer) {
 		_leave(" = -ENOBUFS");
@@ -914,8 +918,8 @@ int cachefiles_write_page(struct fscache_storage *op, struct page *page)
 	cache = container_of(object->fscache.cache,
 			     struct cachefiles_cache, cache);
 
-	/* write the page to the backing filesystem and let it store it in its
-	 * own time */
+	/* write the pages to the backing filesystem and let it store them in
+	 * its own time */
 	dget(object->backer);
 	mntget(cache->mnt);
 	file = dentry_open(object->backer, cache->mnt, O_RDWR,
@@ -925,31 +929,39 @@ int cachefiles_write_page(struct fscache_storage *op, struct page *page)
 	} else {
 		ret = -EIO;
 		if (file->f_op->write) {
-			pos = (loff_t) page->index << PAGE_SHIFT;
-
-			/* we mustn't write more data than we have, so we have
-			 * to beware of a partial page at EOF */
+			pos = (loff_t) pages[0]->index << PAGE_SHIFT;
 			eof = object->fscache.store_limit_l;
-			len = PAGE_SIZE;
-			if (eof & ~PAGE_MASK) {
-				ASSERTCMP(pos, <, eof);
-				if (eof - pos < PAGE_SIZE) {
-					_debug("cut short %llx to %llx",
-					       pos, eof);
-					len = eof - pos;
-					ASSERTCMP(pos + len, ==, eof);
-				}
-			}
 
-			data = kmap(page);
 			old_fs = get_fs();
 			set_fs(KERNEL_DS);
-			ret = file->f_op->write(
-				file, (const void __user *) data, len, &pos);
+			for (loop = 0; loop < nr_pages; loop++) {
+				ASSERTCMP(pos, ==,
+					  (loff_t) pages[loop]->index << PAGE_SHIFT);
+
+				/* we mustn't write more data than we have, so
+				 * we have to beware of a partial page at EOF */
+				len = PAGE_SIZE;
+				if (eof & ~PAGE_MASK) {
+					ASSERTCMP(pos, <, eof);
+					if (eof - pos < PAGE_SIZE) {
+						_debug("cut short %llx to %llx",
+						       pos, eof);
+						len = eof - pos;
+						ASSERTCMP(pos + len, ==, eof);
+					}
+				}
+
+				data = kmap(pages[loop]);
+				ret = file->f_op->write(
+					file, (const void __user *) data,
+					len, &pos);
+				kunmap(pages[loop]);
+				if (ret != len) {
+					ret = -EIO;
+					break;
+				}
+			}
 			set_fs(old_fs);
-			kunmap(page);
-			if (ret != len)
-				ret = -EIO;
 		}
 		fput(file);
 	}
@@ -965,6 +977,20 @@ int cachefiles_write_page(struct fscache_storage *op, struct page *page)
 	return ret;
 }
 
+/*
+ * request a page be stored in the cache
+ * - cache withdrawal is prevented by the caller
+ * - this request may be ignored if there's no cache block available, in which
+ *   case -ENOBUFS will be returned
+ * - if the op is in progress, 0 will be returned
+ */
+int cachefiles_write_page(struct fscache_storage *op, struct page *page)
+{
+	ASSERT(page != NULL);
+
+	return cachefiles_write_pages(op, &page, 1);
+}
+
 /*
  * detach a backing block from a page
  * - cache withdrawal is prevented by the caller
@@ -25,6 +25,7 @@
 #include <linux/writeback.h>
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
+#include <linux/memcontrol.h>
 #include <linux/buffer_head.h>
 #include "internal.h"
 
@@ -41,6 +42,7 @@ int nr_pdflush_threads;
 struct wb_writeback_args {
 	long nr_pages;
 	struct super_block *sb;
+	unsigned short memcg_id;
 	enum writeback_sync_modes sync_mode;
 	int for_kupdate:1;
 	int range_cyclic:1;
@@ -274,6 +276,41 @@ void bdi_start_writeback(struct backing_dev_info *bdi, struct super_block *sb,
 	bdi_alloc_queue_work(bdi, &args);
 }
 
+/**
+ * bdi_start_memcg_writeback - start writeback for a memory cgroup
+ * @bdi: the backing device to write from
+ * @memcg_id: css id of the memory cgroup
+ *
+ * Description:
+ *   Like background writeback, but only writes inodes last dirtied by the
+ *   memory cgroup, until it is below its own background dirty threshold.
+ *   This keeps a cgroup over its dirty limit from pushing out the dirty
+ *   pages of everybody else.  Nothing is queued if the bdi already has
+ *   such work pending for the cgroup.
+ */
+void bdi_start_memcg_writeback(struct backing_dev_info *bdi,
+			       unsigned short memcg_id)
+{
+	struct wb_writeback_args args = {
+		.memcg_id	= memcg_id,
+		.sync_mode	= WB_SYNC_NONE,
+		.nr_pages	= LONG_MAX,
+		.range_cyclic	= 1,
+	};
+	struct bdi_work *work;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(work, &bdi->work_list, list) {
+		if (work->args.memcg_id == memcg_id) {
+			rcu_read_unlock();
+			return;
+		}
+	}
+	rcu_read_unlock();
+
+	bdi_alloc_queue_work(bdi, &args);
+}
+
 /*
  * Redirty an inode: set its when-it-was dirtied timestamp and move it to the
  * furthest end of its superblock's dirty-inode list.
@@ -627,6 +664,13 @@ static int writeback_sb_inodes(struct super_block *sb,
 			requeue_io(inode);
 			continue;
 		}
+		if (wbc->memcg_id &&
+		    !mem_cgroup_mapping_dirtied_by(inode->i_mapping,
+						   wbc->memcg_id)) {
+			/* not this cgroup's, leave it for later */
+			requeue_io(inode);
+			continue;
+		}
 		/*
 		 * Was this inode dirtied after sync_sb_inodes was called?
 		 * This keeps sync from extra jobs and livelock.
@@ -746,6 +790,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 	struct writeback_control wbc = {
 		.bdi			= wb->bdi,
 		.sb			= args->sb,
+		.memcg_id		= args->memcg_id,
 		.sync_mode		= args->sync_mode,
 		.older_than_this	= NULL,
 		.for_kupdate		= args->for_kupdate,
@@ -753,6 +798,7 @@ static long wb_writeback(struct bdi_writeback *wb,
 		.range_cyclic		= args->range_cyclic,
 	};
 	unsigned long oldest_jif;
+	unsigned long wb_start = jiffies;
 	long wrote = 0;
 	struct inode *inode;
 
@@ -779,6 +825,9 @@ static long wb_writeback(struct bdi_writeback *wb,
 		 */
 		if (args->for_background && !over_bground_thresh())
 			break;
+		if (args->memcg_id &&
+		    !mem_cgroup_over_bground_thresh(args->memcg_id))
+			break;
 
 		wbc.more_io = 0;
 		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
@@ -787,6 +836,8 @@ static long wb_writeback(struct bdi_writeback *wb,
 		args->nr_pages -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 		wrote += MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 
+		bdi_update_bandwidth(wb->bdi, wb_start);
+
 		/*
 		 * If we consumed everything, see if we have more
 		 */
@@ -802,6 +853,12 @@ static long wb_writeback(struct bdi_writeback *wb,
 		 */
 		if (wbc.nr_to_write < MAX_WRITEBACK_PAGES)
 			continue;
+		/*
+		 * The inodes left are other cgroups', or busy: the cgroup's
+		 * next dirtier will queue another pass if still needed.
+		 */
+		if (args->memcg_id)
+			break;
 		/*
 		 * Nothing written. Wait for some inode to
 		 * become available for writeback. Otherwise
@@ -81,6 +81,7 @@ extern const struct file_operations fscache_histogram_fops;
 extern unsigned fscache_defer_lookup;
 extern unsigned fscache_defer_create;
 extern unsigned fscache_debug;
+extern unsigned fscache_max_pending_stores;
 extern struct kobject *fscache_root;
 
 extern int fscache_wait_bit(void *);
@@ -118,6 +119,11 @@ extern void fscache_abort_object(struct fscache_object *);
 extern void fscache_start_operations(struct fscache_object *);
 extern void fscache_operation_gc(struct work_struct *);
 
+/*
+ * page.c
+ */
+extern atomic_t fscache_stores_pending;
+
 /*
  * proc.c
  */
@@ -181,6 +187,8 @@ extern atomic_t fscache_n_store_calls;
 extern atomic_t fscache_n_store_pages;
 extern atomic_t fscache_n_store_radix_deletes;
 extern atomic_t fscache_n_store_pages_over_limit;
+extern atomic_t fscache_n_store_batches;
+extern atomic_t fscache_n_stores_pressure;
 
 extern atomic_t fscache_n_store_vmscan_not_storing;
 extern atomic_t fscache_n_store_vmscan_gone;
@@ -33,6 +33,12 @@ module_param_named(defer_create, fscache_defer_create, uint,
 MODULE_PARM_DESC(fscache_defer_create,
 		 "Defer cookie creation to background thread");
 
+unsigned fscache_max_pending_stores = 8192;
+module_param_named(max_pending_stores, fscache_max_pending_stores, uint,
+		   S_IWUSR | S_IRUGO);
+MODULE_PARM_DESC(fscache_max_pending_stores,
+		 "Maximum number of pages waiting to be written to the cache");
+
 unsigned fscache_debug;
 module_param_named(debug, fscache_debug, uint,
 		   S_IWUSR | S_IRUGO);
@@ -17,6 +17,16 @@
 #include <linux/slab.h>
 #include "internal.h"
 
+/*
+ * the number of pages in the cookies' store trees, queued to be written to
+ * the cache or being written; __fscache_write_page() refuses new stores
+ * beyond fscache_max_pending_stores
+ */
+atomic_t fscache_stores_pending;
+
+/* the most pages a writer hands to the cache backend in one go */
+#define FSCACHE_STORE_BATCH	16
+
 /*
  * check to see if a page is being written to the cache
  */
@@ -92,6 +102,7 @@ bool __fscache_maybe_release_page(struct fscache_cookie *cookie,
 	if (xpage) {
 		fscache_stat(&fscache_n_store_vmscan_cancelled);
 		fscache_stat(&fscache_n_store_radix_deletes);
+		atomic_dec(&fscache_stores_pending);
 		ASSERTCMP(xpage, ==, page);
 	} else {
 		fscache_stat(&fscache_n_store_vmscan_gone);
@@ -138,8 +149,10 @@ static void fscache_end_page_write(struct fscache_object *object,
 		wake_up_bit(&cookie->flags, 0);
 	}
 	spin_unlock(&object->lock);
-	if (xpage)
+	if (xpage) {
+		atomic_dec(&fscache_stores_pending);
 		page_cache_release(xpage);
+	}
 }
 
 /*
@@ -667,7 +680,7 @@ static void fscache_release_write_op(struct fscache_operation *_op)
 }
 
 /*
- * perform the background storage of a page into the cache
+ * perform the background storage of a run of pages into the cache
  */
 static void fscache_write_op(struct fscache_operation *_op)
 {
@@ -675,9 +688,9 @@ static void fscache_write_op(struct fscache_operation *_op)
 		container_of(_op, struct fscache_storage, op);
 	struct fscache_object *object = op->op.object;
 	struct fscache_cookie *cookie;
-	struct page *page;
-	unsigned n;
-	void *results[1];
+	struct page *page, *pages[FSCACHE_STORE_BATCH];
+	unsigned n, nr, loop;
+	void *results[FSCACHE_STORE_BATCH];
 	int ret;
 
 	_enter("{OP%x,%d}", op->op.debug_id, atomic_read(&op->op.usage));
@@ -698,10 +711,10 @@ static void fscache_write_op(struct fscache_operation *_op)
 	fscache_stat(&fscache_n_store_calls);
 
 	/* find a page to store */
-	page = NULL;
-	n = radix_tree_gang_lookup_tag(&cookie->stores, results, 0, 1,
+	n = radix_tree_gang_lookup_tag(&cookie->stores, results, 0,
+				       FSCACHE_STORE_BATCH,
 				       FSCACHE_COOKIE_PENDING_TAG);
-	if (n != 1)
+	if (n == 0)
 		goto superseded;
 	page = results[0];
 	_debug("gang %d [%lx]", n, page->index);
@@ -710,31 +723,50 @@ static void fscache_write_op(struct fscache_operation *_op)
 		goto superseded;
 	}
 
-	if (page) {
+	/* the gang lookup returns the pages in index order; take the run that
+	 * starts at the first one so that the cache sees a sequential write */
+	for (nr = 0; nr < n; nr++) {
+		page = results[nr];
+		if (nr > 0 &&
+		    (page->index != pages[nr - 1]->index + 1 ||
+		     page->index > op->store_limit))
+			break;
 		radix_tree_tag_set(&cookie->stores, page->index,
 				   FSCACHE_COOKIE_STORING_TAG);
 		radix_tree_tag_clear(&cookie->stores, page->index,
 				     FSCACHE_COOKIE_PENDING_TAG);
+		pages[nr] = page;
 	}
 
 	spin_unlock(&cookie->stores_lock);
 	spin_unlock(&object->lock);
 
-	if (page) {
-		fscache_set_op_state(&op->op, "Store");
-		fscache_stat(&fscache_n_store_pages);
-		fscache_stat(&fscache_n_cop_write_page);
-		ret = object->cache->ops->write_page(op, page);
-		fscache_stat_d(&fscache_n_cop_write_page);
-		fscache_set_op_state(&op->op, "EndWrite");
-		fscache_end_page_write(object, page);
-		if (ret < 0) {
-			fscache_set_op_state(&op->op, "Abort");
-			fscache_abort_object(object);
-		} else {
-			fscache_enqueue_operation(&op->op);
+	fscache_set_op_state(&op->op, "Store");
+	fscache_stat(&fscache_n_store_batches);
+	fscache_stat(&fscache_n_cop_write_page);
+	if (object->cache->ops->write_pages) {
+		for (loop = 0; loop < nr; loop++)
+			fscache_stat(&fscache_n_store_pages);
+		ret = object->cache->ops->write_pages(op, pages, nr);
+	} else {
+		ret = 0;
+		for (loop = 0; loop < nr; loop++) {
+			fscache_stat(&fscache_n_store_pages);
+			ret = object->cache->ops->write_page(op, pages[loop]);
+			if (ret < 0)
+				break;
 		}
 	}
+	fscache_stat_d(&fscache_n_cop_write_page);
+	fscache_set_op_state(&op->op, "EndWrite");
+	for (loop = 0; loop < nr; loop++)
+		fscache_end_page_write(object, pages[loop]);
+	if (ret < 0) {
+		fscache_set_op_state(&op->op, "Abort");
+		fscache_abort_object(object);
+	} else {
+		fscache_enqueue_operation(&op->op);
+	}
 
 	_leave("");
 	return;
@@ -795,6 +827,15 @@ int __fscache_write_page(struct fscache_cookie *cookie,
 
 	fscache_stat(&fscache_n_stores);
 
+	/* if the cache can't keep up with the netfs, don't let the queue of
+	 * pages waiting for it grow without bound, just skip caching them */
+	if (atomic_read(&fscache_stores_pending) >=
+	    fscache_max_pending_stores) {
+		fscache_stat(&fscache_n_stores_pressure);
+		_leave(" = -ENOBUFS [pressure]");
+		return -ENOBUFS;
+	}
+
 	op = kzalloc(sizeof(*op), GFP_NOIO);
 	if (!op)
 		goto nomem;
@@ -836,6 +877,7 @@ int __fscache_write_page(struct fscache_cookie *cookie,
 	radix_tree_tag_set(&cookie->stores, page->index,
 			   FSCACHE_COOKIE_PENDING_TAG);
 	page_cache_get(page);
+	atomic_inc(&fscache_stores_pending);
 
 	/* we only want one writer at a time, but we do need to queue new
 	 * writers after exclusive ops */
@@ -877,6 +919,7 @@ submit_failed:
 	spin_lock(&cookie->stores_lock);
 	radix_tree_delete(&cookie->stores, page->index);
 	spin_unlock(&cookie->stores_lock);
+	atomic_dec(&fscache_stores_pending);
 	page_cache_release(page);
 	ret = -ENOBUFS;
 	goto nobufs;
@@ -64,6 +64,8 @@ atomic_t fscache_n_store_calls;
 atomic_t fscache_n_store_pages;
 atomic_t fscache_n_store_radix_deletes;
 atomic_t fscache_n_store_pages_over_limit;
+atomic_t fscache_n_store_batches;
+atomic_t fscache_n_stores_pressure;
 
 atomic_t fscache_n_store_vmscan_not_storing;
 atomic_t fscache_n_store_vmscan_gone;
@@ -223,6 +225,10 @@ static int fscache_stats_show(struct seq_file *m, void *v)
 		   atomic_read(&fscache_n_store_pages),
 		   atomic_read(&fscache_n_store_radix_deletes),
 		   atomic_read(&fscache_n_store_pages_over_limit));
+	seq_printf(m, "Stores : bat=%u pnd=%u prs=%u\n",
+		   atomic_read(&fscache_n_store_batches),
+		   atomic_read(&fscache_stores_pending),
+		   atomic_read(&fscache_n_stores_pressure));
 
 	seq_printf(m, "VmScan : nos=%u gon=%u bsy=%u can=%u\n",
 		   atomic_read(&fscache_n_store_vmscan_not_storing),
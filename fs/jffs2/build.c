@@ -16,6 +16,8 @@
 #include <linux/mtd/mtd.h>
 #include "nodelist.h"
 
+static void jffs2_build_obsolete_inode_nodes(struct jffs2_sb_info *,
+		struct jffs2_inode_cache *);
 static void jffs2_build_remove_unlinked_inode(struct jffs2_sb_info *,
 		struct jffs2_inode_cache *, struct jffs2_full_dirent **);
 
@@ -111,8 +113,23 @@ static int jffs2_build_filesystem(struct jffs2_sb_info *c)
 	dbg_fsbuild("scanned flash completely\n");
 	jffs2_dbg_dump_block_lists_nolock(c);
 
-	dbg_fsbuild("pass 1 starting\n");
 	c->flags |= JFFS2_SB_FLAG_BUILDING;
+
+	/* If the link counts were checkpointed at unmount time, all that is
+	   left to do is to get rid of the nodes of deleted inodes */
+	if (jffs2_cp_restore(c)) {
+		dbg_fsbuild("using checkpoint, skipping passes 1 and 2\n");
+		for_each_inode(i, c, ic) {
+			if (ic->pino_nlink)
+				continue;
+
+			jffs2_build_obsolete_inode_nodes(c, ic);
+			cond_resched();
+		}
+		goto free_dents;
+	}
+
+	dbg_fsbuild("pass 1 starting\n");
 	/* Now scan the directory tree, increasing nlink according to every dirent found. */
 	for_each_inode(i, c, ic) {
 		if (ic->scan_dents) {
@@ -152,6 +169,7 @@ static int jffs2_build_filesystem(struct jffs2_sb_info *c)
 	}
 
 	dbg_fsbuild("pass 2a complete\n");
+ free_dents:
 	dbg_fsbuild("freeing temporary data structures\n");
 
 	/* Finally, we can scan again and free the dirent structs */
@@ -189,12 +207,10 @@ exit:
 	return ret;
 }
 
-static void jffs2_build_remove_unlinked_inode(struct jffs2_sb_info *c,
-					struct jffs2_inode_cache *ic,
-					struct jffs2_full_dirent **dead_fds)
+static void jffs2_build_obsolete_inode_nodes(struct jffs2_sb_info *c,
+					     struct jffs2_inode_cache *ic)
 {
 	struct jffs2_raw_node_ref *raw;
-	struct jffs2_full_dirent *fd;
 
 	dbg_fsbuild("removing ino #%u with nlink == zero.\n", ic->ino);
 
@@ -205,6 +221,15 @@ static void jffs2_build_remove_unlinked_inode(struct jffs2_sb_info *c,
 		jffs2_mark_node_obsolete(c, raw);
 		raw = next;
 	}
+}
+
+static void jffs2_build_remove_unlinked_inode(struct jffs2_sb_info *c,
+					struct jffs2_inode_cache *ic,
+					struct jffs2_full_dirent **dead_fds)
+{
+	struct jffs2_full_dirent *fd;
+
+	jffs2_build_obsolete_inode_nodes(c, ic);
 
 	if (ic->scan_dents) {
 		int whinged = 0;
@@ -368,10 +393,17 @@ int jffs2_do_mount_fs(struct jffs2_sb_info *c)
 	if (ret)
 		goto out_free;
 
+	ret = jffs2_cp_init(c);
+	if (ret) {
+		jffs2_sum_exit(c);
+		goto out_free;
+	}
+
 	if (jffs2_build_filesystem(c)) {
 		dbg_fsbuild("build_fs failed\n");
 		jffs2_free_ino_caches(c);
 		jffs2_free_raw_node_refs(c);
+		jffs2_cp_exit(c);
 		ret = -EIO;
 		goto out_free;
 	}
@@ -0,0 +1,486 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * Copyright © 2001-2007 Red Hat, Inc.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ * Inode cache checkpoints.
+ *
+ * Building the file system at mount time walks every directory entry found
+ * by the scan in order to count the links of each inode, and afterwards the
+ * GC thread reads every node of every inode in order to check its CRCs. On
+ * big file systems this dominates the time to get the file system fully
+ * operational, even when erase block summaries are used.
+ *
+ * When the file system is unmounted (or remounted read-only), the link count
+ * of every inode is written to the flash in one or more checkpoint nodes. The
+ * next mount uses them instead of counting the directory entries, and, if all
+ * inodes were checked at unmount time, skips the CRC checking too: the node
+ * tree of an inode is then built when it is first accessed.
+ *
+ * A checkpoint is only valid if nothing has been written after it. As soon as
+ * the file system is mounted read-write again, an invalidation node carrying
+ * the sequence number of the checkpoint is written before anything else. It
+ * is copied by the GC until a newer checkpoint has been written, so a
+ * checkpoint can never be mistaken for a valid one after an unclean shutdown.
+ * Only the checkpoint with the highest sequence number is ever considered.
+ */
+
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mtd/mtd.h>
+#include <linux/crc32.h>
+#include "nodelist.h"
+
+int jffs2_cp_init(struct jffs2_sb_info *c)
+{
+	c->checkpoint = kzalloc(sizeof(struct jffs2_checkpoint), GFP_KERNEL);
+	if (!c->checkpoint) {
+		JFFS2_WARNING("Can't allocate memory for checkpoint information!\n");
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static void jffs2_cp_free_nodes(struct jffs2_checkpoint *cp)
+{
+	struct jffs2_cp_node *n;
+
+	while (cp->nodes) {
+		n = cp->nodes;
+		cp->nodes = n->next;
+		kfree(n);
+	}
+}
+
+void jffs2_cp_exit(struct jffs2_sb_info *c)
+{
+	if (!c->checkpoint)
+		return;
+
+	jffs2_cp_free_nodes(c->checkpoint);
+	kfree(c->checkpoint);
+	c->checkpoint = NULL;
+}
+
+static int jffs2_cp_add_node(struct jffs2_checkpoint *cp,
+			     struct jffs2_raw_node_ref *raw,
+			     struct jffs2_raw_checkpoint *rc)
+{
+	struct jffs2_cp_node *n;
+
+	n = kmalloc(sizeof(struct jffs2_cp_node), GFP_KERNEL);
+	if (!n)
+		return -ENOMEM;
+
+	n->raw = raw;
+	n->seq = je32_to_cpu(rc->cp_seq);
+	n->totlen = je32_to_cpu(rc->totlen);
+	n->index = je16_to_cpu(rc->cp_index);
+	n->count = je16_to_cpu(rc->cp_count);
+	n->flags = je32_to_cpu(rc->flags);
+	n->highest_ino = je32_to_cpu(rc->highest_ino);
+	n->ent_num = je32_to_cpu(rc->ent_num);
+	if (je16_to_cpu(rc->nodetype) == JFFS2_NODETYPE_CHECKPOINT_INVAL)
+		n->count = 0;
+
+	n->next = cp->nodes;
+	cp->nodes = n;
+	if (n->seq > cp->max_seq)
+		cp->max_seq = n->seq;
+	return 0;
+}
+
+/* Called from the scan for checkpoint and checkpoint invalidation nodes */
+int jffs2_cp_scan_node(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+		       struct jffs2_raw_checkpoint *rc, uint32_t ofs,
+		       struct jffs2_summary *s)
+{
+	struct jffs2_raw_node_ref *raw;
+	uint32_t crc, totlen = je32_to_cpu(rc->totlen);
+	int inval = je16_to_cpu(rc->nodetype) == JFFS2_NODETYPE_CHECKPOINT_INVAL;
+
+	crc = crc32(0, rc, sizeof(*rc) - 4);
+	if (crc != je32_to_cpu(rc->node_crc)) {
+		JFFS2_NOTICE("node CRC failed at %#08x, read=%#08x, calc=%#08x\n",
+			     ofs, je32_to_cpu(rc->node_crc), crc);
+		return jffs2_scan_dirty_space(c, jeb, PAD(totlen));
+	}
+
+	if (totlen > JFFS2_CP_MAX_NODE_SIZE ||
+	    totlen != sizeof(*rc) + je32_to_cpu(rc->ent_num) *
+		      sizeof(struct jffs2_checkpoint_entry) ||
+	    (!inval && je16_to_cpu(rc->cp_index) >= je16_to_cpu(rc->cp_count))) {
+		JFFS2_NOTICE("bad checkpoint node at %#08x\n", ofs);
+		return jffs2_scan_dirty_space(c, jeb, PAD(totlen));
+	}
+
+	dbg_fsbuild("checkpoint%s node at %#08x, seq %u\n", inval ? " invalidation" : "",
+		    ofs, je32_to_cpu(rc->cp_seq));
+
+	/* Invalidation nodes must survive GC, so mark them pristine */
+	raw = jffs2_link_node_ref(c, jeb, ofs | (inval ? REF_PRISTINE : REF_NORMAL),
+				  PAD(totlen), NULL);
+
+	/* We can't summarise checkpoint nodes */
+	jffs2_sum_disable_collecting(s);
+
+	return jffs2_cp_add_node(c->checkpoint, raw, rc);
+}
+
+static void jffs2_cp_reset_nlink(struct jffs2_sb_info *c)
+{
+	struct jffs2_inode_cache *ic;
+	int i;
+
+	for (i = 0; i < INOCACHE_HASHSIZE; i++)
+		for (ic = c->inocache_list[i]; ic; ic = ic->next)
+			ic->pino_nlink = (ic->ino == 1);
+}
+
+/*
+ * Mark the nodes of all live inodes as checked. They were all checked before
+ * the checkpoint was written and nothing was written since, so the GC does
+ * not have to read the whole flash again before it may start working. The
+ * node tree of each inode is built when it is first read.
+ */
+static void jffs2_cp_mark_checked(struct jffs2_sb_info *c)
+{
+	struct jffs2_inode_cache *ic;
+	struct jffs2_raw_node_ref *raw;
+	struct jffs2_eraseblock *jeb;
+	uint32_t len;
+	int i;
+
+	for (i = 0; i < INOCACHE_HASHSIZE; i++) {
+		for (ic = c->inocache_list[i]; ic; ic = ic->next) {
+			if (!ic->pino_nlink)
+				continue;
+
+			for (raw = ic->nodes; raw != (void *)ic; raw = raw->next_in_ino) {
+				if (ref_flags(raw) != REF_UNCHECKED)
+					continue;
+
+				jeb = &c->blocks[raw->flash_offset / c->sector_size];
+				len = ref_totlen(c, jeb, raw);
+
+				jeb->used_size += len;
+				jeb->unchecked_size -= len;
+				c->used_size += len;
+				c->unchecked_size -= len;
+				raw->flash_offset = ref_offset(raw) | REF_NORMAL;
+			}
+			ic->state = INO_STATE_CHECKEDABSENT;
+		}
+		cond_resched();
+	}
+}
+
+static int jffs2_cp_apply_node(struct jffs2_sb_info *c, struct jffs2_cp_node *n,
+			       struct jffs2_raw_checkpoint *rc)
+{
+	struct jffs2_inode_cache *ic;
+	uint32_t crc, i, ino;
+	size_t retlen;
+	int ret;
+
+	ret = jffs2_flash_read(c, ref_offset(n->raw), n->totlen, &retlen, (u_char *)rc);
+	if (!ret && retlen != n->totlen)
+		ret = -EIO;
+	if (ret)
+		return ret;
+
+	crc = crc32(0, rc, sizeof(*rc) - 4);
+	if (crc != je32_to_cpu(rc->node_crc))
+		return -EIO;
+	crc = crc32(0, rc->ent, n->ent_num * sizeof(struct jffs2_checkpoint_entry));
+	if (crc != je32_to_cpu(rc->ent_crc))
+		return -EIO;
+
+	for (i = 0; i < n->ent_num; i++) {
+		ino = je32_to_cpu(rc->ent[i].ino);
+		ic = jffs2_get_ino_cache(c, ino);
+		if (!ic) {
+			JFFS2_NOTICE("inode #%u from checkpoint %u not found\n",
+				     ino, n->seq);
+			return -ESTALE;
+		}
+		ic->pino_nlink = je32_to_cpu(rc->ent[i].pino_nlink);
+	}
+	c->checkpoint->restored += n->ent_num;
+
+	return 0;
+}
+
+/**
+ * jffs2_cp_restore - restore the inode cache link counts from a checkpoint.
+ * @c: superblock info
+ *
+ * Called after the medium has been scanned. Returns 1 if the link counts of
+ * all inodes were taken from a valid checkpoint; inodes which are not in the
+ * checkpoint have been deleted. Returns 0 if there is no valid checkpoint
+ * and the inode cache has to be built from the directory entries.
+ */
+int jffs2_cp_restore(struct jffs2_sb_info *c)
+{
+	struct jffs2_checkpoint *cp = c->checkpoint;
+	struct jffs2_cp_node *n, *first = NULL, **table;
+	struct jffs2_raw_checkpoint *rc;
+	int i, ret = 0;
+
+	for (n = cp->nodes; n; n = n->next) {
+		if (n->seq != cp->max_seq)
+			continue;
+		if (!n->count) {
+			JFFS2_NOTICE("checkpoint %u is stale, rebuilding inode cache\n",
+				     n->seq);
+			return 0;
+		}
+		if (!first)
+			first = n;
+		else if (n->count != first->count || n->flags != first->flags ||
+			 n->highest_ino != first->highest_ino)
+			goto inconsistent;
+	}
+
+	if (!first)
+		return 0;
+
+	/* Something was written after the checkpoint without invalidating it */
+	if (c->highest_ino > first->highest_ino)
+		goto inconsistent;
+
+	table = kcalloc(first->count, sizeof(*table), GFP_KERNEL);
+	if (!table)
+		return 0;
+
+	for (n = cp->nodes; n; n = n->next) {
+		if (n->seq != cp->max_seq)
+			continue;
+		if (table[n->index]) {
+			kfree(table);
+			goto inconsistent;
+		}
+		table[n->index] = n;
+	}
+
+	for (i = 0; i < first->count; i++)
+		if (!table[i]) {
+			JFFS2_NOTICE("checkpoint %u is incomplete, rebuilding inode cache\n",
+				     cp->max_seq);
+			kfree(table);
+			return 0;
+		}
+
+	rc = kmalloc(JFFS2_CP_MAX_NODE_SIZE, GFP_KERNEL);
+	if (!rc) {
+		kfree(table);
+		return 0;
+	}
+
+	cp->restored = 0;
+	for (i = 0; i < first->count; i++) {
+		ret = jffs2_cp_apply_node(c, table[i], rc);
+		if (ret)
+			break;
+		cond_resched();
+	}
+
+	kfree(rc);
+	kfree(table);
+
+	if (ret) {
+		JFFS2_NOTICE("cannot use checkpoint %u (error %d), rebuilding inode cache\n",
+			     cp->max_seq, ret);
+		cp->restored = 0;
+		jffs2_cp_reset_nlink(c);
+		return 0;
+	}
+
+	if (first->flags & JFFS2_CP_FLAG_CHECKED)
+		jffs2_cp_mark_checked(c);
+
+	dbg_fsbuild("restored %u inodes from checkpoint %u\n", cp->restored, cp->max_seq);
+	return 1;
+
+inconsistent:
+	JFFS2_NOTICE("checkpoint %u is inconsistent, rebuilding inode cache\n",
+		     cp->max_seq);
+	return 0;
+}
+
+static int jffs2_cp_write_node(struct jffs2_sb_info *c, uint16_t nodetype,
+			       uint32_t seq, uint16_t index, uint16_t count,
+			       uint32_t flags, struct jffs2_checkpoint_entry *ent,
+			       uint32_t ent_num)
+{
+	struct jffs2_raw_checkpoint rc;
+	struct jffs2_raw_node_ref *raw;
+	struct kvec vecs[2];
+	uint32_t alloclen, phys_ofs, totlen;
+	size_t retlen;
+	int ret, inval = nodetype == JFFS2_NODETYPE_CHECKPOINT_INVAL;
+
+	vecs[0].iov_base = &rc;
+	vecs[0].iov_len = sizeof(rc);
+	vecs[1].iov_base = ent;
+	vecs[1].iov_len = ent_num * sizeof(struct jffs2_checkpoint_entry);
+	totlen = vecs[0].iov_len + vecs[1].iov_len;
+
+	/* The invalidation must not fail just because the file system is full */
+	ret = jffs2_reserve_space(c, totlen, &alloclen,
+				  inval ? ALLOC_DELETION : ALLOC_NORMAL,
+				  JFFS2_SUMMARY_NOSUM_SIZE);
+	if (ret)
+		return ret;
+
+	memset(&rc, 0, sizeof(rc));
+	rc.magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
+	rc.nodetype = cpu_to_je16(nodetype);
+	rc.totlen = cpu_to_je32(totlen);
+	rc.hdr_crc = cpu_to_je32(crc32(0, &rc, sizeof(struct jffs2_unknown_node) - 4));
+	rc.cp_seq = cpu_to_je32(seq);
+	rc.cp_index = cpu_to_je16(index);
+	rc.cp_count = cpu_to_je16(count);
+	rc.flags = cpu_to_je32(flags);
+	rc.highest_ino = cpu_to_je32(c->highest_ino);
+	rc.ent_num = cpu_to_je32(ent_num);
+	rc.ent_crc = cpu_to_je32(crc32(0, vecs[1].iov_base, vecs[1].iov_len));
+	rc.node_crc = cpu_to_je32(crc32(0, &rc, sizeof(rc) - 4));
+
+	phys_ofs = write_ofs(c);
+	ret = jffs2_flash_writev(c, vecs, ent_num ? 2 : 1, phys_ofs, &retlen, 0);
+	if (ret || retlen != totlen) {
+		JFFS2_WARNING("jffs2_flash_writev()=%d, req=%u, wrote=%zu, at %#08x\n",
+			      ret, totlen, retlen, phys_ofs);
+		if (retlen)
+			jffs2_add_physical_node_ref(c, phys_ofs | REF_OBSOLETE,
+						    PAD(totlen), NULL);
+		jffs2_complete_reservation(c);
+		return ret ? ret : -EIO;
+	}
+
+	raw = jffs2_add_physical_node_ref(c, phys_ofs | (inval ? REF_PRISTINE : REF_NORMAL),
+					  PAD(totlen), NULL);
+	jffs2_complete_reservation(c);
+	if (IS_ERR(raw))
+		return PTR_ERR(raw);
+
+	return jffs2_cp_add_node(c->checkpoint, raw, &rc);
+}
+
+/**
+ * jffs2_cp_invalidate - invalidate the checkpoint before writing anything.
+ * @c: superblock info
+ *
+ * Called when the file system is mounted or remounted read-write. Writes an
+ * invalidation node for the newest checkpoint on the flash, unless there is
+ * one already, and obsoletes all other checkpoint nodes.
+ */
+int jffs2_cp_invalidate(struct jffs2_sb_info *c)
+{
+	struct jffs2_checkpoint *cp = c->checkpoint;
+	struct jffs2_cp_node *n, *keep = NULL;
+	int ret;
+
+	if (!cp->nodes)
+		return 0;
+
+	for (n = cp->nodes; n; n = n->next)
+		if (n->seq == cp->max_seq && !n->count) {
+			keep = n;
+			break;
+		}
+
+	if (!keep) {
+		ret = jffs2_cp_write_node(c, JFFS2_NODETYPE_CHECKPOINT_INVAL,
+					  cp->max_seq, 0, 0, 0, NULL, 0);
+		if (ret) {
+			JFFS2_WARNING("cannot invalidate checkpoint %u, error %d\n",
+				      cp->max_seq, ret);
+			return ret;
+		}
+		/* The new node is at the head of the list */
+		keep = cp->nodes;
+	}
+
+	for (n = cp->nodes; n; n = n->next)
+		if (n != keep)
+			jffs2_mark_node_obsolete(c, n->raw);
+
+	jffs2_cp_free_nodes(cp);
+	return 0;
+}
+
+/**
+ * jffs2_cp_write - write a checkpoint of the inode cache.
+ * @c: superblock info
+ *
+ * Called when the file system is unmounted or remounted read-only, after all
+ * other writes have finished. Failures are not fatal, the next mount simply
+ * has to rebuild the inode cache.
+ */
+int jffs2_cp_write(struct jffs2_sb_info *c)
+{
+	struct jffs2_checkpoint *cp = c->checkpoint;
+	struct jffs2_checkpoint_entry *ent;
+	struct jffs2_inode_cache *ic;
+	uint32_t cnt = 0, num, per_node, max_size, flags, seq;
+	int i, nodes, ret = 0;
+
+	spin_lock(&c->inocache_lock);
+	for (i = 0; i < INOCACHE_HASHSIZE; i++)
+		for (ic = c->inocache_list[i]; ic; ic = ic->next)
+			if (ic->pino_nlink)
+				cnt++;
+	spin_unlock(&c->inocache_lock);
+
+	max_size = min_t(uint32_t, JFFS2_CP_MAX_NODE_SIZE, c->sector_size / 4);
+	per_node = (max_size - sizeof(struct jffs2_raw_checkpoint)) /
+		   sizeof(struct jffs2_checkpoint_entry);
+	nodes = DIV_ROUND_UP(cnt, per_node);
+	if (!nodes || nodes > 0xffff)
+		return 0;
+
+	ent = vmalloc(cnt * sizeof(*ent));
+	if (!ent)
+		return -ENOMEM;
+
+	num = 0;
+	spin_lock(&c->inocache_lock);
+	for (i = 0; i < INOCACHE_HASHSIZE && num < cnt; i++)
+		for (ic = c->inocache_list[i]; ic && num < cnt; ic = ic->next) {
+			if (!ic->pino_nlink)
+				continue;
+			ent[num].ino = cpu_to_je32(ic->ino);
+			ent[num].pino_nlink = cpu_to_je32(ic->pino_nlink);
+			num++;
+		}
+	spin_unlock(&c->inocache_lock);
+
+	flags = c->unchecked_size ? 0 : JFFS2_CP_FLAG_CHECKED;
+	seq = cp->max_seq + 1;
+
+	for (i = 0; i < nodes; i++) {
+		uint32_t n = min_t(uint32_t, per_node, num - i * per_node);
+
+		ret = jffs2_cp_write_node(c, JFFS2_NODETYPE_CHECKPOINT, seq, i, nodes,
+					  flags, ent + i * per_node, n);
+		if (ret) {
+			JFFS2_WARNING("cannot write checkpoint %u, error %d\n", seq, ret);
+			break;
+		}
+	}
+	vfree(ent);
+
+	/* Even a partially written checkpoint takes up the sequence number */
+	cp->max_seq = seq;
+	if (!ret)
+		dbg_fsbuild("wrote checkpoint %u of %u inodes in %d nodes\n",
+			    seq, num, nodes);
+	return ret;
+}
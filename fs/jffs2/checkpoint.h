@@ -0,0 +1,62 @@
+/*
+ * JFFS2 -- Journalling Flash File System, Version 2.
+ *
+ * Copyright © 2001-2007 Red Hat, Inc.
+ *
+ * For licensing information, see the file 'LICENCE' in this directory.
+ *
+ */
+
+#ifndef JFFS2_CHECKPOINT_H
+#define JFFS2_CHECKPOINT_H
+
+#include <linux/jffs2.h>
+
+/* Keep checkpoint nodes small enough to kmalloc them and to leave room for
+   other nodes in the eraseblock */
+#define JFFS2_CP_MAX_NODE_SIZE 16384
+
+/* A checkpoint node found by the scan */
+struct jffs2_cp_node
+{
+	struct jffs2_cp_node *next;
+	struct jffs2_raw_node_ref *raw;
+	uint32_t seq;
+	uint32_t totlen;
+	uint16_t index;
+	uint16_t count;		/* 0 for invalidation nodes */
+	uint32_t flags;
+	uint32_t highest_ino;
+	uint32_t ent_num;
+};
+
+struct jffs2_checkpoint
+{
+	struct jffs2_cp_node *nodes;	/* checkpoint nodes found by the scan */
+	uint32_t max_seq;		/* highest sequence number on the flash */
+	uint32_t restored;		/* number of inodes restored at mount */
+};
+
+#ifdef CONFIG_JFFS2_CHECKPOINT	/* CHECKPOINT SUPPORT ENABLED */
+
+int jffs2_cp_init(struct jffs2_sb_info *c);
+void jffs2_cp_exit(struct jffs2_sb_info *c);
+int jffs2_cp_scan_node(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb,
+		       struct jffs2_raw_checkpoint *rc, uint32_t ofs,
+		       struct jffs2_summary *s);
+int jffs2_cp_restore(struct jffs2_sb_info *c);
+int jffs2_cp_invalidate(struct jffs2_sb_info *c);
+int jffs2_cp_write(struct jffs2_sb_info *c);
+
+#else				/* CHECKPOINT DISABLED */
+
+#define jffs2_cp_init(a) (0)
+#define jffs2_cp_exit(a)
+#define jffs2_cp_scan_node(a,b,c,d,e) (0)
+#define jffs2_cp_restore(a) (0)
+#define jffs2_cp_invalidate(a) (0)
+#define jffs2_cp_write(a) (0)
+
+#endif /* CONFIG_JFFS2_CHECKPOINT */
+
+#endif /* JFFS2_CHECKPOINT_H */
@@ -391,9 +391,17 @@ int jffs2_remount_fs (struct super_block *sb, int *flags, char *data)
 	lock_kernel();
 	if (!(sb->s_flags & MS_RDONLY)) {
 		jffs2_stop_garbage_collect_thread(c);
+		if (*flags & MS_RDONLY)
+			jffs2_cp_write(c);
 		mutex_lock(&c->alloc_sem);
 		jffs2_flush_wbuf_pad(c);
 		mutex_unlock(&c->alloc_sem);
+	} else if (!(*flags & MS_RDONLY)) {
+		int ret = jffs2_cp_invalidate(c);
+		if (ret) {
+			unlock_kernel();
+			return ret;
+		}
 	}
 
 	if (!(*flags & MS_RDONLY))
@@ -527,6 +535,10 @@ int jffs2_do_fill_super(struct super_block *sb, void *data, int silent)
 	if ((ret = jffs2_do_mount_fs(c)))
 		goto out_inohash;
 
+	/* The checkpoint on the flash is stale once anything is written */
+	if (!(sb->s_flags & MS_RDONLY) && (ret = jffs2_cp_invalidate(c)))
+		goto out_root;
+
 	D1(printk(KERN_DEBUG "jffs2_do_fill_super(): Getting root inode\n"));
 	root_i = jffs2_iget(sb, 1);
 	if (IS_ERR(root_i)) {
@@ -553,6 +565,7 @@ int jffs2_do_fill_super(struct super_block *sb, void *data, int silent)
  out_root_i:
 	iput(root_i);
 out_root:
+	jffs2_cp_exit(c);
 	jffs2_free_ino_caches(c);
 	jffs2_free_raw_node_refs(c);
 	if (jffs2_blocks_use_vmalloc(c))
@@ -831,6 +831,26 @@ scan_more:
 			ofs += PAD(je32_to_cpu(node->totlen));
 			break;
 #endif	/* CONFIG_JFFS2_FS_XATTR */
+#ifdef CONFIG_JFFS2_CHECKPOINT
+		case JFFS2_NODETYPE_CHECKPOINT:
+		case JFFS2_NODETYPE_CHECKPOINT_INVAL:
+			if (buf_ofs + buf_len < ofs + sizeof(struct jffs2_raw_checkpoint)) {
+				buf_len = min_t(uint32_t, buf_size, jeb->offset + c->sector_size - ofs);
+				D1(printk(KERN_DEBUG "Fewer than %zd bytes (checkpoint node)"
+					  " left to end of buf. Reading 0x%x at 0x%08x\n",
+					  sizeof(struct jffs2_raw_checkpoint), buf_len, ofs));
+				err = jffs2_fill_scan_buf(c, buf, ofs, buf_len);
+				if (err)
+					return err;
+				buf_ofs = ofs;
+				node = (void *)buf;
+			}
+			err = jffs2_cp_scan_node(c, jeb, (void *)node, ofs, s);
+			if (err)
+				return err;
+			ofs += PAD(je32_to_cpu(node->totlen));
+			break;
+#endif	/* CONFIG_JFFS2_CHECKPOINT */
 
 		case JFFS2_NODETYPE_CLEANMARKER:
 			D1(printk(KERN_DEBUG "CLEANMARKER node found at 0x%08x\n", ofs));
@@ -350,6 +350,13 @@ int jffs2_sum_add_kvec(struct jffs2_sb_info *c, const struct kvec *invecs,
 			dbg_summary("node SUMMARY\n");
 			break;
 
+		case JFFS2_NODETYPE_CHECKPOINT:
+		case JFFS2_NODETYPE_CHECKPOINT_INVAL:
+			/* Checkpoint nodes are found by scanning the whole block */
+			dbg_summary("node CHECKPOINT\n");
+			jffs2_sum_disable_collecting(c->summary);
+			break;
+
 		default:
 			/* If you implement a new node type you should also implement
 			   summary support for it or disable summary.
@@ -199,11 +199,18 @@ static void jffs2_put_super (struct super_block *sb)
 	if (sb->s_dirt)
 		jffs2_write_super(sb);
 
+	if (!(sb->s_flags & MS_RDONLY)) {
+		/* Nothing may be written after the checkpoint */
+		jffs2_stop_garbage_collect_thread(c);
+		jffs2_cp_write(c);
+	}
+
 	mutex_lock(&c->alloc_sem);
 	jffs2_flush_wbuf_pad(c);
 	mutex_unlock(&c->alloc_sem);
 
 	jffs2_sum_exit(c);
+	jffs2_cp_exit(c);
 
 	jffs2_free_ino_caches(c);
 	jffs2_free_raw_node_refs(c);
@@ -253,6 +260,7 @@ static int __init init_jffs2_fs(void)
 	BUILD_BUG_ON(sizeof(struct jffs2_raw_dirent) != 40);
 	BUILD_BUG_ON(sizeof(struct jffs2_raw_inode) != 68);
 	BUILD_BUG_ON(sizeof(struct jffs2_raw_summary) != 32);
+	BUILD_BUG_ON(sizeof(struct jffs2_raw_checkpoint) != 40);
 
 	printk(KERN_INFO "JFFS2 version 2.2."
 #ifdef CONFIG_JFFS2_FS_WRITEBUFFER
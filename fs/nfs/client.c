@@ -899,8 +899,18 @@ static void nfs_server_set_fsinfo(struct nfs_server *server, struct nfs_fsinfo *
 	server->wpages = (server->wsize + PAGE_CACHE_SIZE - 1) >> PAGE_CACHE_SHIFT;
 	server->wtmult = nfs_block_bits(fsinfo->wtmult, NULL);
 
+	/*
+	 * NFSv3 READDIR replies may span several pages.  dtpref is only
+	 * a hint, and servers tend to set it to one page even though they
+	 * will happily fill bigger READDIRPLUS replies, so ask for rsize.
+	 */
 	server->dtsize = nfs_block_size(fsinfo->dtpref, NULL);
-	if (server->dtsize > PAGE_CACHE_SIZE)
+	if (server->nfs_client->rpc_ops->version == 3) {
+		if (server->dtsize < server->rsize)
+			server->dtsize = server->rsize;
+		if (server->dtsize > NFS_MAX_READDIR_PAGES * PAGE_CACHE_SIZE)
+			server->dtsize = NFS_MAX_READDIR_PAGES * PAGE_CACHE_SIZE;
+	} else if (server->dtsize > PAGE_CACHE_SIZE)
 		server->dtsize = PAGE_CACHE_SIZE;
 	if (server->dtsize > server->rsize)
 		server->dtsize = server->rsize;
@@ -153,12 +153,141 @@ typedef struct {
 	loff_t		current_index;
 	struct nfs_entry *entry;
 	decode_dirent_t	decode;
-	int		plus;
+	int		plus;		/* use READDIRPLUS to fill pages */
+	int		page_plus;	/* desc->page holds READDIRPLUS data */
 	unsigned long	timestamp;
 	unsigned long	gencount;
 	int		timestamp_valid;
 } nfs_readdir_descriptor_t;
 
+static inline
+int dir_decode(nfs_readdir_descriptor_t *desc)
+{
+	__be32	*p = desc->ptr;
+	p = desc->decode(p, desc->entry, desc->page_plus);
+	if (IS_ERR(p))
+		return PTR_ERR(p);
+	desc->ptr = p;
+	if (desc->timestamp_valid) {
+		desc->entry->fattr->time_start = desc->timestamp;
+		desc->entry->fattr->gencount = desc->gencount;
+	} else
+		desc->entry->fattr->valid &= ~NFS_ATTR_FATTR;
+	return 0;
+}
+
+static inline
+void dir_page_release(nfs_readdir_descriptor_t *desc)
+{
+	kunmap(desc->page);
+	page_cache_release(desc->page);
+	desc->page = NULL;
+	desc->ptr = NULL;
+}
+
+static struct dentry *nfs_readdir_lookup(nfs_readdir_descriptor_t *desc);
+
+/*
+ * Set up a page cache page once it holds dirent data.  PG_checked tells
+ * the decoder whether the page was filled by READDIR or READDIRPLUS, as
+ * later calls may use the other one.
+ */
+static void nfs_readdir_page_filled(nfs_readdir_descriptor_t *desc,
+				    struct page *page)
+{
+	if (desc->plus)
+		SetPageChecked(page);
+	else
+		ClearPageChecked(page);
+	SetPageUptodate(page);
+}
+
+/*
+ * A READDIR reply that spans several pages is split into page sized runs
+ * of whole entries, each of them terminated like a short reply, so that
+ * the page cache still holds a self-contained run of entries per page.
+ * As every entry is decoded here anyway, READDIRPLUS results are used to
+ * prime the dcache while their attributes are fresh.
+ *
+ * Returns the number of page cache pages filled, starting with 'page'.
+ */
+static int nfs_readdir_scatter(nfs_readdir_descriptor_t *desc, __be32 *buf,
+			       struct page *page)
+{
+	struct address_space *mapping = page->mapping;
+	nfs_readdir_descriptor_t fill = *desc;
+	struct nfs_entry entry = *desc->entry;
+	struct nfs_fh	fh;
+	struct nfs_fattr fattr;
+	struct dentry	*dentry;
+	struct page	*next = NULL;
+	char		*kaddr;
+	__be32		*p = buf;
+	size_t		len, used = 0;
+	int		nr = 1, status;
+
+	entry.fh = &fh;
+	entry.fattr = &fattr;
+	nfs_fattr_init(&fattr);
+	fill.entry = &entry;
+	fill.page_plus = desc->plus;
+
+	kaddr = kmap(page);
+	for (;;) {
+		fill.ptr = p;
+		status = dir_decode(&fill);
+		if (status)
+			break;
+		len = (char *)fill.ptr - (char *)p;
+
+		/* keep room for the terminating value_follows and eof */
+		if (used + len + 2 * sizeof(__be32) > PAGE_CACHE_SIZE) {
+			if (nr == NFS_MAX_READDIR_PAGES)
+				break;
+			next = grab_cache_page_nowait(mapping, page->index + nr);
+			if (next == NULL)
+				break;
+			if (PageUptodate(next)) {
+				unlock_page(next);
+				page_cache_release(next);
+				break;
+			}
+			memset(kaddr + used, 0, 2 * sizeof(__be32));
+			kunmap(page);
+			if (nr > 1) {
+				nfs_readdir_page_filled(desc, page);
+				unlock_page(page);
+				page_cache_release(page);
+			}
+			page = next;
+			kaddr = kmap(page);
+			used = 0;
+			nr++;
+		}
+		memcpy(kaddr + used, p, len);
+		used += len;
+		p = fill.ptr;
+
+		if (fill.page_plus) {
+			dentry = nfs_readdir_lookup(&fill);
+			if (dentry != NULL)
+				dput(dentry);
+		}
+	}
+
+	/* "no more entries in this page", plus the eof flag at the end */
+	memset(kaddr + used, 0, 2 * sizeof(__be32));
+	if (status == -EBADCOOKIE)
+		((__be32 *)(kaddr + used))[1] = xdr_one;
+	kunmap(page);
+	if (nr > 1) {
+		nfs_readdir_page_filled(desc, page);
+		unlock_page(page);
+		page_cache_release(page);
+	}
+	return nr;
+}
+
 /* Now we cache directories properly, by stuffing the dirent
  * data directly in the page cache.
  *
@@ -170,6 +299,10 @@ typedef struct {
  * NOTE: Dirent information verification is done always by the
  *	 page-in of the RPC reply, nowhere else, this simplies
  *	 things substantially.
+ *
+ * When the server allows READDIR replies bigger than a page, the
+ * reply is read into a physically contiguous buffer instead and then
+ * scattered over this and the following pages, see above.
  */
 static
 int nfs_readdir_filler(nfs_readdir_descriptor_t *desc, struct page *page)
@@ -177,18 +310,31 @@ int nfs_readdir_filler(nfs_readdir_descriptor_t *desc, struct page *page)
 	struct file	*file = desc->file;
 	struct inode	*inode = file->f_path.dentry->d_inode;
 	struct rpc_cred	*cred = nfs_file_cred(file);
+	unsigned int	dtsize = NFS_SERVER(inode)->dtsize;
+	struct page	*pages[NFS_MAX_READDIR_PAGES];
+	struct page	*buf = NULL;
 	unsigned long	timestamp, gencount;
-	int		error;
+	int		error, i, nr = 1;
 
 	dfprintk(DIRCACHE, "NFS: %s: reading cookie %Lu into page %lu\n",
 			__func__, (long long)desc->entry->cookie,
 			page->index);
 
+	if (dtsize > PAGE_CACHE_SIZE)
+		buf = alloc_pages(GFP_KERNEL | __GFP_NOWARN, get_order(dtsize));
+	if (buf != NULL) {
+		for (i = 0; i < NFS_MAX_READDIR_PAGES; i++)
+			pages[i] = buf + i;
+	} else {
+		pages[0] = page;
+		dtsize = min_t(unsigned int, dtsize, PAGE_CACHE_SIZE);
+	}
+
  again:
 	timestamp = jiffies;
 	gencount = nfs_inc_attr_generation_counter();
-	error = NFS_PROTO(inode)->readdir(file->f_path.dentry, cred, desc->entry->cookie, page,
-					  NFS_SERVER(inode)->dtsize, desc->plus);
+	error = NFS_PROTO(inode)->readdir(file->f_path.dentry, cred, desc->entry->cookie, pages,
+					  dtsize, desc->plus);
 	if (error < 0) {
 		/* We requested READDIRPLUS, but the server doesn't grok it */
 		if (error == -ENOTSUPP && desc->plus) {
@@ -202,7 +348,6 @@ int nfs_readdir_filler(nfs_readdir_descriptor_t *desc, struct page *page)
 	desc->timestamp = timestamp;
 	desc->gencount = gencount;
 	desc->timestamp_valid = 1;
-	SetPageUptodate(page);
 	/* Ensure consistent page alignment of the data.
 	 * Note: assumes we have exclusive access to this mapping either
 	 *	 through inode->i_mutex or some other mechanism.
@@ -211,38 +356,21 @@ int nfs_readdir_filler(nfs_readdir_descriptor_t *desc, struct page *page)
 		/* Should never happen */
 		nfs_zap_mapping(inode, inode->i_mapping);
 	}
+	if (buf != NULL) {
+		nr = nfs_readdir_scatter(desc, page_address(buf), page);
+		__free_pages(buf, get_order(dtsize));
+	}
+	nfs_readdir_page_filled(desc, page);
+	dfprintk(DIRCACHE, "NFS: %s: filled %d pages\n", __func__, nr);
 	unlock_page(page);
 	return 0;
  error:
+	if (buf != NULL)
+		__free_pages(buf, get_order(dtsize));
 	unlock_page(page);
 	return -EIO;
 }
 
-static inline
-int dir_decode(nfs_readdir_descriptor_t *desc)
-{
-	__be32	*p = desc->ptr;
-	p = desc->decode(p, desc->entry, desc->plus);
-	if (IS_ERR(p))
-		return PTR_ERR(p);
-	desc->ptr = p;
-	if (desc->timestamp_valid) {
-		desc->entry->fattr->time_start = desc->timestamp;
-		desc->entry->fattr->gencount = desc->gencount;
-	} else
-		desc->entry->fattr->valid &= ~NFS_ATTR_FATTR;
-	return 0;
-}
-
-static inline
-void dir_page_release(nfs_readdir_descriptor_t *desc)
-{
-	kunmap(desc->page);
-	page_cache_release(desc->page);
-	desc->page = NULL;
-	desc->ptr = NULL;
-}
-
 /*
  * Given a pointer to a buffer that has already been filled by a call
  * to readdir, find the next entry with cookie '*desc->dir_cookie'.
@@ -335,6 +463,7 @@ int find_dirent_page(nfs_readdir_descriptor_t *desc)
 
 	/* NOTE: Someone else may have changed the READDIRPLUS flag */
 	desc->page = page;
+	desc->page_plus = PageChecked(page);
 	desc->ptr = kmap(page);		/* matching kunmap in nfs_do_filldir */
 	if (*desc->dir_cookie != 0)
 		status = find_dirent(desc);
@@ -393,8 +522,6 @@ static inline unsigned int dt_type(struct inode *inode)
 	return (inode->i_mode >> 12) & 15;
 }
 
-static struct dentry *nfs_readdir_lookup(nfs_readdir_descriptor_t *desc);
-
 /*
  * Once we've found the start of the dirent within a page: fill 'er up...
  */
@@ -487,10 +614,12 @@ int uncached_readdir(nfs_readdir_descriptor_t *desc, void *dirent,
 	timestamp = jiffies;
 	gencount = nfs_inc_attr_generation_counter();
 	status = NFS_PROTO(inode)->readdir(file->f_path.dentry, cred,
-						*desc->dir_cookie, page,
-						NFS_SERVER(inode)->dtsize,
+						*desc->dir_cookie, &page,
+						min_t(unsigned int, PAGE_CACHE_SIZE,
+						      NFS_SERVER(inode)->dtsize),
 						desc->plus);
 	desc->page = page;
+	desc->page_plus = desc->plus;
 	desc->ptr = kmap(page);		/* matching kunmap in nfs_do_filldir */
 	if (status >= 0) {
 		desc->timestamp = timestamp;
@@ -594,6 +723,12 @@ static int nfs_readdir(struct file *filp, void *dirent, filldir_t filldir)
 			break;
 		}
 	}
+	/*
+	 * Keep using READDIRPLUS for the next listing only if somebody
+	 * stats the entries in the meantime, see nfs_getattr()
+	 */
+	if (desc->entry->eof && desc->plus)
+		clear_bit(NFS_INO_ADVISE_RDPLUS, &NFS_I(inode)->flags);
 out:
 	nfs_unblock_sillyrename(dentry);
 	if (res > 0)
@@ -1130,17 +1265,22 @@ static struct dentry *nfs_readdir_lookup(nfs_readdir_descriptor_t *desc)
 		if (dentry->d_inode != NULL &&
 				(NFS_FILEID(dentry->d_inode) == entry->ino ||
 				d_mountpoint(dentry))) {
-			if (!desc->plus || entry->fh->size == 0)
+			if (!desc->page_plus || entry->fh->size == 0)
 				return dentry;
 			if (nfs_compare_fh(NFS_FH(dentry->d_inode),
-						entry->fh) == 0)
+						entry->fh) == 0) {
+				/* Save the GETATTR a later stat would need */
+				if (entry->fattr->valid & NFS_ATTR_FATTR)
+					nfs_refresh_inode(dentry->d_inode,
+							  entry->fattr);
 				goto out_renew;
+			}
 		}
 		/* No, so d_drop to allow one to be created */
 		d_drop(dentry);
 		dput(dentry);
 	}
-	if (!desc->plus || !(entry->fattr->valid & NFS_ATTR_FATTR))
+	if (!desc->page_plus || !(entry->fattr->valid & NFS_ATTR_FATTR))
 		return NULL;
 	if (name.len > NFS_SERVER(dir)->namelen)
 		return NULL;
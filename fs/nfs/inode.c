@@ -227,9 +227,6 @@ nfs_init_locked(struct inode *inode, void *opaque)
 	return 0;
 }
 
-/* Don't use READDIRPLUS on directories that we believe are too large */
-#define NFS_LIMIT_READDIRPLUS (8*PAGE_SIZE)
-
 /*
  * This is our front-end to iget that looks up inodes by file handle
  * instead of inode number.
@@ -284,8 +281,11 @@ nfs_fhget(struct super_block *sb, struct nfs_fh *fh, struct nfs_fattr *fattr)
 		} else if (S_ISDIR(inode->i_mode)) {
 			inode->i_op = NFS_SB(sb)->nfs_client->rpc_ops->dir_inode_ops;
 			inode->i_fop = &nfs_dir_operations;
-			if (nfs_server_capable(inode, NFS_CAP_READDIRPLUS)
-			    && fattr->size <= NFS_LIMIT_READDIRPLUS)
+			/*
+			 * Start out with READDIRPLUS; nfs_readdir() drops
+			 * back to READDIR unless the entries get stat()ed
+			 */
+			if (nfs_server_capable(inode, NFS_CAP_READDIRPLUS))
 				set_bit(NFS_INO_ADVISE_RDPLUS, &NFS_I(inode)->flags);
 			/* Deal with crossing mountpoints */
 			if ((fattr->valid & NFS_ATTR_FATTR_FSID)
@@ -486,6 +486,25 @@ void nfs_setattr_update_inode(struct inode *inode, struct iattr *attr)
 	}
 }
 
+/*
+ * Somebody stats an entry that READDIRPLUS could have returned the
+ * attributes for: ask the parent directory to use READDIRPLUS again.
+ * If we have to go to the server for the attributes, the pages cached
+ * for the directory were most likely filled by READDIR, so drop them
+ * and let the next readdir fetch the attributes in bulk.
+ */
+static void nfs_advise_use_readdirplus(struct dentry *dentry, int miss)
+{
+	struct dentry *parent = dget_parent(dentry);
+	struct inode *dir = parent->d_inode;
+
+	if (parent != dentry && nfs_server_capable(dir, NFS_CAP_READDIRPLUS) &&
+	    !test_and_set_bit(NFS_INO_ADVISE_RDPLUS, &NFS_I(dir)->flags) &&
+	    miss)
+		nfs_zap_mapping(dir, dir->i_mapping);
+	dput(parent);
+}
+
 int nfs_getattr(struct vfsmount *mnt, struct dentry *dentry, struct kstat *stat)
 {
 	struct inode *inode = dentry->d_inode;
@@ -512,6 +531,10 @@ int nfs_getattr(struct vfsmount *mnt, struct dentry *dentry, struct kstat *stat)
  	    ((mnt->mnt_flags & MNT_NODIRATIME) && S_ISDIR(inode->i_mode)))
 		need_atime = 0;
 
+	nfs_advise_use_readdirplus(dentry, need_atime ||
+			(NFS_I(inode)->cache_validity & NFS_INO_INVALID_ATTR) ||
+			nfs_attribute_timeout(inode));
+
 	if (need_atime)
 		err = __nfs_revalidate_inode(NFS_SERVER(inode), inode);
 	else
@@ -18,6 +18,11 @@ struct nfs_string;
  */
 #define NFS_MAX_READAHEAD	(RPC_DEF_SLOT_TABLE - 1)
 
+/* Maximum size of a single READDIR reply, in pages.  Only NFSv3 can
+ * receive replies that span more than one page, see nfs_readdir_filler()
+ */
+#define NFS_MAX_READDIR_PAGES	8
+
 /*
  * Determine if sessions are in use.
  */
@@ -496,6 +496,8 @@ nfs3_xdr_readdirargs(struct rpc_rqst *req, __be32 *p, struct nfs3_readdirargs *a
 /*
  * Decode the result of a readdir call.
  * We just check for syntactical correctness.
+ * Replies bigger than a page are received into physically contiguous
+ * lowmem pages by nfs_readdir_filler(), so they can be walked linearly.
  */
 static int
 nfs3_xdr_readdirres(struct rpc_rqst *req, __be32 *p, struct nfs3_readdirres *res)
@@ -320,10 +320,69 @@ struct mem_size_stats {
 	unsigned long private_clean;
 	unsigned long private_dirty;
 	unsigned long referenced;
+	unsigned long anonymous_thp;
 	unsigned long swap;
 	u64 pss;
 };
 
+static void smaps_account(struct mem_size_stats *mss, struct page *page,
+			  int young, int dirty)
+{
+	int mapcount;
+
+	mss->resident += PAGE_SIZE;
+	/* Accumulate the size in pages that have been accessed. */
+	if (young || PageReferenced(page))
+		mss->referenced += PAGE_SIZE;
+	mapcount = page_mapcount(page);
+	if (mapcount >= 2) {
+		if (dirty)
+			mss->shared_dirty += PAGE_SIZE;
+		else
+			mss->shared_clean += PAGE_SIZE;
+		mss->pss += (PAGE_SIZE << PSS_SHIFT) / mapcount;
+	} else {
+		if (dirty)
+			mss->private_dirty += PAGE_SIZE;
+		else
+			mss->private_clean += PAGE_SIZE;
+		mss->pss += (PAGE_SIZE << PSS_SHIFT);
+	}
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/* returns 1 if pmd was a huge pmd, which then has been accounted */
+static int smaps_huge_pmd(pmd_t *pmd, unsigned long addr, unsigned long end,
+			  struct mm_walk *walk)
+{
+	struct mem_size_stats *mss = walk->private;
+	struct page *page;
+	int ret = 0;
+
+	spin_lock(&walk->mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && pmd_present(*pmd)) {
+		int young = pmd_young(*pmd);
+
+		page = pmd_page(*pmd) +
+			((addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+		if (PageAnon(page))
+			mss->anonymous_thp += HPAGE_PMD_SIZE;
+		/* huge pmds are always mapped dirty */
+		for (; addr != end; page++, addr += PAGE_SIZE)
+			smaps_account(mss, page, young, 1);
+		ret = 1;
+	}
+	spin_unlock(&walk->mm->page_table_lock);
+	return ret;
+}
+#else
+static inline int smaps_huge_pmd(pmd_t *pmd, unsigned long addr,
+				 unsigned long end, struct mm_walk *walk)
+{
+	return 0;
+}
+#endif
+
 static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 			   struct mm_walk *walk)
 {
@@ -332,7 +391,11 @@ static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 	pte_t *pte, ptent;
 	spinlock_t *ptl;
 	struct page *page;
-	int mapcount;
+
+	if (pmd_trans_huge(*pmd) && smaps_huge_pmd(pmd, addr, end, walk))
+		return 0;
+	if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+		return 0;
 
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE) {
@@ -350,24 +413,7 @@ static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 		if (!page)
 			continue;
 
-		mss->resident += PAGE_SIZE;
-		/* Accumulate the size in pages that have been accessed. */
-		if (pte_young(ptent) || PageReferenced(page))
-			mss->referenced += PAGE_SIZE;
-		mapcount = page_mapcount(page);
-		if (mapcount >= 2) {
-			if (pte_dirty(ptent))
-				mss->shared_dirty += PAGE_SIZE;
-			else
-				mss->shared_clean += PAGE_SIZE;
-			mss->pss += (PAGE_SIZE << PSS_SHIFT) / mapcount;
-		} else {
-			if (pte_dirty(ptent))
-				mss->private_dirty += PAGE_SIZE;
-			else
-				mss->private_clean += PAGE_SIZE;
-			mss->pss += (PAGE_SIZE << PSS_SHIFT);
-		}
+		smaps_account(mss, page, pte_young(ptent), pte_dirty(ptent));
 	}
 	pte_unmap_unlock(pte - 1, ptl);
 	cond_resched();
@@ -403,6 +449,7 @@ static int show_smap(struct seq_file *m, void *v)
 		   "Private_Clean:  %8lu kB\n"
 		   "Private_Dirty:  %8lu kB\n"
 		   "Referenced:     %8lu kB\n"
+		   "AnonHugePages:  %8lu kB\n"
 		   "Swap:           %8lu kB\n"
 		   "KernelPageSize: %8lu kB\n"
 		   "MMUPageSize:    %8lu kB\n",
@@ -414,6 +461,7 @@ static int show_smap(struct seq_file *m, void *v)
 		   mss.private_clean >> 10,
 		   mss.private_dirty >> 10,
 		   mss.referenced >> 10,
+		   mss.anonymous_thp >> 10,
 		   mss.swap >> 10,
 		   vma_kernel_pagesize(vma) >> 10,
 		   vma_mmu_pagesize(vma) >> 10);
@@ -442,6 +490,33 @@ const struct file_operations proc_smaps_operations = {
 	.release	= seq_release_private,
 };
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static int clear_refs_huge_pmd(pmd_t *pmd, unsigned long addr,
+			       unsigned long end, struct mm_walk *walk)
+{
+	struct page *page;
+	int ret = 0;
+
+	spin_lock(&walk->mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && pmd_present(*pmd)) {
+		pmdp_test_and_clear_young(walk->private, addr, pmd);
+		page = pmd_page(*pmd) +
+			((addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+		for (; addr != end; page++, addr += PAGE_SIZE)
+			ClearPageReferenced(page);
+		ret = 1;
+	}
+	spin_unlock(&walk->mm->page_table_lock);
+	return ret;
+}
+#else
+static inline int clear_refs_huge_pmd(pmd_t *pmd, unsigned long addr,
+				      unsigned long end, struct mm_walk *walk)
+{
+	return 0;
+}
+#endif
+
 static int clear_refs_pte_range(pmd_t *pmd, unsigned long addr,
 				unsigned long end, struct mm_walk *walk)
 {
@@ -450,6 +525,11 @@ static int clear_refs_pte_range(pmd_t *pmd, unsigned long addr,
 	spinlock_t *ptl;
 	struct page *page;
 
+	if (pmd_trans_huge(*pmd) && clear_refs_huge_pmd(pmd, addr, end, walk))
+		return 0;
+	if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+		return 0;
+
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE) {
 		ptent = *pte;
@@ -603,10 +683,14 @@ static int pagemap_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 	struct vm_area_struct *vma;
 	struct pagemapread *pm = walk->private;
 	pte_t *pte;
+	int stable;
 	int err = 0;
 
 	/* find the first VMA at or above 'addr' */
 	vma = find_vma(walk->mm, addr);
+	if (pmd_trans_huge(*pmd))
+		split_huge_pmd(vma, pmd, addr);
+	stable = !pmd_none_or_trans_huge_or_clear_bad(pmd);
 	for (; addr != end; addr += PAGE_SIZE) {
 		u64 pfn = PM_NOT_PRESENT;
 
@@ -617,7 +701,7 @@ static int pagemap_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 
 		/* check that 'vma' actually covers this address,
 		 * and that it isn't a huge page vma */
-		if (vma && (vma->vm_start <= addr) &&
+		if (stable && vma && (vma->vm_start <= addr) &&
 		    !is_vm_hugetlb_page(vma)) {
 			pte = pte_offset_map(pmd, addr);
 			pfn = pte_to_pagemap_entry(*pte);
@@ -133,6 +133,77 @@ no_compr:
 	*compr_type = UBIFS_COMPR_NONE;
 }
 
+/**
+ * ubifs_compr_select - select compressor for the next data node of an inode.
+ * @c: UBIFS file-system description object
+ * @ui: UBIFS inode the data node belongs to
+ *
+ * This function returns the compressor type which should be used for the next
+ * data node of inode @ui. This is %UBIFS_COMPR_NONE if compression is
+ * disabled for the inode, or if the adaptive heuristic recently found the
+ * inode data to be incompressible (see 'ubifs_compr_account()'). In the latter
+ * case the data node is not counted by the heuristic.
+ */
+int ubifs_compr_select(const struct ubifs_info *c, struct ubifs_inode *ui)
+{
+	int compr_type = ui->compr_type;
+
+	if (!(ui->flags & UBIFS_COMPR_FL))
+		/* Compression is disabled for this inode */
+		return UBIFS_COMPR_NONE;
+
+	if (c->no_adaptive_compr || compr_type == UBIFS_COMPR_NONE)
+		return compr_type;
+
+	spin_lock(&ui->ui_lock);
+	if (ui->compr_skip) {
+		ui->compr_skip -= 1;
+		compr_type = UBIFS_COMPR_NONE;
+	}
+	spin_unlock(&ui->ui_lock);
+
+	return compr_type;
+}
+
+/**
+ * ubifs_compr_account - feed the result of compression to the heuristic.
+ * @c: UBIFS file-system description object
+ * @ui: UBIFS inode the data node belongs to
+ * @in_len: uncompressed data length
+ * @compr_type: compression type returned by 'ubifs_compress()'
+ *
+ * This function has to be called for every data node which was compressed
+ * with the compressor returned by 'ubifs_compr_select()'. If the last
+ * %UBIFS_COMPR_HEUR_MISSES data nodes of the inode did not shrink, e.g.,
+ * because the file contains JPEG or video data, compression is switched off
+ * for a while, and then probed again. The back-off grows exponentially while
+ * the probes keep failing, and is reset as soon as data compresses again.
+ */
+void ubifs_compr_account(const struct ubifs_info *c, struct ubifs_inode *ui,
+			 int in_len, int compr_type)
+{
+	/* Small data is never compressed, it tells nothing about the file */
+	if (c->no_adaptive_compr || in_len < UBIFS_MIN_COMPR_LEN)
+		return;
+
+	spin_lock(&ui->ui_lock);
+	if (compr_type != UBIFS_COMPR_NONE) {
+		ui->compr_miss = 0;
+		ui->compr_backoff = 0;
+	} else if (++ui->compr_miss >= UBIFS_COMPR_HEUR_MISSES) {
+		if (!ui->compr_backoff)
+			ui->compr_backoff = UBIFS_COMPR_HEUR_MIN_SKIP;
+		ui->compr_skip = ui->compr_backoff;
+		if (ui->compr_backoff < UBIFS_COMPR_HEUR_MAX_SKIP)
+			ui->compr_backoff <<= 1;
+		/* Next time a single failed probe is enough to back off */
+		ui->compr_miss = UBIFS_COMPR_HEUR_MISSES - 1;
+		dbg_gen("inode %lu does not compress, skip %u data nodes",
+			ui->vfs_inode.i_ino, ui->compr_skip);
+	}
+	spin_unlock(&ui->ui_lock);
+}
+
 /**
  * ubifs_decompress - decompress data.
  * @in_buf: data to decompress
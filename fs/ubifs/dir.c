@@ -75,6 +75,35 @@ static int inherit_flags(const struct inode *dir, int mode)
 	return flags;
 }
 
+/**
+ * inherit_compr - inherit compressor of the parent inode.
+ * @c: UBIFS file-system description object
+ * @dir: parent inode
+ * @mode: new inode mode flags
+ *
+ * This is a helper function for 'ubifs_new_inode()' which selects the
+ * compressor for a new inode. A compressor may be assigned to a directory
+ * with the %UBIFS_IOC_SETCOMPR ioctl, in which case regular files and
+ * sub-directories created in it inherit it. Otherwise regular files use the
+ * default compressor and other inodes use no compression.
+ */
+static int inherit_compr(const struct ubifs_info *c, const struct inode *dir,
+			 int mode)
+{
+	const struct ubifs_inode *ui = ubifs_inode(dir);
+
+	if (!S_ISDIR(mode) && !S_ISREG(mode))
+		return UBIFS_COMPR_NONE;
+
+	if (S_ISDIR(dir->i_mode) && ui->compr_type != UBIFS_COMPR_NONE &&
+	    ubifs_compr_present(ui->compr_type))
+		return ui->compr_type;
+
+	if (S_ISREG(mode))
+		return c->default_compr;
+	return UBIFS_COMPR_NONE;
+}
+
 /**
  * ubifs_new_inode - allocate new UBIFS inode object.
  * @c: UBIFS file-system description object
@@ -144,10 +173,7 @@ struct inode *ubifs_new_inode(struct ubifs_info *c, const struct inode *dir,
 
 	ui->flags = inherit_flags(dir, mode);
 	ubifs_set_inode_flags(inode);
-	if (S_ISREG(mode))
-		ui->compr_type = c->default_compr;
-	else
-		ui->compr_type = UBIFS_COMPR_NONE;
+	ui->compr_type = inherit_compr(c, dir, mode);
 	ui->synced_i_size = 0;
 
 	spin_lock(&c->cnt_lock);
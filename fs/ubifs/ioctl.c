@@ -26,6 +26,7 @@
 
 #include <linux/compat.h>
 #include <linux/mount.h>
+#include <mtd/ubifs-user.h>
 #include "ubifs.h"
 
 /**
@@ -144,6 +145,52 @@ out_unlock:
 	return err;
 }
 
+/**
+ * setcompr - set the compressor of an inode.
+ * @inode: inode to set the compressor for
+ * @compr_type: new compressor type
+ *
+ * This function sets the compressor which is used for the data nodes written
+ * to a regular file @inode from now on, or which is inherited by the inodes
+ * created in a directory @inode. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+static int setcompr(struct inode *inode, int compr_type)
+{
+	int err, release;
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+	struct ubifs_budget_req req = { .dirtied_ino = 1,
+					.dirtied_ino_d = ui->data_len };
+
+	if (compr_type < 0 || compr_type >= UBIFS_COMPR_TYPES_CNT)
+		return -EINVAL;
+	if (!ubifs_compr_present(compr_type))
+		return -EOPNOTSUPP;
+	if (!S_ISREG(inode->i_mode) && !S_ISDIR(inode->i_mode))
+		return -EINVAL;
+
+	err = ubifs_budget_space(c, &req);
+	if (err)
+		return err;
+
+	mutex_lock(&ui->ui_mutex);
+	ui->compr_type = compr_type;
+	spin_lock(&ui->ui_lock);
+	ui->compr_miss = ui->compr_skip = ui->compr_backoff = 0;
+	spin_unlock(&ui->ui_lock);
+	inode->i_ctime = ubifs_current_time(inode);
+	release = ui->dirty;
+	mark_inode_dirty_sync(inode);
+	mutex_unlock(&ui->ui_mutex);
+
+	if (release)
+		ubifs_release_budget(c, &req);
+	if (IS_SYNC(inode))
+		err = write_inode_now(inode, 1);
+	return err;
+}
+
 long ubifs_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	int flags, err;
@@ -182,6 +229,29 @@ long ubifs_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		return err;
 	}
 
+	case UBIFS_IOC_GETCOMPR:
+		flags = ubifs_inode(inode)->compr_type;
+		return put_user(flags, (__s32 __user *) arg);
+
+	case UBIFS_IOC_SETCOMPR: {
+		if (IS_RDONLY(inode))
+			return -EROFS;
+
+		if (!is_owner_or_cap(inode))
+			return -EACCES;
+
+		if (get_user(flags, (__s32 __user *) arg))
+			return -EFAULT;
+
+		err = mnt_want_write(file->f_path.mnt);
+		if (err)
+			return err;
+		dbg_gen("set compressor: %d, ino %lu", flags, inode->i_ino);
+		err = setcompr(inode, flags);
+		mnt_drop_write(file->f_path.mnt);
+		return err;
+	}
+
 	default:
 		return -ENOTTY;
 	}
@@ -197,6 +267,9 @@ long ubifs_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case FS_IOC32_SETFLAGS:
 		cmd = FS_IOC_SETFLAGS;
 		break;
+	case UBIFS_IOC_GETCOMPR:
+	case UBIFS_IOC_SETCOMPR:
+		break;
 	default:
 		return -ENOIOCTLCMD;
 	}
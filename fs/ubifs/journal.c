@@ -688,7 +688,7 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 			 const union ubifs_key *key, const void *buf, int len)
 {
 	struct ubifs_data_node *data;
-	int err, lnum, offs, compr_type, out_len;
+	int err, lnum, offs, compr_type, probed, out_len;
 	int dlen = UBIFS_DATA_NODE_SZ + UBIFS_BLOCK_SIZE * WORST_COMPR_FACTOR;
 	struct ubifs_inode *ui = ubifs_inode(inode);
 
@@ -706,14 +706,11 @@ int ubifs_jnl_write_data(struct ubifs_info *c, const struct inode *inode,
 	data->size = cpu_to_le32(len);
 	zero_data_node_unused(data);
 
-	if (!(ui->flags & UBIFS_COMPR_FL))
-		/* Compression is disabled for this inode */
-		compr_type = UBIFS_COMPR_NONE;
-	else
-		compr_type = ui->compr_type;
-
+	compr_type = probed = ubifs_compr_select(c, ui);
 	out_len = dlen - UBIFS_DATA_NODE_SZ;
 	ubifs_compress(buf, len, &data->data, &out_len, &compr_type);
+	if (probed != UBIFS_COMPR_NONE)
+		ubifs_compr_account(c, ui, len, compr_type);
 	ubifs_assert(out_len <= UBIFS_BLOCK_SIZE);
 
 	dlen = UBIFS_DATA_NODE_SZ + out_len;
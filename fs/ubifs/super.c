@@ -36,6 +36,7 @@
 #include <linux/mount.h>
 #include <linux/math64.h>
 #include <linux/writeback.h>
+#include <mtd/ubifs-user.h>
 #include "ubifs.h"
 
 /*
@@ -427,6 +428,11 @@ static int ubifs_show_options(struct seq_file *s, struct vfsmount *mnt)
 	else if (c->mount_opts.chk_data_crc == 1)
 		seq_printf(s, ",no_chk_data_crc");
 
+	if (c->mount_opts.adaptive_compr == 2)
+		seq_printf(s, ",adaptive_compr");
+	else if (c->mount_opts.adaptive_compr == 1)
+		seq_printf(s, ",no_adaptive_compr");
+
 	if (c->mount_opts.override_compr) {
 		seq_printf(s, ",compr=%s",
 			   ubifs_compr_name(c->mount_opts.compr_type));
@@ -903,6 +909,8 @@ static int check_volume_empty(struct ubifs_info *c)
  * Opt_no_bulk_read: disable bulk-reads
  * Opt_chk_data_crc: check CRCs when reading data nodes
  * Opt_no_chk_data_crc: do not check CRCs when reading data nodes
+ * Opt_adaptive_compr: stop compressing data of inodes which does not compress
+ * Opt_no_adaptive_compr: always compress data of inodes with compression on
  * Opt_override_compr: override default compressor
  * Opt_err: just end of array marker
  */
@@ -913,6 +921,8 @@ enum {
 	Opt_no_bulk_read,
 	Opt_chk_data_crc,
 	Opt_no_chk_data_crc,
+	Opt_adaptive_compr,
+	Opt_no_adaptive_compr,
 	Opt_override_compr,
 	Opt_err,
 };
@@ -924,6 +934,8 @@ static const match_table_t tokens = {
 	{Opt_no_bulk_read, "no_bulk_read"},
 	{Opt_chk_data_crc, "chk_data_crc"},
 	{Opt_no_chk_data_crc, "no_chk_data_crc"},
+	{Opt_adaptive_compr, "adaptive_compr"},
+	{Opt_no_adaptive_compr, "no_adaptive_compr"},
 	{Opt_override_compr, "compr=%s"},
 	{Opt_err, NULL},
 };
@@ -1002,6 +1014,14 @@ static int ubifs_parse_options(struct ubifs_info *c, char *options,
 			c->mount_opts.chk_data_crc = 1;
 			c->no_chk_data_crc = 1;
 			break;
+		case Opt_adaptive_compr:
+			c->mount_opts.adaptive_compr = 2;
+			c->no_adaptive_compr = 0;
+			break;
+		case Opt_no_adaptive_compr:
+			c->mount_opts.adaptive_compr = 1;
+			c->no_adaptive_compr = 1;
+			break;
 		case Opt_override_compr:
 		{
 			char *name = match_strdup(&args[0]);
@@ -2158,6 +2178,11 @@ static int __init ubifs_init(void)
 	 */
 	BUILD_BUG_ON(UBIFS_COMPR_TYPES_CNT > 4);
 
+	/* The per-inode compressor ioctls use on-flash compressor types */
+	BUILD_BUG_ON(UBIFS_IOC_COMPR_NONE != UBIFS_COMPR_NONE);
+	BUILD_BUG_ON(UBIFS_IOC_COMPR_LZO  != UBIFS_COMPR_LZO);
+	BUILD_BUG_ON(UBIFS_IOC_COMPR_ZLIB != UBIFS_COMPR_ZLIB);
+
 	/*
 	 * We require that PAGE_CACHE_SIZE is greater-than-or-equal-to
 	 * UBIFS_BLOCK_SIZE. It is assumed that both are powers of 2.
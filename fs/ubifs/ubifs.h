@@ -153,6 +153,17 @@
 /* Maximum number of data nodes to bulk-read */
 #define UBIFS_MAX_BULK_READ 32
 
+/*
+ * Adaptive compression heuristic. If %UBIFS_COMPR_HEUR_MISSES data nodes of an
+ * inode in a row did not compress, compression is switched off for the next
+ * @compr_backoff data nodes of this inode. The back-off starts at
+ * %UBIFS_COMPR_HEUR_MIN_SKIP nodes and is doubled each time the following
+ * probe fails too, up to %UBIFS_COMPR_HEUR_MAX_SKIP nodes.
+ */
+#define UBIFS_COMPR_HEUR_MISSES 4
+#define UBIFS_COMPR_HEUR_MIN_SKIP 16
+#define UBIFS_COMPR_HEUR_MAX_SKIP 1024
+
 /*
  * Lockdep classes for UBIFS inode @ui_mutex.
  */
@@ -343,13 +354,17 @@ struct ubifs_gced_idx_leb {
  * @ui_mutex: serializes inode write-back with the rest of VFS operations,
  *            serializes "clean <-> dirty" state changes, serializes bulk-read,
  *            protects @dirty, @bulk_read, @ui_size, and @xattr_size
- * @ui_lock: protects @synced_i_size
+ * @ui_lock: protects @synced_i_size, @compr_miss, @compr_skip and
+ *           @compr_backoff
  * @synced_i_size: synchronized size of inode, i.e. the value of inode size
  *                 currently stored on the flash; used only for regular file
  *                 inodes
  * @ui_size: inode size used by UBIFS when writing to flash
  * @flags: inode flags (@UBIFS_COMPR_FL, etc)
  * @compr_type: default compression type used for this inode
+ * @compr_miss: how many data nodes in a row did not compress
+ * @compr_skip: how many more data nodes to write without compression
+ * @compr_backoff: value to set @compr_skip to when compression fails next time
  * @last_page_read: page number of last page read (for bulk read)
  * @read_in_a_row: number of consecutive pages read in a row (for bulk read)
  * @data_len: length of the data attached to the inode
@@ -400,6 +415,9 @@ struct ubifs_inode {
 	loff_t synced_i_size;
 	loff_t ui_size;
 	int flags;
+	unsigned short compr_miss;
+	unsigned short compr_backoff;
+	unsigned int compr_skip;
 	pgoff_t last_page_read;
 	pgoff_t read_in_a_row;
 	int data_len;
@@ -911,6 +929,8 @@ struct ubifs_orphan {
  * @bulk_read: enable/disable bulk-reads (%0 default, %1 disabe, %2 enable)
  * @chk_data_crc: enable/disable CRC data checking when reading data nodes
  *                (%0 default, %1 disabe, %2 enable)
+ * @adaptive_compr: enable/disable the adaptive compression heuristic
+ *                  (%0 default, %1 disable, %2 enable)
  * @override_compr: override default compressor (%0 - do not override and use
  *                  superblock compressor, %1 - override and use compressor
  *                  specified in @compr_type)
@@ -921,6 +941,7 @@ struct ubifs_mount_opts {
 	unsigned int unmount_mode:2;
 	unsigned int bulk_read:2;
 	unsigned int chk_data_crc:2;
+	unsigned int adaptive_compr:2;
 	unsigned int override_compr:1;
 	unsigned int compr_type:2;
 };
@@ -971,6 +992,8 @@ struct ubifs_debug_info;
  * @no_chk_data_crc: do not check CRCs when reading data nodes (except during
  *                   recovery)
  * @bulk_read: enable bulk-reads
+ * @no_adaptive_compr: always compress data nodes of inodes which have
+ *                     compression enabled, even if they do not compress
  * @default_compr: default compression algorithm (%UBIFS_COMPR_LZO, etc)
  * @rw_incompat: the media is not R/W compatible
  *
@@ -1214,6 +1237,7 @@ struct ubifs_info {
 	unsigned int big_lpt:1;
 	unsigned int no_chk_data_crc:1;
 	unsigned int bulk_read:1;
+	unsigned int no_adaptive_compr:1;
 	unsigned int default_compr:2;
 	unsigned int rw_incompat:1;
 
@@ -1727,6 +1751,9 @@ void ubifs_compress(const void *in_buf, int in_len, void *out_buf, int *out_len,
 		    int *compr_type);
 int ubifs_decompress(const void *buf, int len, void *out, int *out_len,
 		     int compr_type);
+int ubifs_compr_select(const struct ubifs_info *c, struct ubifs_inode *ui);
+void ubifs_compr_account(const struct ubifs_info *c, struct ubifs_inode *ui,
+			 int in_len, int compr_type);
 
 #include "debug.h"
 #include "misc.h"
@@ -204,6 +204,33 @@ static inline int pmd_none_or_clear_bad(pmd_t *pmd)
 	return 0;
 }
 
+#ifndef CONFIG_TRANSPARENT_HUGEPAGE
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Like pmd_none_or_clear_bad(), but for walkers which hold mmap_sem only
+ * for reading: a transparent huge pmd may appear or disappear under them,
+ * so it must not be mistaken for a bad pmd and cleared. The caller has to
+ * have dealt with huge pmds before, and skips whatever it finds now.
+ */
+static inline int pmd_none_or_trans_huge_or_clear_bad(pmd_t *pmd)
+{
+	pmd_t pmdval = *pmd;
+
+	barrier();
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval))
+		return 1;
+	if (unlikely(pmd_bad(pmdval))) {
+		pmd_clear_bad(pmd);
+		return 1;
+	}
+	return 0;
+}
+
 static inline pte_t __ptep_modify_prot_start(struct mm_struct *mm,
 					     unsigned long addr,
 					     pte_t *ptep)
@@ -260,6 +287,14 @@ static inline void ptep_modify_prot_commit(struct mm_struct *mm,
 	__ptep_modify_prot_commit(mm, addr, ptep, pte);
 }
 #endif /* __HAVE_ARCH_PTEP_MODIFY_PROT_TRANSACTION */
+
+#ifndef CONFIG_NUMA_BALANCING
+/* Without NUMA balancing, PROT_NONE ptes only exist in PROT_NONE vmas */
+static inline int pte_protnone(pte_t pte)
+{
+	return 0;
+}
+#endif
 #endif /* CONFIG_MMU */
 
 /*
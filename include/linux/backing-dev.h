@@ -38,6 +38,10 @@ typedef int (congested_fn)(void *, int);
 enum bdi_stat_item {
 	BDI_RECLAIMABLE,
 	BDI_WRITEBACK,
+	BDI_WRITTEN,
+	BDI_RA_PAGES,		/* pages submitted by readahead */
+	BDI_RA_HIT,		/* readahead windows consumed by a stream */
+	BDI_RA_MISS,		/* readahead windows evicted before use */
 	NR_BDI_STAT_ITEMS
 };
 
@@ -75,6 +79,12 @@ struct backing_dev_info {
 	struct prop_local_percpu completions;
 	int dirty_exceeded;
 
+	spinlock_t bw_lock;		/* protects the bandwidth estimation */
+	unsigned long bw_time_stamp;	/* last time write bw was updated */
+	unsigned long written_stamp;	/* pages written at bw_time_stamp */
+	unsigned long write_bandwidth;	/* the estimated write bandwidth */
+	unsigned long avg_write_bandwidth; /* further smoothed write bw */
+
 	unsigned int min_ratio;
 	unsigned int max_ratio, max_prop_frac;
 
@@ -104,6 +114,8 @@ void bdi_unregister(struct backing_dev_info *bdi);
 int bdi_setup_and_register(struct backing_dev_info *, char *, unsigned int);
 void bdi_start_writeback(struct backing_dev_info *bdi, struct super_block *sb,
 				long nr_pages);
+void bdi_start_memcg_writeback(struct backing_dev_info *bdi,
+				unsigned short memcg_id);
 int bdi_writeback_task(struct bdi_writeback *wb);
 int bdi_has_dirty_io(struct backing_dev_info *bdi);
 
@@ -181,6 +193,8 @@ static inline s64 bdi_stat_sum(struct backing_dev_info *bdi,
 }
 
 extern void bdi_writeout_inc(struct backing_dev_info *bdi);
+void bdi_update_bandwidth(struct backing_dev_info *bdi,
+			  unsigned long start_time);
 
 /*
  * maximal error of a stat counter.
@@ -30,6 +30,9 @@ struct request_pm_state;
 struct blk_trace;
 struct request;
 struct sg_io_hdr;
+struct blk_mq_ops;
+struct blk_mq_ctx;
+struct blk_mq_hw_ctx;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -160,6 +163,7 @@ struct request {
 	struct call_single_data csd;
 
 	struct request_queue *q;
+	struct blk_mq_ctx *mq_ctx;
 
 	unsigned int cmd_flags;
 	enum rq_cmd_type_bits cmd_type;
@@ -350,6 +354,17 @@ struct request_queue
 	dma_drain_needed_fn	*dma_drain_needed;
 	lld_busy_fn		*lld_busy_fn;
 
+	/*
+	 * Multi-queue: per-cpu software queues, mapped by mq_map onto
+	 * the hardware dispatch queues.  Only set up by blk_mq_init_queue().
+	 */
+	struct blk_mq_ops	*mq_ops;
+	struct blk_mq_ctx __percpu *queue_ctx;
+	unsigned int		nr_queues;
+	struct blk_mq_hw_ctx	**queue_hw_ctx;
+	unsigned int		nr_hw_queues;
+	unsigned int		*mq_map;
+
 	/*
 	 * Dispatch queue sorting
 	 */
@@ -630,6 +630,8 @@ struct address_space {
 	spinlock_t		i_mmap_lock;	/* protect tree, count, list */
 	unsigned int		truncate_count;	/* Cover race condition with truncate */
 	unsigned long		nrpages;	/* number of total pages */
+	unsigned long		nrshadows;	/* number of shadow entries */
+	struct list_head	shadow_list;	/* on list while nrshadows */
 	pgoff_t			writeback_index;/* writeback starts here */
 	const struct address_space_operations *a_ops;	/* methods */
 	unsigned long		flags;		/* error bits/gfp mask */
@@ -637,6 +639,9 @@ struct address_space {
 	spinlock_t		private_lock;	/* for use by the address_space */
 	struct list_head	private_list;	/* ditto */
 	struct address_space	*assoc_mapping;	/* ditto */
+#ifdef CONFIG_CGROUP_MEM_RES_CTLR
+	unsigned short		dirty_memcg_id;	/* memcg which last dirtied a page */
+#endif
 } __attribute__((aligned(sizeof(long))));
 	/*
 	 * On most architectures that alignment is already the case; but
@@ -887,15 +892,37 @@ struct fown_struct {
 /*
  * Track a single file's readahead state
  */
+/*
+ * Readahead window of a sequential stream which is not the most recently
+ * accessed one on this file.  Kept small, as every struct file has a few:
+ * windows larger than 64K pages are not remembered.
+ */
+struct file_ra_stream {
+	pgoff_t start;
+	unsigned short size;
+	unsigned short async_size;
+	unsigned short size_cap;
+};
+
+#define RA_NR_STREAMS	2	/* interleaved streams tracked besides the current */
+
 struct file_ra_state {
 	pgoff_t start;			/* where readahead started */
 	unsigned int size;		/* # of readahead pages */
 	unsigned int async_size;	/* do asynchronous readahead when
 					   there are only # of pages ahead */
+	unsigned int size_cap;		/* window size limit after thrashing,
+					   0 if none */
 
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	struct file_ra_stream streams[RA_NR_STREAMS]; /* most recent first */
+
+	pgoff_t stride_last;		/* last read of a strided pattern */
+	long stride;			/* distance between the reads */
+	unsigned int stride_count;	/* # of reads matching the stride */
 };
 
 /*
@@ -290,6 +290,11 @@ struct fscache_cache_ops {
 	/* write a page to its backing block in the cache */
 	int (*write_page)(struct fscache_storage *op, struct page *page);
 
+	/* write a run of pages with consecutive indices to their backing
+	 * blocks in the cache (optional) */
+	int (*write_pages)(struct fscache_storage *op, struct page **pages,
+			   unsigned nr_pages);
+
 	/* detach backing block from a page (optional)
 	 * - must release the cookie lock before returning
 	 * - may sleep
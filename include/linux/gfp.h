@@ -313,6 +313,56 @@ extern struct page *alloc_page_vma(gfp_t gfp_mask,
 #endif
 #define alloc_page(gfp_mask) alloc_pages(gfp_mask, 0)
 
+unsigned long
+__alloc_pages_bulk_nodemask(gfp_t gfp_mask, struct zonelist *zonelist,
+			    nodemask_t *nodemask, unsigned long nr_pages,
+			    struct list_head *page_list, struct page **page_array);
+
+static inline unsigned long
+alloc_pages_bulk_array_node(int nid, gfp_t gfp_mask, unsigned long nr_pages,
+			    struct page **page_array)
+{
+	/* Unknown node is current node */
+	if (nid < 0)
+		nid = numa_node_id();
+
+	return __alloc_pages_bulk_nodemask(gfp_mask, node_zonelist(nid, gfp_mask),
+					   NULL, nr_pages, NULL, page_array);
+}
+
+#ifdef CONFIG_NUMA
+extern unsigned long alloc_pages_bulk_current(gfp_t gfp_mask,
+			unsigned long nr_pages, struct list_head *page_list,
+			struct page **page_array);
+#else
+static inline unsigned long
+alloc_pages_bulk_current(gfp_t gfp_mask, unsigned long nr_pages,
+			 struct list_head *page_list, struct page **page_array)
+{
+	return __alloc_pages_bulk_nodemask(gfp_mask,
+			node_zonelist(numa_node_id(), gfp_mask), NULL,
+			nr_pages, page_list, page_array);
+}
+#endif
+
+/*
+ * Allocate up to @nr_pages order-0 pages, adding them to @list or storing
+ * them in the NULL entries of @array. Returns how many pages were added,
+ * or how many entries of @array are now populated.
+ */
+static inline unsigned long
+alloc_pages_bulk(gfp_t gfp_mask, unsigned long nr_pages, struct list_head *list)
+{
+	return alloc_pages_bulk_current(gfp_mask, nr_pages, list, NULL);
+}
+
+static inline unsigned long
+alloc_pages_bulk_array(gfp_t gfp_mask, unsigned long nr_pages,
+		       struct page **array)
+{
+	return alloc_pages_bulk_current(gfp_mask, nr_pages, NULL, array);
+}
+
 extern unsigned long __get_free_pages(gfp_t gfp_mask, unsigned int order);
 extern unsigned long get_zeroed_page(gfp_t gfp_mask);
 
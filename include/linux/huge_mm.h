@@ -0,0 +1,187 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+
+/*
+ * Transparent huge pages for anonymous memory.
+ *
+ * An anonymous huge pmd maps HPAGE_PMD_NR physically contiguous, naturally
+ * aligned small pages with a single pmd entry. The small pages keep their
+ * own refcount, mapcount and rmap, so only the page table needs to change
+ * when the pmd is split back into ptes: see mm/huge_memory.c. A shared file
+ * mapping may map page cache the same way, from its ->pmd_fault.
+ */
+
+struct mmu_gather;
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+
+#define HPAGE_PMD_SHIFT PMD_SHIFT
+#define HPAGE_PMD_SIZE	((1UL) << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK	(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER (HPAGE_PMD_SHIFT-PAGE_SHIFT)
+#define HPAGE_PMD_NR (1<<HPAGE_PMD_ORDER)
+
+#define TRANSPARENT_HUGEPAGE_NEVER	0
+#define TRANSPARENT_HUGEPAGE_MADVISE	1	/* only in MADV_HUGEPAGE areas */
+#define TRANSPARENT_HUGEPAGE_ALWAYS	2
+
+extern int transparent_hugepage_enabled_mode;
+extern int transparent_hugepage_defrag_mode;
+
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma)
+{
+	if (vma->vm_flags & VM_NOHUGEPAGE)
+		return 0;
+	if (transparent_hugepage_enabled_mode == TRANSPARENT_HUGEPAGE_ALWAYS)
+		return 1;
+	return transparent_hugepage_enabled_mode ==
+			TRANSPARENT_HUGEPAGE_MADVISE &&
+		(vma->vm_flags & VM_HUGEPAGE);
+}
+
+extern int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+				      struct vm_area_struct *vma,
+				      unsigned long address, pmd_t *pmd,
+				      unsigned int flags);
+extern int do_huge_pmd_file_page(struct vm_area_struct *vma,
+				 unsigned long haddr, pmd_t *pmd,
+				 struct page *page);
+extern int do_huge_pmd_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+			     unsigned long address, pmd_t *pmd,
+			     unsigned int flags);
+extern struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
+					  unsigned long address, pmd_t *pmd,
+					  unsigned int flags);
+extern int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+			pmd_t *pmd);
+extern int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+			   unsigned long address, pgprot_t newprot);
+extern int move_huge_pmd(struct vm_area_struct *vma, unsigned long old_addr,
+			 unsigned long new_addr, pmd_t *old_pmd,
+			 pmd_t *new_pmd);
+extern void split_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+			   unsigned long address);
+extern void split_huge_pmd_address(struct vm_area_struct *vma,
+				   unsigned long address);
+extern void split_huge_pmds(struct vm_area_struct *vma);
+extern pmd_t *page_check_address_pmd(struct page *page, struct mm_struct *mm,
+				     unsigned long address);
+extern int hugepage_madvise(struct vm_area_struct *vma,
+			    unsigned long *vm_flags, int advice);
+
+extern void __vma_adjust_trans_huge(struct vm_area_struct *vma,
+				    unsigned long start, unsigned long end,
+				    long adjust_next);
+static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
+					 unsigned long start,
+					 unsigned long end,
+					 long adjust_next)
+{
+	/* only anonymous faults and ->pmd_fault set up huge pmds */
+	if (!(vma->vm_ops && vma->vm_ops->pmd_fault) &&
+	    (!vma->anon_vma || vma->vm_ops || vma->vm_file))
+		return;
+	__vma_adjust_trans_huge(vma, start, end, adjust_next);
+}
+
+#else /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#define HPAGE_PMD_SHIFT ({ BUG(); 0; })
+#define HPAGE_PMD_MASK ({ BUG(); 0; })
+#define HPAGE_PMD_SIZE ({ BUG(); 0; })
+
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma)
+{
+	return 0;
+}
+
+static inline int do_huge_pmd_anonymous_page(struct mm_struct *mm,
+					     struct vm_area_struct *vma,
+					     unsigned long address, pmd_t *pmd,
+					     unsigned int flags)
+{
+	return VM_FAULT_FALLBACK;
+}
+
+static inline int do_huge_pmd_file_page(struct vm_area_struct *vma,
+					unsigned long haddr, pmd_t *pmd,
+					struct page *page)
+{
+	return VM_FAULT_FALLBACK;
+}
+
+static inline int do_huge_pmd_fault(struct mm_struct *mm,
+				    struct vm_area_struct *vma,
+				    unsigned long address, pmd_t *pmd,
+				    unsigned int flags)
+{
+	BUG();
+	return 0;
+}
+
+static inline struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
+						 unsigned long address,
+						 pmd_t *pmd,
+						 unsigned int flags)
+{
+	BUG();
+	return NULL;
+}
+
+static inline int zap_huge_pmd(struct mmu_gather *tlb,
+			       struct vm_area_struct *vma, pmd_t *pmd)
+{
+	return 0;
+}
+
+static inline int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+				  unsigned long address, pgprot_t newprot)
+{
+	return 0;
+}
+
+static inline int move_huge_pmd(struct vm_area_struct *vma,
+				unsigned long old_addr, unsigned long new_addr,
+				pmd_t *old_pmd, pmd_t *new_pmd)
+{
+	return 0;
+}
+
+static inline void split_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+				  unsigned long address)
+{
+}
+
+static inline void split_huge_pmd_address(struct vm_area_struct *vma,
+					  unsigned long address)
+{
+}
+
+static inline void split_huge_pmds(struct vm_area_struct *vma)
+{
+}
+
+static inline pmd_t *page_check_address_pmd(struct page *page,
+					    struct mm_struct *mm,
+					    unsigned long address)
+{
+	return NULL;
+}
+
+static inline int hugepage_madvise(struct vm_area_struct *vma,
+				   unsigned long *vm_flags, int advice)
+{
+	BUG();
+	return 0;
+}
+
+static inline void vma_adjust_trans_huge(struct vm_area_struct *vma,
+					 unsigned long start,
+					 unsigned long end,
+					 long adjust_next)
+{
+}
+
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#endif /* _LINUX_HUGE_MM_H */
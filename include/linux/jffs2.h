@@ -67,6 +67,12 @@
 #define JFFS2_NODETYPE_XATTR (JFFS2_FEATURE_INCOMPAT | JFFS2_NODE_ACCURATE | 8)
 #define JFFS2_NODETYPE_XREF (JFFS2_FEATURE_INCOMPAT | JFFS2_NODE_ACCURATE | 9)
 
+/* Inode cache checkpoint written at unmount. Kernels which do not know it
+   must not write to the file system, because the checkpoint would go stale */
+#define JFFS2_NODETYPE_CHECKPOINT (JFFS2_FEATURE_ROCOMPAT | JFFS2_NODE_ACCURATE | 10)
+/* Marks a checkpoint as stale; must be kept until a newer one is written */
+#define JFFS2_NODETYPE_CHECKPOINT_INVAL (JFFS2_FEATURE_RWCOMPAT_COPY | JFFS2_NODE_ACCURATE | 11)
+
 /* XATTR Related */
 #define JFFS2_XPREFIX_USER		1	/* for "user." */
 #define JFFS2_XPREFIX_SECURITY		2	/* for "security." */
@@ -77,7 +83,6 @@
 #define JFFS2_ACL_VERSION		0x0001
 
 // Maybe later...
-//#define JFFS2_NODETYPE_CHECKPOINT (JFFS2_FEATURE_RWCOMPAT_DELETE | JFFS2_NODE_ACCURATE | 3)
 //#define JFFS2_NODETYPE_OPTIONS (JFFS2_FEATURE_RWCOMPAT_COPY | JFFS2_NODE_ACCURATE | 4)
 
 
@@ -203,6 +208,33 @@ struct jffs2_raw_summary
 	jint32_t sum[0]; 	/* inode summary info */
 };
 
+/* All inodes were CRC-checked when the checkpoint was written */
+#define JFFS2_CP_FLAG_CHECKED	1
+
+struct jffs2_checkpoint_entry
+{
+	jint32_t ino;		/* inode number */
+	jint32_t pino_nlink;	/* parent inode number for directories,
+				   link count otherwise */
+} __attribute__((packed));
+
+struct jffs2_raw_checkpoint
+{
+	jint16_t magic;
+	jint16_t nodetype;	/* = JFFS2_NODETYPE_CHECKPOINT{,_INVAL} */
+	jint32_t totlen;
+	jint32_t hdr_crc;
+	jint32_t cp_seq;	/* checkpoint sequence number */
+	jint16_t cp_index;	/* index of this node in the checkpoint */
+	jint16_t cp_count;	/* number of nodes in the checkpoint */
+	jint32_t flags;		/* JFFS2_CP_FLAG_* */
+	jint32_t highest_ino;	/* highest inode number in use */
+	jint32_t ent_num;	/* number of entries in this node */
+	jint32_t ent_crc;	/* CRC of the entries */
+	jint32_t node_crc;	/* CRC of the node header */
+	struct jffs2_checkpoint_entry ent[0];
+};
+
 union jffs2_node_union
 {
 	struct jffs2_raw_inode i;
@@ -210,6 +242,7 @@ union jffs2_node_union
 	struct jffs2_raw_xattr x;
 	struct jffs2_raw_xref r;
 	struct jffs2_raw_summary s;
+	struct jffs2_raw_checkpoint cp;
 	struct jffs2_unknown_node u;
 };
 
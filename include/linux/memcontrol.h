@@ -20,10 +20,34 @@
 #ifndef _LINUX_MEMCONTROL_H
 #define _LINUX_MEMCONTROL_H
 #include <linux/cgroup.h>
+#include <linux/mmzone.h>
 struct mem_cgroup;
 struct page_cgroup;
 struct page;
 struct mm_struct;
+struct address_space;
+
+/* Page statistics updated from outside of the memory controller */
+enum mem_cgroup_page_stat_item {
+	MEMCG_NR_FILE_MAPPED,	/* # of pages charged as file rss */
+	MEMCG_NR_FILE_DIRTY,	/* # of dirty pages in page cache */
+	MEMCG_NR_FILE_WRITEBACK, /* # of pages under writeback */
+};
+
+/* Where a global reclaim walk over the cgroups is, see mem_cgroup_reclaim_iter() */
+struct mem_cgroup_reclaim_cookie {
+	struct zone *zone;
+	int priority;
+	unsigned short start;	/* css id the walk started at */
+};
+
+/* Dirty limits of a memcg and its pages counted against them, in pages */
+struct mem_cgroup_dirty_info {
+	unsigned long dirty_thresh;
+	unsigned long background_thresh;
+	unsigned long nr_reclaimable;
+	unsigned long nr_writeback;
+};
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR
 /*
@@ -48,12 +72,18 @@ extern void mem_cgroup_cancel_charge_swapin(struct mem_cgroup *ptr);
 
 extern int mem_cgroup_cache_charge(struct page *page, struct mm_struct *mm,
 					gfp_t gfp_mask);
-extern void mem_cgroup_add_lru_list(struct page *page, enum lru_list lru);
-extern void mem_cgroup_del_lru_list(struct page *page, enum lru_list lru);
-extern void mem_cgroup_rotate_lru_list(struct page *page, enum lru_list lru);
-extern void mem_cgroup_del_lru(struct page *page);
-extern void mem_cgroup_move_lists(struct page *page,
-				  enum lru_list from, enum lru_list to);
+extern struct lruvec *mem_cgroup_zone_lruvec(struct zone *zone,
+					     struct mem_cgroup *mem);
+extern struct lruvec *mem_cgroup_page_lruvec(struct page *page,
+					     struct zone *zone);
+extern struct lruvec *mem_cgroup_lru_add_lruvec(struct page *page,
+						struct zone *zone);
+extern void mem_cgroup_lru_add(struct page *page, struct lruvec *lruvec);
+extern void mem_cgroup_lru_del(struct page *page);
+extern struct mem_cgroup *mem_cgroup_iter(struct mem_cgroup *prev);
+extern struct mem_cgroup *mem_cgroup_reclaim_iter(struct mem_cgroup *prev,
+				struct mem_cgroup_reclaim_cookie *reclaim);
+extern void mem_cgroup_iter_break(struct mem_cgroup *prev);
 
 /* For coalescing uncharge for reducing memcg' overhead*/
 extern void mem_cgroup_uncharge_start(void);
@@ -64,12 +94,6 @@ extern void mem_cgroup_uncharge_cache_page(struct page *page);
 extern int mem_cgroup_shmem_charge_fallback(struct page *page,
 			struct mm_struct *mm, gfp_t gfp_mask);
 
-extern unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
-					struct list_head *dst,
-					unsigned long *scanned, int order,
-					int mode, struct zone *z,
-					struct mem_cgroup *mem_cont,
-					int active, int file);
 extern void mem_cgroup_out_of_memory(struct mem_cgroup *mem, gfp_t gfp_mask);
 int task_in_mem_cgroup(struct task_struct *task, const struct mem_cgroup *mem);
 
@@ -103,13 +127,6 @@ extern void mem_cgroup_record_reclaim_priority(struct mem_cgroup *mem,
 							int priority);
 int mem_cgroup_inactive_anon_is_low(struct mem_cgroup *memcg);
 int mem_cgroup_inactive_file_is_low(struct mem_cgroup *memcg);
-unsigned long mem_cgroup_zone_nr_pages(struct mem_cgroup *memcg,
-				       struct zone *zone,
-				       enum lru_list lru);
-struct zone_reclaim_stat *mem_cgroup_get_reclaim_stat(struct mem_cgroup *memcg,
-						      struct zone *zone);
-struct zone_reclaim_stat*
-mem_cgroup_get_reclaim_stat_from_page(struct page *page);
 extern void mem_cgroup_print_oom_info(struct mem_cgroup *memcg,
 					struct task_struct *p);
 
@@ -124,7 +141,27 @@ static inline bool mem_cgroup_disabled(void)
 	return false;
 }
 
-void mem_cgroup_update_file_mapped(struct page *page, int val);
+void mem_cgroup_update_page_stat(struct page *page,
+				 enum mem_cgroup_page_stat_item idx, int val);
+
+static inline void mem_cgroup_inc_page_stat(struct page *page,
+					    enum mem_cgroup_page_stat_item idx)
+{
+	mem_cgroup_update_page_stat(page, idx, 1);
+}
+
+static inline void mem_cgroup_dec_page_stat(struct page *page,
+					    enum mem_cgroup_page_stat_item idx)
+{
+	mem_cgroup_update_page_stat(page, idx, -1);
+}
+
+unsigned short mem_cgroup_dirty_info(unsigned long sys_available_mem,
+				     struct mem_cgroup_dirty_info *info);
+bool mem_cgroup_over_bground_thresh(unsigned short id);
+bool mem_cgroup_mapping_dirtied_by(struct address_space *mapping,
+				   unsigned short id);
+
 unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 						gfp_t gfp_mask, int nid,
 						int zid);
@@ -180,27 +217,46 @@ static inline int mem_cgroup_shmem_charge_fallback(struct page *page,
 	return 0;
 }
 
-static inline void mem_cgroup_add_lru_list(struct page *page, int lru)
+static inline struct lruvec *mem_cgroup_zone_lruvec(struct zone *zone,
+						    struct mem_cgroup *mem)
 {
+	return &zone->lruvec;
 }
 
-static inline void mem_cgroup_del_lru_list(struct page *page, int lru)
+static inline struct lruvec *mem_cgroup_page_lruvec(struct page *page,
+						    struct zone *zone)
 {
-	return ;
+	return &zone->lruvec;
 }
 
-static inline void mem_cgroup_rotate_lru_list(struct page *page, int lru)
+static inline struct lruvec *mem_cgroup_lru_add_lruvec(struct page *page,
+						       struct zone *zone)
 {
-	return ;
+	return &zone->lruvec;
 }
 
-static inline void mem_cgroup_del_lru(struct page *page)
+static inline void mem_cgroup_lru_add(struct page *page,
+				      struct lruvec *lruvec)
 {
-	return ;
 }
 
-static inline void
-mem_cgroup_move_lists(struct page *page, enum lru_list from, enum lru_list to)
+static inline void mem_cgroup_lru_del(struct page *page)
+{
+}
+
+static inline struct mem_cgroup *mem_cgroup_iter(struct mem_cgroup *prev)
+{
+	return NULL;
+}
+
+static inline struct mem_cgroup *
+mem_cgroup_reclaim_iter(struct mem_cgroup *prev,
+			struct mem_cgroup_reclaim_cookie *reclaim)
+{
+	return NULL;
+}
+
+static inline void mem_cgroup_iter_break(struct mem_cgroup *prev)
 {
 }
 
@@ -269,34 +325,37 @@ mem_cgroup_inactive_file_is_low(struct mem_cgroup *memcg)
 	return 1;
 }
 
-static inline unsigned long
-mem_cgroup_zone_nr_pages(struct mem_cgroup *memcg, struct zone *zone,
-			 enum lru_list lru)
+static inline void
+mem_cgroup_print_oom_info(struct mem_cgroup *memcg, struct task_struct *p)
 {
-	return 0;
 }
 
+static inline void mem_cgroup_inc_page_stat(struct page *page,
+					    enum mem_cgroup_page_stat_item idx)
+{
+}
 
-static inline struct zone_reclaim_stat*
-mem_cgroup_get_reclaim_stat(struct mem_cgroup *memcg, struct zone *zone)
+static inline void mem_cgroup_dec_page_stat(struct page *page,
+					    enum mem_cgroup_page_stat_item idx)
 {
-	return NULL;
 }
 
-static inline struct zone_reclaim_stat*
-mem_cgroup_get_reclaim_stat_from_page(struct page *page)
+static inline unsigned short
+mem_cgroup_dirty_info(unsigned long sys_available_mem,
+		      struct mem_cgroup_dirty_info *info)
 {
-	return NULL;
+	return 0;
 }
 
-static inline void
-mem_cgroup_print_oom_info(struct mem_cgroup *memcg, struct task_struct *p)
+static inline bool mem_cgroup_over_bground_thresh(unsigned short id)
 {
+	return false;
 }
 
-static inline void mem_cgroup_update_file_mapped(struct page *page,
-							int val)
+static inline bool mem_cgroup_mapping_dirtied_by(struct address_space *mapping,
+						 unsigned short id)
 {
+	return true;
 }
 
 static inline
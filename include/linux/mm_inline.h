@@ -19,20 +19,49 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+/**
+ * page_lruvec - the lruvec a page is linked on
+ * @page: the page
+ *
+ * The result is only stable while the page can not move to another
+ * lruvec: under the lru_lock of the returned lruvec, after the caller
+ * cleared PageLRU itself, or after it dropped the last reference.
+ */
+static inline struct lruvec *page_lruvec(struct page *page)
+{
+	return mem_cgroup_page_lruvec(page, page_zone(page));
+}
+
+/**
+ * page_lru_add_lruvec - the lruvec a page should be added to
+ * @page: the page, not on the LRU
+ */
+static inline struct lruvec *page_lru_add_lruvec(struct page *page)
+{
+	return mem_cgroup_lru_add_lruvec(page, page_zone(page));
+}
+
+/*
+ * Callers of add_page_to_lru_list() set PageLRU only after the page
+ * was added, so that whoever sees PageLRU finds the right lruvec.
+ */
 static inline void
-add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l)
+add_page_to_lru_list(struct lruvec *lruvec, struct page *page, enum lru_list l)
 {
-	list_add(&page->lru, &zone->lru[l].list);
-	__inc_zone_state(zone, NR_LRU_BASE + l);
-	mem_cgroup_add_lru_list(page, l);
+	mem_cgroup_lru_add(page, lruvec);
+	list_add(&page->lru, &lruvec->lists[l]);
+	lruvec->count[l]++;
+	__inc_zone_page_state(page, NR_LRU_BASE + l);
 }
 
 static inline void
-del_page_from_lru_list(struct zone *zone, struct page *page, enum lru_list l)
+del_page_from_lru_list(struct lruvec *lruvec, struct page *page,
+		       enum lru_list l)
 {
 	list_del(&page->lru);
-	__dec_zone_state(zone, NR_LRU_BASE + l);
-	mem_cgroup_del_lru_list(page, l);
+	lruvec->count[l]--;
+	__dec_zone_page_state(page, NR_LRU_BASE + l);
+	mem_cgroup_lru_del(page);
 }
 
 /**
@@ -51,11 +80,10 @@ static inline enum lru_list page_lru_base_type(struct page *page)
 }
 
 static inline void
-del_page_from_lru(struct zone *zone, struct page *page)
+del_page_from_lru(struct lruvec *lruvec, struct page *page)
 {
 	enum lru_list l;
 
-	list_del(&page->lru);
 	if (PageUnevictable(page)) {
 		__ClearPageUnevictable(page);
 		l = LRU_UNEVICTABLE;
@@ -66,8 +94,7 @@ del_page_from_lru(struct zone *zone, struct page *page)
 			l += LRU_ACTIVE;
 		}
 	}
-	__dec_zone_state(zone, NR_LRU_BASE + l);
-	mem_cgroup_del_lru_list(page, l);
+	del_page_from_lru_list(lruvec, page, l);
 }
 
 /**
@@ -62,10 +62,10 @@ struct free_area {
 struct pglist_data;
 
 /*
- * zone->lock and zone->lru_lock are two of the hottest locks in the kernel.
- * So add a wild amount of padding here to ensure that they fall into separate
- * cachelines.  There are very few zone structures in the machine, so space
- * consumption is not a concern here.
+ * zone->lock and zone->lruvec.lru_lock are two of the hottest locks in the
+ * kernel.  So add a wild amount of padding here to ensure that they fall into
+ * separate cachelines.  There are very few zone structures in the machine, so
+ * space consumption is not a concern here.
  */
 #if defined(CONFIG_SMP)
 struct zone_padding {
@@ -104,6 +104,9 @@ enum zone_stat_item {
 	NR_ISOLATED_ANON,	/* Temporary isolated pages from anon lru */
 	NR_ISOLATED_FILE,	/* Temporary isolated pages from file lru */
 	NR_SHMEM,		/* shmem pages (included tmpfs/GEM pages) */
+	NR_ANON_TRANSPARENT_HUGEPAGES,
+	WORKINGSET_REFAULT,	/* evicted file pages read back in */
+	WORKINGSET_ACTIVATE,	/* ... and activated on refault */
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -277,6 +280,21 @@ struct zone_reclaim_stat {
 	unsigned long		nr_saved_scan[NR_LRU_LISTS];
 };
 
+/*
+ * A set of LRU lists along with the lock that protects them.  Every
+ * zone has one, and with the memory controller enabled every cgroup
+ * has one per zone, so that tasks in unrelated cgroups do not contend
+ * on the same lock when they add, rotate or reclaim pages.
+ */
+struct lruvec {
+	spinlock_t		lru_lock;
+	struct list_head	lists[NR_LRU_LISTS];
+	unsigned long		count[NR_LRU_LISTS];
+	struct zone_reclaim_stat reclaim_stat;
+};
+
+extern void lruvec_init(struct lruvec *lruvec);
+
 struct zone {
 	/* Fields commonly accessed by the page allocator */
 
@@ -321,16 +339,24 @@ struct zone {
 	unsigned long		*pageblock_flags;
 #endif /* CONFIG_SPARSEMEM */
 
+#ifdef CONFIG_COMPACTION
+	/*
+	 * On compaction failure, 1<<compact_defer_shift compactions
+	 * are skipped before trying again. The number attempted since
+	 * last failure is tracked with compact_considered.
+	 */
+	unsigned int		compact_considered;
+	unsigned int		compact_defer_shift;
+#endif
 
 	ZONE_PADDING(_pad1_)
 
-	/* Fields commonly accessed by the page reclaim scanner */
-	spinlock_t		lru_lock;	
-	struct zone_lru {
-		struct list_head list;
-	} lru[NR_LRU_LISTS];
-
-	struct zone_reclaim_stat reclaim_stat;
+	/*
+	 * Fields commonly accessed by the page reclaim scanner.  Pages that
+	 * are charged to a memory cgroup live on the cgroup's lruvec for
+	 * this zone instead, see mem_cgroup_zone_lruvec().
+	 */
+	struct lruvec		lruvec;
 
 	unsigned long		pages_scanned;	   /* since last reclaim */
 	unsigned long		flags;		   /* zone flags, see below */
@@ -359,6 +385,9 @@ struct zone {
 	 */
 	unsigned int inactive_ratio;
 
+	/* Evictions and activations, the clock for refault distances */
+	atomic_long_t		inactive_age;
+
 
 	ZONE_PADDING(_pad2_)
 	/* Rarely used or read-mostly fields */
@@ -628,6 +657,12 @@ typedef struct pglist_data {
 	wait_queue_head_t kswapd_wait;
 	struct task_struct *kswapd;
 	int kswapd_max_order;
+#ifdef CONFIG_NUMA_BALANCING
+	/* rate limiting of NUMA balancing migrations into this node */
+	spinlock_t numabalancing_migrate_lock;
+	unsigned long numabalancing_migrate_next_window;
+	unsigned long numabalancing_migrate_nr_pages;
+#endif
 } pg_data_t;
 
 #define node_present_pages(nid)	(NODE_DATA(nid)->node_present_pages)
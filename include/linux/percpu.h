@@ -255,6 +255,27 @@ do {									\
 	}								\
 } while (0)
 
+/*
+ * Special handling for cmpxchg_double. cmpxchg_double is passed two
+ * percpu variables. The first has to be aligned to a double word
+ * boundary and the second has to follow directly thereafter.
+ */
+#define __pcpu_double_call_return_int(stem, pcp1, pcp2, ...)		\
+({									\
+	int pdcri_ret__;						\
+	__verify_pcpu_ptr(&(pcp1));					\
+	BUILD_BUG_ON(sizeof(pcp1) != sizeof(pcp2));			\
+	switch(sizeof(pcp1)) {						\
+	case 1: pdcri_ret__ = stem##1(pcp1, pcp2, __VA_ARGS__);break;	\
+	case 2: pdcri_ret__ = stem##2(pcp1, pcp2, __VA_ARGS__);break;	\
+	case 4: pdcri_ret__ = stem##4(pcp1, pcp2, __VA_ARGS__);break;	\
+	case 8: pdcri_ret__ = stem##8(pcp1, pcp2, __VA_ARGS__);break;	\
+	default:							\
+		__bad_size_call_parameter();break;			\
+	}								\
+	pdcri_ret__;							\
+})
+
 /*
  * Optimized manipulation for memory allocated through the per cpu
  * allocator or for addresses of per cpu variables.
@@ -622,4 +643,50 @@ do {									\
 # define irqsafe_cpu_xor(pcp, val) __pcpu_size_call(irqsafe_cpu_xor_, (val))
 #endif
 
+/*
+ * irqsafe_cpu_cmpxchg_double(pcp1, pcp2, oval1, oval2, nval1, nval2)
+ *
+ * Replace the two adjacent per cpu scalars pcp1 and pcp2 with nval1 and
+ * nval2 if they still contain oval1 and oval2. Returns 1 on success and
+ * 0 on failure. The pair is updated atomically vs. local interrupts and
+ * preemption; the generic version disables interrupts, architectures with
+ * a double word cmpxchg can avoid that.
+ */
+#define irqsafe_generic_cpu_cmpxchg_double(pcp1, pcp2, oval1, oval2, nval1, nval2) \
+({									\
+	int ret__ = 0;							\
+	unsigned long flags;						\
+	local_irq_save(flags);						\
+	if (*__this_cpu_ptr(&(pcp1)) == (oval1) &&			\
+	    *__this_cpu_ptr(&(pcp2)) == (oval2)) {			\
+		*__this_cpu_ptr(&(pcp1)) = (nval1);			\
+		*__this_cpu_ptr(&(pcp2)) = (nval2);			\
+		ret__ = 1;						\
+	}								\
+	local_irq_restore(flags);					\
+	ret__;								\
+})
+
+#ifndef irqsafe_cpu_cmpxchg_double
+# ifndef irqsafe_cpu_cmpxchg_double_1
+#  define irqsafe_cpu_cmpxchg_double_1(pcp1, pcp2, oval1, oval2, nval1, nval2) \
+	irqsafe_generic_cpu_cmpxchg_double(pcp1, pcp2, oval1, oval2, nval1, nval2)
+# endif
+# ifndef irqsafe_cpu_cmpxchg_double_2
+#  define irqsafe_cpu_cmpxchg_double_2(pcp1, pcp2, oval1, oval2, nval1, nval2) \
+	irqsafe_generic_cpu_cmpxchg_double(pcp1, pcp2, oval1, oval2, nval1, nval2)
+# endif
+# ifndef irqsafe_cpu_cmpxchg_double_4
+#  define irqsafe_cpu_cmpxchg_double_4(pcp1, pcp2, oval1, oval2, nval1, nval2) \
+	irqsafe_generic_cpu_cmpxchg_double(pcp1, pcp2, oval1, oval2, nval1, nval2)
+# endif
+# ifndef irqsafe_cpu_cmpxchg_double_8
+#  define irqsafe_cpu_cmpxchg_double_8(pcp1, pcp2, oval1, oval2, nval1, nval2) \
+	irqsafe_generic_cpu_cmpxchg_double(pcp1, pcp2, oval1, oval2, nval1, nval2)
+# endif
+# define irqsafe_cpu_cmpxchg_double(pcp1, pcp2, oval1, oval2, nval1, nval2) \
+	__pcpu_double_call_return_int(irqsafe_cpu_cmpxchg_double_, (pcp1), (pcp2), \
+				      oval1, oval2, nval1, nval2)
+#endif
+
 #endif /* __LINUX_PERCPU_H */
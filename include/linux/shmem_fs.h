@@ -30,9 +30,17 @@ struct shmem_sb_info {
 	uid_t uid;		    /* Mount uid for root directory */
 	gid_t gid;		    /* Mount gid for root directory */
 	mode_t mode;		    /* Mount mode for root directory */
+	int huge;		    /* SHMEM_HUGE_* */
 	struct mempolicy *mpol;     /* default memory policy for mappings */
 };
 
+/*
+ * When to back files with huge page sized, naturally aligned extents
+ */
+#define SHMEM_HUGE_NEVER	0
+#define SHMEM_HUGE_WITHIN_SIZE	1	/* only extents inside i_size */
+#define SHMEM_HUGE_ALWAYS	2
+
 static inline struct shmem_inode_info *SHMEM_I(struct inode *inode)
 {
 	return container_of(inode, struct shmem_inode_info, vfs_inode);
@@ -43,6 +43,11 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		KSWAPD_LOW_WMARK_HIT_QUICKLY, KSWAPD_HIGH_WMARK_HIT_QUICKLY,
 		KSWAPD_SKIP_CONGESTION_WAIT,
 		PAGEOUTRUN, ALLOCSTALL, PGROTATED,
+		PGLAZYFREED,		/* MADV_FREE pages dropped by reclaim */
+#ifdef CONFIG_COMPACTION
+		COMPACTBLOCKS, COMPACTPAGES, COMPACTPAGEFAILED,
+		COMPACTSTALL, COMPACTFAIL, COMPACTSUCCESS,
+#endif
 #ifdef CONFIG_HUGETLB_PAGE
 		HTLB_BUDDY_PGALLOC, HTLB_BUDDY_PGALLOC_FAIL,
 #endif
@@ -54,6 +59,31 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		UNEVICTABLE_PGCLEARED,	/* on COW, page truncate */
 		UNEVICTABLE_PGSTRANDED,	/* unable to isolate on unlock */
 		UNEVICTABLE_MLOCKFREED,
+		SHMEM_HUGE_ALLOC,	/* huge page extents allocated */
+		SHMEM_HUGE_FALLBACK,	/* fell back to a small page */
+		SHMEM_SMALL_ALLOC,	/* small pages allocated */
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+		SPECULATIVE_PGFAULT,	/* faults handled without mmap_sem */
+		SPECULATIVE_PGFAULT_ABORT, /* retried with mmap_sem */
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+		NUMA_PTE_UPDATES,	/* ptes armed for a hinting fault */
+		NUMA_HINT_FAULTS,
+		NUMA_HINT_FAULTS_LOCAL,	/* page was on the faulting node */
+		NUMA_PAGE_MIGRATE,
+#endif
+#ifdef CONFIG_SWAP
+		SWAP_RA,		/* pages read ahead from swap */
+		SWAP_RA_HIT,		/* of those, later found by a fault */
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		THP_FAULT_ALLOC,
+		THP_FAULT_FALLBACK,
+		THP_COLLAPSE_ALLOC,
+		THP_COLLAPSE_ALLOC_FAILED,
+		THP_SPLIT,
+		THP_FILE_MAPPED,	/* page cache extents mapped by a pmd */
+#endif
 		NR_VM_EVENT_ITEMS
 };
 
@@ -40,6 +40,8 @@ struct writeback_control {
 	long nr_to_write;		/* Write this many pages, and decrement
 					   this for each page written */
 	long pages_skipped;		/* Pages which were not written */
+	unsigned short memcg_id;	/* If !0, only write inodes dirtied
+					   by this memory cgroup */
 
 	/*
 	 * For a_ops->writepages(): is start or end are non-zero then this is
@@ -0,0 +1,52 @@
+/*
+ * This file is part of UBIFS.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published by
+ * the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin St, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef __UBIFS_USER_H__
+#define __UBIFS_USER_H__
+
+#include <linux/types.h>
+
+/*
+ * Per-inode compressor
+ * ~~~~~~~~~~~~~~~~~~~~
+ *
+ * Every UBIFS inode records the compressor used for its data. The
+ * %UBIFS_IOC_GETCOMPR and %UBIFS_IOC_SETCOMPR ioctl commands get and set it.
+ * A pointer to a 32-bit compressor type (%UBIFS_IOC_COMPR_NONE, etc) has to be
+ * passed to the ioctls.
+ *
+ * Setting a compressor on a regular file affects data written afterwards, and
+ * already written data stays as is. Setting a compressor on a directory makes
+ * regular files and sub-directories created in it inherit the compressor.
+ * Compression as such is still switched on and off with the %FS_COMPR_FL
+ * inode flag (see 'chattr +c').
+ */
+
+/* Compressor types, the same as the on-flash ones */
+#define UBIFS_IOC_COMPR_NONE 0
+#define UBIFS_IOC_COMPR_LZO  1
+#define UBIFS_IOC_COMPR_ZLIB 2
+
+/* ioctl commands of UBIFS files and directories */
+#define UBIFS_IOC_MAGIC 'O'
+
+/* Get the compressor of an inode */
+#define UBIFS_IOC_GETCOMPR _IOR(UBIFS_IOC_MAGIC, 0x20, __s32)
+/* Set the compressor of an inode */
+#define UBIFS_IOC_SETCOMPR _IOW(UBIFS_IOC_MAGIC, 0x21, __s32)
+
+#endif /* __UBIFS_USER_H__ */
@@ -1517,6 +1517,10 @@ static unsigned long power_of(int cpu)
 
 static int task_hot(struct task_struct *p, u64 now, struct sched_domain *sd);
 
+#ifdef CONFIG_NUMA_BALANCING
+static void sched_numa_migrate(int nid);
+#endif
+
 static unsigned long cpu_avg_load_per_task(int cpu)
 {
 	struct rq *rq = cpu_rq(cpu);
@@ -2582,6 +2586,19 @@ static void __sched_fork(struct task_struct *p)
 #ifdef CONFIG_PREEMPT_NOTIFIERS
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
+
+#ifdef CONFIG_NUMA_BALANCING
+	p->node_stamp = 0;
+	p->numa_scan_seq = p->mm ? p->mm->numa_scan_seq : 0;
+	p->numa_scan_period = sysctl_numa_balancing_scan_delay;
+	p->numa_work_pending = 0;
+	p->numa_preferred_nid = -1;
+	p->numa_faults = NULL;
+	p->numa_faults_buffer = NULL;
+	p->numa_faults_locality[0] = p->numa_faults_locality[1] = 0;
+	p->numa_pages_migrated = 0;
+	p->numa_task_migrations = 0;
+#endif
 }
 
 /*
@@ -3172,6 +3189,58 @@ again:
 	task_rq_unlock(rq, &flags);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * sched_numa_migrate - move current next to its memory, onto the least
+ * loaded cpu of @nid, unless that cpu is at least as busy as this one:
+ * the load balancer would only pull the task back.
+ */
+static void sched_numa_migrate(int nid)
+{
+	struct task_struct *p = current;
+	unsigned long load, min_load = ULONG_MAX;
+	struct migration_req req;
+	int cpu, dest_cpu = -1;
+	unsigned long flags;
+	struct rq *rq;
+
+	for_each_cpu_and(cpu, cpumask_of_node(nid), &p->cpus_allowed) {
+		if (!cpu_active(cpu))
+			continue;
+		load = weighted_cpuload(cpu);
+		if (load < min_load) {
+			min_load = load;
+			dest_cpu = cpu;
+		}
+	}
+	if (dest_cpu == -1)
+		return;
+
+	rq = task_rq_lock(p, &flags);
+	if (cpu_rq(dest_cpu)->nr_running >= rq->nr_running ||
+	    !cpumask_test_cpu(dest_cpu, &p->cpus_allowed) ||
+	    unlikely(!cpu_active(dest_cpu))) {
+		task_rq_unlock(rq, &flags);
+		return;
+	}
+
+	p->numa_task_migrations++;
+	if (migrate_task(p, dest_cpu, &req)) {
+		/* Need to wait for migration thread (might exit: take ref). */
+		struct task_struct *mt = rq->migration_thread;
+
+		get_task_struct(mt);
+		task_rq_unlock(rq, &flags);
+		wake_up_process(mt);
+		put_task_struct(mt);
+		wait_for_completion(&req.done);
+
+		return;
+	}
+	task_rq_unlock(rq, &flags);
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 #endif
 
 DEFINE_PER_CPU(struct kernel_stat, kstat);
@@ -474,6 +474,19 @@ void proc_sched_show_task(struct task_struct *p, struct seq_file *m)
 	P(se.load.weight);
 	P(policy);
 	P(prio);
+#ifdef CONFIG_NUMA_BALANCING
+	P(numa_preferred_nid);
+	P(numa_scan_period);
+	P(numa_pages_migrated);
+	P(numa_task_migrations);
+	if (p->numa_faults) {
+		int node;
+
+		for_each_online_node(node)
+			SEQ_printf(m, "numa_faults node %-18d:%21Ld\n",
+				   node, (long long)p->numa_faults[node]);
+	}
+#endif
 #undef PN
 #undef __PN
 #undef P
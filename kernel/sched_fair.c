@@ -21,6 +21,7 @@
  */
 
 #include <linux/latencytop.h>
+#include <linux/mempolicy.h>
 #include <linux/sched.h>
 
 /*
@@ -1810,6 +1811,267 @@ static void put_prev_task_fair(struct rq *rq, struct task_struct *prev)
 	}
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/**************************************************
+ * Automatic NUMA balancing:
+ *
+ * Every numa_scan_period of cpu time, a task asks to scan a window of
+ * its address space on the way back to userspace.  The scan makes the
+ * ptes of the window PROT_NONE (see change_prot_numa()), so that the
+ * next access to each page takes a NUMA hinting fault.  The fault handler
+ * moves misplaced pages next to the faulting cpu and reports the fault
+ * to task_numa_fault(), which tracks the node the task's memory lives on
+ * and moves the task there.
+ */
+
+unsigned int sysctl_numa_balancing = 1;
+
+/* cpu time before the first scan of a new task, in ms */
+unsigned int sysctl_numa_balancing_scan_delay = 1000;
+
+/* bounds of the adaptive scan period, in ms */
+unsigned int sysctl_numa_balancing_scan_period_min = 1000;
+unsigned int sysctl_numa_balancing_scan_period_max = 60000;
+
+/* amount of address space scanned per window, in MB */
+unsigned int sysctl_numa_balancing_scan_size = 256;
+
+/*
+ * Scan less often while the hinting faults of the last window were
+ * mostly local, more often when memory and task are far apart.
+ */
+static void update_task_scan_period(struct task_struct *p)
+{
+	unsigned long remote = p->numa_faults_locality[0];
+	unsigned long local = p->numa_faults_locality[1];
+	unsigned int period = p->numa_scan_period;
+
+	p->numa_faults_locality[0] = p->numa_faults_locality[1] = 0;
+	if (!(local + remote))
+		return;
+
+	if (local * 10 >= (local + remote) * 7)
+		period = min(period * 2, sysctl_numa_balancing_scan_period_max);
+	else
+		period = max(period / 2, sysctl_numa_balancing_scan_period_min);
+	p->numa_scan_period = period;
+}
+
+/*
+ * Once per completed scan of the address space, age the fault counts and
+ * pick the node with the most faults as the one the task should run on.
+ */
+static void task_numa_placement(struct task_struct *p)
+{
+	int seq = ACCESS_ONCE(p->mm->numa_scan_seq);
+	unsigned long faults, max_faults = 0;
+	int nid, max_nid = -1;
+
+	if (p->numa_scan_seq == seq)
+		return;
+	p->numa_scan_seq = seq;
+
+	update_task_scan_period(p);
+
+	for_each_online_node(nid) {
+		faults = (p->numa_faults[nid] >> 1) + p->numa_faults_buffer[nid];
+		p->numa_faults[nid] = faults;
+		p->numa_faults_buffer[nid] = 0;
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+	}
+
+	if (max_nid == -1)
+		return;
+	p->numa_preferred_nid = max_nid;
+	if (cpu_to_node(task_cpu(p)) != max_nid)
+		sched_numa_migrate(max_nid);
+}
+
+/*
+ * Called from the NUMA hinting fault handler: @pages of the current task
+ * were found on @node, after migrating them there if @migrated.
+ */
+void task_numa_fault(int node, int pages, bool migrated)
+{
+	struct task_struct *p = current;
+	int local = (node == numa_node_id());
+
+	if (!sysctl_numa_balancing || !p->mm)
+		return;
+
+	if (unlikely(!p->numa_faults)) {
+		int size = sizeof(*p->numa_faults) * 2 * nr_node_ids;
+
+		p->numa_faults = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
+		if (!p->numa_faults)
+			return;
+		p->numa_faults_buffer = p->numa_faults + nr_node_ids;
+	}
+
+	if (migrated)
+		p->numa_pages_migrated += pages;
+	p->numa_faults_buffer[node] += pages;
+	p->numa_faults_locality[local] += pages;
+
+	task_numa_placement(p);
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+}
+
+static void reset_ptenuma_scan(struct mm_struct *mm)
+{
+	ACCESS_ONCE(mm->numa_scan_seq)++;
+	mm->numa_scan_offset = 0;
+}
+
+/*
+ * Scan the next window of the address space.  Run by current on the way
+ * back to userspace after task_tick_numa() asked for it; only one thread
+ * of a process scans per scan period.
+ */
+void task_numa_work(void)
+{
+	unsigned long migrate, next_scan, now = jiffies;
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long start, end;
+	long pages, virtpages;
+
+	if (!p->numa_work_pending)
+		return;
+	p->numa_work_pending = 0;
+
+	if (!mm || (p->flags & PF_EXITING))
+		return;
+
+	migrate = mm->numa_next_scan;
+	if (time_before(now, migrate))
+		return;
+	next_scan = now + msecs_to_jiffies(p->numa_scan_period);
+	if (cmpxchg(&mm->numa_next_scan, migrate, next_scan) != migrate)
+		return;
+
+	/*
+	 * Ptes that are already PROT_NONE or empty cost little to walk,
+	 * so bound the scan by address space as well as by updated ptes.
+	 */
+	pages = (long)sysctl_numa_balancing_scan_size << (20 - PAGE_SHIFT);
+	virtpages = pages * 8;
+	if (!pages)
+		return;
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		reset_ptenuma_scan(mm);
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma) || (vma->vm_flags & VM_MIXEDMAP))
+			continue;
+		/* an inaccessible vma takes no hinting faults */
+		if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+			continue;
+
+		do {
+			start = max(start, vma->vm_start);
+			end = ALIGN(start + (pages << PAGE_SHIFT), PMD_SIZE);
+			end = min(end, vma->vm_end);
+			if (change_prot_numa(vma, start, end))
+				pages -= (end - start) >> PAGE_SHIFT;
+			virtpages -= (end - start) >> PAGE_SHIFT;
+			start = end;
+			if (pages <= 0 || virtpages <= 0)
+				goto out;
+		} while (end != vma->vm_end);
+	}
+out:
+	/*
+	 * Record where to resume; if the walk reached the end of the
+	 * address space, the next scan starts over with a new sequence.
+	 */
+	if (vma)
+		mm->numa_scan_offset = start;
+	else
+		reset_ptenuma_scan(mm);
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Ask current to scan its address space once it ran for numa_scan_period
+ * since the last request.
+ */
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	u64 period, now;
+
+	if (!sysctl_numa_balancing || nr_online_nodes == 1)
+		return;
+	if (!curr->mm || (curr->flags & (PF_EXITING | PF_KTHREAD)) ||
+	    curr->numa_work_pending)
+		return;
+
+	now = curr->se.sum_exec_runtime;
+	period = (u64)curr->numa_scan_period * NSEC_PER_MSEC;
+	if (now - curr->node_stamp > period) {
+		curr->node_stamp += period;
+		if (!time_before(jiffies, curr->mm->numa_next_scan)) {
+			curr->numa_work_pending = 1;
+			set_tsk_thread_flag(curr, TIF_NOTIFY_RESUME);
+		}
+	}
+}
+
+/* Load balancing may move a task toward its preferred node... */
+static bool migrate_improves_locality(struct task_struct *p,
+				      int src_cpu, int dst_cpu)
+{
+	int dst_nid = cpu_to_node(dst_cpu);
+
+	if (!sysctl_numa_balancing || p->numa_preferred_nid == -1)
+		return false;
+	return cpu_to_node(src_cpu) != dst_nid &&
+	       dst_nid == p->numa_preferred_nid;
+}
+
+/* ...but should think twice before moving it away from there. */
+static bool migrate_degrades_locality(struct task_struct *p,
+				      int src_cpu, int dst_cpu)
+{
+	int src_nid = cpu_to_node(src_cpu);
+
+	if (!sysctl_numa_balancing || p->numa_preferred_nid == -1)
+		return false;
+	return src_nid != cpu_to_node(dst_cpu) &&
+	       src_nid == p->numa_preferred_nid;
+}
+#else
+static inline void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+}
+
+static inline bool migrate_improves_locality(struct task_struct *p,
+					     int src_cpu, int dst_cpu)
+{
+	return false;
+}
+
+static inline bool migrate_degrades_locality(struct task_struct *p,
+					     int src_cpu, int dst_cpu)
+{
+	return false;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 #ifdef CONFIG_SMP
 /**************************************************
  * Fair scheduling class load-balancing methods:
@@ -1856,12 +2118,17 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 
 	/*
 	 * Aggressive migration if:
-	 * 1) task is cache cold, or
-	 * 2) too many balance attempts have failed.
+	 * 1) the destination is on the task's preferred NUMA node, or
+	 * 2) task is cache cold, or
+	 * 3) too many balance attempts have failed.
+	 *
+	 * Leaving the preferred NUMA node counts as moving a hot task.
 	 */
 
-	tsk_cache_hot = task_hot(p, rq->clock, sd);
-	if (!tsk_cache_hot ||
+	tsk_cache_hot = task_hot(p, rq->clock, sd) ||
+			migrate_degrades_locality(p, cpu_of(rq), this_cpu);
+	if (migrate_improves_locality(p, cpu_of(rq), this_cpu) ||
+	    !tsk_cache_hot ||
 		sd->nr_balance_failed > sd->cache_nice_tries) {
 #ifdef CONFIG_SCHEDSTATS
 		if (tsk_cache_hot) {
@@ -3567,6 +3834,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(rq, curr);
 }
 
 /*
@@ -208,6 +208,9 @@ SYSCALL_DEFINE5(remap_file_pages, unsigned long, start, unsigned long, size,
 			}
 			goto out;
 		}
+		/* no new huge pmds can be set up under our mmap_sem */
+		if (vma->vm_ops->pmd_fault)
+			split_huge_pmds(vma);
 		spin_lock(&mapping->i_mmap_lock);
 		flush_dcache_mmap_lock(mapping);
 		vma->vm_flags |= VM_NONLINEAR;
@@ -0,0 +1,1465 @@
+/*
+ * Transparent huge pages for anonymous memory.
+ *
+ * An anonymous huge pmd maps HPAGE_PMD_NR naturally aligned, physically
+ * contiguous small pages. They are allocated as one block and then split
+ * into independent order-0 pages, each with its own refcount, mapcount,
+ * anon rmap, LRU position and memcg charge: so reclaim, migration, mlock
+ * and fork only have to split the pmd back into ptes to deal with them.
+ *
+ * A huge pmd always lies inside a single private anonymous vma, is never
+ * shared with a child, and is modified under mm->page_table_lock only.
+ * Filesystems which back files with aligned, physically contiguous extents
+ * of small page cache pages may also map such an extent with a huge pmd in
+ * a shared vma, from their ->pmd_fault: see do_huge_pmd_file_page().
+ * The pte table needed to split it is allocated when the pmd is set up,
+ * and deposited on mm->pmd_huge_pte until then.
+ *
+ * khugepaged scans the mms that have suitable vmas and collapses runs of
+ * small pages back into huge pmds.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/hugetlb.h>
+#include <linux/mmu_notifier.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/mman.h>
+#include <linux/mempolicy.h>
+#include <linux/memcontrol.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/ksm.h>
+#include <linux/khugepaged.h>
+
+#include <asm/tlb.h>
+#include <asm/tlbflush.h>
+#include <asm/pgalloc.h>
+#include "internal.h"
+
+int transparent_hugepage_enabled_mode __read_mostly =
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE_ALWAYS
+	TRANSPARENT_HUGEPAGE_ALWAYS;
+#else
+	TRANSPARENT_HUGEPAGE_MADVISE;
+#endif
+int transparent_hugepage_defrag_mode __read_mostly =
+	TRANSPARENT_HUGEPAGE_MADVISE;
+
+/* default scan 8*512 pte (or vmas) every 10 second */
+static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR * 8;
+static unsigned int khugepaged_pages_collapsed;
+static unsigned int khugepaged_full_scans;
+static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
+/* during fragmentation poll the hugepage allocator once every minute */
+static unsigned int khugepaged_alloc_sleep_millisecs __read_mostly = 60000;
+/*
+ * The number of unmapped ptes which khugepaged may fill in when it
+ * collapses a range: the default lets it collapse any range with at least
+ * one page mapped, at the cost of some memory.
+ */
+static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR - 1;
+
+static struct task_struct *khugepaged_thread __read_mostly;
+static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
+static DEFINE_SPINLOCK(khugepaged_mm_lock);
+
+#define MM_SLOTS_HASH_HEADS 1024
+static struct hlist_head mm_slots_hash[MM_SLOTS_HASH_HEADS];
+static struct kmem_cache *mm_slot_cache __read_mostly;
+
+/**
+ * struct mm_slot - khugepaged information per mm that is being scanned
+ * @hash: link to the mm_slots hash list
+ * @mm_node: link into khugepaged_scan.mm_head
+ * @mm: the mm that this information is valid for
+ */
+struct mm_slot {
+	struct hlist_node hash;
+	struct list_head mm_node;
+	struct mm_struct *mm;
+};
+
+/**
+ * struct khugepaged_scan - cursor for scanning
+ * @mm_head: the head of the mm list to scan
+ * @mm_slot: the current mm_slot we are scanning
+ * @address: the next address inside that to be scanned
+ *
+ * There is only the one khugepaged_scan instance of this cursor structure.
+ */
+struct khugepaged_scan {
+	struct list_head mm_head;
+	struct mm_slot *mm_slot;
+	unsigned long address;
+};
+static struct khugepaged_scan khugepaged_scan = {
+	.mm_head = LIST_HEAD_INIT(khugepaged_scan.mm_head),
+};
+
+/* Areas which are never mapped with huge pmds */
+#define VM_NO_THP (VM_SHARED | VM_MAYSHARE | VM_HUGETLB | VM_PFNMAP | \
+		   VM_IO | VM_MIXEDMAP | VM_NONLINEAR | VM_GROWSDOWN | \
+		   VM_GROWSUP | VM_INSERTPAGE | VM_RESERVED)
+
+static int hugepage_vma_check(struct vm_area_struct *vma)
+{
+	if (vma->vm_ops || vma->vm_file)
+		return 0;
+	if (vma->vm_flags & VM_NO_THP)
+		return 0;
+	/* the allocation below does not follow vma policies */
+	if (vma_policy(vma))
+		return 0;
+	return 1;
+}
+
+static int transparent_hugepage_defrag(struct vm_area_struct *vma)
+{
+	if (transparent_hugepage_defrag_mode == TRANSPARENT_HUGEPAGE_ALWAYS)
+		return 1;
+	return transparent_hugepage_defrag_mode ==
+			TRANSPARENT_HUGEPAGE_MADVISE &&
+		(vma->vm_flags & VM_HUGEPAGE);
+}
+
+/*
+ * Huge page allocations are opportunistic: without defrag they must not
+ * enter direct reclaim at all, and with it they should give up early and
+ * leave the memory to small page allocations.
+ */
+static inline gfp_t alloc_hugepage_gfpmask(int defrag)
+{
+	gfp_t gfp = GFP_HIGHUSER_MOVABLE | __GFP_NOMEMALLOC |
+		    __GFP_NORETRY | __GFP_NOWARN;
+
+	if (!defrag)
+		gfp &= ~__GFP_WAIT;
+	return gfp;
+}
+
+static struct page *alloc_hugepage(int defrag)
+{
+	struct page *page;
+
+	page = alloc_pages(alloc_hugepage_gfpmask(defrag), HPAGE_PMD_ORDER);
+	if (page)
+		split_page(page, HPAGE_PMD_ORDER);
+	return page;
+}
+
+/* charges each small page to the memcg of mm, all or none of them */
+static int charge_hugepage(struct page *page, struct mm_struct *mm)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (mem_cgroup_newpage_charge(page + i, mm, GFP_KERNEL)) {
+			while (--i >= 0)
+				mem_cgroup_uncharge_page(page + i);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void release_hugepage(struct page *page, int charged)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (charged)
+			mem_cgroup_uncharge_page(page + i);
+		put_page(page + i);
+	}
+}
+
+static inline pmd_t mk_huge_pmd(struct page *page, struct vm_area_struct *vma)
+{
+	pmd_t entry;
+
+	entry = pmd_mkhuge(pfn_pmd(page_to_pfn(page), vma->vm_page_prot));
+	entry = pmd_mkyoung(pmd_mkdirty(entry));
+	if (vma->vm_flags & VM_WRITE)
+		entry = pmd_mkwrite(entry);
+	return entry;
+}
+
+static void pgtable_trans_huge_deposit(struct mm_struct *mm, pgtable_t pgtable)
+{
+	assert_spin_locked(&mm->page_table_lock);
+
+	/* FIFO */
+	if (!mm->pmd_huge_pte)
+		INIT_LIST_HEAD(&pgtable->lru);
+	else
+		list_add(&pgtable->lru, &mm->pmd_huge_pte->lru);
+	mm->pmd_huge_pte = pgtable;
+}
+
+static pgtable_t pgtable_trans_huge_withdraw(struct mm_struct *mm)
+{
+	pgtable_t pgtable;
+
+	assert_spin_locked(&mm->page_table_lock);
+
+	pgtable = mm->pmd_huge_pte;
+	if (list_empty(&pgtable->lru))
+		mm->pmd_huge_pte = NULL;
+	else {
+		mm->pmd_huge_pte = list_entry(pgtable->lru.next,
+					      struct page, lru);
+		list_del(&pgtable->lru);
+	}
+	return pgtable;
+}
+
+/* called with mm->page_table_lock held, on a pmd which is none */
+static void set_huge_pmd(struct mm_struct *mm, struct vm_area_struct *vma,
+			 unsigned long haddr, pmd_t *pmd, struct page *page,
+			 pgtable_t pgtable)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_new_anon_rmap(page + i, vma, haddr + i * PAGE_SIZE);
+	set_pmd(pmd, mk_huge_pmd(page, vma));
+	pgtable_trans_huge_deposit(mm, pgtable);
+	inc_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+}
+
+int do_huge_pmd_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			       unsigned long address, pmd_t *pmd,
+			       unsigned int flags)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pgtable_t pgtable;
+	int i;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	if (!hugepage_vma_check(vma))
+		return VM_FAULT_FALLBACK;
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+	if (unlikely(khugepaged_enter(vma)))
+		return VM_FAULT_OOM;
+
+	page = alloc_hugepage(transparent_hugepage_defrag(vma));
+	if (unlikely(!page)) {
+		count_vm_event(THP_FAULT_FALLBACK);
+		return VM_FAULT_FALLBACK;
+	}
+	if (unlikely(charge_hugepage(page, mm))) {
+		release_hugepage(page, 0);
+		count_vm_event(THP_FAULT_FALLBACK);
+		return VM_FAULT_FALLBACK;
+	}
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable)) {
+		release_hugepage(page, 1);
+		return VM_FAULT_OOM;
+	}
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+		__SetPageUptodate(page + i);
+		cond_resched();
+	}
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		release_hugepage(page, 1);
+		pte_free(mm, pgtable);
+		return 0;
+	}
+	set_huge_pmd(mm, vma, haddr, pmd, page, pgtable);
+	mm->nr_ptes++;
+	add_mm_counter(mm, MM_ANONPAGES, HPAGE_PMD_NR);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FAULT_ALLOC);
+	return 0;
+}
+
+/*
+ * Maps the HPAGE_PMD_NR page cache pages starting at the naturally aligned
+ * @page with a huge pmd at @haddr, in a shared vma. The caller holds them
+ * locked, uptodate and still in the file, with one reference each: those
+ * are taken over by the pmd when it is set up, and 0 is returned.
+ */
+int do_huge_pmd_file_page(struct vm_area_struct *vma, unsigned long haddr,
+			  pmd_t *pmd, struct page *page)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	pgtable_t pgtable;
+	int i;
+
+	VM_BUG_ON(!(vma->vm_flags & VM_SHARED));
+	VM_BUG_ON(page_to_pfn(page) & (HPAGE_PMD_NR - 1));
+
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable))
+		return VM_FAULT_OOM;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		return VM_FAULT_FALLBACK;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		page_add_file_rmap(page + i);
+	set_pmd(pmd, mk_huge_pmd(page, vma));
+	pgtable_trans_huge_deposit(mm, pgtable);
+	mm->nr_ptes++;
+	add_mm_counter(mm, MM_FILEPAGES, HPAGE_PMD_NR);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FILE_MAPPED);
+	return 0;
+}
+
+/*
+ * A fault on a huge pmd: either it is being split, or it was write
+ * protected by mprotect(). The small pages behind it are either private to
+ * the vma or page cache of a shared one, so like do_wp_page() we reuse them
+ * in place and just make the pmd writable.
+ */
+int do_huge_pmd_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+		      unsigned long address, pmd_t *pmd, unsigned int flags)
+{
+	int ret = 0;
+
+	if ((flags & FAULT_FLAG_WRITE) && !(vma->vm_flags & VM_WRITE)) {
+		/* forced write through get_user_pages: COW the small page */
+		split_huge_pmd(vma, pmd, address);
+		return VM_FAULT_FALLBACK;
+	}
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd) || !pmd_present(*pmd)))
+		ret = VM_FAULT_FALLBACK;
+	else if (flags & FAULT_FLAG_WRITE)
+		set_pmd(pmd, pmd_mkyoung(pmd_mkdirty(pmd_mkwrite(*pmd))));
+	else
+		set_pmd(pmd, pmd_mkyoung(*pmd));
+	spin_unlock(&mm->page_table_lock);
+
+	return ret;
+}
+
+struct page *follow_trans_huge_pmd(struct vm_area_struct *vma,
+				   unsigned long address, pmd_t *pmd,
+				   unsigned int flags)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page = NULL;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd) || !pmd_present(*pmd)))
+		goto out;
+	if ((flags & FOLL_WRITE) && !pmd_write(*pmd))
+		goto out;
+
+	page = pmd_page(*pmd) + ((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+	if (flags & FOLL_GET)
+		get_page(page);
+	/* huge pmds are always mapped dirty */
+	if (flags & FOLL_TOUCH)
+		mark_page_accessed(page);
+out:
+	spin_unlock(&mm->page_table_lock);
+	return page;
+}
+
+int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+		 pmd_t *pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t orig_pmd;
+	int anon, i;
+
+	spin_lock(&mm->page_table_lock);
+	orig_pmd = *pmd;
+	if (unlikely(!pmd_trans_huge(orig_pmd) || !pmd_present(orig_pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	page = pmd_page(orig_pmd);
+	anon = PageAnon(page);
+	pmd_clear(pmd);
+	pgtable = pgtable_trans_huge_withdraw(mm);
+	mm->nr_ptes--;
+	if (anon)
+		dec_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (!anon) {
+			/* huge pmds are always mapped dirty */
+			set_page_dirty(page + i);
+			if (pmd_young(orig_pmd) &&
+			    likely(!VM_SequentialReadHint(vma)))
+				mark_page_accessed(page + i);
+		}
+		page_remove_rmap(page + i);
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	add_mm_counter(mm, anon ? MM_ANONPAGES : MM_FILEPAGES, -HPAGE_PMD_NR);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		tlb_remove_page(tlb, page + i);
+	pte_free(mm, pgtable);
+	return 1;
+}
+
+int change_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+		    unsigned long addr, pgprot_t newprot)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	int ret = 0;
+
+	/*
+	 * A huge pmd without access rights would not be present, and could
+	 * not be told apart from one being split: use ptes for those.
+	 */
+	if (!(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+		return 0;
+
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_trans_huge(*pmd) && pmd_present(*pmd))) {
+		set_pmd(pmd, pmd_modify(*pmd, newprot));
+		ret = 1;
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	return ret;
+}
+
+/*
+ * mremap() moves a huge pmd as a whole when both addresses are huge page
+ * aligned: its small pages keep their rmap, since the new vma takes over
+ * the anon_vma and the page offsets of the old one.
+ */
+int move_huge_pmd(struct vm_area_struct *vma, unsigned long old_addr,
+		  unsigned long new_addr, pmd_t *old_pmd, pmd_t *new_pmd)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	int ret = 0;
+	pmd_t pmd;
+
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_trans_huge(*old_pmd) && pmd_present(*old_pmd) &&
+		   pmd_none(*new_pmd))) {
+		pmd = *old_pmd;
+		pmd_clear(old_pmd);
+		set_pmd(new_pmd, pmd);
+		flush_tlb_range(vma, old_addr, old_addr + HPAGE_PMD_SIZE);
+		ret = 1;
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	return ret;
+}
+
+void split_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd,
+		    unsigned long address)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t old, _pmd;
+	int i;
+
+	spin_lock(&mm->page_table_lock);
+	old = *pmd;
+	if (unlikely(!pmd_trans_huge(old) || !pmd_present(old))) {
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
+
+	/*
+	 * Keep the pmd huge but not present while the ptes are set up, so
+	 * that faults wait for the split instead of mapping a new huge page,
+	 * and flush it before the pte table replaces it in the TLB.
+	 */
+	set_pmd(pmd, pmd_mknotpresent(old));
+	flush_tlb_range(vma, haddr, haddr + HPAGE_PMD_SIZE);
+
+	page = pmd_page(old);
+	pgtable = pgtable_trans_huge_withdraw(mm);
+	pmd_populate(mm, &_pmd, pgtable);
+	for (i = 0; i < HPAGE_PMD_NR; i++, haddr += PAGE_SIZE) {
+		pte_t entry, *pte;
+
+		entry = pte_mkdirty(mk_pte(page + i, vma->vm_page_prot));
+		if (pmd_write(old))
+			entry = pte_mkwrite(entry);
+		if (!pmd_young(old))
+			entry = pte_mkold(entry);
+		pte = pte_offset_map(&_pmd, haddr);
+		BUG_ON(!pte_none(*pte));
+		set_pte_at(mm, haddr, pte, entry);
+		pte_unmap(pte);
+	}
+	smp_wmb(); /* make the ptes visible before the pmd */
+	pmd_populate(mm, pmd, pgtable);
+	if (PageAnon(page))
+		dec_zone_page_state(page, NR_ANON_TRANSPARENT_HUGEPAGES);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_SPLIT);
+}
+
+static pmd_t *huge_pmd_offset(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_trans_huge(*pmd))
+		return NULL;
+	return pmd;
+}
+
+void split_huge_pmd_address(struct vm_area_struct *vma, unsigned long address)
+{
+	pmd_t *pmd;
+
+	pmd = huge_pmd_offset(vma->vm_mm, address);
+	if (pmd)
+		split_huge_pmd(vma, pmd, address);
+}
+
+/*
+ * Splits all the huge pmds of a shared file vma which is being made
+ * nonlinear: its file ptes and nonlinear rmap walks only know about ptes.
+ */
+void split_huge_pmds(struct vm_area_struct *vma)
+{
+	unsigned long addr = ALIGN(vma->vm_start, HPAGE_PMD_SIZE);
+
+	for (; addr + HPAGE_PMD_SIZE <= vma->vm_end; addr += HPAGE_PMD_SIZE) {
+		split_huge_pmd_address(vma, addr);
+		cond_resched();
+	}
+}
+
+/*
+ * Returns the huge pmd mapping page at address in mm, with
+ * mm->page_table_lock held, or NULL.
+ */
+pmd_t *page_check_address_pmd(struct page *page, struct mm_struct *mm,
+			      unsigned long address)
+{
+	pmd_t *pmd;
+
+	pmd = huge_pmd_offset(mm, address);
+	if (!pmd)
+		return NULL;
+
+	spin_lock(&mm->page_table_lock);
+	if (pmd_trans_huge(*pmd) && pmd_present(*pmd) &&
+	    pmd_page(*pmd) + ((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT) ==
+	    page)
+		return pmd;
+	spin_unlock(&mm->page_table_lock);
+	return NULL;
+}
+
+int hugepage_madvise(struct vm_area_struct *vma,
+		     unsigned long *vm_flags, int advice)
+{
+	struct mm_struct *mm = vma->vm_mm;
+
+	switch (advice) {
+	case MADV_HUGEPAGE:
+		if (*vm_flags & VM_NO_THP)
+			return -EINVAL;
+		*vm_flags &= ~VM_NOHUGEPAGE;
+		*vm_flags |= VM_HUGEPAGE;
+		/*
+		 * The vma may now be collapsed by khugepaged even if it was
+		 * faulted in before, or with transparent hugepages off.
+		 */
+		if (!test_bit(MMF_VM_HUGEPAGE, &mm->flags) &&
+		    transparent_hugepage_enabled_mode !=
+		    TRANSPARENT_HUGEPAGE_NEVER &&
+		    __khugepaged_enter(mm))
+			return -ENOMEM;
+		break;
+	case MADV_NOHUGEPAGE:
+		if (*vm_flags & VM_NO_THP)
+			return -EINVAL;
+		*vm_flags &= ~VM_HUGEPAGE;
+		*vm_flags |= VM_NOHUGEPAGE;
+		break;
+	}
+
+	return 0;
+}
+
+static void split_huge_pmd_straddling(struct vm_area_struct *vma,
+				      unsigned long address)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+
+	if ((address & ~HPAGE_PMD_MASK) && haddr >= vma->vm_start &&
+	    haddr + HPAGE_PMD_SIZE <= vma->vm_end)
+		split_huge_pmd_address(vma, address);
+}
+
+/*
+ * Called by vma_adjust() before the boundaries of vma, and of the next vma
+ * if adjust_next, move: a huge pmd must not end up straddling two vmas.
+ */
+void __vma_adjust_trans_huge(struct vm_area_struct *vma, unsigned long start,
+			     unsigned long end, long adjust_next)
+{
+	split_huge_pmd_straddling(vma, start);
+	split_huge_pmd_straddling(vma, end);
+
+	if (adjust_next > 0) {
+		struct vm_area_struct *next = vma->vm_next;
+
+		split_huge_pmd_straddling(next,
+				next->vm_start + (adjust_next << PAGE_SHIFT));
+	}
+}
+
+static inline int khugepaged_test_exit(struct mm_struct *mm)
+{
+	return atomic_read(&mm->mm_users) == 0;
+}
+
+static inline int khugepaged_has_work(void)
+{
+	return !list_empty(&khugepaged_scan.mm_head) &&
+		transparent_hugepage_enabled_mode != TRANSPARENT_HUGEPAGE_NEVER;
+}
+
+static struct mm_slot *get_mm_slot(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	struct hlist_head *bucket;
+	struct hlist_node *node;
+
+	bucket = &mm_slots_hash[((unsigned long)mm / sizeof(struct mm_struct))
+				% MM_SLOTS_HASH_HEADS];
+	hlist_for_each_entry(mm_slot, node, bucket, hash) {
+		if (mm == mm_slot->mm)
+			return mm_slot;
+	}
+	return NULL;
+}
+
+static void insert_to_mm_slots_hash(struct mm_struct *mm,
+				    struct mm_slot *mm_slot)
+{
+	struct hlist_head *bucket;
+
+	bucket = &mm_slots_hash[((unsigned long)mm / sizeof(struct mm_struct))
+				% MM_SLOTS_HASH_HEADS];
+	mm_slot->mm = mm;
+	hlist_add_head(&mm_slot->hash, bucket);
+}
+
+int __khugepaged_enter(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int wakeup;
+
+	mm_slot = kmem_cache_zalloc(mm_slot_cache, GFP_KERNEL);
+	if (!mm_slot)
+		return -ENOMEM;
+
+	/* __khugepaged_exit() must not run from under us */
+	VM_BUG_ON(khugepaged_test_exit(mm));
+	if (unlikely(test_and_set_bit(MMF_VM_HUGEPAGE, &mm->flags))) {
+		kmem_cache_free(mm_slot_cache, mm_slot);
+		return 0;
+	}
+
+	spin_lock(&khugepaged_mm_lock);
+	insert_to_mm_slots_hash(mm, mm_slot);
+	/*
+	 * Insert just behind the scanning cursor, to let the area settle
+	 * down a little.
+	 */
+	wakeup = list_empty(&khugepaged_scan.mm_head);
+	list_add_tail(&mm_slot->mm_node, &khugepaged_scan.mm_head);
+	spin_unlock(&khugepaged_mm_lock);
+
+	atomic_inc(&mm->mm_count);
+	if (wakeup)
+		wake_up_interruptible(&khugepaged_wait);
+
+	return 0;
+}
+
+void __khugepaged_exit(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+	int free = 0;
+
+	spin_lock(&khugepaged_mm_lock);
+	mm_slot = get_mm_slot(mm);
+	if (mm_slot && khugepaged_scan.mm_slot != mm_slot) {
+		hlist_del(&mm_slot->hash);
+		list_del(&mm_slot->mm_node);
+		free = 1;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (free) {
+		clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
+		kmem_cache_free(mm_slot_cache, mm_slot);
+		mmdrop(mm);
+	} else if (mm_slot) {
+		/*
+		 * khugepaged is scanning this mm: wait for it to drop
+		 * mmap_sem, so that exit_mmap() cannot free the page tables
+		 * from under a collapse. khugepaged frees the mm_slot later.
+		 */
+		down_write(&mm->mmap_sem);
+		up_write(&mm->mmap_sem);
+	}
+}
+
+static void release_pte_page(struct page *page)
+{
+	/* 0 stands for page_is_file_cache(page) == false */
+	dec_zone_page_state(page, NR_ISOLATED_ANON + 0);
+	unlock_page(page);
+	putback_lru_page(page);
+}
+
+static void release_pte_pages(pte_t *pte, pte_t *_pte)
+{
+	while (--_pte >= pte) {
+		pte_t pteval = *_pte;
+
+		if (!pte_none(pteval))
+			release_pte_page(pte_page(pteval));
+	}
+}
+
+/*
+ * Isolates and locks all the small pages mapped by the pte table, which
+ * must all be exclusively owned by this mm. Called with the pte lock held.
+ */
+static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
+					unsigned long address, pte_t *pte)
+{
+	struct page *page;
+	pte_t *_pte;
+	int referenced = 0, none = 0;
+
+	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+
+		if (pte_none(pteval)) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out;
+		}
+		if (!pte_present(pteval) || !pte_write(pteval))
+			goto out;
+		page = vm_normal_page(vma, address, pteval);
+		if (unlikely(!page))
+			goto out;
+		if (!PageAnon(page) || PageKsm(page))
+			goto out;
+		/* no other mapping, no swap cache and no get_user_pages pin */
+		if (page_count(page) != 1)
+			goto out;
+		if (!trylock_page(page))
+			goto out;
+		/*
+		 * isolate_lru_page() takes a reference, and fails if the page
+		 * is not on the LRU any longer, e.g. on a pagevec.
+		 */
+		if (isolate_lru_page(page)) {
+			unlock_page(page);
+			goto out;
+		}
+		/* 0 stands for page_is_file_cache(page) == false */
+		inc_zone_page_state(page, NR_ISOLATED_ANON + 0);
+		if (pte_young(pteval) || PageReferenced(page))
+			referenced = 1;
+	}
+	if (likely(referenced))
+		return 1;
+out:
+	release_pte_pages(pte, _pte);
+	return 0;
+}
+
+static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
+				      struct vm_area_struct *vma,
+				      unsigned long address, spinlock_t *ptl)
+{
+	pte_t *_pte;
+
+	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, page++, address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+		struct page *src_page;
+
+		if (pte_none(pteval)) {
+			clear_user_highpage(page, address);
+			add_mm_counter(vma->vm_mm, MM_ANONPAGES, 1);
+		} else {
+			src_page = pte_page(pteval);
+			copy_user_highpage(page, src_page, address, vma);
+			spin_lock(ptl);
+			pte_clear(vma->vm_mm, address, _pte);
+			page_remove_rmap(src_page);
+			spin_unlock(ptl);
+			release_pte_page(src_page);
+			/* drop the reference of the pte */
+			put_page(src_page);
+		}
+		__SetPageUptodate(page);
+	}
+}
+
+/*
+ * Returns pmd if address is mapped by a present, non-huge pmd in mm.
+ */
+static pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
+		return NULL;
+	return pmd;
+}
+
+/*
+ * Replaces the pte table at address with a huge pmd. Called with mmap_sem
+ * held for reading, returns with it released.
+ */
+static void collapse_huge_page(struct mm_struct *mm, unsigned long address,
+			       int *alloc_failed)
+{
+	struct vm_area_struct *vma;
+	struct page *new_page;
+	pgtable_t pgtable;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	spinlock_t *ptl;
+	int isolated;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	/* the allocation may enter direct reclaim, don't hold mmap_sem */
+	up_read(&mm->mmap_sem);
+	new_page = alloc_hugepage(1);
+	if (unlikely(!new_page)) {
+		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		*alloc_failed = 1;
+		return;
+	}
+	count_vm_event(THP_COLLAPSE_ALLOC);
+	if (unlikely(charge_hugepage(new_page, mm))) {
+		release_hugepage(new_page, 0);
+		return;
+	}
+
+	/*
+	 * Faults, get_user_pages and rmap walks of other pages all need
+	 * mmap_sem or the anon_vma lock: with mmap_sem held for writing,
+	 * the pages we isolate below can only be reached from reclaim.
+	 */
+	down_write(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		goto out;
+
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start ||
+	    address + HPAGE_PMD_SIZE > vma->vm_end)
+		goto out;
+	if (!transparent_hugepage_enabled(vma) || !hugepage_vma_check(vma))
+		goto out;
+	if (!vma->anon_vma || (vma->vm_flags & VM_LOCKED))
+		goto out;
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd)
+		goto out;
+
+	mmu_notifier_invalidate_range_start(mm, address,
+					    address + HPAGE_PMD_SIZE);
+	/*
+	 * Stop get_user_pages_fast, speculative faults and the hardware
+	 * from using the ptes.
+	 */
+	vm_write_begin(vma);
+	spin_lock(&mm->page_table_lock);
+	_pmd = *pmd;
+	pmd_clear(pmd);
+	flush_tlb_range(vma, address, address + HPAGE_PMD_SIZE);
+	spin_unlock(&mm->page_table_lock);
+
+	pte = pte_offset_map(&_pmd, address);
+	ptl = pte_lockptr(mm, &_pmd);
+	spin_lock(ptl);
+	isolated = __collapse_huge_page_isolate(vma, address, pte);
+	spin_unlock(ptl);
+
+	if (unlikely(!isolated)) {
+		pte_unmap(pte);
+		spin_lock(&mm->page_table_lock);
+		BUG_ON(!pmd_none(*pmd));
+		set_pmd(pmd, _pmd);
+		spin_unlock(&mm->page_table_lock);
+		vm_write_end(vma);
+		mmu_notifier_invalidate_range_end(mm, address,
+						  address + HPAGE_PMD_SIZE);
+		goto out;
+	}
+
+	__collapse_huge_page_copy(pte, new_page, vma, address, ptl);
+	pte_unmap(pte);
+	mmu_notifier_invalidate_range_end(mm, address,
+					  address + HPAGE_PMD_SIZE);
+
+	/* the emptied pte table becomes the deposit of the huge pmd */
+	pgtable = pmd_pgtable(_pmd);
+	spin_lock(&mm->page_table_lock);
+	BUG_ON(!pmd_none(*pmd));
+	set_huge_pmd(mm, vma, address, pmd, new_page, pgtable);
+	spin_unlock(&mm->page_table_lock);
+	vm_write_end(vma);
+
+	khugepaged_pages_collapsed++;
+	new_page = NULL;
+out:
+	up_write(&mm->mmap_sem);
+	if (new_page)
+		release_hugepage(new_page, 1);
+}
+
+/*
+ * Checks whether the pte table at address is worth collapsing, and does it
+ * if so. Returns 1 if mmap_sem was released.
+ */
+static int khugepaged_scan_pmd(struct mm_struct *mm,
+			       struct vm_area_struct *vma,
+			       unsigned long address, int *alloc_failed)
+{
+	pmd_t *pmd;
+	pte_t *pte, *_pte;
+	struct page *page;
+	unsigned long _address;
+	spinlock_t *ptl;
+	int ret = 0, referenced = 0, none = 0;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd)
+		return 0;
+
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	for (_address = address, _pte = pte; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, _address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+
+		if (pte_none(pteval)) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out_unmap;
+		}
+		if (!pte_present(pteval) || !pte_write(pteval))
+			goto out_unmap;
+		page = vm_normal_page(vma, _address, pteval);
+		if (unlikely(!page))
+			goto out_unmap;
+		if (!PageLRU(page) || PageLocked(page) || !PageAnon(page) ||
+		    PageKsm(page))
+			goto out_unmap;
+		if (page_count(page) != 1)
+			goto out_unmap;
+		if (pte_young(pteval) || PageReferenced(page))
+			referenced = 1;
+	}
+	ret = referenced;
+out_unmap:
+	pte_unmap_unlock(pte, ptl);
+	if (ret)
+		collapse_huge_page(mm, address, alloc_failed);
+	return ret;
+}
+
+static void collect_mm_slot(struct mm_slot *mm_slot)
+{
+	struct mm_struct *mm = mm_slot->mm;
+
+	VM_BUG_ON(!spin_is_locked(&khugepaged_mm_lock));
+
+	if (khugepaged_test_exit(mm)) {
+		/* free mm_slot */
+		hlist_del(&mm_slot->hash);
+		list_del(&mm_slot->mm_node);
+		/*
+		 * Not strictly needed because the mm exited already:
+		 * clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
+		 */
+		kmem_cache_free(mm_slot_cache, mm_slot);
+		mmdrop(mm);
+	}
+}
+
+/* called and returns with khugepaged_mm_lock held */
+static unsigned int khugepaged_scan_mm_slot(unsigned int pages,
+					    int *alloc_failed)
+{
+	struct mm_slot *mm_slot;
+	struct mm_struct *mm;
+	struct vm_area_struct *vma;
+	unsigned int progress = 0;
+
+	VM_BUG_ON(!pages);
+
+	if (khugepaged_scan.mm_slot)
+		mm_slot = khugepaged_scan.mm_slot;
+	else {
+		mm_slot = list_entry(khugepaged_scan.mm_head.next,
+				     struct mm_slot, mm_node);
+		khugepaged_scan.address = 0;
+		khugepaged_scan.mm_slot = mm_slot;
+	}
+	spin_unlock(&khugepaged_mm_lock);
+
+	mm = mm_slot->mm;
+	down_read(&mm->mmap_sem);
+	if (unlikely(khugepaged_test_exit(mm)))
+		vma = NULL;
+	else
+		vma = find_vma(mm, khugepaged_scan.address);
+
+	progress++;
+	for (; vma; vma = vma->vm_next) {
+		unsigned long hstart, hend;
+
+		cond_resched();
+		if (unlikely(khugepaged_test_exit(mm))) {
+			progress++;
+			break;
+		}
+
+		progress++;
+		if (!transparent_hugepage_enabled(vma) ||
+		    !hugepage_vma_check(vma) || !vma->anon_vma ||
+		    (vma->vm_flags & VM_LOCKED))
+			continue;
+		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+		hend = vma->vm_end & HPAGE_PMD_MASK;
+		if (hstart >= hend || khugepaged_scan.address >= hend)
+			continue;
+		if (khugepaged_scan.address < hstart)
+			khugepaged_scan.address = hstart;
+
+		while (khugepaged_scan.address < hend) {
+			int dropped;
+
+			cond_resched();
+			if (unlikely(khugepaged_test_exit(mm)))
+				goto breakouterloop;
+
+			dropped = khugepaged_scan_pmd(mm, vma,
+						      khugepaged_scan.address,
+						      alloc_failed);
+			khugepaged_scan.address += HPAGE_PMD_SIZE;
+			progress += HPAGE_PMD_NR;
+			/* vma is stale once mmap_sem was released */
+			if (dropped)
+				goto breakouterloop_mmap_sem;
+			if (progress >= pages)
+				goto breakouterloop;
+		}
+	}
+breakouterloop:
+	up_read(&mm->mmap_sem);
+breakouterloop_mmap_sem:
+
+	spin_lock(&khugepaged_mm_lock);
+	VM_BUG_ON(khugepaged_scan.mm_slot != mm_slot);
+	/*
+	 * Release the current mm_slot if this mm is about to die, or
+	 * if we scanned all vmas of this mm.
+	 */
+	if (khugepaged_test_exit(mm) || !vma) {
+		/*
+		 * Make sure that if mm_users is reaching zero while
+		 * khugepaged runs here, __khugepaged_exit() will find
+		 * mm_slot not pointing to the exiting mm.
+		 */
+		if (mm_slot->mm_node.next != &khugepaged_scan.mm_head) {
+			khugepaged_scan.mm_slot = list_entry(
+				mm_slot->mm_node.next,
+				struct mm_slot, mm_node);
+			khugepaged_scan.address = 0;
+		} else {
+			khugepaged_scan.mm_slot = NULL;
+			khugepaged_full_scans++;
+		}
+
+		collect_mm_slot(mm_slot);
+	}
+
+	return progress;
+}
+
+/* returns 1 if a huge page allocation failed */
+static int khugepaged_do_scan(void)
+{
+	unsigned int progress = 0, pass_through_head = 0;
+	unsigned int pages = khugepaged_pages_to_scan;
+	int alloc_failed = 0;
+
+	while (progress < pages && !alloc_failed) {
+		cond_resched();
+		if (unlikely(kthread_should_stop() || freezing(current)))
+			break;
+
+		spin_lock(&khugepaged_mm_lock);
+		if (!khugepaged_scan.mm_slot)
+			pass_through_head++;
+		if (khugepaged_has_work() && pass_through_head < 2)
+			progress += khugepaged_scan_mm_slot(pages - progress,
+							    &alloc_failed);
+		else
+			progress = pages;
+		spin_unlock(&khugepaged_mm_lock);
+	}
+	return alloc_failed;
+}
+
+static int khugepaged(void *none)
+{
+	set_freezable();
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		unsigned int msecs = khugepaged_scan_sleep_millisecs;
+
+		if (khugepaged_do_scan())
+			msecs = khugepaged_alloc_sleep_millisecs;
+
+		try_to_freeze();
+		if (khugepaged_has_work())
+			wait_event_freezable_timeout(khugepaged_wait,
+						     kthread_should_stop(),
+						     msecs_to_jiffies(msecs));
+		else
+			wait_event_freezable(khugepaged_wait,
+					     khugepaged_has_work() ||
+					     kthread_should_stop());
+	}
+	return 0;
+}
+
+static int __init setup_transparent_hugepage(char *str)
+{
+	if (!str)
+		return 0;
+	if (!strcmp(str, "always"))
+		transparent_hugepage_enabled_mode = TRANSPARENT_HUGEPAGE_ALWAYS;
+	else if (!strcmp(str, "madvise"))
+		transparent_hugepage_enabled_mode =
+			TRANSPARENT_HUGEPAGE_MADVISE;
+	else if (!strcmp(str, "never"))
+		transparent_hugepage_enabled_mode = TRANSPARENT_HUGEPAGE_NEVER;
+	else {
+		printk(KERN_WARNING
+		       "transparent_hugepage= cannot parse, ignored\n");
+		return 0;
+	}
+	return 1;
+}
+__setup("transparent_hugepage=", setup_transparent_hugepage);
+
+#ifdef CONFIG_SYSFS
+
+#define THP_ATTR_RO(_name) \
+	static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+#define THP_ATTR(_name) \
+	static struct kobj_attribute _name##_attr = \
+		__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t thp_mode_show(int mode, char *buf)
+{
+	switch (mode) {
+	case TRANSPARENT_HUGEPAGE_ALWAYS:
+		return sprintf(buf, "[always] madvise never\n");
+	case TRANSPARENT_HUGEPAGE_MADVISE:
+		return sprintf(buf, "always [madvise] never\n");
+	default:
+		return sprintf(buf, "always madvise [never]\n");
+	}
+}
+
+static ssize_t thp_mode_store(int *mode, const char *buf, size_t count)
+{
+	if (sysfs_streq(buf, "always"))
+		*mode = TRANSPARENT_HUGEPAGE_ALWAYS;
+	else if (sysfs_streq(buf, "madvise"))
+		*mode = TRANSPARENT_HUGEPAGE_MADVISE;
+	else if (sysfs_streq(buf, "never"))
+		*mode = TRANSPARENT_HUGEPAGE_NEVER;
+	else
+		return -EINVAL;
+	return count;
+}
+
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return thp_mode_show(transparent_hugepage_enabled_mode, buf);
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	ret = thp_mode_store(&transparent_hugepage_enabled_mode, buf, count);
+	if (ret > 0 && khugepaged_has_work())
+		wake_up_interruptible(&khugepaged_wait);
+	return ret;
+}
+THP_ATTR(enabled);
+
+static ssize_t defrag_show(struct kobject *kobj,
+			   struct kobj_attribute *attr, char *buf)
+{
+	return thp_mode_show(transparent_hugepage_defrag_mode, buf);
+}
+
+static ssize_t defrag_store(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    const char *buf, size_t count)
+{
+	return thp_mode_store(&transparent_hugepage_defrag_mode, buf, count);
+}
+THP_ATTR(defrag);
+
+static struct attribute *hugepage_attrs[] = {
+	&enabled_attr.attr,
+	&defrag_attr.attr,
+	NULL,
+};
+
+static struct attribute_group hugepage_attr_group = {
+	.attrs = hugepage_attrs,
+};
+
+static ssize_t khugepaged_uint_store(unsigned int *val, unsigned long min,
+				     unsigned long max, const char *buf,
+				     size_t count)
+{
+	unsigned long value;
+	int err;
+
+	err = strict_strtoul(buf, 10, &value);
+	if (err || value < min || value > max)
+		return -EINVAL;
+
+	*val = value;
+	return count;
+}
+
+static ssize_t scan_sleep_millisecs_show(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_scan_sleep_millisecs);
+}
+
+static ssize_t scan_sleep_millisecs_store(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	ret = khugepaged_uint_store(&khugepaged_scan_sleep_millisecs, 0,
+				    UINT_MAX, buf, count);
+	if (ret > 0)
+		wake_up_interruptible(&khugepaged_wait);
+	return ret;
+}
+THP_ATTR(scan_sleep_millisecs);
+
+static ssize_t alloc_sleep_millisecs_show(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_alloc_sleep_millisecs);
+}
+
+static ssize_t alloc_sleep_millisecs_store(struct kobject *kobj,
+					   struct kobj_attribute *attr,
+					   const char *buf, size_t count)
+{
+	ssize_t ret;
+
+	ret = khugepaged_uint_store(&khugepaged_alloc_sleep_millisecs, 0,
+				    UINT_MAX, buf, count);
+	if (ret > 0)
+		wake_up_interruptible(&khugepaged_wait);
+	return ret;
+}
+THP_ATTR(alloc_sleep_millisecs);
+
+static ssize_t pages_to_scan_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_pages_to_scan);
+}
+
+static ssize_t pages_to_scan_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	return khugepaged_uint_store(&khugepaged_pages_to_scan, 1,
+				     UINT_MAX, buf, count);
+}
+THP_ATTR(pages_to_scan);
+
+static ssize_t max_ptes_none_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_max_ptes_none);
+}
+
+static ssize_t max_ptes_none_store(struct kobject *kobj,
+				   struct kobj_attribute *attr,
+				   const char *buf, size_t count)
+{
+	return khugepaged_uint_store(&khugepaged_max_ptes_none, 0,
+				     HPAGE_PMD_NR - 1, buf, count);
+}
+THP_ATTR(max_ptes_none);
+
+static ssize_t pages_collapsed_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_pages_collapsed);
+}
+THP_ATTR_RO(pages_collapsed);
+
+static ssize_t full_scans_show(struct kobject *kobj,
+			       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", khugepaged_full_scans);
+}
+THP_ATTR_RO(full_scans);
+
+static struct attribute *khugepaged_attrs[] = {
+	&pages_to_scan_attr.attr,
+	&scan_sleep_millisecs_attr.attr,
+	&alloc_sleep_millisecs_attr.attr,
+	&max_ptes_none_attr.attr,
+	&pages_collapsed_attr.attr,
+	&full_scans_attr.attr,
+	NULL,
+};
+
+static struct attribute_group khugepaged_attr_group = {
+	.attrs = khugepaged_attrs,
+	.name = "khugepaged",
+};
+
+static int __init hugepage_sysfs_init(void)
+{
+	struct kobject *hugepage_kobj;
+	int err;
+
+	hugepage_kobj = kobject_create_and_add("transparent_hugepage", mm_kobj);
+	if (!hugepage_kobj)
+		return -ENOMEM;
+
+	err = sysfs_create_group(hugepage_kobj, &hugepage_attr_group);
+	if (!err)
+		err = sysfs_create_group(hugepage_kobj, &khugepaged_attr_group);
+	if (err)
+		kobject_put(hugepage_kobj);
+	return err;
+}
+#else
+static inline int hugepage_sysfs_init(void)
+{
+	return 0;
+}
+#endif /* CONFIG_SYSFS */
+
+static int __init hugepage_init(void)
+{
+	int err;
+
+	mm_slot_cache = kmem_cache_create("khugepaged_mm_slot",
+					  sizeof(struct mm_slot),
+					  __alignof__(struct mm_slot), 0, NULL);
+	if (!mm_slot_cache) {
+		transparent_hugepage_enabled_mode = TRANSPARENT_HUGEPAGE_NEVER;
+		return -ENOMEM;
+	}
+
+	khugepaged_thread = kthread_run(khugepaged, NULL, "khugepaged");
+	if (IS_ERR(khugepaged_thread)) {
+		printk(KERN_ERR "khugepaged: kthread_run(khugepaged) failed\n");
+		err = PTR_ERR(khugepaged_thread);
+		goto out_free;
+	}
+
+	err = hugepage_sysfs_init();
+	if (err) {
+		printk(KERN_ERR "transparent_hugepage: register sysfs failed\n");
+		goto out_stop;
+	}
+
+	return 0;
+
+out_stop:
+	kthread_stop(khugepaged_thread);
+out_free:
+	kmem_cache_destroy(mm_slot_cache);
+	mm_slot_cache = NULL;
+	transparent_hugepage_enabled_mode = TRANSPARENT_HUGEPAGE_NEVER;
+	return err;
+}
+module_init(hugepage_init)
@@ -185,6 +185,31 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* The number of pages ksmd has scanned so far */
+static unsigned long ksm_pages_scanned;
+
+/*
+ * In auto_scan mode ksmd sizes each batch from the merge yield of the
+ * previous one, between ksm_auto_pages_min and ksm_auto_pages_max, instead
+ * of using ksm_thread_pages_to_scan.
+ */
+static bool ksm_auto_scan;
+static unsigned int ksm_auto_pages_min = 100;
+static unsigned int ksm_auto_pages_max = 10000;
+static unsigned int ksm_auto_pages_to_scan = 100;
+
+/* Grow the batch when at least one in this many scanned pages merged */
+#define KSM_AUTO_GROW_YIELD	64
+
+/* Whether to merge empty pages with the zero page, bypassing the trees */
+static bool ksm_use_zero_pages;
+
+/* Checksum of an empty page, to tell that a page was empty last scan */
+static unsigned int zero_checksum __read_mostly;
+
+/* The number of pages merged with the zero page so far */
+static unsigned long ksm_zero_pages_merged;
+
 #define KSM_RUN_STOP	0
 #define KSM_RUN_MERGE	1
 #define KSM_RUN_UNMERGE	2
@@ -318,14 +343,14 @@ static void hold_anon_vma(struct rmap_item *rmap_item,
 			  struct anon_vma *anon_vma)
 {
 	rmap_item->anon_vma = anon_vma;
-	atomic_inc(&anon_vma->ksm_refcount);
+	atomic_inc(&anon_vma->external_refcount);
 }
 
 static void drop_anon_vma(struct rmap_item *rmap_item)
 {
 	struct anon_vma *anon_vma = rmap_item->anon_vma;
 
-	if (atomic_dec_and_lock(&anon_vma->ksm_refcount, &anon_vma->lock)) {
+	if (atomic_dec_and_lock(&anon_vma->external_refcount, &anon_vma->lock)) {
 		int empty = list_empty(&anon_vma->head);
 		spin_unlock(&anon_vma->lock);
 		if (empty)
@@ -713,6 +738,23 @@ static inline int pages_identical(struct page *page1, struct page *page2)
 	return !memcmp_pages(page1, page2);
 }
 
+static bool page_is_empty(struct page *page)
+{
+	unsigned long *addr;
+	bool empty = true;
+	int i;
+
+	addr = kmap_atomic(page, KM_USER0);
+	for (i = 0; i < PAGE_SIZE / sizeof(*addr); i++) {
+		if (addr[i]) {
+			empty = false;
+			break;
+		}
+	}
+	kunmap_atomic(addr, KM_USER0);
+	return empty;
+}
+
 static int write_protect_page(struct vm_area_struct *vma, struct page *page,
 			      pte_t *orig_pte)
 {
@@ -727,6 +769,12 @@ static int write_protect_page(struct vm_area_struct *vma, struct page *page,
 	if (addr == -EFAULT)
 		goto out;
 
+	/*
+	 * A huge pmd maps the page along with its neighbours: split it, so
+	 * that the page gets a pte of its own to write-protect and replace.
+	 */
+	split_huge_pmd_address(vma, addr);
+
 	ptep = page_check_address(page, mm, addr, &ptl, 0);
 	if (!ptep)
 		goto out;
@@ -770,7 +818,7 @@ out:
  * replace_page - replace page in vma by new ksm page
  * @vma:      vma that holds the pte pointing to page
  * @page:     the page we are replacing by kpage
- * @kpage:    the ksm page we replace page by
+ * @kpage:    the ksm page (or the zero page) we replace page by
  * @orig_pte: the original value of the pte
  *
  * Returns 0 on success, -EFAULT on failure.
@@ -783,6 +831,7 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 	pud_t *pud;
 	pmd_t *pmd;
 	pte_t *ptep;
+	pte_t newpte;
 	spinlock_t *ptl;
 	unsigned long addr;
 	int err = -EFAULT;
@@ -800,7 +849,7 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 		goto out;
 
 	pmd = pmd_offset(pud, addr);
-	if (!pmd_present(*pmd))
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		goto out;
 
 	ptep = pte_offset_map_lock(mm, pmd, addr, &ptl);
@@ -809,12 +858,23 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 		goto out;
 	}
 
-	get_page(kpage);
-	page_add_anon_rmap(kpage, vma, addr);
+	/*
+	 * The zero page is mapped like do_anonymous_page() does it: with
+	 * no rmap and no refcount, and not accounted as an anon page.
+	 */
+	if (!is_zero_pfn(page_to_pfn(kpage))) {
+		get_page(kpage);
+		page_add_anon_rmap(kpage, vma, addr);
+		newpte = mk_pte(kpage, vma->vm_page_prot);
+	} else {
+		newpte = pte_mkspecial(pfn_pte(page_to_pfn(kpage),
+					       vma->vm_page_prot));
+		dec_mm_counter(mm, MM_ANONPAGES);
+	}
 
 	flush_cache_page(vma, addr, pte_pfn(*ptep));
 	ptep_clear_flush(vma, addr, ptep);
-	set_pte_at_notify(mm, addr, ptep, mk_pte(kpage, vma->vm_page_prot));
+	set_pte_at_notify(mm, addr, ptep, newpte);
 
 	page_remove_rmap(page);
 	put_page(page);
@@ -923,6 +983,36 @@ out:
 	return err;
 }
 
+/*
+ * try_to_merge_zero_page - map the zero page in place of an empty page.
+ * Nothing is added to the stable tree: the zero page is never freed, and
+ * a write fault on it allocates a new page like for any other zero pte.
+ *
+ * This function returns 0 if the page was replaced, -EFAULT otherwise.
+ */
+static int try_to_merge_zero_page(struct rmap_item *rmap_item,
+				  struct page *page)
+{
+	struct mm_struct *mm = rmap_item->mm;
+	struct vm_area_struct *vma;
+	int err = -EFAULT;
+
+	down_read(&mm->mmap_sem);
+	if (ksm_test_exit(mm))
+		goto out;
+	vma = find_vma(mm, rmap_item->address);
+	if (!vma || vma->vm_start > rmap_item->address)
+		goto out;
+	/* The zero page cannot be mlocked in place of the page */
+	if (vma->vm_flags & VM_LOCKED)
+		goto out;
+
+	err = try_to_merge_one_page(vma, page, ZERO_PAGE(rmap_item->address));
+out:
+	up_read(&mm->mmap_sem);
+	return err;
+}
+
 /*
  * try_to_merge_two_pages - take two identical pages and prepare them
  * to be merged into one page.
@@ -1159,6 +1249,20 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 
 	remove_rmap_item_from_tree(rmap_item);
 
+	/*
+	 * An empty page can be merged with the zero page right away, without
+	 * searching either tree.  As for the unstable tree, wait until it
+	 * was still empty one scan later: a fresh page is often empty just
+	 * because it has not been written yet.
+	 */
+	if (ksm_use_zero_pages && page_is_empty(page)) {
+		if (rmap_item->oldchecksum == zero_checksum &&
+		    !try_to_merge_zero_page(rmap_item, page))
+			ksm_zero_pages_merged++;
+		rmap_item->oldchecksum = zero_checksum;
+		return;
+	}
+
 	/* We first start with searching the page inside the stable tree */
 	kpage = stable_tree_search(page);
 	if (kpage) {
@@ -1377,9 +1481,36 @@ static void ksm_do_scan(unsigned int scan_npages)
 		if (!PageKsm(page) || !in_stable_tree(rmap_item))
 			cmp_and_merge_page(page, rmap_item);
 		put_page(page);
+		ksm_pages_scanned++;
 	}
 }
 
+/*
+ * ksm_auto_do_scan - scan one batch in auto_scan mode, then size the next
+ * batch from what this one merged: double it while at least one page in
+ * KSM_AUTO_GROW_YIELD merges, and shrink it slowly while nothing does.
+ */
+static void ksm_auto_do_scan(void)
+{
+	unsigned long scanned = ksm_pages_scanned;
+	unsigned long merged = ksm_pages_sharing + ksm_zero_pages_merged;
+	unsigned long nr_pages = ksm_auto_pages_to_scan;
+
+	ksm_do_scan(nr_pages);
+
+	scanned = ksm_pages_scanned - scanned;
+	merged = ksm_pages_sharing + ksm_zero_pages_merged - merged;
+
+	/* ksm_pages_sharing also drops as merged pages are unmapped */
+	if ((long)merged > 0 && merged * KSM_AUTO_GROW_YIELD >= scanned)
+		nr_pages *= 2;
+	else if ((long)merged <= 0)
+		nr_pages -= nr_pages / 8;
+
+	ksm_auto_pages_to_scan = clamp_t(unsigned long, nr_pages,
+				ksm_auto_pages_min, ksm_auto_pages_max);
+}
+
 static int ksmd_should_run(void)
 {
 	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
@@ -1391,8 +1522,12 @@ static int ksm_scan_thread(void *nothing)
 
 	while (!kthread_should_stop()) {
 		mutex_lock(&ksm_thread_mutex);
-		if (ksmd_should_run())
-			ksm_do_scan(ksm_thread_pages_to_scan);
+		if (ksmd_should_run()) {
+			if (ksm_auto_scan)
+				ksm_auto_do_scan();
+			else
+				ksm_do_scan(ksm_thread_pages_to_scan);
+		}
 		mutex_unlock(&ksm_thread_mutex);
 
 		if (ksmd_should_run()) {
@@ -1916,6 +2051,134 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t pages_scanned_show(struct kobject *kobj,
+				  struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_pages_scanned);
+}
+KSM_ATTR_RO(pages_scanned);
+
+static ssize_t auto_scan_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_auto_scan);
+}
+
+static ssize_t auto_scan_store(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       const char *buf, size_t count)
+{
+	int err;
+	unsigned long value;
+
+	err = strict_strtoul(buf, 10, &value);
+	if (err || value > 1)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (value && !ksm_auto_scan)
+		ksm_auto_pages_to_scan = clamp(ksm_thread_pages_to_scan,
+				ksm_auto_pages_min, ksm_auto_pages_max);
+	ksm_auto_scan = value;
+	mutex_unlock(&ksm_thread_mutex);
+
+	return count;
+}
+KSM_ATTR(auto_scan);
+
+static ssize_t auto_pages_min_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_auto_pages_min);
+}
+
+static ssize_t auto_pages_min_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	int err;
+	unsigned long nr_pages;
+
+	err = strict_strtoul(buf, 10, &nr_pages);
+	if (err || !nr_pages || nr_pages > UINT_MAX)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (nr_pages > ksm_auto_pages_max)
+		count = -EINVAL;
+	else
+		ksm_auto_pages_min = nr_pages;
+	mutex_unlock(&ksm_thread_mutex);
+
+	return count;
+}
+KSM_ATTR(auto_pages_min);
+
+static ssize_t auto_pages_max_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_auto_pages_max);
+}
+
+static ssize_t auto_pages_max_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	int err;
+	unsigned long nr_pages;
+
+	err = strict_strtoul(buf, 10, &nr_pages);
+	if (err || nr_pages > UINT_MAX)
+		return -EINVAL;
+
+	mutex_lock(&ksm_thread_mutex);
+	if (nr_pages < ksm_auto_pages_min)
+		count = -EINVAL;
+	else
+		ksm_auto_pages_max = nr_pages;
+	mutex_unlock(&ksm_thread_mutex);
+
+	return count;
+}
+KSM_ATTR(auto_pages_max);
+
+static ssize_t auto_pages_to_scan_show(struct kobject *kobj,
+				       struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_auto_pages_to_scan);
+}
+KSM_ATTR_RO(auto_pages_to_scan);
+
+static ssize_t use_zero_pages_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_use_zero_pages);
+}
+
+static ssize_t use_zero_pages_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	int err;
+	unsigned long value;
+
+	err = strict_strtoul(buf, 10, &value);
+	if (err || value > 1)
+		return -EINVAL;
+
+	ksm_use_zero_pages = value;
+
+	return count;
+}
+KSM_ATTR(use_zero_pages);
+
+static ssize_t zero_pages_merged_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_zero_pages_merged);
+}
+KSM_ATTR_RO(zero_pages_merged);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -1925,6 +2188,13 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&pages_scanned_attr.attr,
+	&auto_scan_attr.attr,
+	&auto_pages_min_attr.attr,
+	&auto_pages_max_attr.attr,
+	&auto_pages_to_scan_attr.attr,
+	&use_zero_pages_attr.attr,
+	&zero_pages_merged_attr.attr,
 	NULL,
 };
 
@@ -1947,6 +2217,8 @@ static int __init ksm_init(void)
 	if (err)
 		goto out_free1;
 
+	zero_checksum = calc_checksum(ZERO_PAGE(0));
+
 	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
 	if (IS_ERR(ksm_thread)) {
 		printk(KERN_ERR "ksm: creating kthread failed\n");
@@ -47,6 +47,7 @@
 #include <linux/mm_inline.h>
 #include <linux/page_cgroup.h>
 #include <linux/cpu.h>
+#include <linux/writeback.h>
 #include "internal.h"
 
 #include <asm/uaccess.h>
@@ -83,10 +84,13 @@ enum mem_cgroup_stat_index {
 	MEM_CGROUP_STAT_CACHE, 	   /* # of pages charged as cache */
 	MEM_CGROUP_STAT_RSS,	   /* # of pages charged as anon rss */
 	MEM_CGROUP_STAT_FILE_MAPPED,  /* # of pages charged as file rss */
+	MEM_CGROUP_STAT_FILE_DIRTY,	/* # of dirty pages in page cache */
+	MEM_CGROUP_STAT_FILE_WRITEBACK,	/* # of pages under writeback */
 	MEM_CGROUP_STAT_PGPGIN_COUNT,	/* # of pages paged in */
 	MEM_CGROUP_STAT_PGPGOUT_COUNT,	/* # of pages paged out */
 	MEM_CGROUP_STAT_SWAPOUT, /* # of pages, swapped out */
 	MEM_CGROUP_EVENTS,	/* incremented at every  pagein/pageout */
+	MEM_CGROUP_ON_MOVE,	/* someone is moving account between groups */
 
 	MEM_CGROUP_STAT_NSTATS,
 };
@@ -95,26 +99,38 @@ struct mem_cgroup_stat_cpu {
 	s64 count[MEM_CGROUP_STAT_NSTATS];
 };
 
+/*
+ * Dirty page limits of a memory cgroup, with the same meaning as the
+ * vm.dirty_* sysctls but relative to the memory the cgroup may use.
+ */
+struct vm_dirty_param {
+	int dirty_ratio;
+	int dirty_background_ratio;
+	unsigned long dirty_bytes;
+	unsigned long dirty_background_bytes;
+};
+
 /*
  * per-zone information in memory controller.
  */
 struct mem_cgroup_per_zone {
 	/*
-	 * spin_lock to protect the per cgroup LRU
+	 * LRU lists of the pages charged to this cgroup in this zone,
+	 * protected by their own lru_lock.
 	 */
-	struct list_head	lists[NR_LRU_LISTS];
-	unsigned long		count[NR_LRU_LISTS];
+	struct lruvec		lruvec;
 
-	struct zone_reclaim_stat reclaim_stat;
 	struct rb_node		tree_node;	/* RB tree node */
 	unsigned long long	usage_in_excess;/* Set to the value by which */
 						/* the soft limit is exceeded*/
 	bool			on_tree;
 	struct mem_cgroup	*mem;		/* Back pointer, we cannot */
 						/* use container_of	   */
+	/* css id global reclaim goes on with, per priority, in root's zones */
+	unsigned short		reclaim_cursor[DEF_PRIORITY + 1];
 };
 /* Macro for accessing counter */
-#define MEM_CGROUP_ZSTAT(mz, idx)	((mz)->count[(idx)])
+#define MEM_CGROUP_ZSTAT(mz, idx)	((mz)->lruvec.count[(idx)])
 
 struct mem_cgroup_per_node {
 	struct mem_cgroup_per_zone zoneinfo[MAX_NR_ZONES];
@@ -208,6 +224,9 @@ struct mem_cgroup {
 
 	unsigned int	swappiness;
 
+	/* dirty page limits, protected by reclaim_param_lock */
+	struct vm_dirty_param dirty_param;
+
 	/* set when res.limit == memsw.limit */
 	bool		memsw_is_minimum;
 
@@ -230,6 +249,21 @@ struct mem_cgroup {
 	 * percpu counter.
 	 */
 	struct mem_cgroup_stat_cpu *stat;
+	/*
+	 * counters of cpus which went offline, folded in by
+	 * mem_cgroup_drain_pcp_counter().
+	 */
+	struct mem_cgroup_stat_cpu nocpu_base;
+	spinlock_t pcp_counter_lock;
+
+	/*
+	 * freeing is deferred past an RCU grace period, and from there to
+	 * a work item because the structure may be vmalloc()ed.
+	 */
+	union {
+		struct rcu_head rcu_freeing;
+		struct work_struct work_freeing;
+	};
 };
 
 /* Stuffs for move charges at task migration. */
@@ -488,14 +522,27 @@ mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_zone *mctz)
 	return mz;
 }
 
+/*
+ * Only online cpus are summed up, the counters of an offlined cpu are
+ * folded into nocpu_base by the hotplug callback. A cpu going down may
+ * be missed for a moment in between; these are statistics only.
+ */
+/*
+ * The sum is not atomic against concurrent updates anyway, so the
+ * counters of dead cpus are read without pcp_counter_lock: that lock
+ * only serializes the writers of nocpu_base.
+ */
 static s64 mem_cgroup_read_stat(struct mem_cgroup *mem,
 		enum mem_cgroup_stat_index idx)
 {
 	int cpu;
 	s64 val = 0;
 
-	for_each_possible_cpu(cpu)
+	for_each_online_cpu(cpu)
 		val += per_cpu(mem->stat->count[idx], cpu);
+#ifdef CONFIG_HOTPLUG_CPU
+	val += ACCESS_ONCE(mem->nocpu_base.count[idx]);
+#endif
 	return val;
 }
 
@@ -537,6 +584,39 @@ static void mem_cgroup_charge_statistics(struct mem_cgroup *mem,
 	preempt_enable();
 }
 
+/*
+ * Page statistics are updated without lock_page_cgroup() unless charges
+ * are being moved away from the memcg: mem_cgroup_start_move() marks it
+ * on every cpu, and waits for updaters that did not see the mark yet.
+ */
+static void mem_cgroup_start_move(struct mem_cgroup *mem)
+{
+	int cpu;
+
+	spin_lock(&mem->pcp_counter_lock);
+	for_each_possible_cpu(cpu)
+		per_cpu(mem->stat->count[MEM_CGROUP_ON_MOVE], cpu) += 1;
+	spin_unlock(&mem->pcp_counter_lock);
+
+	synchronize_rcu();
+}
+
+static void mem_cgroup_end_move(struct mem_cgroup *mem)
+{
+	int cpu;
+
+	spin_lock(&mem->pcp_counter_lock);
+	for_each_possible_cpu(cpu)
+		per_cpu(mem->stat->count[MEM_CGROUP_ON_MOVE], cpu) -= 1;
+	spin_unlock(&mem->pcp_counter_lock);
+}
+
+/* Must be called under rcu_read_lock() */
+static bool mem_cgroup_stealed(struct mem_cgroup *mem)
+{
+	return this_cpu_read(mem->stat->count[MEM_CGROUP_ON_MOVE]) > 0;
+}
+
 static unsigned long mem_cgroup_get_local_zonestat(struct mem_cgroup *mem,
 					enum lru_list idx)
 {
@@ -618,18 +698,16 @@ static struct mem_cgroup *try_get_mem_cgroup_from_mm(struct mm_struct *mm)
 }
 
 /*
- * Call callback function against all cgroup under hierarchy tree.
+ * Call callback function against all cgroup below root in the cgroup tree,
+ * whether or not they use hierarchy.
  */
-static int mem_cgroup_walk_tree(struct mem_cgroup *root, void *data,
+static int __mem_cgroup_walk_tree(struct mem_cgroup *root, void *data,
 			  int (*func)(struct mem_cgroup *, void *))
 {
 	int found, ret, nextid;
 	struct cgroup_subsys_state *css;
 	struct mem_cgroup *mem;
 
-	if (!root->use_hierarchy)
-		return (*func)(root, data);
-
 	nextid = 1;
 	do {
 		ret = 0;
@@ -652,62 +730,96 @@ static int mem_cgroup_walk_tree(struct mem_cgroup *root, void *data,
 	return ret;
 }
 
+/*
+ * Call callback function against all cgroup under hierarchy tree.
+ */
+static int mem_cgroup_walk_tree(struct mem_cgroup *root, void *data,
+			  int (*func)(struct mem_cgroup *, void *))
+{
+	if (!root->use_hierarchy)
+		return (*func)(root, data);
+
+	return __mem_cgroup_walk_tree(root, data, func);
+}
+
 static inline bool mem_cgroup_is_root(struct mem_cgroup *mem)
 {
 	return (mem == root_mem_cgroup);
 }
 
 /*
- * Following LRU functions are allowed to be used without PCG_LOCK.
- * Operations are called by routine of global LRU independently from memcg.
- * What we have to take care of here is validness of pc->mem_cgroup.
+ * Every page on the LRU is linked on exactly one lruvec: the one of the
+ * cgroup it was charged to when it was added, or the root cgroup's if
+ * it was not charged.  Without the controller, all pages are on the
+ * zone's own lruvec.
  *
- * Changes to pc->mem_cgroup happens when
- * 1. charge
- * 2. moving account
- * In typical case, "charge" is done before add-to-lru. Exception is SwapCache.
- * It is added to LRU before charge.
- * If PCG_USED bit is not set, page_cgroup is not added to this private LRU.
- * When moving account, the page is not on LRU. It's isolated.
+ * pc->lru_mem_cgroup records which cgroup's lruvec the page is on.  It
+ * is set when the page is linked and cleared when it is unlinked, both
+ * under that lruvec's lru_lock, so it is stable while that lock is
+ * held or while the page is kept from being moved between LRU lists
+ * (PageLRU cleared by the caller, or the last reference dropped).
+ *
+ * pc->mem_cgroup can change while a page is on the LRU only when an
+ * uncharged SwapCache page is charged again.  Such a page is taken off
+ * the LRU before and put back after the charge, so that it moves to the
+ * new cgroup's lists.  When moving account, the page is isolated.
  */
 
-void mem_cgroup_del_lru_list(struct page *page, enum lru_list lru)
+/**
+ * mem_cgroup_zone_lruvec - get the lruvec for a zone and a memcg
+ * @zone: zone of the wanted lruvec
+ * @mem: memcg of the wanted lruvec, or %NULL for the zone's own
+ */
+struct lruvec *mem_cgroup_zone_lruvec(struct zone *zone,
+				      struct mem_cgroup *mem)
 {
-	struct page_cgroup *pc;
 	struct mem_cgroup_per_zone *mz;
 
-	if (mem_cgroup_disabled())
-		return;
-	pc = lookup_page_cgroup(page);
-	/* can happen while we handle swapcache. */
-	if (!TestClearPageCgroupAcctLRU(pc))
-		return;
-	VM_BUG_ON(!pc->mem_cgroup);
-	/*
-	 * We don't check PCG_USED bit. It's cleared when the "page" is finally
-	 * removed from global LRU.
-	 */
-	mz = page_cgroup_zoneinfo(pc);
-	MEM_CGROUP_ZSTAT(mz, lru) -= 1;
-	if (mem_cgroup_is_root(pc->mem_cgroup))
-		return;
-	VM_BUG_ON(list_empty(&pc->lru));
-	list_del_init(&pc->lru);
-	return;
+	if (mem_cgroup_disabled() || !mem)
+		return &zone->lruvec;
+
+	mz = mem_cgroup_zoneinfo(mem, zone_to_nid(zone), zone_idx(zone));
+	return &mz->lruvec;
 }
 
-void mem_cgroup_del_lru(struct page *page)
+/**
+ * mem_cgroup_page_lruvec - get the lruvec a page is linked on
+ * @page: the page
+ * @zone: zone of the page
+ *
+ * Returns %NULL if the page is not on any LRU list.  See above for
+ * when the result is stable.  Callers that look at pages they have not
+ * pinned to their lruvec, like the pfn walkers of compaction and lumpy
+ * reclaim, must hold rcu_read_lock() while they use the lruvec, as the
+ * cgroup it belongs to may be freed meanwhile.
+ */
+struct lruvec *mem_cgroup_page_lruvec(struct page *page, struct zone *zone)
 {
-	mem_cgroup_del_lru_list(page, page_lru(page));
+	struct page_cgroup *pc;
+	struct mem_cgroup *mem;
+
+	if (mem_cgroup_disabled())
+		return &zone->lruvec;
+
+	pc = lookup_page_cgroup(page);
+	mem = ACCESS_ONCE(pc->lru_mem_cgroup);
+	if (!mem)
+		return NULL;
+	return mem_cgroup_zone_lruvec(zone, mem);
 }
 
-void mem_cgroup_rotate_lru_list(struct page *page, enum lru_list lru)
+/**
+ * mem_cgroup_lru_add_lruvec - get the lruvec a page should be added to
+ * @page: the page, not on the LRU
+ * @zone: zone of the page
+ */
+struct lruvec *mem_cgroup_lru_add_lruvec(struct page *page, struct zone *zone)
 {
-	struct mem_cgroup_per_zone *mz;
 	struct page_cgroup *pc;
+	struct mem_cgroup *mem = root_mem_cgroup;
 
 	if (mem_cgroup_disabled())
-		return;
+		return &zone->lruvec;
 
 	pc = lookup_page_cgroup(page);
 	/*
@@ -715,82 +827,184 @@ void mem_cgroup_rotate_lru_list(struct page *page, enum lru_list lru)
 	 * For making pc->mem_cgroup visible, insert smp_rmb() here.
 	 */
 	smp_rmb();
-	/* unused or root page is not rotated. */
-	if (!PageCgroupUsed(pc) || mem_cgroup_is_root(pc->mem_cgroup))
-		return;
-	mz = page_cgroup_zoneinfo(pc);
-	list_move(&pc->lru, &mz->lists[lru]);
+	if (PageCgroupUsed(pc))
+		mem = pc->mem_cgroup;
+	return mem_cgroup_zone_lruvec(zone, mem);
 }
 
-void mem_cgroup_add_lru_list(struct page *page, enum lru_list lru)
+/*
+ * Called under lruvec->lru_lock, before the page is marked PageLRU.
+ */
+void mem_cgroup_lru_add(struct page *page, struct lruvec *lruvec)
 {
-	struct page_cgroup *pc;
 	struct mem_cgroup_per_zone *mz;
+	struct page_cgroup *pc;
 
 	if (mem_cgroup_disabled())
 		return;
+
+	mz = container_of(lruvec, struct mem_cgroup_per_zone, lruvec);
 	pc = lookup_page_cgroup(page);
-	VM_BUG_ON(PageCgroupAcctLRU(pc));
-	/*
-	 * Used bit is set without atomic ops but after smp_wmb().
-	 * For making pc->mem_cgroup visible, insert smp_rmb() here.
-	 */
-	smp_rmb();
-	if (!PageCgroupUsed(pc))
-		return;
+	VM_BUG_ON(pc->lru_mem_cgroup);
+	pc->lru_mem_cgroup = mz->mem;
+	/* Whoever sees PageLRU must see the owner, too. */
+	smp_wmb();
+}
 
-	mz = page_cgroup_zoneinfo(pc);
-	MEM_CGROUP_ZSTAT(mz, lru) += 1;
-	SetPageCgroupAcctLRU(pc);
-	if (mem_cgroup_is_root(pc->mem_cgroup))
+/*
+ * Called under the lru_lock of the lruvec the page is unlinked from.
+ */
+void mem_cgroup_lru_del(struct page *page)
+{
+	struct page_cgroup *pc;
+
+	if (mem_cgroup_disabled())
 		return;
-	list_add(&pc->lru, &mz->lists[lru]);
+
+	pc = lookup_page_cgroup(page);
+	VM_BUG_ON(!pc->lru_mem_cgroup);
+	pc->lru_mem_cgroup = NULL;
+}
+
+/**
+ * mem_cgroup_iter - iterate over all memory cgroups
+ * @prev: the cgroup returned by the previous call, or %NULL to start
+ *
+ * Returns the next cgroup with a css reference held, and drops the
+ * reference on @prev.  Returns %NULL once all cgroups were visited,
+ * and right away if the controller is disabled.
+ */
+struct mem_cgroup *mem_cgroup_iter(struct mem_cgroup *prev)
+{
+	struct cgroup_subsys_state *css;
+	struct mem_cgroup *mem = NULL;
+	int nextid = 1, found;
+
+	if (mem_cgroup_disabled())
+		return NULL;
+
+	if (prev) {
+		nextid = css_id(&prev->css) + 1;
+		css_put(&prev->css);
+	}
+
+	rcu_read_lock();
+	while (!mem) {
+		css = css_get_next(&mem_cgroup_subsys, nextid,
+				   &root_mem_cgroup->css, &found);
+		if (!css)
+			break;
+		if (css_tryget(css))
+			mem = container_of(css, struct mem_cgroup, css);
+		nextid = found + 1;
+	}
+	rcu_read_unlock();
+
+	return mem;
+}
+
+/*
+ * Drop the reference held on the cgroup a walk stopped at early.
+ */
+void mem_cgroup_iter_break(struct mem_cgroup *prev)
+{
+	if (prev)
+		css_put(&prev->css);
+}
+
+/**
+ * mem_cgroup_reclaim_iter - iterate over all memory cgroups for global reclaim
+ * @prev: the cgroup returned by the previous call, or %NULL to start
+ * @reclaim: the zone and priority of the reclaim pass
+ *
+ * Like mem_cgroup_iter(), but starts after the cgroup the previous walk
+ * over the zone at that priority stopped at, and wraps around.  Walks
+ * that stop early once their reclaim target is met thus take turns over
+ * the cgroups, instead of always putting the pressure on the first ones.
+ */
+struct mem_cgroup *mem_cgroup_reclaim_iter(struct mem_cgroup *prev,
+				struct mem_cgroup_reclaim_cookie *reclaim)
+{
+	struct mem_cgroup_per_zone *mz;
+	struct cgroup_subsys_state *css;
+	struct mem_cgroup *mem = NULL;
+	bool wrapped = false;
+	int nextid, found;
+
+	if (mem_cgroup_disabled())
+		return NULL;
+
+	mz = mem_cgroup_zoneinfo(root_mem_cgroup, zone_to_nid(reclaim->zone),
+				 zone_idx(reclaim->zone));
+	if (!prev) {
+		reclaim->start = max_t(unsigned short,
+				       mz->reclaim_cursor[reclaim->priority], 1);
+		nextid = reclaim->start;
+	} else {
+		nextid = css_id(&prev->css) + 1;
+		wrapped = nextid <= reclaim->start;
+		css_put(&prev->css);
+	}
+
+	rcu_read_lock();
+	while (!mem) {
+		css = css_get_next(&mem_cgroup_subsys, nextid,
+				   &root_mem_cgroup->css, &found);
+		if (!css) {
+			if (wrapped)
+				break;
+			wrapped = true;
+			nextid = 1;
+			continue;
+		}
+		if (wrapped && found >= reclaim->start)
+			break;
+		if (css_tryget(css))
+			mem = container_of(css, struct mem_cgroup, css);
+		nextid = found + 1;
+	}
+	rcu_read_unlock();
+
+	if (mem)
+		mz->reclaim_cursor[reclaim->priority] = css_id(&mem->css) + 1;
+	return mem;
 }
 
 /*
  * At handling SwapCache, pc->mem_cgroup may be changed while it's linked to
  * lru because the page may.be reused after it's fully uncharged (because of
- * SwapCache behavior).To handle that, unlink page_cgroup from LRU when charge
- * it again. This function is only used to charge SwapCache. It's done under
- * lock_page and expected that zone->lru_lock is never held.
+ * SwapCache behavior). To handle that, take the page off the LRU when
+ * charging it again, and put it back onto the new cgroup's LRU afterwards.
+ * This function is only used to charge SwapCache. It's done under
+ * lock_page and expected that no lru_lock is held.
  */
-static void mem_cgroup_lru_del_before_commit_swapcache(struct page *page)
+static bool mem_cgroup_lru_del_before_commit_swapcache(struct page *page)
 {
-	unsigned long flags;
-	struct zone *zone = page_zone(page);
 	struct page_cgroup *pc = lookup_page_cgroup(page);
 
-	spin_lock_irqsave(&zone->lru_lock, flags);
 	/*
 	 * Forget old LRU when this page_cgroup is *not* used. This Used bit
 	 * is guarded by lock_page() because the page is SwapCache.
 	 */
-	if (!PageCgroupUsed(pc))
-		mem_cgroup_del_lru_list(page, page_lru(page));
-	spin_unlock_irqrestore(&zone->lru_lock, flags);
+	if (PageCgroupUsed(pc) || !PageLRU(page))
+		return false;
+	return !isolate_lru_page(page);
 }
 
-static void mem_cgroup_lru_add_after_commit_swapcache(struct page *page)
+static void mem_cgroup_lru_add_after_commit_swapcache(struct page *page,
+						      bool isolated)
 {
-	unsigned long flags;
-	struct zone *zone = page_zone(page);
 	struct page_cgroup *pc = lookup_page_cgroup(page);
 
-	spin_lock_irqsave(&zone->lru_lock, flags);
-	/* link when the page is linked to LRU but page_cgroup isn't */
-	if (PageLRU(page) && !PageCgroupAcctLRU(pc))
-		mem_cgroup_add_lru_list(page, page_lru(page));
-	spin_unlock_irqrestore(&zone->lru_lock, flags);
-}
-
-
-void mem_cgroup_move_lists(struct page *page,
-			   enum lru_list from, enum lru_list to)
-{
-	if (mem_cgroup_disabled())
-		return;
-	mem_cgroup_del_lru_list(page, from);
-	mem_cgroup_add_lru_list(page, to);
+	/*
+	 * The page may have been sitting in a pagevec while it was
+	 * charged, and been linked to the root cgroup's LRU since.
+	 */
+	if (!isolated && PageLRU(page) &&
+	    pc->lru_mem_cgroup != pc->mem_cgroup)
+		isolated = !isolate_lru_page(page);
+	if (isolated)
+		putback_lru_page(page);
 }
 
 int task_in_mem_cgroup(struct task_struct *task, const struct mem_cgroup *mem)
@@ -901,107 +1115,6 @@ int mem_cgroup_inactive_file_is_low(struct mem_cgroup *memcg)
 	return (active > inactive);
 }
 
-unsigned long mem_cgroup_zone_nr_pages(struct mem_cgroup *memcg,
-				       struct zone *zone,
-				       enum lru_list lru)
-{
-	int nid = zone->zone_pgdat->node_id;
-	int zid = zone_idx(zone);
-	struct mem_cgroup_per_zone *mz = mem_cgroup_zoneinfo(memcg, nid, zid);
-
-	return MEM_CGROUP_ZSTAT(mz, lru);
-}
-
-struct zone_reclaim_stat *mem_cgroup_get_reclaim_stat(struct mem_cgroup *memcg,
-						      struct zone *zone)
-{
-	int nid = zone->zone_pgdat->node_id;
-	int zid = zone_idx(zone);
-	struct mem_cgroup_per_zone *mz = mem_cgroup_zoneinfo(memcg, nid, zid);
-
-	return &mz->reclaim_stat;
-}
-
-struct zone_reclaim_stat *
-mem_cgroup_get_reclaim_stat_from_page(struct page *page)
-{
-	struct page_cgroup *pc;
-	struct mem_cgroup_per_zone *mz;
-
-	if (mem_cgroup_disabled())
-		return NULL;
-
-	pc = lookup_page_cgroup(page);
-	/*
-	 * Used bit is set without atomic ops but after smp_wmb().
-	 * For making pc->mem_cgroup visible, insert smp_rmb() here.
-	 */
-	smp_rmb();
-	if (!PageCgroupUsed(pc))
-		return NULL;
-
-	mz = page_cgroup_zoneinfo(pc);
-	if (!mz)
-		return NULL;
-
-	return &mz->reclaim_stat;
-}
-
-unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
-					struct list_head *dst,
-					unsigned long *scanned, int order,
-					int mode, struct zone *z,
-					struct mem_cgroup *mem_cont,
-					int active, int file)
-{
-	unsigned long nr_taken = 0;
-	struct page *page;
-	unsigned long scan;
-	LIST_HEAD(pc_list);
-	struct list_head *src;
-	struct page_cgroup *pc, *tmp;
-	int nid = z->zone_pgdat->node_id;
-	int zid = zone_idx(z);
-	struct mem_cgroup_per_zone *mz;
-	int lru = LRU_FILE * file + active;
-	int ret;
-
-	BUG_ON(!mem_cont);
-	mz = mem_cgroup_zoneinfo(mem_cont, nid, zid);
-	src = &mz->lists[lru];
-
-	scan = 0;
-	list_for_each_entry_safe_reverse(pc, tmp, src, lru) {
-		if (scan >= nr_to_scan)
-			break;
-
-		page = pc->page;
-		if (unlikely(!PageCgroupUsed(pc)))
-			continue;
-		if (unlikely(!PageLRU(page)))
-			continue;
-
-		scan++;
-		ret = __isolate_lru_page(page, mode, file);
-		switch (ret) {
-		case 0:
-			list_move(&page->lru, dst);
-			mem_cgroup_del_lru(page);
-			nr_taken++;
-			break;
-		case -EBUSY:
-			/* we don't affect global LRU but rotate in our LRU */
-			mem_cgroup_rotate_lru_list(page, page_lru(page));
-			break;
-		default:
-			break;
-		}
-	}
-
-	*scanned = scan;
-	return nr_taken;
-}
-
 #define mem_cgroup_from_res_counter(counter, member)	\
 	container_of(counter, struct mem_cgroup, member)
 
@@ -1033,6 +1146,25 @@ static unsigned int get_swappiness(struct mem_cgroup *memcg)
 	return swappiness;
 }
 
+static void get_dirty_param(struct mem_cgroup *memcg,
+			    struct vm_dirty_param *param)
+{
+	struct cgroup *cgrp = memcg->css.cgroup;
+
+	/* root ? */
+	if (cgrp->parent == NULL) {
+		param->dirty_ratio = vm_dirty_ratio;
+		param->dirty_background_ratio = dirty_background_ratio;
+		param->dirty_bytes = vm_dirty_bytes;
+		param->dirty_background_bytes = dirty_background_bytes;
+		return;
+	}
+
+	spin_lock(&memcg->reclaim_param_lock);
+	*param = memcg->dirty_param;
+	spin_unlock(&memcg->reclaim_param_lock);
+}
+
 static int mem_cgroup_count_children_cb(struct mem_cgroup *mem, void *data)
 {
 	int *val = data;
@@ -1345,36 +1477,87 @@ bool mem_cgroup_handle_oom(struct mem_cgroup *mem, gfp_t mask)
 }
 
 /*
- * Currently used to update mapped file statistics, but the routine can be
- * generalized to update other statistics as well.
+ * Update page statistics which are kept in sync with page flags outside of
+ * the memory controller: mapped, dirty and under writeback. The matching
+ * page_cgroup flag records that the page is accounted, so that the counter
+ * can be moved along with the page and is never decremented twice.
+ *
+ * Called with the page's state stable against other updates of the same
+ * item, possibly from interrupt context.
  */
-void mem_cgroup_update_file_mapped(struct page *page, int val)
+void mem_cgroup_update_page_stat(struct page *page,
+				 enum mem_cgroup_page_stat_item idx, int val)
 {
 	struct mem_cgroup *mem;
 	struct page_cgroup *pc;
+	struct address_space *mapping;
+	bool need_unlock = false;
+	unsigned long flags;
+	int changed;
+
+	if (mem_cgroup_disabled())
+		return;
 
 	pc = lookup_page_cgroup(page);
 	if (unlikely(!pc))
 		return;
 
-	lock_page_cgroup(pc);
+	rcu_read_lock();
 	mem = pc->mem_cgroup;
-	if (!mem || !PageCgroupUsed(pc))
+	if (unlikely(!mem || !PageCgroupUsed(pc)))
 		goto done;
-
 	/*
-	 * Preemption is already disabled. We can use __this_cpu_xxx
+	 * pc->mem_cgroup only changes while charges are moved away from
+	 * it; take the lock against mem_cgroup_move_account() then.
 	 */
-	if (val > 0) {
-		__this_cpu_inc(mem->stat->count[MEM_CGROUP_STAT_FILE_MAPPED]);
-		SetPageCgroupFileMapped(pc);
-	} else {
-		__this_cpu_dec(mem->stat->count[MEM_CGROUP_STAT_FILE_MAPPED]);
-		ClearPageCgroupFileMapped(pc);
+	if (unlikely(mem_cgroup_stealed(mem))) {
+		move_lock_page_cgroup(pc, &flags);
+		need_unlock = true;
+		mem = pc->mem_cgroup;
+		if (!mem || !PageCgroupUsed(pc))
+			goto done;
+	}
+
+	switch (idx) {
+	case MEMCG_NR_FILE_MAPPED:
+		if (val > 0)
+			SetPageCgroupFileMapped(pc);
+		else
+			ClearPageCgroupFileMapped(pc);
+		this_cpu_add(mem->stat->count[MEM_CGROUP_STAT_FILE_MAPPED],
+			     val);
+		break;
+	case MEMCG_NR_FILE_DIRTY:
+		if (val > 0) {
+			changed = !TestSetPageCgroupFileDirty(pc);
+			/* remember whose inode this is, for writeback */
+			mapping = page->mapping;
+			if (mapping && !PageAnon(page))
+				mapping->dirty_memcg_id = css_id(&mem->css);
+		} else
+			changed = TestClearPageCgroupFileDirty(pc);
+		if (changed)
+			this_cpu_add(mem->stat->count[MEM_CGROUP_STAT_FILE_DIRTY],
+				     val);
+		break;
+	case MEMCG_NR_FILE_WRITEBACK:
+		if (val > 0)
+			changed = !TestSetPageCgroupFileWriteback(pc);
+		else
+			changed = TestClearPageCgroupFileWriteback(pc);
+		if (changed)
+			this_cpu_add(
+				mem->stat->count[MEM_CGROUP_STAT_FILE_WRITEBACK],
+				val);
+		break;
+	default:
+		BUG();
 	}
 
 done:
-	unlock_page_cgroup(pc);
+	if (unlikely(need_unlock))
+		move_unlock_page_cgroup(pc, &flags);
+	rcu_read_unlock();
 }
 
 /*
@@ -1452,6 +1635,26 @@ static void refill_stock(struct mem_cgroup *mem, int val)
 	put_cpu_var(memcg_stock);
 }
 
+/*
+ * Give an uncharged page back to the local stock instead of the
+ * res_counter, if the stock caches this memcg and is not full. It will be
+ * consumed by the next charge on this cpu, or drained as usual. Returns
+ * false if the caller must uncharge the res_counter itself.
+ */
+static bool uncharge_to_stock(struct mem_cgroup *mem)
+{
+	struct memcg_stock_pcp *stock;
+	bool ret = false;
+
+	stock = &get_cpu_var(memcg_stock);
+	if (mem == stock->cached && stock->charge < CHARGE_SIZE) {
+		stock->charge += PAGE_SIZE;
+		ret = true;
+	}
+	put_cpu_var(memcg_stock);
+	return ret;
+}
+
 /*
  * Tries to drain stocked charges in other cpus. This function is asynchronous
  * and just put a work per cpu for draining localy on each cpu. Caller can
@@ -1490,6 +1693,27 @@ static void drain_all_stock_sync(void)
 	atomic_dec(&memcg_drain_count);
 }
 
+/*
+ * Fold the statistics of a dead cpu into nocpu_base, so that readers only
+ * have to look at online cpus. Events and the move marker are per cpu
+ * by nature and stay where they are.
+ */
+static int mem_cgroup_drain_pcp_counter(struct mem_cgroup *mem, void *data)
+{
+	int cpu = *(int *)data;
+	int i;
+
+	spin_lock(&mem->pcp_counter_lock);
+	for (i = 0; i < MEM_CGROUP_EVENTS; i++) {
+		s64 x = per_cpu(mem->stat->count[i], cpu);
+
+		per_cpu(mem->stat->count[i], cpu) = 0;
+		mem->nocpu_base.count[i] += x;
+	}
+	spin_unlock(&mem->pcp_counter_lock);
+	return 0;
+}
+
 static int __cpuinit memcg_stock_cpu_callback(struct notifier_block *nb,
 					unsigned long action,
 					void *hcpu)
@@ -1499,6 +1723,8 @@ static int __cpuinit memcg_stock_cpu_callback(struct notifier_block *nb,
 
 	if (action != CPU_DEAD)
 		return NOTIFY_OK;
+	__mem_cgroup_walk_tree(root_mem_cgroup, &cpu,
+			       mem_cgroup_drain_pcp_counter);
 	stock = &per_cpu(memcg_stock, cpu);
 	drain_stock(stock);
 	return NOTIFY_OK;
@@ -1754,7 +1980,7 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *mem,
 	 * Especially when a page_cgroup is taken from a page, pc->mem_cgroup
 	 * is accessed after testing USED bit. To make pc->mem_cgroup visible
 	 * before USED bit, we need memory barrier here.
-	 * See mem_cgroup_add_lru_list(), etc.
+	 * See mem_cgroup_lru_add_lruvec(), etc.
  	 */
 	smp_wmb();
 	switch (ctype) {
@@ -1799,22 +2025,35 @@ static void __mem_cgroup_commit_charge(struct mem_cgroup *mem,
  * @uncharge is false, so a caller should do "uncharge".
  */
 
+static void mem_cgroup_move_page_stat(struct mem_cgroup *from,
+				      struct mem_cgroup *to,
+				      enum mem_cgroup_stat_index idx)
+{
+	preempt_disable();
+	__this_cpu_dec(from->stat->count[idx]);
+	__this_cpu_inc(to->stat->count[idx]);
+	preempt_enable();
+}
+
 static void __mem_cgroup_move_account(struct page_cgroup *pc,
 	struct mem_cgroup *from, struct mem_cgroup *to, bool uncharge)
 {
+	unsigned long flags;
+
 	VM_BUG_ON(from == to);
 	VM_BUG_ON(PageLRU(pc->page));
 	VM_BUG_ON(!PageCgroupLocked(pc));
 	VM_BUG_ON(!PageCgroupUsed(pc));
 	VM_BUG_ON(pc->mem_cgroup != from);
 
-	if (PageCgroupFileMapped(pc)) {
-		/* Update mapped_file data for mem_cgroup */
-		preempt_disable();
-		__this_cpu_dec(from->stat->count[MEM_CGROUP_STAT_FILE_MAPPED]);
-		__this_cpu_inc(to->stat->count[MEM_CGROUP_STAT_FILE_MAPPED]);
-		preempt_enable();
-	}
+	move_lock_page_cgroup(pc, &flags);
+	if (PageCgroupFileMapped(pc))
+		mem_cgroup_move_page_stat(from, to, MEM_CGROUP_STAT_FILE_MAPPED);
+	if (PageCgroupFileDirty(pc))
+		mem_cgroup_move_page_stat(from, to, MEM_CGROUP_STAT_FILE_DIRTY);
+	if (PageCgroupFileWriteback(pc))
+		mem_cgroup_move_page_stat(from, to,
+					  MEM_CGROUP_STAT_FILE_WRITEBACK);
 	mem_cgroup_charge_statistics(from, pc, false);
 	if (uncharge)
 		/* This is not "cancel", but cancel_charge does all we need. */
@@ -1823,6 +2062,7 @@ static void __mem_cgroup_move_account(struct page_cgroup *pc,
 	/* caller should have done css_get */
 	pc->mem_cgroup = to;
 	mem_cgroup_charge_statistics(to, pc, true);
+	move_unlock_page_cgroup(pc, &flags);
 	/*
 	 * We charges against "to" which may not have any tasks. Then, "to"
 	 * can be under rmdir(). But in current implementation, caller of
@@ -2050,6 +2290,7 @@ __mem_cgroup_commit_charge_swapin(struct page *page, struct mem_cgroup *ptr,
 					enum charge_type ctype)
 {
 	struct page_cgroup *pc;
+	bool isolated;
 
 	if (mem_cgroup_disabled())
 		return;
@@ -2057,9 +2298,9 @@ __mem_cgroup_commit_charge_swapin(struct page *page, struct mem_cgroup *ptr,
 		return;
 	cgroup_exclude_rmdir(&ptr->css);
 	pc = lookup_page_cgroup(page);
-	mem_cgroup_lru_del_before_commit_swapcache(page);
+	isolated = mem_cgroup_lru_del_before_commit_swapcache(page);
 	__mem_cgroup_commit_charge(ptr, pc, ctype);
-	mem_cgroup_lru_add_after_commit_swapcache(page);
+	mem_cgroup_lru_add_after_commit_swapcache(page, isolated);
 	/*
 	 * Now swap is on-memory. This means this page may be
 	 * counted both as mem and swap....double count.
@@ -2125,8 +2366,18 @@ __do_uncharge(struct mem_cgroup *mem, const enum charge_type ctype)
 	 * But we do uncharge one by one if this is killed by OOM(TIF_MEMDIE)
 	 * because we want to do uncharge as soon as possible.
 	 */
-	if (!current->memcg_batch.do_batch || test_thread_flag(TIF_MEMDIE))
+	if (test_thread_flag(TIF_MEMDIE))
 		goto direct_uncharge;
+	if (!current->memcg_batch.do_batch) {
+		/*
+		 * The stock holds res and memsw charges alike, so only
+		 * uncharges of both can go there.
+		 */
+		if (ctype != MEM_CGROUP_CHARGE_TYPE_SWAPOUT &&
+		    uncharge_to_stock(mem))
+			return;
+		goto direct_uncharge;
+	}
 
 	batch = &current->memcg_batch;
 	/*
@@ -2207,6 +2458,11 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 	if (ctype == MEM_CGROUP_CHARGE_TYPE_SWAPOUT)
 		mem_cgroup_swap_statistics(mem, true);
 	mem_cgroup_charge_statistics(mem, pc, false);
+	/* the page leaves the memcg, and its page stats with it */
+	if (TestClearPageCgroupFileDirty(pc))
+		this_cpu_dec(mem->stat->count[MEM_CGROUP_STAT_FILE_DIRTY]);
+	if (TestClearPageCgroupFileWriteback(pc))
+		this_cpu_dec(mem->stat->count[MEM_CGROUP_STAT_FILE_WRITEBACK]);
 
 	ClearPageCgroupUsed(pc);
 	/*
@@ -2249,7 +2505,8 @@ void mem_cgroup_uncharge_cache_page(struct page *page)
 }
 
 /*
- * Batch_start/batch_end is called in unmap_page_range/invlidate/trucate.
+ * Batch_start/batch_end is called in unmap_page_range/invlidate/trucate
+ * and page reclaim.
  * In that cases, pages are freed continuously and we can expect pages
  * are in the same memcg. All these calls itself limits the number of
  * pages freed at once, then uncharge_start/end() is called properly.
@@ -2725,22 +2982,20 @@ unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
 }
 
 /*
- * This routine traverse page_cgroup in given list and drop them all.
+ * This routine traverse pages in given list and drop them all.
  * *And* this routine doesn't reclaim page itself, just removes page_cgroup.
  */
 static int mem_cgroup_force_empty_list(struct mem_cgroup *mem,
 				int node, int zid, enum lru_list lru)
 {
-	struct zone *zone;
 	struct mem_cgroup_per_zone *mz;
-	struct page_cgroup *pc, *busy;
+	struct page *page, *busy;
 	unsigned long flags, loop;
 	struct list_head *list;
 	int ret = 0;
 
-	zone = &NODE_DATA(node)->node_zones[zid];
 	mz = mem_cgroup_zoneinfo(mem, node, zid);
-	list = &mz->lists[lru];
+	list = &mz->lruvec.lists[lru];
 
 	loop = MEM_CGROUP_ZSTAT(mz, lru);
 	/* give some margin against EBUSY etc...*/
@@ -2748,27 +3003,28 @@ static int mem_cgroup_force_empty_list(struct mem_cgroup *mem,
 	busy = NULL;
 	while (loop--) {
 		ret = 0;
-		spin_lock_irqsave(&zone->lru_lock, flags);
+		spin_lock_irqsave(&mz->lruvec.lru_lock, flags);
 		if (list_empty(list)) {
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			spin_unlock_irqrestore(&mz->lruvec.lru_lock, flags);
 			break;
 		}
-		pc = list_entry(list->prev, struct page_cgroup, lru);
-		if (busy == pc) {
-			list_move(&pc->lru, list);
+		page = list_entry(list->prev, struct page, lru);
+		if (busy == page) {
+			list_move(&page->lru, list);
 			busy = NULL;
-			spin_unlock_irqrestore(&zone->lru_lock, flags);
+			spin_unlock_irqrestore(&mz->lruvec.lru_lock, flags);
 			continue;
 		}
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		spin_unlock_irqrestore(&mz->lruvec.lru_lock, flags);
 
-		ret = mem_cgroup_move_parent(pc, mem, GFP_KERNEL);
+		ret = mem_cgroup_move_parent(lookup_page_cgroup(page), mem,
+					     GFP_KERNEL);
 		if (ret == -ENOMEM)
 			break;
 
 		if (ret == -EBUSY || ret == -EINVAL) {
 			/* found lock contention or "pc" is obsolete. */
-			busy = pc;
+			busy = page;
 			cond_resched();
 		} else
 			busy = NULL;
@@ -2808,6 +3064,7 @@ move_account:
 		lru_add_drain_all();
 		drain_all_stock_sync();
 		ret = 0;
+		mem_cgroup_start_move(mem);
 		for_each_node_state(node, N_HIGH_MEMORY) {
 			for (zid = 0; !ret && zid < MAX_NR_ZONES; zid++) {
 				enum lru_list l;
@@ -2821,6 +3078,7 @@ move_account:
 			if (ret)
 				break;
 		}
+		mem_cgroup_end_move(mem);
 		/* it seems parent cgroup doesn't have enough mem */
 		if (ret == -ENOMEM)
 			goto try_to_free;
@@ -3060,6 +3318,176 @@ out:
 	return;
 }
 
+struct mem_cgroup_dirty_stat {
+	s64 dirty;
+	s64 writeback;
+	unsigned long file;
+};
+
+static int mem_cgroup_get_dirty_stat(struct mem_cgroup *mem, void *data)
+{
+	struct mem_cgroup_dirty_stat *d = data;
+
+	d->dirty += mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_FILE_DIRTY);
+	d->writeback += mem_cgroup_read_stat(mem,
+					     MEM_CGROUP_STAT_FILE_WRITEBACK);
+	d->file += mem_cgroup_get_local_zonestat(mem, LRU_INACTIVE_FILE) +
+		   mem_cgroup_get_local_zonestat(mem, LRU_ACTIVE_FILE);
+	return 0;
+}
+
+/*
+ * The memory a cgroup could still fill with dirty pages: what is left
+ * below its limit, plus its page cache that reclaim can free.
+ */
+static unsigned long mem_cgroup_dirtyable_memory(struct mem_cgroup *mem,
+						 unsigned long file)
+{
+	unsigned long long limit, memsw_limit, usage;
+	unsigned long room = 0;
+
+	memcg_get_hierarchical_limit(mem, &limit, &memsw_limit);
+	usage = res_counter_read_u64(&mem->res, RES_USAGE);
+	if (limit > usage)
+		room = min_t(unsigned long long,
+			     (limit - usage) >> PAGE_SHIFT, ULONG_MAX);
+
+	return room + file;
+}
+
+/*
+ * The dirty limits of @mem, and the dirty pages counted against them:
+ * those of the whole subtree when the cgroup is hierarchical.
+ */
+static bool __mem_cgroup_dirty_info(struct mem_cgroup *mem,
+				    unsigned long sys_available_mem,
+				    struct mem_cgroup_dirty_info *info)
+{
+	struct mem_cgroup_dirty_stat stat = { 0 };
+	struct vm_dirty_param param;
+	unsigned long available;
+
+	if (mem_cgroup_is_root(mem))
+		return false;
+
+	mem_cgroup_walk_tree(mem, &stat, mem_cgroup_get_dirty_stat);
+
+	get_dirty_param(mem, &param);
+	available = min(sys_available_mem,
+			mem_cgroup_dirtyable_memory(mem, stat.file));
+
+	if (param.dirty_bytes)
+		info->dirty_thresh = DIV_ROUND_UP(param.dirty_bytes, PAGE_SIZE);
+	else
+		info->dirty_thresh = param.dirty_ratio * available / 100;
+
+	if (param.dirty_background_bytes)
+		info->background_thresh =
+			DIV_ROUND_UP(param.dirty_background_bytes, PAGE_SIZE);
+	else
+		info->background_thresh =
+			param.dirty_background_ratio * available / 100;
+
+	if (info->background_thresh >= info->dirty_thresh)
+		info->background_thresh = info->dirty_thresh / 2;
+
+	info->nr_reclaimable = max_t(s64, 0, stat.dirty);
+	info->nr_writeback = max_t(s64, 0, stat.writeback);
+	return true;
+}
+
+/*
+ * Whether @info has more dirty pages per page of dirty threshold than
+ * @worst, i.e. is further over or closer to its limit.
+ */
+static bool mem_cgroup_dirtier(struct mem_cgroup_dirty_info *info,
+			       struct mem_cgroup_dirty_info *worst)
+{
+	u64 dirty = info->nr_reclaimable + info->nr_writeback;
+	u64 worst_dirty = worst->nr_reclaimable + worst->nr_writeback;
+
+	return dirty * (worst->dirty_thresh + 1) >
+		worst_dirty * (info->dirty_thresh + 1);
+}
+
+/**
+ * mem_cgroup_dirty_info - dirty limits of the current task's memcg
+ * @sys_available_mem: dirtyable memory of the whole system, in pages
+ * @info: filled with the memcg's dirty limits and dirty page counts
+ *
+ * Under use_hierarchy, the limits of the ancestors apply as well: @info
+ * is filled in for whichever of the memcg and its ancestors is furthest
+ * over its limit, or closest to it.
+ *
+ * Returns the css id of that memcg, to target writeback at it, or 0 if
+ * no memcg dirty limits apply and @info is left alone.
+ */
+unsigned short mem_cgroup_dirty_info(unsigned long sys_available_mem,
+				     struct mem_cgroup_dirty_info *info)
+{
+	struct mem_cgroup_dirty_info this;
+	struct mem_cgroup *mem;
+	unsigned short id = 0;
+
+	if (mem_cgroup_disabled())
+		return 0;
+
+	rcu_read_lock();
+	mem = mem_cgroup_from_task(current);
+	for (; mem; mem = parent_mem_cgroup(mem)) {
+		if (!__mem_cgroup_dirty_info(mem, sys_available_mem, &this))
+			break;
+		if (!id || mem_cgroup_dirtier(&this, info)) {
+			*info = this;
+			id = css_id(&mem->css);
+		}
+	}
+	rcu_read_unlock();
+	return id;
+}
+
+/*
+ * Called by the flusher thread doing writeback for a memcg, to stop once
+ * the memcg is back below its background threshold.
+ */
+bool mem_cgroup_over_bground_thresh(unsigned short id)
+{
+	struct mem_cgroup_dirty_info info;
+	struct mem_cgroup *mem;
+	bool ret = false;
+
+	rcu_read_lock();
+	mem = mem_cgroup_lookup(id);
+	if (mem && !css_is_removed(&mem->css) &&
+	    __mem_cgroup_dirty_info(mem, determine_dirtyable_memory(), &info))
+		ret = info.nr_reclaimable > info.background_thresh;
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * Whether the inode of @mapping was last dirtied by the memcg with css id
+ * @id, or by one of its descendants.
+ */
+bool mem_cgroup_mapping_dirtied_by(struct address_space *mapping,
+				   unsigned short id)
+{
+	struct mem_cgroup *mem, *dirtier;
+	unsigned short dirtier_id = mapping->dirty_memcg_id;
+	bool ret;
+
+	if (dirtier_id == id)
+		return true;
+
+	rcu_read_lock();
+	mem = mem_cgroup_lookup(id);
+	dirtier = mem_cgroup_lookup(dirtier_id);
+	ret = mem && dirtier && mem->use_hierarchy &&
+		css_is_ancestor(&dirtier->css, &mem->css);
+	rcu_read_unlock();
+	return ret;
+}
+
 static int mem_cgroup_reset(struct cgroup *cont, unsigned int event)
 {
 	struct mem_cgroup *mem;
@@ -3125,6 +3553,8 @@ enum {
 	MCS_CACHE,
 	MCS_RSS,
 	MCS_FILE_MAPPED,
+	MCS_FILE_DIRTY,
+	MCS_WRITEBACK,
 	MCS_PGPGIN,
 	MCS_PGPGOUT,
 	MCS_SWAP,
@@ -3147,6 +3577,8 @@ struct {
 	{"cache", "total_cache"},
 	{"rss", "total_rss"},
 	{"mapped_file", "total_mapped_file"},
+	{"dirty", "total_dirty"},
+	{"writeback", "total_writeback"},
 	{"pgpgin", "total_pgpgin"},
 	{"pgpgout", "total_pgpgout"},
 	{"swap", "total_swap"},
@@ -3170,6 +3602,10 @@ static int mem_cgroup_get_local_stat(struct mem_cgroup *mem, void *data)
 	s->stat[MCS_RSS] += val * PAGE_SIZE;
 	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_FILE_MAPPED);
 	s->stat[MCS_FILE_MAPPED] += val * PAGE_SIZE;
+	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_FILE_DIRTY);
+	s->stat[MCS_FILE_DIRTY] += val * PAGE_SIZE;
+	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_FILE_WRITEBACK);
+	s->stat[MCS_WRITEBACK] += val * PAGE_SIZE;
 	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_PGPGIN_COUNT);
 	s->stat[MCS_PGPGIN] += val;
 	val = mem_cgroup_read_stat(mem, MEM_CGROUP_STAT_PGPGOUT_COUNT);
@@ -3246,13 +3682,13 @@ static int mem_control_stat_show(struct cgroup *cont, struct cftype *cft,
 				mz = mem_cgroup_zoneinfo(mem_cont, nid, zid);
 
 				recent_rotated[0] +=
-					mz->reclaim_stat.recent_rotated[0];
+				    mz->lruvec.reclaim_stat.recent_rotated[0];
 				recent_rotated[1] +=
-					mz->reclaim_stat.recent_rotated[1];
+				    mz->lruvec.reclaim_stat.recent_rotated[1];
 				recent_scanned[0] +=
-					mz->reclaim_stat.recent_scanned[0];
+				    mz->lruvec.reclaim_stat.recent_scanned[0];
 				recent_scanned[1] +=
-					mz->reclaim_stat.recent_scanned[1];
+				    mz->lruvec.reclaim_stat.recent_scanned[1];
 			}
 		cb->fill(cb, "recent_rotated_anon", recent_rotated[0]);
 		cb->fill(cb, "recent_rotated_file", recent_rotated[1]);
@@ -3303,6 +3739,83 @@ static int mem_cgroup_swappiness_write(struct cgroup *cgrp, struct cftype *cft,
 	return 0;
 }
 
+enum {
+	MEM_CGROUP_DIRTY_RATIO,
+	MEM_CGROUP_DIRTY_BACKGROUND_RATIO,
+	MEM_CGROUP_DIRTY_BYTES,
+	MEM_CGROUP_DIRTY_BACKGROUND_BYTES,
+};
+
+static u64 mem_cgroup_dirty_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+	struct vm_dirty_param param;
+
+	get_dirty_param(memcg, &param);
+
+	switch (cft->private) {
+	case MEM_CGROUP_DIRTY_RATIO:
+		return param.dirty_ratio;
+	case MEM_CGROUP_DIRTY_BACKGROUND_RATIO:
+		return param.dirty_background_ratio;
+	case MEM_CGROUP_DIRTY_BYTES:
+		return param.dirty_bytes;
+	case MEM_CGROUP_DIRTY_BACKGROUND_BYTES:
+		return param.dirty_background_bytes;
+	default:
+		BUG();
+	}
+}
+
+/*
+ * As with the sysctls, setting a ratio clears the corresponding bytes
+ * value and vice versa. The root cgroup follows the sysctls.
+ */
+static int mem_cgroup_dirty_write(struct cgroup *cgrp, struct cftype *cft,
+				  u64 val)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cgrp);
+	struct vm_dirty_param *param = &memcg->dirty_param;
+
+	if (cgrp->parent == NULL)
+		return -EINVAL;
+
+	switch (cft->private) {
+	case MEM_CGROUP_DIRTY_RATIO:
+	case MEM_CGROUP_DIRTY_BACKGROUND_RATIO:
+		if (val > 100)
+			return -EINVAL;
+		break;
+	default:
+		if (val > ULONG_MAX)
+			return -EINVAL;
+		break;
+	}
+
+	spin_lock(&memcg->reclaim_param_lock);
+	switch (cft->private) {
+	case MEM_CGROUP_DIRTY_RATIO:
+		param->dirty_ratio = val;
+		param->dirty_bytes = 0;
+		break;
+	case MEM_CGROUP_DIRTY_BACKGROUND_RATIO:
+		param->dirty_background_ratio = val;
+		param->dirty_background_bytes = 0;
+		break;
+	case MEM_CGROUP_DIRTY_BYTES:
+		param->dirty_bytes = val;
+		param->dirty_ratio = 0;
+		break;
+	case MEM_CGROUP_DIRTY_BACKGROUND_BYTES:
+		param->dirty_background_bytes = val;
+		param->dirty_background_ratio = 0;
+		break;
+	}
+	spin_unlock(&memcg->reclaim_param_lock);
+
+	return 0;
+}
+
 static void __mem_cgroup_threshold(struct mem_cgroup *memcg, bool swap)
 {
 	struct mem_cgroup_threshold_ary *t;
@@ -3594,6 +4107,30 @@ static struct cftype mem_cgroup_files[] = {
 		.read_u64 = mem_cgroup_move_charge_read,
 		.write_u64 = mem_cgroup_move_charge_write,
 	},
+	{
+		.name = "dirty_ratio",
+		.private = MEM_CGROUP_DIRTY_RATIO,
+		.read_u64 = mem_cgroup_dirty_read,
+		.write_u64 = mem_cgroup_dirty_write,
+	},
+	{
+		.name = "dirty_background_ratio",
+		.private = MEM_CGROUP_DIRTY_BACKGROUND_RATIO,
+		.read_u64 = mem_cgroup_dirty_read,
+		.write_u64 = mem_cgroup_dirty_write,
+	},
+	{
+		.name = "dirty_bytes",
+		.private = MEM_CGROUP_DIRTY_BYTES,
+		.read_u64 = mem_cgroup_dirty_read,
+		.write_u64 = mem_cgroup_dirty_write,
+	},
+	{
+		.name = "dirty_background_bytes",
+		.private = MEM_CGROUP_DIRTY_BACKGROUND_BYTES,
+		.read_u64 = mem_cgroup_dirty_read,
+		.write_u64 = mem_cgroup_dirty_write,
+	},
 };
 
 #ifdef CONFIG_CGROUP_MEM_RES_CTLR_SWAP
@@ -3643,7 +4180,6 @@ static int alloc_mem_cgroup_per_zone_info(struct mem_cgroup *mem, int node)
 {
 	struct mem_cgroup_per_node *pn;
 	struct mem_cgroup_per_zone *mz;
-	enum lru_list l;
 	int zone, tmp = node;
 	/*
 	 * This routine is called against possible nodes.
@@ -3664,8 +4200,7 @@ static int alloc_mem_cgroup_per_zone_info(struct mem_cgroup *mem, int node)
 
 	for (zone = 0; zone < MAX_NR_ZONES; zone++) {
 		mz = &pn->zoneinfo[zone];
-		for_each_lru(l)
-			INIT_LIST_HEAD(&mz->lists[l]);
+		lruvec_init(&mz->lruvec);
 		mz->usage_in_excess = 0;
 		mz->on_tree = false;
 		mz->mem = mem;
@@ -3693,6 +4228,7 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 		return NULL;
 
 	memset(mem, 0, size);
+	spin_lock_init(&mem->pcp_counter_lock);
 	mem->stat = alloc_percpu(struct mem_cgroup_stat_cpu);
 	if (!mem->stat) {
 		if (size < PAGE_SIZE)
@@ -3715,12 +4251,12 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
  * Removal of cgroup itself succeeds regardless of refs from swap.
  */
 
-static void __mem_cgroup_free(struct mem_cgroup *mem)
+static void mem_cgroup_free_work(struct work_struct *work)
 {
+	struct mem_cgroup *mem;
 	int node;
 
-	mem_cgroup_remove_from_trees(mem);
-	free_css_id(&mem_cgroup_subsys, &mem->css);
+	mem = container_of(work, struct mem_cgroup, work_freeing);
 
 	for_each_node_state(node, N_POSSIBLE)
 		free_mem_cgroup_per_zone_info(mem, node);
@@ -3732,6 +4268,24 @@ static void __mem_cgroup_free(struct mem_cgroup *mem)
 		vfree(mem);
 }
 
+static void mem_cgroup_free_rcu(struct rcu_head *head)
+{
+	struct mem_cgroup *mem;
+
+	mem = container_of(head, struct mem_cgroup, rcu_freeing);
+	INIT_WORK(&mem->work_freeing, mem_cgroup_free_work);
+	schedule_work(&mem->work_freeing);
+}
+
+static void __mem_cgroup_free(struct mem_cgroup *mem)
+{
+	mem_cgroup_remove_from_trees(mem);
+	free_css_id(&mem_cgroup_subsys, &mem->css);
+
+	/* lockless lruvec lookups may still be looking at it */
+	call_rcu(&mem->rcu_freeing, mem_cgroup_free_rcu);
+}
+
 static void mem_cgroup_get(struct mem_cgroup *mem)
 {
 	atomic_inc(&mem->refcnt);
@@ -3850,8 +4404,10 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	mem->last_scanned_child = 0;
 	spin_lock_init(&mem->reclaim_param_lock);
 
-	if (parent)
+	if (parent) {
 		mem->swappiness = get_swappiness(parent);
+		get_dirty_param(parent, &mem->dirty_param);
+	}
 	atomic_set(&mem->refcnt, 1);
 	mem->move_charge_at_immigrate = 0;
 	mutex_init(&mem->thresholds_lock);
@@ -4053,6 +4609,10 @@ static int mem_cgroup_count_precharge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
+	split_huge_pmd(vma, pmd, addr);
+	if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+		return 0;
+
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; pte++, addr += PAGE_SIZE)
 		if (is_target_pte_for_mc(vma, addr, *pte, NULL))
@@ -4134,6 +4694,8 @@ static void mem_cgroup_clear_mc(void)
 
 		mc.moved_swap = 0;
 	}
+	if (mc.from)
+		mem_cgroup_end_move(mc.from);
 	mc.from = NULL;
 	mc.to = NULL;
 	mc.moving_task = NULL;
@@ -4171,6 +4733,7 @@ static int mem_cgroup_can_attach(struct cgroup_subsys *ss,
 			mc.moved_charge = 0;
 			mc.moved_swap = 0;
 			mc.moving_task = current;
+			mem_cgroup_start_move(from);
 
 			ret = mem_cgroup_precharge_mc(mm);
 			if (ret)
@@ -4198,6 +4761,9 @@ static int mem_cgroup_move_charge_pte_range(pmd_t *pmd,
 	pte_t *pte;
 	spinlock_t *ptl;
 
+	split_huge_pmd(vma, pmd, addr);
+	if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+		return 0;
 retry:
 	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
 	for (; addr != end; addr += PAGE_SIZE) {
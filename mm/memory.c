@@ -53,6 +53,7 @@
 #include <linux/writeback.h>
 #include <linux/memcontrol.h>
 #include <linux/mmu_notifier.h>
+#include <linux/migrate.h>
 #include <linux/kallsyms.h>
 #include <linux/swapops.h>
 #include <linux/elf.h>
@@ -533,20 +534,6 @@ static inline int is_cow_mapping(unsigned int flags)
 	return (flags & (VM_SHARED | VM_MAYWRITE)) == VM_MAYWRITE;
 }
 
-#ifndef is_zero_pfn
-static inline int is_zero_pfn(unsigned long pfn)
-{
-	return pfn == zero_pfn;
-}
-#endif
-
-#ifndef my_zero_pfn
-static inline unsigned long my_zero_pfn(unsigned long addr)
-{
-	return zero_pfn;
-}
-#endif
-
 /*
  * vm_normal_page -- This function gets the "struct page" associated with a pte.
  *
@@ -797,6 +784,12 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/*
+		 * A huge pmd is never shared with the child: split it, and
+		 * let copy_pte_range() set up COW of the small pages.
+		 */
+		if (pmd_trans_huge(*src_pmd))
+			split_huge_pmd(vma, src_pmd, addr);
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
@@ -999,7 +992,19 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd)) {
+		if (pmd_trans_huge(*pmd)) {
+			if (next - addr == HPAGE_PMD_SIZE &&
+			    zap_huge_pmd(tlb, vma, pmd)) {
+				(*zap_work) -= HPAGE_PMD_SIZE;
+				continue;
+			}
+			split_huge_pmd(vma, pmd, addr);
+		}
+		/*
+		 * Here there can be other concurrent MADV_DONTNEED or
+		 * huge pmd faults: only mmap_sem for reading is held.
+		 */
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd)) {
 			(*zap_work)--;
 			continue;
 		}
@@ -1266,11 +1271,20 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	pmd = pmd_offset(pud, address);
 	if (pmd_none(*pmd))
 		goto no_page_table;
-	if (pmd_huge(*pmd)) {
+	if (pmd_huge(*pmd) && vma->vm_flags & VM_HUGETLB) {
 		BUG_ON(flags & FOLL_GET);
 		page = follow_huge_pmd(mm, address, pmd, flags & FOLL_WRITE);
 		goto out;
 	}
+	if (pmd_trans_huge(*pmd)) {
+		page = follow_trans_huge_pmd(vma, address, pmd, flags);
+		/* not writable yet: let handle_mm_fault() upgrade it */
+		if (page || pmd_trans_huge(*pmd))
+			goto out;
+		/* split under us */
+		if (pmd_none(*pmd))
+			goto no_page_table;
+	}
 	if (unlikely(pmd_bad(*pmd)))
 		goto no_page_table;
 
@@ -2031,6 +2045,73 @@ static inline int pte_unmap_same(struct mm_struct *mm, pmd_t *pmd,
 	return same;
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Map and lock the pte, like pte_offset_map_lock.  For a speculative
+ * fault, first make sure that the vma did not change since the fault
+ * started at sequence count @seq; fail if it did, and the caller must
+ * return VM_FAULT_RETRY.
+ *
+ * Page tables are only freed after the vma is removed and a TLB flush
+ * IPI was answered by all cpus, so with interrupts disabled the pmd and
+ * pte table stay valid while we check.  The pte lock is only tried: its
+ * holder may be waiting for our answer to such an IPI.  Once the pte lock
+ * is held with the vma unchanged, the ptes cannot be zapped under us.
+ * Kernel faults may come in with interrupts already disabled, so their
+ * state is saved and restored rather than enabled on the way out.
+ */
+static bool pte_map_lock(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pmd_t *pmd, unsigned int flags,
+		unsigned int seq, pte_t **ptep, spinlock_t **ptlp)
+{
+	unsigned long irqflags;
+	pmd_t pmdval;
+	spinlock_t *ptl;
+	pte_t *pte;
+	bool ret = false;
+
+	if (!(flags & FAULT_FLAG_SPECULATIVE)) {
+		*ptep = pte_offset_map_lock(mm, pmd, address, ptlp);
+		return true;
+	}
+
+	local_irq_save(irqflags);
+	if (read_seqcount_retry(&vma->vm_sequence, seq))
+		goto out;
+	/* khugepaged may be clearing the pmd, see collapse_huge_page() */
+	pmdval = *pmd;
+	barrier();
+	if (unlikely(pmd_none(pmdval) || pmd_trans_huge(pmdval)))
+		goto out;
+
+	ptl = pte_lockptr(mm, &pmdval);
+	pte = pte_offset_map(&pmdval, address);
+	if (unlikely(!spin_trylock(ptl))) {
+		pte_unmap(pte);
+		goto out;
+	}
+	if (read_seqcount_retry(&vma->vm_sequence, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out;
+	}
+	*ptep = pte;
+	*ptlp = ptl;
+	ret = true;
+out:
+	local_irq_restore(irqflags);
+	return ret;
+}
+#else
+static inline bool pte_map_lock(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address, pmd_t *pmd,
+		unsigned int flags, unsigned int seq,
+		pte_t **ptep, spinlock_t **ptlp)
+{
+	*ptep = pte_offset_map_lock(mm, pmd, address, ptlp);
+	return true;
+}
+#endif
+
 /*
  * Do pte_mkwrite, but only if the vma says VM_WRITE.  We do this when
  * servicing faults for write access.  In the normal case, do always want
@@ -2629,11 +2710,15 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 		goto out;
 	}
 	delayacct_set_flag(DELAYACCT_PF_SWAPIN);
-	page = lookup_swap_cache(entry);
+	page = lookup_swap_cache(entry, vma, address);
 	if (!page) {
 		grab_swap_token(mm); /* Contend for token _before_ read-in */
-		page = swapin_readahead(entry,
-					GFP_HIGHUSER_MOVABLE, vma, address);
+		if (swap_use_vma_readahead())
+			page = swap_vma_readahead(entry, GFP_HIGHUSER_MOVABLE,
+						  vma, address, pmd);
+		else
+			page = swapin_readahead(entry, GFP_HIGHUSER_MOVABLE,
+						vma, address);
 		if (!page) {
 			/*
 			 * Back out if somebody else faulted in this pte
@@ -2742,33 +2827,38 @@ out_release:
 
 /*
  * We enter with non-exclusive mmap_sem (to exclude vma changes,
- * but allow concurrent faults), and pte mapped but not yet locked.
+ * but allow concurrent faults), and pte neither mapped nor locked.
  * We return with mmap_sem still held, but pte unmapped and unlocked.
  */
 static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
-		unsigned long address, pte_t *page_table, pmd_t *pmd,
-		unsigned int flags)
+		unsigned long address, pmd_t *pmd, unsigned int flags,
+		unsigned int seq)
 {
 	struct page *page;
+	pte_t *page_table;
 	spinlock_t *ptl;
 	pte_t entry;
 
 	if (!(flags & FAULT_FLAG_WRITE)) {
 		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
 						vma->vm_page_prot));
-		ptl = pte_lockptr(mm, pmd);
-		spin_lock(ptl);
+		if (!pte_map_lock(mm, vma, address, pmd, flags, seq,
+				  &page_table, &ptl))
+			return VM_FAULT_RETRY;
 		if (!pte_none(*page_table))
 			goto unlock;
 		goto setpte;
 	}
 
 	/* Allocate our own private page. */
-	pte_unmap(page_table);
-
 	if (unlikely(anon_vma_prepare(vma)))
 		goto oom;
-	page = alloc_zeroed_user_highpage_movable(vma, address);
+	/*
+	 * A speculative fault only comes here for vmas without a policy
+	 * of their own, and must not look at one set meanwhile.
+	 */
+	page = alloc_zeroed_user_highpage_movable(
+			flags & FAULT_FLAG_SPECULATIVE ? NULL : vma, address);
 	if (!page)
 		goto oom;
 	__SetPageUptodate(page);
@@ -2780,7 +2870,12 @@ static int do_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	if (vma->vm_flags & VM_WRITE)
 		entry = pte_mkwrite(pte_mkdirty(entry));
 
-	page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
+	if (!pte_map_lock(mm, vma, address, pmd, flags, seq,
+			  &page_table, &ptl)) {
+		mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+		return VM_FAULT_RETRY;
+	}
 	if (!pte_none(*page_table))
 		goto release;
 
@@ -2818,8 +2913,8 @@ oom:
  * We return with mmap_sem still held, but pte unmapped and unlocked.
  */
 static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
-		unsigned long address, pmd_t *pmd,
-		pgoff_t pgoff, unsigned int flags, pte_t orig_pte)
+		unsigned long address, pmd_t *pmd, pgoff_t pgoff,
+		unsigned int flags, pte_t orig_pte, unsigned int seq)
 {
 	pte_t *page_table;
 	spinlock_t *ptl;
@@ -2919,7 +3014,14 @@ static int __do_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	}
 
-	page_table = pte_offset_map_lock(mm, pmd, address, &ptl);
+	if (!pte_map_lock(mm, vma, address, pmd, flags, seq,
+			  &page_table, &ptl)) {
+		/* Only read faults are speculative: no copy, nothing dirty */
+		VM_BUG_ON(anon || dirty_page);
+		unlock_page(vmf.page);
+		page_cache_release(vmf.page);
+		return VM_FAULT_RETRY;
+	}
 
 	/*
 	 * This silly early PAGE_DIRTY setting removes a race
@@ -2996,14 +3098,13 @@ unwritable_page:
 }
 
 static int do_linear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
-		unsigned long address, pte_t *page_table, pmd_t *pmd,
-		unsigned int flags, pte_t orig_pte)
+		unsigned long address, pmd_t *pmd, unsigned int flags,
+		pte_t orig_pte, unsigned int seq)
 {
 	pgoff_t pgoff = (((address & PAGE_MASK)
 			- vma->vm_start) >> PAGE_SHIFT) + vma->vm_pgoff;
 
-	pte_unmap(page_table);
-	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
+	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte, seq);
 }
 
 /*
@@ -3035,8 +3136,74 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	}
 
 	pgoff = pte_to_pgoff(orig_pte);
-	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
+	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte, 0);
+}
+
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * NUMA hinting fault: the scanner in task_numa_work() made this pte
+ * inaccessible to find out which node touches the page.  Restore the vma
+ * protection, then move the page next to the faulting cpu if the memory
+ * policy allows it, and feed the outcome to the scheduler.
+ *
+ * We enter with non-exclusive mmap_sem and pte mapped but not yet locked.
+ * We return with mmap_sem still held, but pte unmapped and unlocked.
+ */
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pte_t *page_table, pmd_t *pmd,
+		pte_t orig_pte)
+{
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t entry;
+	int page_nid, target_nid;
+	int migrated = 0;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*page_table, orig_pte))) {
+		pte_unmap_unlock(page_table, ptl);
+		return 0;
+	}
+
+	entry = pte_mkyoung(pte_modify(orig_pte, vma->vm_page_prot));
+	set_pte_at(mm, address, page_table, entry);
+	update_mmu_cache(vma, address, page_table);
+
+	count_vm_event(NUMA_HINT_FAULTS);
+	page = vm_normal_page(vma, address, entry);
+	if (!page) {
+		pte_unmap_unlock(page_table, ptl);
+		return 0;
+	}
+	page_nid = page_to_nid(page);
+	if (page_nid == numa_node_id())
+		count_vm_event(NUMA_HINT_FAULTS_LOCAL);
+	get_page(page);
+	pte_unmap_unlock(page_table, ptl);
+
+	target_nid = mpol_misplaced(page, vma, address);
+	if (target_nid == -1) {
+		put_page(page);
+		goto out;
+	}
+
+	migrated = migrate_misplaced_page(page, target_nid);
+	if (migrated)
+		page_nid = target_nid;
+out:
+	task_numa_fault(page_nid, 1, migrated);
+	return 0;
+}
+#else
+static inline int do_numa_page(struct mm_struct *mm,
+		struct vm_area_struct *vma, unsigned long address,
+		pte_t *page_table, pmd_t *pmd, pte_t orig_pte)
+{
+	BUG();
+	return 0;
 }
+#endif
 
 /*
  * These routines also need to handle stuff like marking pages dirty
@@ -3061,13 +3228,14 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 	entry = *pte;
 	if (!pte_present(entry)) {
 		if (pte_none(entry)) {
+			pte_unmap(pte);
 			if (vma->vm_ops) {
 				if (likely(vma->vm_ops->fault))
 					return do_linear_fault(mm, vma, address,
-						pte, pmd, flags, entry);
+						pmd, flags, entry, 0);
 			}
 			return do_anonymous_page(mm, vma, address,
-						 pte, pmd, flags);
+						 pmd, flags, 0);
 		}
 		if (pte_file(entry))
 			return do_nonlinear_fault(mm, vma, address,
@@ -3076,6 +3244,10 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 					pte, pmd, flags, entry);
 	}
 
+	/* PROT_NONE ptes in an accessible vma are NUMA hinting faults */
+	if (pte_protnone(entry) && (vma->vm_flags & (VM_READ|VM_EXEC|VM_WRITE)))
+		return do_numa_page(mm, vma, address, pte, pmd, entry);
+
 	ptl = pte_lockptr(mm, pmd);
 	spin_lock(ptl);
 	if (unlikely(!pte_same(*pte, entry)))
@@ -3104,6 +3276,23 @@ unlock:
 	return 0;
 }
 
+/*
+ * A fault in an empty pmd: anonymous memory, and files whose ->pmd_fault
+ * knows how, may map the whole of it with a huge pmd.
+ */
+static inline int create_huge_pmd(struct mm_struct *mm,
+				  struct vm_area_struct *vma,
+				  unsigned long address, pmd_t *pmd,
+				  unsigned int flags)
+{
+	if (vma->vm_ops && vma->vm_ops->pmd_fault)
+		return vma->vm_ops->pmd_fault(vma, address, pmd, flags);
+	if (transparent_hugepage_enabled(vma))
+		return do_huge_pmd_anonymous_page(mm, vma, address, pmd,
+						  flags);
+	return VM_FAULT_FALLBACK;
+}
+
 /*
  * By the time we get here, we already hold the mm semaphore
  */
@@ -3132,13 +3321,147 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	pte = pte_alloc_map(mm, pmd, address);
-	if (!pte)
+	if (pmd_none(*pmd)) {
+		int ret = create_huge_pmd(mm, vma, address, pmd, flags);
+
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else {
+		pmd_t orig_pmd = *pmd;
+
+		barrier();
+		if (pmd_trans_huge(orig_pmd)) {
+			int ret = do_huge_pmd_fault(mm, vma, address,
+						    pmd, flags);
+			if (!(ret & VM_FAULT_FALLBACK))
+				return ret;
+		}
+	}
+
+	/*
+	 * Use __pte_alloc instead of pte_alloc_map, because we can't
+	 * run pte_offset_map on the pmd, if an huge pmd could
+	 * materialize from under us from a different thread.
+	 */
+	if (unlikely(pmd_none(*pmd)) && __pte_alloc(mm, pmd, address))
 		return VM_FAULT_OOM;
+	/* if an huge pmd materialized from under us just retry later */
+	if (unlikely(pmd_trans_huge(*pmd)))
+		return 0;
+	pte = pte_offset_map(pmd, address);
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Handle a fault on a not present pte without mmap_sem, so that faulting
+ * threads are not held up by another thread changing the address space.
+ *
+ * Instead of mmap_sem, the vma is pinned with a reference, and the fault
+ * notes its sequence count: any change to the vma the fault depends on
+ * bumps it, see vm_write_begin().  pte_map_lock() checks it once more
+ * under the pte lock, before the new pte is set.  Only anonymous faults
+ * on vmas that already have an anon_vma, and read faults on files mapped
+ * through the page cache, are handled; everything that needs more of the
+ * vma, or any change seen, returns VM_FAULT_RETRY.  The caller must then
+ * take mmap_sem and go through handle_mm_fault() as usual.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags)
+{
+	struct vm_area_struct *vma;
+	unsigned long irqflags;
+	unsigned int seq;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+	pte_t *pte, entry;
+	int ret = VM_FAULT_RETRY;
+
+	flags |= FAULT_FLAG_SPECULATIVE;
+
+	vma = get_vma(mm, address);
+	if (!vma)
+		goto out;
+
+	seq = ACCESS_ONCE(vma->vm_sequence.sequence);
+	smp_rmb();
+	if (seq & 1)
+		goto out_put;
+
+	if (address < vma->vm_start || address >= vma->vm_end)
+		goto out_put;
+	if (flags & FAULT_FLAG_WRITE) {
+		if (!(vma->vm_flags & VM_WRITE))
+			goto out_put;
+	} else if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+		goto out_put;
+	if (vma->vm_flags & (VM_HUGETLB | VM_PFNMAP | VM_MIXEDMAP |
+			     VM_NONLINEAR))
+		goto out_put;
+	if (vma_policy(vma))
+		goto out_put;
+	if (vma->vm_ops) {
+		/* Write faults may COW or need ->page_mkwrite */
+		if (vma->vm_ops->fault != filemap_fault ||
+		    (flags & FAULT_FLAG_WRITE))
+			goto out_put;
+	} else if (!vma->anon_vma)
+		goto out_put;
+
+	/*
+	 * Walk the page tables with interrupts disabled, see pte_map_lock().
+	 * Missing page tables and huge pmds are left to handle_mm_fault().
+	 */
+	local_irq_save(irqflags);
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out_walk;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out_walk;
+	pmd = pmd_offset(pud, address);
+	pmdval = *pmd;
+	barrier();
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+	    unlikely(pmd_bad(pmdval)))
+		goto out_walk;
+	pte = pte_offset_map(&pmdval, address);
+	entry = *pte;
+	pte_unmap(pte);
+	local_irq_restore(irqflags);
+
+	if (!pte_none(entry))
+		goto out_put;
+
+	__set_current_state(TASK_RUNNING);
+	check_sync_rss_stat(current);
+
+	if (vma->vm_ops)
+		ret = do_linear_fault(mm, vma, address, pmd, flags, entry, seq);
+	else
+		ret = do_anonymous_page(mm, vma, address, pmd, flags, seq);
+
+	/* Errors are reported by the retry with mmap_sem held */
+	if (!(ret & (VM_FAULT_RETRY | VM_FAULT_ERROR))) {
+		count_vm_event(PGFAULT);
+		count_vm_event(SPECULATIVE_PGFAULT);
+	} else
+		count_vm_event(SPECULATIVE_PGFAULT_ABORT);
+	put_vma(vma);
+	return ret;
+
+out_walk:
+	local_irq_restore(irqflags);
+out_put:
+	put_vma(vma);
+out:
+	count_vm_event(SPECULATIVE_PGFAULT_ABORT);
+	return ret;
+}
+#endif
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
@@ -90,6 +90,7 @@
 #include <linux/syscalls.h>
 #include <linux/ctype.h>
 #include <linux/mm_inline.h>
+#include <linux/mmu_notifier.h>
 
 #include <asm/tlbflush.h>
 #include <asm/uaccess.h>
@@ -445,7 +446,9 @@ static inline int check_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd))
+		if (pmd_trans_huge(*pmd))
+			split_huge_pmd(vma, pmd, addr);
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
 		if (check_pte_range(vma, pmd, addr, next, nodes,
 				    flags, private))
@@ -555,7 +558,9 @@ static int policy_vma(struct vm_area_struct *vma, struct mempolicy *new)
 		err = vma->vm_ops->set_policy(vma, new);
 	if (!err) {
 		mpol_get(new);
+		vm_write_begin(vma);
 		vma->vm_policy = new;
+		vm_write_end(vma);
 		mpol_put(old);
 	}
 	return err;
@@ -1744,6 +1749,152 @@ struct page *alloc_pages_current(gfp_t gfp, unsigned order)
 }
 EXPORT_SYMBOL(alloc_pages_current);
 
+/*
+ * Bulk variant of alloc_pages_current() for order-0 pages. Interleaving
+ * has to pick a node per page, so that policy falls back to allocating
+ * one page at a time.
+ */
+unsigned long alloc_pages_bulk_current(gfp_t gfp, unsigned long nr_pages,
+		struct list_head *page_list, struct page **page_array)
+{
+	struct mempolicy *pol = current->mempolicy;
+	unsigned long nr_populated = 0;
+	unsigned long i;
+	struct page *page;
+
+	if (!pol || in_interrupt() || (gfp & __GFP_THISNODE))
+		pol = &default_policy;
+
+	if (pol->mode != MPOL_INTERLEAVE)
+		return __alloc_pages_bulk_nodemask(gfp,
+				policy_zonelist(gfp, pol),
+				policy_nodemask(gfp, pol),
+				nr_pages, page_list, page_array);
+
+	for (i = 0; i < nr_pages; i++) {
+		if (page_array && page_array[i]) {
+			nr_populated++;
+			continue;
+		}
+		page = alloc_page_interleave(gfp, 0, interleave_nodes(pol));
+		if (!page)
+			break;
+		if (page_list)
+			list_add_tail(&page->lru, page_list);
+		else
+			page_array[i] = page;
+		nr_populated++;
+	}
+	return nr_populated;
+}
+EXPORT_SYMBOL(alloc_pages_bulk_current);
+
+#ifdef CONFIG_NUMA_BALANCING
+struct prot_numa_walk {
+	struct vm_area_struct *vma;
+	unsigned long pages;
+};
+
+static int change_prot_numa_pte_range(pmd_t *pmd, unsigned long addr,
+				      unsigned long end, struct mm_walk *walk)
+{
+	struct prot_numa_walk *pnw = walk->private;
+	struct vm_area_struct *vma = pnw->vma;
+	struct mm_struct *mm = walk->mm;
+	pte_t *orig_pte, *pte;
+	spinlock_t *ptl;
+
+	/* huge pmds are not worth splitting just to sample them */
+	if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+		return 0;
+
+	orig_pte = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+	arch_enter_lazy_mmu_mode();
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+		struct page *page;
+
+		if (!pte_present(ptent) || pte_protnone(ptent))
+			continue;
+		page = vm_normal_page(vma, addr, ptent);
+		if (!page || PageReserved(page) || PageKsm(page))
+			continue;
+
+		ptent = ptep_modify_prot_start(mm, addr, pte);
+		ptent = pte_modify(ptent, PAGE_NONE);
+		ptep_modify_prot_commit(mm, addr, pte, ptent);
+		pnw->pages++;
+	}
+	arch_leave_lazy_mmu_mode();
+	pte_unmap_unlock(orig_pte, ptl);
+	cond_resched();
+	return 0;
+}
+
+/*
+ * Make the ptes of [start, end) in @vma inaccessible, keeping the pages
+ * mapped, so that the next access to each page takes a NUMA hinting
+ * fault.  The fault handler restores the vma protection and, if the page
+ * sits on a remote node, may migrate it next to the faulting task.
+ * Huge pmds are skipped.  Called with mmap_sem held for read; returns
+ * the number of ptes updated.
+ */
+unsigned long change_prot_numa(struct vm_area_struct *vma,
+			       unsigned long start, unsigned long end)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct prot_numa_walk pnw = {
+		.vma = vma,
+	};
+	struct mm_walk prot_numa_walk = {
+		.pmd_entry = change_prot_numa_pte_range,
+		.mm = mm,
+		.private = &pnw,
+	};
+
+	mmu_notifier_invalidate_range_start(mm, start, end);
+	walk_page_range(start, end, &prot_numa_walk);
+	if (pnw.pages)
+		flush_tlb_range(vma, start, end);
+	mmu_notifier_invalidate_range_end(mm, start, end);
+
+	count_vm_events(NUMA_PTE_UPDATES, pnw.pages);
+	return pnw.pages;
+}
+
+/**
+ * mpol_misplaced - check whether a page should move to the faulting node
+ * @page: page hit by a NUMA hinting fault
+ * @vma: vma the fault happened in
+ * @addr: faulting address
+ *
+ * Only memory that follows the default, local allocation policy is
+ * considered: an explicit policy placed the page where it is on purpose.
+ *
+ * Returns the node of the current cpu if @page lives elsewhere and the
+ * task is allowed to allocate there, -1 otherwise.
+ */
+int mpol_misplaced(struct page *page, struct vm_area_struct *vma,
+		   unsigned long addr)
+{
+	struct mempolicy *pol = get_vma_policy(current, vma, addr);
+	int thisnid = numa_node_id();
+	int ret = -1;
+
+	if (pol != &default_policy &&
+	    !(pol->mode == MPOL_PREFERRED && (pol->flags & MPOL_F_LOCAL)))
+		goto out;
+	if (page_to_nid(page) == thisnid)
+		goto out;
+	if (!node_isset(thisnid, cpuset_current_mems_allowed))
+		goto out;
+	ret = thisnid;
+out:
+	mpol_cond_put(pol);
+	return ret;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /*
  * If mpol_dup() sees current->cpuset == cpuset_being_rebound, then it
  * rebinds the mempolicy its copying by calling mpol_rebind_policy()
@@ -41,6 +41,8 @@ static pmd_t *get_old_pmd(struct mm_struct *mm, unsigned long addr)
 		return NULL;
 
 	pmd = pmd_offset(pud, addr);
+	if (pmd_trans_huge(*pmd))
+		return pmd;
 	if (pmd_none_or_clear_bad(pmd))
 		return NULL;
 
@@ -62,9 +64,6 @@ static pmd_t *alloc_new_pmd(struct mm_struct *mm, unsigned long addr)
 	if (!pmd)
 		return NULL;
 
-	if (!pmd_present(*pmd) && __pte_alloc(mm, pmd, addr))
-		return NULL;
-
 	return pmd;
 }
 
@@ -77,11 +76,7 @@ static void move_ptes(struct vm_area_struct *vma, pmd_t *old_pmd,
 	struct mm_struct *mm = vma->vm_mm;
 	pte_t *old_pte, *new_pte, pte;
 	spinlock_t *old_ptl, *new_ptl;
-	unsigned long old_start;
 
-	old_start = old_addr;
-	mmu_notifier_invalidate_range_start(vma->vm_mm,
-					    old_start, old_end);
 	if (vma->vm_file) {
 		/*
 		 * Subtle point from Rajesh Venkatasubramanian: before
@@ -123,20 +118,85 @@ static void move_ptes(struct vm_area_struct *vma, pmd_t *old_pmd,
 	pte_unmap_unlock(old_pte - 1, old_ptl);
 	if (mapping)
 		spin_unlock(&mapping->i_mmap_lock);
-	mmu_notifier_invalidate_range_end(vma->vm_mm, old_start, old_end);
 }
 
+#ifdef CONFIG_HAVE_MOVE_PMD
+/*
+ * Move a whole pte table from old_pmd to new_pmd, for a PMD_SIZE extent
+ * aligned on both sides: the cost no longer depends on how many ptes
+ * are populated in it.
+ */
+static bool move_normal_pmd(struct vm_area_struct *vma, unsigned long old_addr,
+		struct vm_area_struct *new_vma, unsigned long new_addr,
+		pmd_t *old_pmd, pmd_t *new_pmd)
+{
+	struct anon_vma *anon_vma = vma->anon_vma;
+	struct address_space *mapping = NULL;
+	struct mm_struct *mm = vma->vm_mm;
+	spinlock_t *ptl;
+	pmd_t pmd;
+
+	/* munmap of the destination normally freed its pte table */
+	if (!pmd_none(*new_pmd))
+		return false;
+
+	/*
+	 * rmap walkers find the pte table of a page before they lock it,
+	 * so they must be locked out while the table changes address.
+	 * The anon_vma lock only covers all of them when no page here can
+	 * belong to the anon_vma of a parent process.
+	 */
+	if (anon_vma && !list_is_singular(&vma->anon_vma_chain))
+		return false;
+
+	if (vma->vm_file) {
+		/* see move_ptes() */
+		mapping = vma->vm_file->f_mapping;
+		spin_lock(&mapping->i_mmap_lock);
+		if (new_vma->vm_truncate_count &&
+		    new_vma->vm_truncate_count != vma->vm_truncate_count)
+			new_vma->vm_truncate_count = 0;
+	}
+	if (anon_vma)
+		spin_lock(&anon_vma->lock);
+
+	ptl = pte_lockptr(mm, old_pmd);
+	spin_lock(ptl);
+	pmd = *old_pmd;
+	pmd_clear(old_pmd);
+	set_pmd(new_pmd, pmd);
+	flush_tlb_range(vma, old_addr, old_addr + PMD_SIZE);
+	spin_unlock(ptl);
+
+	if (anon_vma)
+		spin_unlock(&anon_vma->lock);
+	if (mapping)
+		spin_unlock(&mapping->i_mmap_lock);
+
+	return true;
+}
+#else
+static inline bool move_normal_pmd(struct vm_area_struct *vma,
+		unsigned long old_addr, struct vm_area_struct *new_vma,
+		unsigned long new_addr, pmd_t *old_pmd, pmd_t *new_pmd)
+{
+	return false;
+}
+#endif
+
 #define LATENCY_LIMIT	(64 * PAGE_SIZE)
 
 unsigned long move_page_tables(struct vm_area_struct *vma,
 		unsigned long old_addr, struct vm_area_struct *new_vma,
 		unsigned long new_addr, unsigned long len)
 {
-	unsigned long extent, next, old_end;
+	unsigned long extent, next, old_end, old_start;
 	pmd_t *old_pmd, *new_pmd;
 
+	old_start = old_addr;
 	old_end = old_addr + len;
 	flush_cache_range(vma, old_addr, old_end);
+	mmu_notifier_invalidate_range_start(vma->vm_mm, old_start, old_end);
 
 	for (; old_addr < old_end; old_addr += extent, new_addr += extent) {
 		cond_resched();
@@ -153,11 +213,25 @@ unsigned long move_page_tables(struct vm_area_struct *vma,
 		next = (new_addr + PMD_SIZE) & PMD_MASK;
 		if (extent > next - new_addr)
 			extent = next - new_addr;
+		if (pmd_trans_huge(*old_pmd)) {
+			if (extent == HPAGE_PMD_SIZE &&
+			    move_huge_pmd(vma, old_addr, new_addr,
+					  old_pmd, new_pmd))
+				continue;
+			split_huge_pmd(vma, old_pmd, old_addr);
+		} else if (extent == PMD_SIZE &&
+			   move_normal_pmd(vma, old_addr, new_vma, new_addr,
+					   old_pmd, new_pmd))
+			continue;
+		if (!pmd_present(*new_pmd) &&
+		    __pte_alloc(vma->vm_mm, new_pmd, new_addr))
+			break;
 		if (extent > LATENCY_LIMIT)
 			extent = LATENCY_LIMIT;
 		move_ptes(vma, old_pmd, old_addr, old_addr + extent,
 				new_vma, new_pmd, new_addr);
 	}
+	mmu_notifier_invalidate_range_end(vma->vm_mm, old_start, old_end);
 
 	return len + old_addr - old_end;	/* how much done */
 }
@@ -200,6 +274,10 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 	if (!new_vma)
 		return -ENOMEM;
 
+	/* Keep speculative faults away from the ptes while they move */
+	vm_write_begin(vma);
+	if (new_vma != vma)
+		vm_write_begin(new_vma);
 	moved_len = move_page_tables(vma, old_addr, new_vma, new_addr, old_len);
 	if (moved_len < old_len) {
 		/*
@@ -208,6 +286,11 @@ static unsigned long move_vma(struct vm_area_struct *vma,
 		 * and then proceed to unmap new area instead of old.
 		 */
 		move_page_tables(new_vma, new_addr, vma, old_addr, moved_len);
+	}
+	if (new_vma != vma)
+		vm_write_end(new_vma);
+	vm_write_end(vma);
+	if (moved_len < old_len) {
 		vma = new_vma;
 		old_len = new_len;
 		old_addr = new_addr;
@@ -34,26 +34,35 @@
 #include <linux/syscalls.h>
 #include <linux/buffer_head.h>
 #include <linux/pagevec.h>
+#include <linux/memcontrol.h>
 
 /*
- * After a CPU has dirtied this many pages, balance_dirty_pages_ratelimited
+ * After a task has dirtied this many pages, balance_dirty_pages_ratelimited
  * will look to see if it needs to force writeback or throttling.
  */
 static long ratelimit_pages = 32;
 
 /*
- * When balance_dirty_pages decides that the caller needs to perform some
- * non-background writeback, this is how many pages it will attempt to write.
- * It should be somewhat larger than dirtied pages to ensure that reasonably
- * large amounts of I/O are submitted.
+ * Sleep at most 200ms at a time in balance_dirty_pages().
  */
-static inline long sync_writeback_pages(unsigned long dirtied)
-{
-	if (dirtied < ratelimit_pages)
-		dirtied = ratelimit_pages;
+#define MAX_PAUSE		max(HZ/5, 1)
 
-	return dirtied + dirtied / 2;
-}
+/*
+ * Sleep at least 10ms at a time, to not round the pauses down to nothing.
+ */
+#define MIN_PAUSE		max(HZ/100, 1)
+
+/*
+ * Estimate write bandwidth at 200ms intervals.
+ */
+#define BANDWIDTH_INTERVAL	max(HZ/5, 1)
+
+/*
+ * A task is throttled to the bdi's write bandwidth when the bdi reaches its
+ * dirty threshold, and then gradually down to zero when the bdi exceeds its
+ * threshold by 1/DIRTY_SCOPE.
+ */
+#define DIRTY_SCOPE		8
 
 /* The following parameters are exported via /proc/sys/vm */
 
@@ -218,6 +227,7 @@ int dirty_bytes_handler(struct ctl_table *table, int write,
  */
 static inline void __bdi_writeout_inc(struct backing_dev_info *bdi)
 {
+	__inc_bdi_stat(bdi, BDI_WRITTEN);
 	__prop_inc_percpu_max(&vm_completions, &bdi->completions,
 			      bdi->max_prop_frac);
 }
@@ -473,34 +483,170 @@ get_dirty_limits(unsigned long *pbackground, unsigned long *pdirty,
 	}
 }
 
+static void __bdi_update_write_bandwidth(struct backing_dev_info *bdi,
+					 unsigned long elapsed,
+					 unsigned long written)
+{
+	const unsigned long period = roundup_pow_of_two(3 * HZ);
+	unsigned long avg = bdi->avg_write_bandwidth;
+	unsigned long old = bdi->write_bandwidth;
+	u64 bw;
+
+	/*
+	 * bw = written * HZ / elapsed
+	 *
+	 *                   bw * elapsed + write_bandwidth * (period - elapsed)
+	 * write_bandwidth = ---------------------------------------------------
+	 *                                          period
+	 */
+	bw = written - bdi->written_stamp;
+	bw *= HZ;
+	if (unlikely(elapsed > period)) {
+		do_div(bw, elapsed);
+		avg = bw;
+		goto out;
+	}
+	bw += (u64)bdi->write_bandwidth * (period - elapsed);
+	bw >>= ilog2(period);
+
+	/*
+	 * One more level of smoothing, for filtering out sudden spikes
+	 */
+	if (avg > old && old >= (unsigned long)bw)
+		avg -= (avg - old) >> 3;
+
+	if (avg < old && old <= (unsigned long)bw)
+		avg += (old - avg) >> 3;
+
+out:
+	bdi->write_bandwidth = bw;
+	bdi->avg_write_bandwidth = avg;
+}
+
+/**
+ * bdi_update_bandwidth - update the estimated write bandwidth of a bdi
+ * @bdi: the backing device
+ * @start_time: when the caller started writing or being throttled
+ *
+ * Called periodically by the flusher threads and by throttled tasks. Intervals
+ * during which nobody was writing to the device are not accounted, so that an
+ * idle device does not look slow.
+ */
+void bdi_update_bandwidth(struct backing_dev_info *bdi,
+			  unsigned long start_time)
+{
+	unsigned long now = jiffies;
+	unsigned long elapsed = now - bdi->bw_time_stamp;
+	unsigned long written;
+
+	if (elapsed < BANDWIDTH_INTERVAL)
+		return;
+
+	spin_lock(&bdi->bw_lock);
+
+	/* Somebody else updated it meanwhile */
+	elapsed = now - bdi->bw_time_stamp;
+	if (elapsed < BANDWIDTH_INTERVAL)
+		goto unlock;
+
+	written = percpu_counter_read(&bdi->bdi_stat[BDI_WRITTEN]);
+
+	/*
+	 * Skip quiet periods when the disk bandwidth is under-utilized.
+	 * (at least 1s idle time between two flusher runs)
+	 */
+	if (elapsed > HZ && time_before(bdi->bw_time_stamp, start_time))
+		goto snapshot;
+
+	__bdi_update_write_bandwidth(bdi, elapsed, written);
+
+snapshot:
+	bdi->written_stamp = written;
+	bdi->bw_time_stamp = now;
+unlock:
+	spin_unlock(&bdi->bw_lock);
+}
+
+/*
+ * The rate, in pages per second, that a task may dirty pages at when
+ * @dirty pages count against a limit of @thresh: the bdi's write bandwidth
+ * at the limit, scaled down to nothing at 1/DIRTY_SCOPE above it.  0 means
+ * the task should wait for writeback instead.
+ */
+static unsigned long dirty_ratelimit(struct backing_dev_info *bdi,
+				     unsigned long dirty, unsigned long thresh)
+{
+	unsigned long limit = thresh + thresh / DIRTY_SCOPE + 1;
+
+	if (dirty >= limit)
+		return 0;
+
+	return div_u64((u64)bdi->avg_write_bandwidth * (limit - dirty),
+		       limit - thresh);
+}
+
+/*
+ * The same for the dirty limit of the task's memory cgroup, or of the
+ * ancestor furthest over its own under use_hierarchy, and ULONG_MAX while
+ * they are all below their limits.  The flusher is asked to write
+ * out only inodes the cgroup dirtied, so that one cgroup over its limit does
+ * not push out everybody else's dirty pages, nor gets stuck behind them.
+ */
+static unsigned long memcg_dirty_ratelimit(struct backing_dev_info *bdi)
+{
+	struct mem_cgroup_dirty_info info;
+	unsigned long dirty;
+	unsigned short id;
+
+	id = mem_cgroup_dirty_info(determine_dirtyable_memory(), &info);
+	if (!id)
+		return ULONG_MAX;
+
+	/* Queued even behind other work, which need not write for the cgroup */
+	if (info.nr_reclaimable > info.background_thresh)
+		bdi_start_memcg_writeback(bdi, id);
+
+	dirty = info.nr_reclaimable + info.nr_writeback;
+	if (dirty <= info.dirty_thresh)
+		return ULONG_MAX;
+
+	return dirty_ratelimit(bdi, dirty, info.dirty_thresh);
+}
+
 /*
  * balance_dirty_pages() must be called by processes which are generating dirty
- * data.  It looks at the number of dirty pages in the machine and will force
- * the caller to perform writeback if the system is over `vm_dirty_ratio'.
- * If we're over `background_thresh' then the writeback threads are woken to
- * perform some writeout.
+ * data.  It looks at the number of dirty pages in the machine and will throttle
+ * the caller if the system is over `vm_dirty_ratio'.  The caller does no
+ * writeback itself: that is left to the flusher threads, which are woken as
+ * soon as we're over `background_thresh'.
+ *
+ * A throttled task sleeps long enough to make its dirtying rate match the
+ * estimated write bandwidth of the bdi, scaled down linearly from the bdi's
+ * dirty threshold to 1/DIRTY_SCOPE above it.  With many dirtiers the number
+ * of dirty pages settles where their combined rate equals the bandwidth.
+ *
+ * The pause pays for the pages the task dirtied since its last pause.  As
+ * long as they are too few to sleep for MIN_PAUSE, the task carries on and
+ * comes back once it has dirtied enough of them, instead of sleeping for
+ * a pause rounded down to nothing.
  */
-static void balance_dirty_pages(struct address_space *mapping,
-				unsigned long write_chunk)
+static void balance_dirty_pages(struct address_space *mapping)
 {
 	long nr_reclaimable, bdi_nr_reclaimable;
 	long nr_writeback, bdi_nr_writeback;
 	unsigned long background_thresh;
 	unsigned long dirty_thresh;
 	unsigned long bdi_thresh;
-	unsigned long pages_written = 0;
-	unsigned long pause = 1;
+	unsigned long bdi_dirty;
+	unsigned long task_ratelimit;
+	unsigned long start_time = jiffies;
+	long pause;
+	int throttled = 0;
 
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
 
 	for (;;) {
-		struct writeback_control wbc = {
-			.bdi		= bdi,
-			.sync_mode	= WB_SYNC_NONE,
-			.older_than_this = NULL,
-			.nr_to_write	= write_chunk,
-			.range_cyclic	= 1,
-		};
+		task_ratelimit = memcg_dirty_ratelimit(bdi);
 
 		get_dirty_limits(&background_thresh, &dirty_thresh,
 				&bdi_thresh, bdi);
@@ -509,40 +655,6 @@ static void balance_dirty_pages(struct address_space *mapping,
 					global_page_state(NR_UNSTABLE_NFS);
 		nr_writeback = global_page_state(NR_WRITEBACK);
 
-		bdi_nr_reclaimable = bdi_stat(bdi, BDI_RECLAIMABLE);
-		bdi_nr_writeback = bdi_stat(bdi, BDI_WRITEBACK);
-
-		if (bdi_nr_reclaimable + bdi_nr_writeback <= bdi_thresh)
-			break;
-
-		/*
-		 * Throttle it only when the background writeback cannot
-		 * catch-up. This avoids (excessively) small writeouts
-		 * when the bdi limits are ramping up.
-		 */
-		if (nr_reclaimable + nr_writeback <
-				(background_thresh + dirty_thresh) / 2)
-			break;
-
-		if (!bdi->dirty_exceeded)
-			bdi->dirty_exceeded = 1;
-
-		/* Note: nr_reclaimable denotes nr_dirty + nr_unstable.
-		 * Unstable writes are a feature of certain networked
-		 * filesystems (i.e. NFS) in which data may have been
-		 * written to the server's write cache, but has not yet
-		 * been flushed to permanent storage.
-		 * Only move pages to writeback if this bdi is over its
-		 * threshold otherwise wait until the disk writes catch
-		 * up.
-		 */
-		if (bdi_nr_reclaimable > bdi_thresh) {
-			writeback_inodes_wbc(&wbc);
-			pages_written += write_chunk - wbc.nr_to_write;
-			get_dirty_limits(&background_thresh, &dirty_thresh,
-				       &bdi_thresh, bdi);
-		}
-
 		/*
 		 * In order to avoid the stacked BDI deadlock we need
 		 * to ensure we accurately count the 'dirty' pages when
@@ -556,30 +668,69 @@ static void balance_dirty_pages(struct address_space *mapping,
 		if (bdi_thresh < 2*bdi_stat_error(bdi)) {
 			bdi_nr_reclaimable = bdi_stat_sum(bdi, BDI_RECLAIMABLE);
 			bdi_nr_writeback = bdi_stat_sum(bdi, BDI_WRITEBACK);
-		} else if (bdi_nr_reclaimable) {
+		} else {
 			bdi_nr_reclaimable = bdi_stat(bdi, BDI_RECLAIMABLE);
 			bdi_nr_writeback = bdi_stat(bdi, BDI_WRITEBACK);
 		}
+		bdi_dirty = bdi_nr_reclaimable + bdi_nr_writeback;
+
+		/*
+		 * Throttle it only when the background writeback cannot
+		 * catch-up. This avoids (excessively) small writeouts
+		 * when the bdi limits are ramping up.
+		 */
+		if (bdi_dirty > bdi_thresh &&
+		    nr_reclaimable + nr_writeback >=
+				(background_thresh + dirty_thresh) / 2) {
+			if (!bdi->dirty_exceeded)
+				bdi->dirty_exceeded = 1;
+			throttled = 1;
+
+			/* The flusher thread does the actual writeout */
+			if (!writeback_in_progress(bdi))
+				bdi_start_writeback(bdi, NULL, 0);
+
+			task_ratelimit = min(task_ratelimit,
+					     dirty_ratelimit(bdi, bdi_dirty,
+							     bdi_thresh));
+		}
+
+		/* Below all the limits, nothing to pay for */
+		if (task_ratelimit == ULONG_MAX) {
+			current->nr_dirtied = 0;
+			current->nr_dirtied_pause = ratelimit_pages;
+			break;
+		}
+
+		bdi_update_bandwidth(bdi, start_time);
 
-		if (bdi_nr_reclaimable + bdi_nr_writeback <= bdi_thresh)
+		if (task_ratelimit)
+			pause = HZ * (unsigned long)current->nr_dirtied /
+				task_ratelimit;
+		else
+			pause = MAX_PAUSE;
+		current->nr_dirtied_pause = task_ratelimit * MIN_PAUSE / HZ + 1;
+
+		/* Too few pages yet to sleep for, keep counting them */
+		if (pause < MIN_PAUSE)
 			break;
-		if (pages_written >= write_chunk)
-			break;		/* We've done our duty */
 
 		__set_current_state(TASK_INTERRUPTIBLE);
-		io_schedule_timeout(pause);
+		io_schedule_timeout(min_t(long, pause, MAX_PAUSE));
+		current->nr_dirtied = 0;
 
 		/*
-		 * Increase the delay for each loop, up to our previous
-		 * default of taking a 100ms nap.
+		 * The pause has paid for the pages dirtied, unless the bdi
+		 * is over its limit: then wait for the flusher to catch up.
 		 */
-		pause <<= 1;
-		if (pause > HZ / 10)
-			pause = HZ / 10;
+		if (task_ratelimit)
+			break;
+
+		if (fatal_signal_pending(current))
+			break;
 	}
 
-	if (bdi_nr_reclaimable + bdi_nr_writeback < bdi_thresh &&
-			bdi->dirty_exceeded)
+	if (bdi_dirty < bdi_thresh && bdi->dirty_exceeded)
 		bdi->dirty_exceeded = 0;
 
 	if (writeback_in_progress(bdi))
@@ -593,7 +744,7 @@ static void balance_dirty_pages(struct address_space *mapping,
 	 * In normal mode, we start background writeout at the lower
 	 * background_thresh, to keep the amount of dirty memory low.
 	 */
-	if ((laptop_mode && pages_written) ||
+	if ((laptop_mode && throttled) ||
 	    (!laptop_mode && ((global_page_state(NR_FILE_DIRTY)
 			       + global_page_state(NR_UNSTABLE_NFS))
 					  > background_thresh)))
@@ -610,8 +761,6 @@ void set_page_dirty_balance(struct page *page, int page_mkwrite)
 	}
 }
 
-static DEFINE_PER_CPU(unsigned long, bdp_ratelimits) = 0;
-
 /**
  * balance_dirty_pages_ratelimited_nr - balance dirty memory state
  * @mapping: address_space which was dirtied
@@ -622,35 +771,24 @@ static DEFINE_PER_CPU(unsigned long, bdp_ratelimits) = 0;
  * dirty state and will initiate writeback if needed.
  *
  * On really big machines, get_writeback_state is expensive, so try to avoid
- * calling it too often (ratelimiting).  But once we're over the dirty memory
- * limit we decrease the ratelimiting by a lot, to prevent individual processes
- * from overshooting the limit by (ratelimit_pages) each.
+ * calling it too often (ratelimiting).  The pages are counted per task,
+ * and balance_dirty_pages() sets how many more the task may dirty before
+ * it comes back.  But once we're over the dirty memory limit we decrease
+ * the ratelimiting by a lot, to prevent individual processes from
+ * overshooting the limit by (ratelimit_pages) each.
  */
 void balance_dirty_pages_ratelimited_nr(struct address_space *mapping,
 					unsigned long nr_pages_dirtied)
 {
-	unsigned long ratelimit;
-	unsigned long *p;
+	int ratelimit;
 
-	ratelimit = ratelimit_pages;
+	ratelimit = current->nr_dirtied_pause;
 	if (mapping->backing_dev_info->dirty_exceeded)
-		ratelimit = 8;
+		ratelimit = min(ratelimit, 8);
 
-	/*
-	 * Check the rate limiting. Also, we do not want to throttle real-time
-	 * tasks in balance_dirty_pages(). Period.
-	 */
-	preempt_disable();
-	p =  &__get_cpu_var(bdp_ratelimits);
-	*p += nr_pages_dirtied;
-	if (unlikely(*p >= ratelimit)) {
-		ratelimit = sync_writeback_pages(*p);
-		*p = 0;
-		preempt_enable();
-		balance_dirty_pages(mapping, ratelimit);
-		return;
-	}
-	preempt_enable();
+	current->nr_dirtied += nr_pages_dirtied;
+	if (unlikely(current->nr_dirtied >= ratelimit))
+		balance_dirty_pages(mapping);
 }
 EXPORT_SYMBOL(balance_dirty_pages_ratelimited_nr);
 
@@ -1079,6 +1217,7 @@ void account_page_dirtied(struct page *page, struct address_space *mapping)
 {
 	if (mapping_cap_account_dirty(mapping)) {
 		__inc_zone_page_state(page, NR_FILE_DIRTY);
+		mem_cgroup_inc_page_stat(page, MEMCG_NR_FILE_DIRTY);
 		__inc_bdi_stat(mapping->backing_dev_info, BDI_RECLAIMABLE);
 		task_dirty_inc(current);
 		task_io_account_write(PAGE_CACHE_SIZE);
@@ -1254,6 +1393,7 @@ int clear_page_dirty_for_io(struct page *page)
 		 */
 		if (TestClearPageDirty(page)) {
 			dec_zone_page_state(page, NR_FILE_DIRTY);
+			mem_cgroup_dec_page_stat(page, MEMCG_NR_FILE_DIRTY);
 			dec_bdi_stat(mapping->backing_dev_info,
 					BDI_RECLAIMABLE);
 			return 1;
@@ -1288,8 +1428,10 @@ int test_clear_page_writeback(struct page *page)
 	} else {
 		ret = TestClearPageWriteback(page);
 	}
-	if (ret)
+	if (ret) {
 		dec_zone_page_state(page, NR_WRITEBACK);
+		mem_cgroup_dec_page_stat(page, MEMCG_NR_FILE_WRITEBACK);
+	}
 	return ret;
 }
 
@@ -1319,8 +1461,10 @@ int test_set_page_writeback(struct page *page)
 	} else {
 		ret = TestSetPageWriteback(page);
 	}
-	if (!ret)
+	if (!ret) {
 		inc_zone_page_state(page, NR_WRITEBACK);
+		mem_cgroup_inc_page_stat(page, MEMCG_NR_FILE_WRITEBACK);
+	}
 	return ret;
 
 }
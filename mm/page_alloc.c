@@ -49,6 +49,7 @@
 #include <linux/debugobjects.h>
 #include <linux/kmemleak.h>
 #include <linux/memory.h>
+#include <linux/compaction.h>
 #include <trace/events/kmem.h>
 #include <linux/ftrace_event.h>
 
@@ -1187,6 +1188,51 @@ void split_page(struct page *page, unsigned int order)
 		set_page_refcounted(page + i);
 }
 
+/*
+ * Similar to split_page except the page is already free. As this is only
+ * being used for migration, the migratetype of the block also changes.
+ * As this is called with interrupts disabled, the caller is responsible
+ * for calling arch_alloc_page() and kernel_map_page() after interrupts
+ * are enabled.
+ *
+ * Note: this is probably too low level an operation for use in drivers.
+ * Please consult with lkml before using this in your driver.
+ */
+int split_free_page(struct page *page)
+{
+	unsigned int order;
+	unsigned long watermark;
+	struct zone *zone;
+
+	BUG_ON(!PageBuddy(page));
+
+	zone = page_zone(page);
+	order = page_order(page);
+
+	/* Obey watermarks as if the page was being allocated */
+	watermark = low_wmark_pages(zone) + (1 << order);
+	if (!zone_watermark_ok(zone, 0, watermark, 0, 0))
+		return 0;
+
+	/* Remove page from free list */
+	list_del(&page->lru);
+	zone->free_area[order].nr_free--;
+	rmv_page_order(page);
+	__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
+
+	/* Split into individual pages */
+	set_page_refcounted(page);
+	split_page(page, order);
+
+	if (order >= pageblock_order - 1) {
+		struct page *endpage = page + (1 << order) - 1;
+		for (; page < endpage; page += pageblock_nr_pages)
+			set_pageblock_migratetype(page, MIGRATE_MOVABLE);
+	}
+
+	return 1 << order;
+}
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -1693,6 +1739,61 @@ out:
 	return page;
 }
 
+#ifdef CONFIG_COMPACTION
+/* Try memory compaction for high-order allocations before reclaim */
+static struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags, struct zone *preferred_zone,
+	int migratetype, unsigned long *did_some_progress)
+{
+	struct page *page;
+
+	if (!order || compaction_deferred(preferred_zone))
+		return NULL;
+
+	*did_some_progress = try_to_compact_pages(zonelist, order, gfp_mask,
+								nodemask);
+	if (*did_some_progress != COMPACT_SKIPPED) {
+
+		/* Page migration frees to the PCP lists but we want merging */
+		drain_pages(get_cpu());
+		put_cpu();
+
+		page = get_page_from_freelist(gfp_mask, nodemask,
+				order, zonelist, high_zoneidx,
+				alloc_flags, preferred_zone,
+				migratetype);
+		if (page) {
+			compaction_succeeded(preferred_zone);
+			count_vm_event(COMPACTSUCCESS);
+			return page;
+		}
+
+		/*
+		 * It's bad if compaction run occurs and fails.
+		 * The most likely reason is that pages exist,
+		 * but not enough to satisfy watermarks.
+		 */
+		count_vm_event(COMPACTFAIL);
+		defer_compaction(preferred_zone);
+
+		cond_resched();
+	}
+
+	return NULL;
+}
+#else
+static inline struct page *
+__alloc_pages_direct_compact(gfp_t gfp_mask, unsigned int order,
+	struct zonelist *zonelist, enum zone_type high_zoneidx,
+	nodemask_t *nodemask, int alloc_flags, struct zone *preferred_zone,
+	int migratetype, unsigned long *did_some_progress)
+{
+	return NULL;
+}
+#endif /* CONFIG_COMPACTION */
+
 /* The really slow allocator path where we enter direct reclaim */
 static inline struct page *
 __alloc_pages_direct_reclaim(gfp_t gfp_mask, unsigned int order,
@@ -1879,6 +1980,15 @@ rebalance:
 	if (test_thread_flag(TIF_MEMDIE) && !(gfp_mask & __GFP_NOFAIL))
 		goto nopage;
 
+	/* Try direct compaction */
+	page = __alloc_pages_direct_compact(gfp_mask, order,
+					zonelist, high_zoneidx,
+					nodemask,
+					alloc_flags, preferred_zone,
+					migratetype, &did_some_progress);
+	if (page)
+		goto got_pg;
+
 	/* Try direct reclaim and then allocating */
 	page = __alloc_pages_direct_reclaim(gfp_mask, order,
 					zonelist, high_zoneidx,
@@ -1989,6 +2099,165 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
 
+static inline void bulk_add_page(struct page *page, struct list_head *page_list,
+				 struct page **page_array, unsigned long *idx)
+{
+	if (page_list) {
+		list_add_tail(&page->lru, page_list);
+		return;
+	}
+
+	while (page_array[*idx])
+		(*idx)++;
+	page_array[*idx] = page;
+}
+
+/**
+ * __alloc_pages_bulk_nodemask - allocate a batch of order-0 pages
+ * @gfp_mask: GFP flags for the allocation
+ * @zonelist: zonelist to allocate from
+ * @nodemask: set of nodes to allocate from, may be NULL
+ * @nr_pages: number of pages wanted
+ * @page_list: list to add the pages to, or NULL
+ * @page_array: array to store the pages in if @page_list is NULL
+ *
+ * Allocating N pages with alloc_pages() takes the per-cpu list and, every
+ * pcp->batch pages, zone->lock once per page. This takes the whole batch
+ * from the first zone in @zonelist that can satisfy it above the low
+ * watermark, with interrupts off and zone->lock held once per pcp->batch
+ * pages rather than once per page. Whatever cannot be taken that way
+ * (no zone has enough free pages, bad pages) is filled in one page at a time
+ * through the normal allocator, which may reclaim if @gfp_mask allows it.
+ *
+ * Entries of @page_array that are already set are left alone, so a caller
+ * can retry a partially filled array.
+ *
+ * Returns the number of pages added to @page_list, or the number of
+ * populated entries in @page_array. This can be less than @nr_pages.
+ */
+unsigned long
+__alloc_pages_bulk_nodemask(gfp_t gfp_mask, struct zonelist *zonelist,
+			    nodemask_t *nodemask, unsigned long nr_pages,
+			    struct list_head *page_list, struct page **page_array)
+{
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	int migratetype = allocflags_to_migratetype(gfp_mask);
+	int cold = !!(gfp_mask & __GFP_COLD);
+	struct zone *preferred_zone, *zone;
+	struct zoneref *z;
+	struct per_cpu_pages *pcp;
+	struct list_head *list;
+	struct page *page;
+	unsigned long flags, i, nr_wanted, nr_taken = 0;
+	unsigned long nr_chunk, max_chunk, want;
+	unsigned long nr_populated = 0, idx = 0;
+	LIST_HEAD(batch);
+
+	gfp_mask &= gfp_allowed_mask;
+
+	if (page_array) {
+		for (i = 0; i < nr_pages; i++)
+			if (page_array[i])
+				nr_populated++;
+	}
+	nr_wanted = nr_pages - nr_populated;
+
+	/* A single page is no cheaper in bulk */
+	if (nr_wanted <= 1)
+		goto fallback;
+
+	lockdep_trace_alloc(gfp_mask);
+
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	if (should_fail_alloc_page(gfp_mask, 0))
+		goto fallback;
+
+	if (unlikely(!zonelist->_zonerefs->zone))
+		return nr_populated;
+
+	first_zones_zonelist(zonelist, high_zoneidx, nodemask, &preferred_zone);
+	if (!preferred_zone)
+		return nr_populated;
+
+	/*
+	 * Only take the whole batch from a zone that stays above the low
+	 * watermark afterwards; anything tighter goes through the slowpath.
+	 */
+	for_each_zone_zonelist_nodemask(zone, z, zonelist,
+						high_zoneidx, nodemask) {
+		if (!cpuset_zone_allowed_softwall(zone, gfp_mask|__GFP_HARDWALL))
+			continue;
+		if (zone_watermark_ok(zone, 0, low_wmark_pages(zone) + nr_wanted,
+				      zone_idx(preferred_zone), 0))
+			break;
+	}
+	if (!zone)
+		goto fallback;
+
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	max_chunk = max(pcp->batch, 1);
+	list = &pcp->lists[migratetype];
+	while (nr_taken < nr_wanted && !list_empty(list)) {
+		if (cold)
+			page = list_entry(list->prev, struct page, lru);
+		else
+			page = list_entry(list->next, struct page, lru);
+		list_move_tail(&page->lru, &batch);
+		pcp->count--;
+		nr_taken++;
+	}
+	want = nr_chunk = nr_taken;
+
+	/*
+	 * Take the rest from the buddy lists a pcp batch at a time, with
+	 * interrupts back on in between: a large vmalloc() must not keep
+	 * them off for thousands of pages.
+	 */
+	for (;;) {
+		__count_zone_vm_events(PGALLOC, zone, nr_chunk);
+		for (i = 0; i < nr_chunk; i++)
+			zone_statistics(preferred_zone, zone);
+		local_irq_restore(flags);
+
+		/* done, or the zone ran out */
+		if (nr_taken == nr_wanted || nr_chunk < want)
+			break;
+
+		want = min(nr_wanted - nr_taken, max_chunk);
+		local_irq_save(flags);
+		nr_chunk = rmqueue_bulk(zone, 0, want, &batch,
+					migratetype, cold);
+		nr_taken += nr_chunk;
+	}
+
+	while (!list_empty(&batch)) {
+		page = list_first_entry(&batch, struct page, lru);
+		list_del(&page->lru);
+
+		VM_BUG_ON(bad_range(zone, page));
+		if (prep_new_page(page, 0, gfp_mask))
+			continue;
+
+		trace_mm_page_alloc(page, 0, gfp_mask, migratetype);
+		bulk_add_page(page, page_list, page_array, &idx);
+		nr_populated++;
+	}
+
+fallback:
+	while (nr_populated < nr_pages) {
+		page = __alloc_pages_nodemask(gfp_mask, 0, zonelist, nodemask);
+		if (!page)
+			break;
+		bulk_add_page(page, page_list, page_array, &idx);
+		nr_populated++;
+	}
+
+	return nr_populated;
+}
+EXPORT_SYMBOL(__alloc_pages_bulk_nodemask);
+
 /*
  * Common helper functions.
  */
@@ -3808,12 +4077,16 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 	pgdat->nr_zones = 0;
 	init_waitqueue_head(&pgdat->kswapd_wait);
 	pgdat->kswapd_max_order = 0;
+#ifdef CONFIG_NUMA_BALANCING
+	spin_lock_init(&pgdat->numabalancing_migrate_lock);
+	pgdat->numabalancing_migrate_nr_pages = 0;
+	pgdat->numabalancing_migrate_next_window = jiffies;
+#endif
 	pgdat_page_cgroup_init(pgdat);
 	
 	for (j = 0; j < MAX_NR_ZONES; j++) {
 		struct zone *zone = pgdat->node_zones + j;
 		unsigned long size, realsize, memmap_pages;
-		enum lru_list l;
 
 		size = zone_spanned_pages_in_node(nid, j, zones_size);
 		realsize = size - zone_absent_pages_in_node(nid, j,
@@ -3858,21 +4131,13 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 #endif
 		zone->name = zone_names[j];
 		spin_lock_init(&zone->lock);
-		spin_lock_init(&zone->lru_lock);
 		zone_seqlock_init(zone);
 		zone->zone_pgdat = pgdat;
 
 		zone->prev_priority = DEF_PRIORITY;
 
 		zone_pcp_init(zone);
-		for_each_lru(l) {
-			INIT_LIST_HEAD(&zone->lru[l].list);
-			zone->reclaim_stat.nr_saved_scan[l] = 0;
-		}
-		zone->reclaim_stat.recent_rotated[0] = 0;
-		zone->reclaim_stat.recent_rotated[1] = 0;
-		zone->reclaim_stat.recent_scanned[0] = 0;
-		zone->reclaim_stat.recent_scanned[1] = 0;
+		lruvec_init(&zone->lruvec);
 		zap_zone_vm_stats(zone);
 		zone->flags = 0;
 		if (!size)
@@ -0,0 +1,103 @@
+/*
+ * mm/page_alloc_bulk-test.c
+ *
+ * Times allocating and freeing batches of order-0 pages one at a time with
+ * alloc_page() against a single alloc_pages_bulk() call, and reports the
+ * pages per second of each.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/list.h>
+#include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+
+static unsigned long batch = 256;
+module_param(batch, ulong, 0444);
+MODULE_PARM_DESC(batch, "Number of pages allocated per batch");
+
+static unsigned long loops = 4096;
+module_param(loops, ulong, 0444);
+MODULE_PARM_DESC(loops, "Number of batches allocated and freed");
+
+static u64 pages_per_sec(unsigned long nr_pages, ktime_t start)
+{
+	s64 ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	if (ns <= 0)
+		ns = 1;
+	return div64_u64((u64)nr_pages * NSEC_PER_SEC, ns);
+}
+
+static unsigned long run_single(void)
+{
+	unsigned long i, nr, total = 0;
+	struct page *page;
+	LIST_HEAD(pages);
+
+	for (i = 0; i < loops; i++) {
+		for (nr = 0; nr < batch; nr++) {
+			page = alloc_page(GFP_KERNEL);
+			if (!page)
+				break;
+			list_add(&page->lru, &pages);
+		}
+		total += nr;
+		put_pages_list(&pages);
+		cond_resched();
+	}
+	return total;
+}
+
+static unsigned long run_bulk(void)
+{
+	unsigned long i, total = 0;
+	LIST_HEAD(pages);
+
+	for (i = 0; i < loops; i++) {
+		total += alloc_pages_bulk(GFP_KERNEL, batch, &pages);
+		put_pages_list(&pages);
+		cond_resched();
+	}
+	return total;
+}
+
+static int __init page_alloc_bulk_test_init(void)
+{
+	unsigned long nr;
+	ktime_t start;
+
+	if (!batch || !loops)
+		return -EINVAL;
+
+	pr_info("page_alloc_bulk: %lu batches of %lu pages\n", loops, batch);
+
+	start = ktime_get();
+	nr = run_single();
+	pr_info("page_alloc_bulk: alloc_page:       %llu pages/sec\n",
+		(unsigned long long)pages_per_sec(nr, start));
+
+	start = ktime_get();
+	nr = run_bulk();
+	pr_info("page_alloc_bulk: alloc_pages_bulk: %llu pages/sec\n",
+		(unsigned long long)pages_per_sec(nr, start));
+
+	return 0;
+}
+module_init(page_alloc_bulk_test_init);
+
+static void __exit page_alloc_bulk_test_exit(void)
+{
+}
+module_exit(page_alloc_bulk_test_exit);
+
+MODULE_LICENSE("GPL");
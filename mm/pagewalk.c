@@ -34,17 +34,26 @@ static int walk_pmd_range(pud_t *pud, unsigned long addr, unsigned long end,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd)) {
+		if (pmd_none(*pmd) ||
+		    (!pmd_trans_huge(*pmd) && pmd_none_or_clear_bad(pmd))) {
 			if (walk->pte_hole)
 				err = walk->pte_hole(addr, next, walk);
 			if (err)
 				break;
 			continue;
 		}
+		/*
+		 * ->pmd_entry is handed a transparent huge pmd as it is, and
+		 * has to deal with it; ->pte_entry only sees it split.
+		 */
 		if (walk->pmd_entry)
 			err = walk->pmd_entry(pmd, addr, next, walk);
-		if (!err && walk->pte_entry)
-			err = walk_pte_range(pmd, addr, next, walk);
+		if (!err && walk->pte_entry) {
+			if (pmd_trans_huge(*pmd))
+				split_huge_pmd(find_vma(walk->mm, addr), pmd, addr);
+			if (!pmd_none_or_trans_huge_or_clear_bad(pmd))
+				err = walk_pte_range(pmd, addr, next, walk);
+		}
 		if (err)
 			break;
 	} while (pmd++, addr = next, addr != end);
@@ -150,6 +150,8 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	struct page *page;
 	unsigned long end_index;	/* The last page we want to read */
 	LIST_HEAD(page_pool);
+	LIST_HEAD(free_pages);
+	unsigned long nr_missing = 0;
 	int page_idx;
 	int ret = 0;
 	loff_t isize = i_size_read(inode);
@@ -159,6 +161,25 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 
 	end_index = ((isize - 1) >> PAGE_CACHE_SHIFT);
 
+	/*
+	 * Count the holes first so that the pages can be taken from the
+	 * allocator in one go rather than one page at a time.
+	 */
+	rcu_read_lock();
+	for (page_idx = 0; page_idx < nr_to_read; page_idx++) {
+		pgoff_t page_offset = offset + page_idx;
+
+		if (page_offset > end_index)
+			break;
+		page = radix_tree_lookup(&mapping->page_tree, page_offset);
+		if (!page || radix_tree_exceptional_entry(page))
+			nr_missing++;
+	}
+	rcu_read_unlock();
+
+	if (nr_missing)
+		page_cache_alloc_cold_bulk(mapping, nr_missing, &free_pages);
+
 	/*
 	 * Preallocate as many pages as we will need.
 	 */
@@ -171,12 +192,13 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 		rcu_read_lock();
 		page = radix_tree_lookup(&mapping->page_tree, page_offset);
 		rcu_read_unlock();
-		if (page)
+		if (page && !radix_tree_exceptional_entry(page))
 			continue;
 
-		page = page_cache_alloc_cold(mapping);
-		if (!page)
+		if (list_empty(&free_pages))
 			break;
+		page = list_first_entry(&free_pages, struct page, lru);
+		list_del(&page->lru);
 		page->index = page_offset;
 		list_add(&page->lru, &page_pool);
 		if (page_idx == nr_to_read - lookahead_size)
@@ -192,6 +214,9 @@ __do_page_cache_readahead(struct address_space *mapping, struct file *filp,
 	if (ret)
 		read_pages(mapping, filp, &page_pool, ret);
 	BUG_ON(!list_empty(&page_pool));
+
+	/* Pages that showed up in the cache meanwhile leave spares behind */
+	put_pages_list(&free_pages);
 out:
 	return ret;
 }
@@ -249,6 +274,7 @@ unsigned long ra_submit(struct file_ra_state *ra,
 
 	actual = __do_page_cache_readahead(mapping, filp,
 					ra->start, ra->size, ra->async_size);
+	__add_bdi_stat(mapping->backing_dev_info, BDI_RA_PAGES, actual);
 
 	return actual;
 }
@@ -283,6 +309,9 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
 	unsigned long cur = ra->size;
 	unsigned long newsize;
 
+	if (ra->size_cap && ra->size_cap < max)
+		max = ra->size_cap;
+
 	if (cur < max / 16)
 		newsize = 4 * cur;
 	else
@@ -328,7 +357,133 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  *
  * The code ramps up the readahead size aggressively at first, but slow down as
  * it approaches max_readhead.
+ *
+ * Besides the current stream, the windows of the last RA_NR_STREAMS streams
+ * are remembered, so that interleaved sequential reads on one file each keep
+ * their own window instead of resetting each other's.
+ *
+ * If a page inside the current window is missing, the readahead pages were
+ * evicted before the application got to them. The window of that stream is
+ * then capped to half its size; the cap is relaxed again while the stream
+ * keeps consuming its windows.
+ *
+ * Small reads at a fixed distance from each other are detected as a strided
+ * stream, and the next few strides are read ahead, with the PG_readahead
+ * marker on the last one.
+ */
+
+#define MIN_RA_CAP	4	/* smallest window after thrashing */
+#define MAX_RA_STRIDES	8	/* strides to read ahead at most */
+
+/*
+ * Remember the current window before starting a new stream.
+ */
+static void ra_push_stream(struct file_ra_state *ra)
+{
+	struct file_ra_stream *s = ra->streams;
+
+	if (!ra->size || ra->size > USHORT_MAX)
+		return;
+
+	memmove(s + 1, s, (RA_NR_STREAMS - 1) * sizeof(*s));
+	s->start = ra->start;
+	s->size = ra->size;
+	s->async_size = ra->async_size;
+	s->size_cap = min_t(unsigned int, ra->size_cap, USHORT_MAX);
+}
+
+/*
+ * Is @offset the expected callback offset of a remembered stream?
+ * If so, make it the current one.
+ */
+static int ra_resume_stream(struct file_ra_state *ra, pgoff_t offset)
+{
+	struct file_ra_stream *s = ra->streams;
+	struct file_ra_stream found;
+	int i;
+
+	for (i = 0; i < RA_NR_STREAMS; i++) {
+		if (!s[i].size)
+			continue;
+		if (offset == s[i].start + s[i].size - s[i].async_size ||
+		    offset == s[i].start + s[i].size)
+			break;
+	}
+	if (i == RA_NR_STREAMS)
+		return 0;
+
+	found = s[i];
+	memmove(s + i, s + i + 1, (RA_NR_STREAMS - 1 - i) * sizeof(*s));
+	memset(s + RA_NR_STREAMS - 1, 0, sizeof(*s));
+	ra_push_stream(ra);
+
+	ra->start = found.start;
+	ra->size = found.size;
+	ra->async_size = found.async_size;
+	ra->size_cap = found.size_cap;
+	return 1;
+}
+
+/*
+ * The current stream consumed its window: relax the thrashing cap.
+ */
+static void ra_stream_hit(struct address_space *mapping,
+			  struct file_ra_state *ra, unsigned long max)
+{
+	if (ra->size_cap) {
+		ra->size_cap += ra->size_cap / 4 + 1;
+		if (ra->size_cap >= max)
+			ra->size_cap = 0;
+	}
+	__inc_bdi_stat(mapping->backing_dev_info, BDI_RA_HIT);
+}
+
+/*
+ * Track small random reads, and return true once they have been found at
+ * the same distance from each other a few times.
+ */
+static int ra_stride_detect(struct file_ra_state *ra, pgoff_t offset,
+			    unsigned long req_size)
+{
+	long delta = (long)(offset - ra->stride_last);
+
+	if (ra->stride && delta == ra->stride) {
+		ra->stride_count++;
+	} else {
+		ra->stride = delta > (long)req_size ? delta : 0;
+		ra->stride_count = 0;
+	}
+	ra->stride_last = offset;
+
+	return ra->stride_count > 0;
+}
+
+/*
+ * Read ahead the next strides after @offset, marking the last one.
  */
+static unsigned long ra_submit_strides(struct address_space *mapping,
+				       struct file_ra_state *ra,
+				       struct file *filp, pgoff_t offset,
+				       unsigned long req_size,
+				       unsigned long max)
+{
+	unsigned long i, n, actual = 0;
+
+	if (!req_size)
+		return 0;
+
+	n = min_t(unsigned long, ra->stride_count, MAX_RA_STRIDES);
+	n = min(n, max / req_size);
+	for (i = 1; i <= n; i++)
+		actual += __do_page_cache_readahead(mapping, filp,
+					offset + i * ra->stride, req_size,
+					i == n ? req_size : 0);
+	if (n)
+		ra->stride_last = offset + n * ra->stride;
+	__add_bdi_stat(mapping->backing_dev_info, BDI_RA_PAGES, actual);
+
+	return actual;
+}
 
 /*
  * Count contiguously cached pages from @offset-1 to @offset-@max,
@@ -343,20 +498,22 @@ static pgoff_t count_history_pages(struct address_space *mapping,
 	pgoff_t head;
 
 	rcu_read_lock();
-	head = radix_tree_prev_hole(&mapping->page_tree, offset - 1, max);
+	head = page_cache_prev_hole(mapping, offset - 1, max);
 	rcu_read_unlock();
 
 	return offset - 1 - head;
 }
 
 /*
- * page cache context based read-ahead
+ * page cache context based read-ahead: returns the size of the window to
+ * start at @offset, or 0 if this looks like a random read.  @ra is left
+ * alone, so that the caller can remember the current window first.
  */
-static int try_context_readahead(struct address_space *mapping,
-				 struct file_ra_state *ra,
-				 pgoff_t offset,
-				 unsigned long req_size,
-				 unsigned long max)
+static unsigned long context_readahead_size(struct address_space *mapping,
+					    struct file_ra_state *ra,
+					    pgoff_t offset,
+					    unsigned long req_size,
+					    unsigned long max)
 {
 	pgoff_t size;
 
@@ -376,11 +533,7 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
-	ra->start = offset;
-	ra->size = get_init_ra_size(size + req_size, max);
-	ra->async_size = ra->size;
-
-	return 1;
+	return get_init_ra_size(size + req_size, max);
 }
 
 /*
@@ -393,12 +546,13 @@ ondemand_readahead(struct address_space *mapping,
 		   unsigned long req_size)
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
+	unsigned long size;
 
 	/*
 	 * start of file
 	 */
 	if (!offset)
-		goto initial_readahead;
+		goto new_stream;
 
 	/*
 	 * It's the expected callback offset, assume sequential access.
@@ -406,12 +560,41 @@ ondemand_readahead(struct address_space *mapping,
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
+sequential:
+		ra_stream_hit(mapping, ra, max);
 		ra->start += ra->size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
 		goto readit;
 	}
 
+	/*
+	 * Hit the marker on the last read ahead stride.
+	 */
+	if (hit_readahead_marker && ra->stride && ra->stride_count &&
+	    offset == ra->stride_last) {
+		ra->stride_count++;
+		__inc_bdi_stat(mapping->backing_dev_info, BDI_RA_HIT);
+		return ra_submit_strides(mapping, ra, filp, offset,
+					 req_size, max);
+	}
+
+	/*
+	 * Interleaved reads: another stream on this file continues.
+	 */
+	if (ra_resume_stream(ra, offset))
+		goto sequential;
+
+	/*
+	 * A page of the current window is missing: it has been evicted
+	 * before it could be used. Restart the stream at half the size.
+	 */
+	if (!hit_readahead_marker && ra_has_index(ra, offset)) {
+		ra->size_cap = max_t(unsigned long, ra->size / 2, MIN_RA_CAP);
+		__inc_bdi_stat(mapping->backing_dev_info, BDI_RA_MISS);
+		goto initial_readahead;
+	}
+
 	/*
 	 * Hit a marked page without valid readahead state.
 	 * E.g. interleaved reads.
@@ -422,12 +605,14 @@ ondemand_readahead(struct address_space *mapping,
 		pgoff_t start;
 
 		rcu_read_lock();
-		start = radix_tree_next_hole(&mapping->page_tree, offset+1,max);
+		start = page_cache_next_hole(mapping, offset+1,max);
 		rcu_read_unlock();
 
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_push_stream(ra);
+		ra->size_cap = 0;
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
@@ -440,30 +625,50 @@ ondemand_readahead(struct address_space *mapping,
 	 * oversize read
 	 */
 	if (req_size > max)
-		goto initial_readahead;
+		goto new_stream;
 
 	/*
 	 * sequential cache miss
 	 */
 	if (offset - (ra->prev_pos >> PAGE_CACHE_SHIFT) <= 1UL)
-		goto initial_readahead;
+		goto new_stream;
 
 	/*
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
 	 */
-	if (try_context_readahead(mapping, ra, offset, req_size, max))
+	size = context_readahead_size(mapping, ra, offset, req_size, max);
+	if (size) {
+		ra_push_stream(ra);
+		ra->size_cap = 0;
+		ra->start = offset;
+		ra->size = size;
+		ra->async_size = size;
 		goto readit;
+	}
 
 	/*
 	 * standalone, small random read
-	 * Read as is, and do not pollute the readahead state.
+	 * Read as is, and do not pollute the readahead window; only the
+	 * stride tracking looks at it, in case it is a strided stream.
 	 */
+	if (ra_stride_detect(ra, offset, req_size)) {
+		unsigned long actual;
+
+		actual = __do_page_cache_readahead(mapping, filp, offset,
+						   req_size, 0);
+		return actual + ra_submit_strides(mapping, ra, filp, offset,
+						  req_size, max);
+	}
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
+new_stream:
+	ra_push_stream(ra);
+	ra->size_cap = 0;
 initial_readahead:
 	ra->start = offset;
-	ra->size = get_init_ra_size(req_size, max);
+	ra->size = get_init_ra_size(req_size,
+			ra->size_cap ? min_t(unsigned long, ra->size_cap, max) : max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
 
 readit:
@@ -27,7 +27,7 @@
  *       mapping->i_mmap_lock
  *         anon_vma->lock
  *           mm->page_table_lock or pte_lock
- *             zone->lru_lock (in mark_page_accessed, isolate_lru_page)
+ *             lruvec->lru_lock (in mark_page_accessed, isolate_lru_page)
  *             swap_lock (in swap_duplicate, swap_info_get)
  *               mmlist_lock (in mmput, drain_mmlist and others)
  *               mapping->private_lock (in __set_page_dirty_buffers)
@@ -250,7 +250,7 @@ static void anon_vma_unlink(struct anon_vma_chain *anon_vma_chain)
 	list_del(&anon_vma_chain->same_anon_vma);
 
 	/* We must garbage collect the anon_vma if it's empty */
-	empty = list_empty(&anon_vma->head) && !ksm_refcount(anon_vma);
+	empty = list_empty(&anon_vma->head) && !anonvma_external_refcount(anon_vma);
 	spin_unlock(&anon_vma->lock);
 
 	if (empty)
@@ -274,7 +274,7 @@ static void anon_vma_ctor(void *data)
 	struct anon_vma *anon_vma = data;
 
 	spin_lock_init(&anon_vma->lock);
-	ksm_refcount_init(anon_vma);
+	anonvma_external_refcount_init(anon_vma);
 	INIT_LIST_HEAD(&anon_vma->head);
 }
 
@@ -380,6 +380,9 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 	pmd = pmd_offset(pud, address);
 	if (!pmd_present(*pmd))
 		return NULL;
+	/* pages mapped by a huge pmd are handled by page_check_address_pmd */
+	if (pmd_trans_huge(*pmd))
+		return NULL;
 
 	pte = pte_offset_map(pmd, address);
 	/* Make a quick check before getting the lock */
@@ -424,6 +427,48 @@ int page_mapped_in_vma(struct page *page, struct vm_area_struct *vma)
 	return 1;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A huge pmd has a single accessed bit for all of its small pages. When it
+ * is found young, pass the reference on to the other small pages through
+ * PG_referenced, so that clearing the bit here does not hide it from them.
+ */
+static int page_referenced_pmd(struct page *page, struct vm_area_struct *vma,
+			       unsigned long address, pmd_t *pmd,
+			       unsigned int *mapcount, unsigned long *vm_flags)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *head;
+	int i;
+
+	(*mapcount)--;
+	if (vma->vm_flags & VM_LOCKED) {
+		*mapcount = 0;	/* break early from loop */
+		*vm_flags |= VM_LOCKED;
+		return 0;
+	}
+
+	if (!pmdp_clear_flush_young(vma, haddr, pmd))
+		return 0;
+
+	head = pmd_page(*pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		if (head + i != page)
+			SetPageReferenced(head + i);
+	*vm_flags |= vma->vm_flags;
+	return 1;
+}
+#else
+static inline int page_referenced_pmd(struct page *page,
+				      struct vm_area_struct *vma,
+				      unsigned long address, pmd_t *pmd,
+				      unsigned int *mapcount,
+				      unsigned long *vm_flags)
+{
+	return 0;
+}
+#endif
+
 /*
  * Subfunctions of page_referenced: page_referenced_one called
  * repeatedly from either page_referenced_anon or page_referenced_file.
@@ -437,6 +482,18 @@ int page_referenced_one(struct page *page, struct vm_area_struct *vma,
 	spinlock_t *ptl;
 	int referenced = 0;
 
+	/* anonymous and shmem pages may be mapped by a huge pmd */
+	if (PageSwapBacked(page)) {
+		pmd_t *pmd = page_check_address_pmd(page, mm, address);
+
+		if (pmd) {
+			referenced = page_referenced_pmd(page, vma, address,
+							 pmd, mapcount, vm_flags);
+			spin_unlock(&mm->page_table_lock);
+			goto out;
+		}
+	}
+
 	pte = page_check_address(page, mm, address, &ptl, 0);
 	if (!pte)
 		goto out;
@@ -846,7 +903,7 @@ void page_add_file_rmap(struct page *page)
 {
 	if (atomic_inc_and_test(&page->_mapcount)) {
 		__inc_zone_page_state(page, NR_FILE_MAPPED);
-		mem_cgroup_update_file_mapped(page, 1);
+		mem_cgroup_inc_page_stat(page, MEMCG_NR_FILE_MAPPED);
 	}
 }
 
@@ -878,7 +935,7 @@ void page_remove_rmap(struct page *page)
 		__dec_zone_page_state(page, NR_ANON_PAGES);
 	} else {
 		__dec_zone_page_state(page, NR_FILE_MAPPED);
-		mem_cgroup_update_file_mapped(page, -1);
+		mem_cgroup_dec_page_stat(page, MEMCG_NR_FILE_MAPPED);
 	}
 	/*
 	 * It would be tidy to reset the PageAnon mapping here,
@@ -904,6 +961,10 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	spinlock_t *ptl;
 	int ret = SWAP_AGAIN;
 
+	/* reclaim and migration work on the small pages of a huge pmd */
+	if (PageSwapBacked(page) && TTU_ACTION(flags) != TTU_MUNLOCK)
+		split_huge_pmd_address(vma, address);
+
 	pte = page_check_address(page, mm, address, &ptl, 0);
 	if (!pte)
 		goto out;
@@ -920,6 +981,14 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 		if (TTU_ACTION(flags) == TTU_MUNLOCK)
 			goto out_unmap;
 	}
+	/*
+	 * A page freed with MADV_FREE and written to again must be kept:
+	 * back off before paying for the flush if this pte is dirty.
+	 */
+	if ((flags & TTU_FREE) && pte_dirty(*pte)) {
+		ret = SWAP_FAIL;
+		goto out_unmap;
+	}
 	if (!(flags & TTU_IGNORE_ACCESS)) {
 		if (ptep_clear_flush_young_notify(vma, address, pte)) {
 			ret = SWAP_FAIL;
@@ -948,6 +1017,22 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else if (PageAnon(page)) {
 		swp_entry_t entry = { .val = page_private(page) };
 
+		if (flags & TTU_FREE) {
+			/*
+			 * Clean lazily freed page: leave an empty pte, so
+			 * the next touch faults in a zeroed page.  Recheck
+			 * the dirty bit, it may have been set just before
+			 * the pte was cleared.
+			 */
+			VM_BUG_ON(PageSwapCache(page));
+			if (PageDirty(page)) {
+				set_pte_at(mm, address, pte, pteval);
+				ret = SWAP_FAIL;
+				goto out_unmap;
+			}
+			dec_mm_counter(mm, MM_ANONPAGES);
+			goto discard;
+		}
 		if (PageSwapCache(page)) {
 			/*
 			 * Store the swap location in the pte.
@@ -985,6 +1070,7 @@ int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
 	} else
 		dec_mm_counter(mm, MM_FILEPAGES);
 
+discard:
 	page_remove_rmap(page);
 	page_cache_release(page);
 
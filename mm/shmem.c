@@ -206,6 +206,12 @@ static inline int shmem_acct_block(unsigned long flags)
 		security_vm_enough_memory_kern(VM_ACCT(PAGE_CACHE_SIZE)) : 0;
 }
 
+static inline int shmem_acct_blocks(unsigned long flags, long pages)
+{
+	return (flags & VM_NORESERVE) ?
+		security_vm_enough_memory_kern(pages * VM_ACCT(PAGE_CACHE_SIZE)) : 0;
+}
+
 static inline void shmem_unacct_blocks(unsigned long flags, long pages)
 {
 	if (flags & VM_NORESERVE)
@@ -1206,6 +1212,203 @@ static inline struct mempolicy *shmem_get_sbmpol(struct shmem_sb_info *sbinfo)
 }
 #endif
 
+/*
+ * Huge page extents: with the huge= mount option, the first page allocated
+ * in an empty, naturally aligned range of SHMEM_HUGE_PAGES pages allocates
+ * the whole range at once, from a single huge page sized block, so that the
+ * file is backed by physically contiguous memory and its pages are set up
+ * in one go. Each page of the extent is then an ordinary page cache page:
+ * it can be swapped out, migrated or truncated on its own. A shared mapping
+ * which lines the extent up with a huge page aligned pmd maps it with that
+ * pmd, see shmem_pmd_fault(), which reclaim and truncation split back into
+ * ptes. When no such block is available we just fall back to allocating a
+ * small page.
+ */
+#define SHMEM_HUGE_ORDER	min(PMD_SHIFT - PAGE_SHIFT, MAX_ORDER - 1)
+#define SHMEM_HUGE_PAGES	(1UL << SHMEM_HUGE_ORDER)
+
+/* Huge extents for the internal mount: shared memory and shared anonymous */
+static int shmem_huge_internal __read_mostly = SHMEM_HUGE_NEVER;
+
+static int shmem_parse_huge(const char *str)
+{
+	if (!strcmp(str, "never"))
+		return SHMEM_HUGE_NEVER;
+	if (!strcmp(str, "within_size"))
+		return SHMEM_HUGE_WITHIN_SIZE;
+	if (!strcmp(str, "always"))
+		return SHMEM_HUGE_ALWAYS;
+	return -EINVAL;
+}
+
+static int __init setup_shmem_huge(char *str)
+{
+	int huge = shmem_parse_huge(str);
+
+	if (huge < 0)
+		return 0;
+	shmem_huge_internal = huge;
+	return 1;
+}
+__setup("shmem_huge=", setup_shmem_huge);
+
+/*
+ * Try to populate the whole extent around @idx. Returns 1 if the page at
+ * @idx is now in the page cache, 0 if the caller has to allocate it.
+ */
+static int shmem_alloc_huge_extent(struct inode *inode, unsigned long idx,
+				   enum sgp_type sgp, gfp_t gfp)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct shmem_inode_info *info = SHMEM_I(inode);
+	struct shmem_sb_info *sbinfo = SHMEM_SB(inode->i_sb);
+	unsigned long base = idx & ~(SHMEM_HUGE_PAGES - 1);
+	unsigned long nr = SHMEM_HUGE_PAGES;
+	unsigned long i, added = 0;
+	struct mempolicy *mpol;
+	struct page *page;
+	swp_entry_t *entry;
+	int error = 0;
+
+	if (sbinfo->huge == SHMEM_HUGE_NEVER || sgp == SGP_READ)
+		return 0;
+	if (base + nr > SHMEM_MAX_INDEX)
+		return 0;
+	if (sbinfo->huge == SHMEM_HUGE_WITHIN_SIZE) {
+		if (base + nr > DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE))
+			return 0;
+	} else
+		sgp = SGP_WRITE;
+
+	/* An explicit memory policy takes precedence */
+	mpol = mpol_shared_policy_lookup(&info->policy, idx);
+	if (mpol) {
+		mpol_put(mpol);
+		return 0;
+	}
+
+	/* Only ever populate a completely empty extent */
+	if (find_get_pages(mapping, base, 1, &page)) {
+		int busy = page->index < base + nr;
+
+		page_cache_release(page);
+		if (busy)
+			return 0;
+	}
+
+	/*
+	 * Allocate the swap vector index pages of the whole extent while we
+	 * can sleep, so that its entries can be looked up below with the
+	 * radix tree preloaded.
+	 */
+	spin_lock(&info->lock);
+	for (i = 0; i < nr && !error; i++) {
+		entry = shmem_swp_alloc(info, base + i, sgp);
+		if (IS_ERR(entry))
+			error = PTR_ERR(entry);
+		else {
+			if (entry->val)
+				error = -EEXIST;
+			shmem_swp_unmap(entry);
+		}
+	}
+	spin_unlock(&info->lock);
+	if (error)
+		goto fallback;
+
+	if (shmem_acct_blocks(info->flags, nr))
+		goto fallback;
+	if (sbinfo->max_blocks) {
+		spin_lock(&sbinfo->stat_lock);
+		if (sbinfo->free_blocks <= nr) {
+			spin_unlock(&sbinfo->stat_lock);
+			shmem_unacct_blocks(info->flags, nr);
+			goto fallback;
+		}
+		sbinfo->free_blocks -= nr;
+		inode->i_blocks += nr * BLOCKS_PER_PAGE;
+		spin_unlock(&sbinfo->stat_lock);
+	}
+
+	page = alloc_pages(gfp | __GFP_NORETRY | __GFP_NOWARN,
+			   SHMEM_HUGE_ORDER);
+	if (!page) {
+		shmem_unacct_blocks(info->flags, nr);
+		shmem_free_blocks(inode, nr);
+		goto fallback;
+	}
+	split_page(page, SHMEM_HUGE_ORDER);
+
+	for (i = 0; i < nr; i++) {
+		struct page *subpage = page + i;
+
+		if (error) {
+			__free_page(subpage);
+			continue;
+		}
+
+		SetPageSwapBacked(subpage);
+		clear_highpage(subpage);
+		flush_dcache_page(subpage);
+
+		error = mem_cgroup_cache_charge(subpage, current->mm,
+						GFP_KERNEL);
+		if (error) {
+			__free_page(subpage);
+			continue;
+		}
+
+		error = radix_tree_preload(gfp & ~__GFP_HIGHMEM);
+		if (error) {
+			mem_cgroup_uncharge_cache_page(subpage);
+			page_cache_release(subpage);
+			continue;
+		}
+
+		spin_lock(&info->lock);
+		entry = shmem_swp_entry(info, base + i, NULL);
+		if (!entry)
+			error = -EEXIST;	/* truncated meanwhile */
+		else {
+			if (entry->val)
+				error = -EEXIST;
+			shmem_swp_unmap(entry);
+		}
+		if (error)
+			mem_cgroup_uncharge_cache_page(subpage);
+		else
+			error = add_to_page_cache_lru(subpage, mapping,
+						      base + i, GFP_NOWAIT);
+		if (error) {
+			spin_unlock(&info->lock);
+			radix_tree_preload_end();
+			page_cache_release(subpage);
+			continue;
+		}
+		info->flags |= SHMEM_PAGEIN;
+		info->alloced++;
+		spin_unlock(&info->lock);
+		radix_tree_preload_end();
+
+		SetPageUptodate(subpage);
+		unlock_page(subpage);
+		page_cache_release(subpage);
+		added++;
+	}
+
+	if (added < nr) {
+		shmem_unacct_blocks(info->flags, nr - added);
+		shmem_free_blocks(inode, nr - added);
+	}
+	if (added)
+		count_vm_event(SHMEM_HUGE_ALLOC);
+	if (idx - base < added)
+		return 1;
+fallback:
+	count_vm_event(SHMEM_HUGE_FALLBACK);
+	return 0;
+}
+
 /*
  * shmem_getpage - either get the page from swap or allocate a new one
  *
@@ -1256,6 +1459,9 @@ repeat:
 		if (error)
 			goto failed;
 		radix_tree_preload_end();
+
+		if (shmem_alloc_huge_extent(inode, idx, sgp, gfp))
+			goto repeat;
 	}
 
 	spin_lock(&info->lock);
@@ -1270,7 +1476,7 @@ repeat:
 
 	if (swap.val) {
 		/* Look it up and read it in.. */
-		swappage = lookup_swap_cache(swap);
+		swappage = lookup_swap_cache(swap, NULL, 0);
 		if (!swappage) {
 			shmem_swp_unmap(entry);
 			/* here we actually do the io */
@@ -1413,6 +1619,7 @@ repeat:
 				error = -ENOMEM;
 				goto failed;
 			}
+			count_vm_event(SHMEM_SMALL_ALLOC);
 			SetPageSwapBacked(filepage);
 
 			/* Precharge page while we can wait, compensate after */
@@ -1493,6 +1700,90 @@ static int shmem_fault(struct vm_area_struct *vma, struct vm_fault *vmf)
 	return ret | VM_FAULT_LOCKED;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Map a whole huge extent of the file with a huge pmd, when the fault is
+ * in a shared vma which lines the extent up with a huge page aligned pmd.
+ * The extent must be fully populated from a single block, as it is by
+ * shmem_alloc_huge_extent(), and fully within i_size: anything else, like
+ * a page of it swapped out or truncated, is left to ptes and shmem_fault.
+ */
+static int shmem_pmd_fault(struct vm_area_struct *vma, unsigned long address,
+			   pmd_t *pmd, unsigned int flags)
+{
+	struct inode *inode = vma->vm_file->f_path.dentry->d_inode;
+	struct address_space *mapping = inode->i_mapping;
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgoff_t pgoff = linear_page_index(vma, haddr);
+	pgoff_t idx = linear_page_index(vma, address);
+	struct page *page;
+	unsigned long pfn;
+	int error, ret, nr, i;
+
+	if (SHMEM_HUGE_PAGES != HPAGE_PMD_NR ||
+	    SHMEM_SB(inode->i_sb)->huge == SHMEM_HUGE_NEVER)
+		return VM_FAULT_FALLBACK;
+	if (!(vma->vm_flags & VM_SHARED) ||
+	    (vma->vm_flags & (VM_NONLINEAR | VM_NOHUGEPAGE)))
+		return VM_FAULT_FALLBACK;
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end ||
+	    (pgoff & (HPAGE_PMD_NR - 1)))
+		return VM_FAULT_FALLBACK;
+	if (pgoff + HPAGE_PMD_NR >
+	    DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE))
+		return VM_FAULT_FALLBACK;
+
+	/* populates the whole extent, if it can */
+	error = shmem_getpage(inode, idx, &page, SGP_CACHE, &ret);
+	if (error)
+		return ((error == -ENOMEM) ? VM_FAULT_OOM : VM_FAULT_SIGBUS);
+
+	/*
+	 * Lock down the other pages of the extent, which must be the rest of
+	 * the same huge page sized block; trylock, since we hold one already.
+	 */
+	pfn = page_to_pfn(page) - (idx - pgoff);
+	for (nr = 0; nr < HPAGE_PMD_NR && !(pfn & (HPAGE_PMD_NR - 1)); nr++) {
+		struct page *subpage;
+
+		if (pgoff + nr == idx)
+			continue;
+		subpage = find_get_page(mapping, pgoff + nr);
+		if (!subpage)
+			break;
+		if (page_to_pfn(subpage) != pfn + nr ||
+		    !trylock_page(subpage)) {
+			page_cache_release(subpage);
+			break;
+		}
+		if (subpage->mapping != mapping || !PageUptodate(subpage)) {
+			unlock_page(subpage);
+			page_cache_release(subpage);
+			break;
+		}
+	}
+
+	/* the pages are locked against truncation: recheck i_size */
+	if (nr < HPAGE_PMD_NR || pgoff + HPAGE_PMD_NR >
+	    DIV_ROUND_UP(i_size_read(inode), PAGE_CACHE_SIZE))
+		ret = VM_FAULT_FALLBACK;
+	else
+		ret |= do_huge_pmd_file_page(vma, haddr, pmd,
+					     pfn_to_page(pfn));
+
+	/* on success the pmd has taken over our page references */
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (i >= nr && pgoff + i != idx)
+			continue;
+		page = pfn_to_page(pfn + i);
+		unlock_page(page);
+		if (ret & (VM_FAULT_FALLBACK | VM_FAULT_ERROR))
+			page_cache_release(page);
+	}
+	return ret;
+}
+#endif
+
 #ifdef CONFIG_NUMA
 static int shmem_set_policy(struct vm_area_struct *vma, struct mempolicy *new)
 {
@@ -2231,6 +2522,11 @@ static int shmem_parse_options(char *options, struct shmem_sb_info *sbinfo,
 		} else if (!strcmp(this_char,"mpol")) {
 			if (mpol_parse_str(value, &sbinfo->mpol, 1))
 				goto bad_val;
+		} else if (!strcmp(this_char,"huge")) {
+			int huge = shmem_parse_huge(value);
+			if (huge < 0)
+				goto bad_val;
+			sbinfo->huge = huge;
 		} else {
 			printk(KERN_ERR "tmpfs: Bad mount option %s\n",
 			       this_char);
@@ -2276,6 +2572,7 @@ static int shmem_remount_fs(struct super_block *sb, int *flags, char *data)
 		goto out;
 
 	error = 0;
+	sbinfo->huge        = config.huge;
 	sbinfo->max_blocks  = config.max_blocks;
 	sbinfo->free_blocks = config.max_blocks - blocks;
 	sbinfo->max_inodes  = config.max_inodes;
@@ -2303,6 +2600,10 @@ static int shmem_show_options(struct seq_file *seq, struct vfsmount *vfs)
 		seq_printf(seq, ",uid=%u", sbinfo->uid);
 	if (sbinfo->gid != 0)
 		seq_printf(seq, ",gid=%u", sbinfo->gid);
+	if (sbinfo->huge == SHMEM_HUGE_WITHIN_SIZE)
+		seq_printf(seq, ",huge=within_size");
+	else if (sbinfo->huge == SHMEM_HUGE_ALWAYS)
+		seq_printf(seq, ",huge=always");
 	shmem_show_mpol(seq, sbinfo->mpol);
 	return 0;
 }
@@ -2331,6 +2632,8 @@ int shmem_fill_super(struct super_block *sb, void *data, int silent)
 	sbinfo->uid = current_fsuid();
 	sbinfo->gid = current_fsgid();
 	sb->s_fs_info = sbinfo;
+	if (sb->s_flags & MS_NOUSER)
+		sbinfo->huge = shmem_huge_internal;
 
 #ifdef CONFIG_TMPFS
 	/*
@@ -2512,6 +2815,9 @@ static const struct super_operations shmem_ops = {
 
 static const struct vm_operations_struct shmem_vm_ops = {
 	.fault		= shmem_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.pmd_fault	= shmem_pmd_fault,
+#endif
 #ifdef CONFIG_NUMA
 	.set_policy     = shmem_set_policy,
 	.get_policy     = shmem_get_policy,
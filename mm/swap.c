@@ -48,13 +48,13 @@ static void __page_cache_release(struct page *page)
 {
 	if (PageLRU(page)) {
 		unsigned long flags;
-		struct zone *zone = page_zone(page);
+		struct lruvec *lruvec = page_lruvec(page);
 
-		spin_lock_irqsave(&zone->lru_lock, flags);
+		spin_lock_irqsave(&lruvec->lru_lock, flags);
 		VM_BUG_ON(!PageLRU(page));
 		__ClearPageLRU(page);
-		del_page_from_lru(zone, page);
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+		del_page_from_lru(lruvec, page);
+		spin_unlock_irqrestore(&lruvec->lru_lock, flags);
 	}
 	free_hot_cold_page(page, 0);
 }
@@ -106,26 +106,32 @@ static void pagevec_move_tail(struct pagevec *pvec)
 {
 	int i;
 	int pgmoved = 0;
-	struct zone *zone = NULL;
+	struct lruvec *lruvec = NULL;
 
 	for (i = 0; i < pagevec_count(pvec); i++) {
 		struct page *page = pvec->pages[i];
-		struct zone *pagezone = page_zone(page);
+		struct lruvec *pagelruvec;
 
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock(&zone->lru_lock);
+		/* Keep the page from moving to another lruvec meanwhile */
+		if (!TestClearPageLRU(page))
+			continue;
+
+		pagelruvec = page_lruvec(page);
+		if (pagelruvec != lruvec) {
+			if (lruvec)
+				spin_unlock(&lruvec->lru_lock);
+			lruvec = pagelruvec;
+			spin_lock(&lruvec->lru_lock);
 		}
-		if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
+		if (!PageActive(page) && !PageUnevictable(page)) {
 			int lru = page_lru_base_type(page);
-			list_move_tail(&page->lru, &zone->lru[lru].list);
+			list_move_tail(&page->lru, &lruvec->lists[lru]);
 			pgmoved++;
 		}
+		SetPageLRU(page);
 	}
-	if (zone)
-		spin_unlock(&zone->lru_lock);
+	if (lruvec)
+		spin_unlock(&lruvec->lru_lock);
 	__count_vm_events(PGROTATED, pgmoved);
 	release_pages(pvec->pages, pvec->nr, pvec->cold);
 	pagevec_reinit(pvec);
@@ -152,24 +158,14 @@ void  rotate_reclaimable_page(struct page *page)
 	}
 }
 
-static void update_page_reclaim_stat(struct zone *zone, struct page *page,
+static void update_page_reclaim_stat(struct lruvec *lruvec,
 				     int file, int rotated)
 {
-	struct zone_reclaim_stat *reclaim_stat = &zone->reclaim_stat;
-	struct zone_reclaim_stat *memcg_reclaim_stat;
-
-	memcg_reclaim_stat = mem_cgroup_get_reclaim_stat_from_page(page);
+	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
 
 	reclaim_stat->recent_scanned[file]++;
 	if (rotated)
 		reclaim_stat->recent_rotated[file]++;
-
-	if (!memcg_reclaim_stat)
-		return;
-
-	memcg_reclaim_stat->recent_scanned[file]++;
-	if (rotated)
-		memcg_reclaim_stat->recent_rotated[file]++;
 }
 
 /*
@@ -177,22 +173,54 @@ static void update_page_reclaim_stat(struct zone *zone, struct page *page,
  */
 void activate_page(struct page *page)
 {
-	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec;
+
+	if (!TestClearPageLRU(page))
+		return;
 
-	spin_lock_irq(&zone->lru_lock);
-	if (PageLRU(page) && !PageActive(page) && !PageUnevictable(page)) {
+	lruvec = page_lruvec(page);
+	spin_lock_irq(&lruvec->lru_lock);
+	if (!PageActive(page) && !PageUnevictable(page)) {
 		int file = page_is_file_cache(page);
 		int lru = page_lru_base_type(page);
-		del_page_from_lru_list(zone, page, lru);
+
+		del_page_from_lru_list(lruvec, page, lru);
 
 		SetPageActive(page);
 		lru += LRU_ACTIVE;
-		add_page_to_lru_list(zone, page, lru);
+		add_page_to_lru_list(lruvec, page, lru);
 		__count_vm_event(PGACTIVATE);
 
-		update_page_reclaim_stat(zone, page, file, 1);
+		update_page_reclaim_stat(lruvec, file, 1);
 	}
-	spin_unlock_irq(&zone->lru_lock);
+	SetPageLRU(page);
+	spin_unlock_irq(&lruvec->lru_lock);
+}
+
+/*
+ * Move an active page to the inactive list and forget its references,
+ * so that reclaim gets to it before the rest of the working set.
+ */
+void deactivate_page(struct page *page)
+{
+	struct lruvec *lruvec;
+
+	if (!PageActive(page) || !TestClearPageLRU(page))
+		return;
+
+	lruvec = page_lruvec(page);
+	spin_lock_irq(&lruvec->lru_lock);
+	if (PageActive(page) && !PageUnevictable(page)) {
+		int lru = page_lru_base_type(page);
+
+		del_page_from_lru_list(lruvec, page, lru + LRU_ACTIVE);
+		ClearPageActive(page);
+		add_page_to_lru_list(lruvec, page, lru);
+		__count_vm_event(PGDEACTIVATE);
+	}
+	ClearPageReferenced(page);
+	SetPageLRU(page);
+	spin_unlock_irq(&lruvec->lru_lock);
 }
 
 /*
@@ -208,6 +236,7 @@ void mark_page_accessed(struct page *page)
 			PageReferenced(page) && PageLRU(page)) {
 		activate_page(page);
 		ClearPageReferenced(page);
+		workingset_activation(page);
 	} else if (!PageReferenced(page)) {
 		SetPageReferenced(page);
 	}
@@ -256,13 +285,13 @@ void lru_cache_add_lru(struct page *page, enum lru_list lru)
  */
 void add_page_to_unevictable_list(struct page *page)
 {
-	struct zone *zone = page_zone(page);
+	struct lruvec *lruvec = page_lru_add_lruvec(page);
 
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 	SetPageUnevictable(page);
+	add_page_to_lru_list(lruvec, page, LRU_UNEVICTABLE);
 	SetPageLRU(page);
-	add_page_to_lru_list(zone, page, LRU_UNEVICTABLE);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 }
 
 /*
@@ -317,8 +346,8 @@ int lru_add_drain_all(void)
  * passed pages.  If it fell to zero then remove the page from the LRU and
  * free it.
  *
- * Avoid taking zone->lru_lock if possible, but if it is taken, retain it
- * for the remainder of the operation.
+ * Avoid taking an lru_lock if possible, but if it is taken, retain it
+ * for as long as the pages are on the same lruvec.
  *
  * The locking in this function is against shrink_inactive_list(): we recheck
  * the page count inside the lock to see whether shrink_inactive_list()
@@ -329,7 +358,7 @@ void release_pages(struct page **pages, int nr, int cold)
 {
 	int i;
 	struct pagevec pages_to_free;
-	struct zone *zone = NULL;
+	struct lruvec *lruvec = NULL;
 	unsigned long uninitialized_var(flags);
 
 	pagevec_init(&pages_to_free, cold);
@@ -337,9 +366,10 @@ void release_pages(struct page **pages, int nr, int cold)
 		struct page *page = pages[i];
 
 		if (unlikely(PageCompound(page))) {
-			if (zone) {
-				spin_unlock_irqrestore(&zone->lru_lock, flags);
-				zone = NULL;
+			if (lruvec) {
+				spin_unlock_irqrestore(&lruvec->lru_lock,
+						       flags);
+				lruvec = NULL;
 			}
 			put_compound_page(page);
 			continue;
@@ -349,31 +379,32 @@ void release_pages(struct page **pages, int nr, int cold)
 			continue;
 
 		if (PageLRU(page)) {
-			struct zone *pagezone = page_zone(page);
-
-			if (pagezone != zone) {
-				if (zone)
-					spin_unlock_irqrestore(&zone->lru_lock,
-									flags);
-				zone = pagezone;
-				spin_lock_irqsave(&zone->lru_lock, flags);
+			struct lruvec *pagelruvec = page_lruvec(page);
+
+			if (pagelruvec != lruvec) {
+				if (lruvec)
+					spin_unlock_irqrestore(
+						&lruvec->lru_lock, flags);
+				lruvec = pagelruvec;
+				spin_lock_irqsave(&lruvec->lru_lock, flags);
 			}
 			VM_BUG_ON(!PageLRU(page));
 			__ClearPageLRU(page);
-			del_page_from_lru(zone, page);
+			del_page_from_lru(lruvec, page);
 		}
 
 		if (!pagevec_add(&pages_to_free, page)) {
-			if (zone) {
-				spin_unlock_irqrestore(&zone->lru_lock, flags);
-				zone = NULL;
+			if (lruvec) {
+				spin_unlock_irqrestore(&lruvec->lru_lock,
+						       flags);
+				lruvec = NULL;
 			}
 			__pagevec_free(&pages_to_free);
 			pagevec_reinit(&pages_to_free);
   		}
 	}
-	if (zone)
-		spin_unlock_irqrestore(&zone->lru_lock, flags);
+	if (lruvec)
+		spin_unlock_irqrestore(&lruvec->lru_lock, flags);
 
 	pagevec_free(&pages_to_free);
 }
@@ -404,35 +435,35 @@ EXPORT_SYMBOL(__pagevec_release);
 void ____pagevec_lru_add(struct pagevec *pvec, enum lru_list lru)
 {
 	int i;
-	struct zone *zone = NULL;
+	struct lruvec *lruvec = NULL;
 
 	VM_BUG_ON(is_unevictable_lru(lru));
 
 	for (i = 0; i < pagevec_count(pvec); i++) {
 		struct page *page = pvec->pages[i];
-		struct zone *pagezone = page_zone(page);
+		struct lruvec *pagelruvec = page_lru_add_lruvec(page);
 		int file;
 		int active;
 
-		if (pagezone != zone) {
-			if (zone)
-				spin_unlock_irq(&zone->lru_lock);
-			zone = pagezone;
-			spin_lock_irq(&zone->lru_lock);
+		if (pagelruvec != lruvec) {
+			if (lruvec)
+				spin_unlock_irq(&lruvec->lru_lock);
+			lruvec = pagelruvec;
+			spin_lock_irq(&lruvec->lru_lock);
 		}
 		VM_BUG_ON(PageActive(page));
 		VM_BUG_ON(PageUnevictable(page));
 		VM_BUG_ON(PageLRU(page));
-		SetPageLRU(page);
 		active = is_active_lru(lru);
 		file = is_file_lru(lru);
 		if (active)
 			SetPageActive(page);
-		update_page_reclaim_stat(zone, page, file, active);
-		add_page_to_lru_list(zone, page, lru);
+		update_page_reclaim_stat(lruvec, file, active);
+		add_page_to_lru_list(lruvec, page, lru);
+		SetPageLRU(page);
 	}
-	if (zone)
-		spin_unlock_irq(&zone->lru_lock);
+	if (lruvec)
+		spin_unlock_irq(&lruvec->lru_lock);
 	release_pages(pvec->pages, pvec->nr, pvec->cold);
 	pagevec_reinit(pvec);
 }
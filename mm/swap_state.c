@@ -19,6 +19,7 @@
 #include <linux/pagevec.h>
 #include <linux/migrate.h>
 #include <linux/page_cgroup.h>
+#include <linux/vmstat.h>
 
 #include <asm/pgtable.h>
 
@@ -257,14 +258,22 @@ void free_pages_and_swap_cache(struct page **pages, int nr)
  * lock getting page table operations atomic even if we drop the page
  * lock before returning.
  */
-struct page * lookup_swap_cache(swp_entry_t entry)
+struct page *lookup_swap_cache(swp_entry_t entry, struct vm_area_struct *vma,
+				unsigned long addr)
 {
 	struct page *page;
 
 	page = find_get_page(&swapper_space, entry.val);
 
-	if (page)
+	if (page) {
 		INC_CACHE_INFO(find_success);
+		/* PG_readahead is PG_reclaim while under writeback */
+		if (!PageWriteback(page) && TestClearPageReadahead(page)) {
+			count_vm_event(SWAP_RA_HIT);
+			if (vma)
+				swap_ra_hit(vma);
+		}
+	}
 
 	INC_CACHE_INFO(find_total);
 	return page;
@@ -276,8 +285,9 @@ struct page * lookup_swap_cache(swp_entry_t entry)
  * A failure return means that either the page allocation failed or that
  * the swap entry is no longer in use.
  */
-struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
-			struct vm_area_struct *vma, unsigned long addr)
+static struct page *__read_swap_cache_async(swp_entry_t entry,
+			gfp_t gfp_mask, struct vm_area_struct *vma,
+			unsigned long addr, bool *allocated)
 {
 	struct page *found_page, *new_page = NULL;
 	int err;
@@ -332,6 +342,7 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 			 */
 			lru_cache_add_anon(new_page);
 			swap_readpage(new_page);
+			*allocated = true;
 			return new_page;
 		}
 		radix_tree_preload_end();
@@ -349,6 +360,35 @@ struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
 	return found_page;
 }
 
+struct page *read_swap_cache_async(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	bool allocated = false;
+
+	return __read_swap_cache_async(entry, gfp_mask, vma, addr, &allocated);
+}
+
+/*
+ * Read ahead a page that is not needed yet, and mark it so that a later
+ * lookup_swap_cache() can tell that the readahead was useful.
+ */
+static int swap_readahead_page(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr)
+{
+	bool allocated = false;
+	struct page *page;
+
+	page = __read_swap_cache_async(entry, gfp_mask, vma, addr, &allocated);
+	if (!page)
+		return -ENOMEM;
+	if (allocated) {
+		SetPageReadahead(page);
+		count_vm_event(SWAP_RA);
+	}
+	page_cache_release(page);
+	return 0;
+}
+
 /**
  * swapin_readahead - swap in pages in hope we need them soon
  * @entry: swap entry of this memory
@@ -372,7 +412,6 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 			struct vm_area_struct *vma, unsigned long addr)
 {
 	int nr_pages;
-	struct page *page;
 	unsigned long offset;
 	unsigned long end_offset;
 
@@ -386,12 +425,165 @@ struct page *swapin_readahead(swp_entry_t entry, gfp_t gfp_mask,
 	nr_pages = valid_swaphandles(entry, &offset);
 	for (end_offset = offset + nr_pages; offset < end_offset; offset++) {
 		/* Ok, do the async read-ahead now */
-		page = read_swap_cache_async(swp_entry(swp_type(entry), offset),
-						gfp_mask, vma, addr);
-		if (!page)
+		if (offset == swp_offset(entry))
+			continue;
+		if (swap_readahead_page(swp_entry(swp_type(entry), offset),
+					gfp_mask, vma, addr))
+			break;
+	}
+	lru_add_drain();	/* Push any new pages onto the LRU now */
+	return read_swap_cache_async(entry, gfp_mask, vma, addr);
+}
+
+/*
+ * VMA based swap readahead
+ *
+ * Neighbours on the swap device are often unrelated to the faulting
+ * task, especially with several tasks swapping at once.  Instead, read
+ * the swap entries of the PTEs around the faulting address, which the
+ * task is likely to touch soon, wherever they are on the device.  Seek
+ * times make this a loss on rotating disks, so it is only done while all
+ * swap areas are solid state.
+ *
+ * The window adapts to how many of the pages read ahead last time were
+ * used: vma->swap_readahead_info holds the last faulting address, the
+ * window used for it and the number of readahead hits since.
+ */
+int swap_vma_readahead_enabled __read_mostly = 1;
+
+#define SWAP_RA_WIN_SHIFT	(PAGE_SHIFT / 2)
+#define SWAP_RA_HITS_MASK	((1UL << SWAP_RA_WIN_SHIFT) - 1)
+#define SWAP_RA_HITS_MAX	SWAP_RA_HITS_MASK
+#define SWAP_RA_WIN_MASK	(~PAGE_MASK & ~SWAP_RA_HITS_MASK)
+
+#define SWAP_RA_HITS(v)		((v) & SWAP_RA_HITS_MASK)
+#define SWAP_RA_WIN(v)		(((v) & SWAP_RA_WIN_MASK) >> SWAP_RA_WIN_SHIFT)
+#define SWAP_RA_ADDR(v)		((v) & PAGE_MASK)
+
+#define SWAP_RA_VAL(addr, win, hits)				\
+	(((addr) & PAGE_MASK) |					\
+	 (((win) << SWAP_RA_WIN_SHIFT) & SWAP_RA_WIN_MASK) |	\
+	 ((hits) & SWAP_RA_HITS_MASK))
+
+/* Keep the copied PTEs on the stack */
+#define SWAP_RA_WIN_MAX		32
+
+void swap_ra_hit(struct vm_area_struct *vma)
+{
+	unsigned long ra_val, old;
+
+	ra_val = atomic_long_read(&vma->swap_readahead_info);
+	do {
+		if (SWAP_RA_HITS(ra_val) == SWAP_RA_HITS_MAX)
+			return;
+		old = ra_val;
+		ra_val = atomic_long_cmpxchg(&vma->swap_readahead_info,
+					     old, old + 1);
+	} while (ra_val != old);
+}
+
+static unsigned int swap_ra_win(unsigned long pfn, unsigned long prev_pfn,
+				unsigned int hits, unsigned int prev_win)
+{
+	unsigned int max_win = min_t(unsigned int, 1U << page_cluster,
+				     SWAP_RA_WIN_MAX);
+	unsigned int win;
+
+	/*
+	 * Grow the window to the next power of two above the number of
+	 * hits.  Without any hits to go by, still try two pages when the
+	 * faults are sequential, to get started.
+	 */
+	win = hits + 2;
+	if (win == 2) {
+		if (pfn != prev_pfn + 1 && pfn != prev_pfn - 1)
+			win = 1;
+	} else
+		win = roundup_pow_of_two(win);
+
+	if (win > max_win)
+		win = max_win;
+
+	/* Don't shrink the window too fast */
+	if (win < prev_win / 2)
+		win = prev_win / 2;
+	return win;
+}
+
+/**
+ * swap_vma_readahead - swap in pages of the VMA in hope we need them soon
+ * @entry: swap entry of the faulting address
+ * @gfp_mask: memory allocation flags
+ * @vma: user vma of the faulting address
+ * @addr: faulting address
+ * @pmd: pmd mapping the page table of @addr
+ *
+ * Like swapin_readahead(), but reads ahead the swap entries of the PTEs
+ * around @addr within @vma and the page table of @addr, rather than
+ * those next to @entry on the swap device.  Called with mmap_sem held.
+ *
+ * Returns the struct page for entry and addr, after queueing swapin.
+ */
+struct page *swap_vma_readahead(swp_entry_t entry, gfp_t gfp_mask,
+			struct vm_area_struct *vma, unsigned long addr,
+			pmd_t *pmd)
+{
+	pte_t ptes[SWAP_RA_WIN_MAX];
+	unsigned long ra_val, pfn, prev_pfn, lo, hi, back, start, end;
+	unsigned int win, i, nr;
+	pte_t *pte;
+
+	ra_val = atomic_long_read(&vma->swap_readahead_info);
+	pfn = addr >> PAGE_SHIFT;
+	prev_pfn = SWAP_RA_ADDR(ra_val) >> PAGE_SHIFT;
+	win = swap_ra_win(pfn, prev_pfn, SWAP_RA_HITS(ra_val),
+			  SWAP_RA_WIN(ra_val));
+	atomic_long_set(&vma->swap_readahead_info, SWAP_RA_VAL(addr, win, 0));
+
+	if (win == 1)
+		goto skip;
+
+	/* Stay within the VMA and the page table of the faulting address */
+	lo = max(vma->vm_start, addr & PMD_MASK) >> PAGE_SHIFT;
+	hi = pmd_addr_end(addr, vma->vm_end) >> PAGE_SHIFT;
+
+	/* Follow the direction of sequential faults, else read around */
+	if (pfn == prev_pfn + 1)
+		back = 0;
+	else if (pfn == prev_pfn - 1)
+		back = win - 1;
+	else
+		back = (win - 1) / 2;
+	start = pfn - min(back, pfn - lo);
+	end = min(start + win, hi);
+
+	/*
+	 * Copy the PTEs, because reading the pages in may sleep.  They may
+	 * change meanwhile, but read_swap_cache_async() copes with swap
+	 * entries that were freed.
+	 */
+	nr = end - start;
+	pte = pte_offset_map(pmd, start << PAGE_SHIFT);
+	for (i = 0; i < nr; i++)
+		ptes[i] = pte[i];
+	pte_unmap(pte);
+
+	for (i = 0; i < nr; i++) {
+		swp_entry_t ra_entry;
+		unsigned long ra_addr = (start + i) << PAGE_SHIFT;
+
+		if (ra_addr == (addr & PAGE_MASK))
+			continue;
+		if (pte_none(ptes[i]) || pte_present(ptes[i]) ||
+		    pte_file(ptes[i]))
+			continue;
+		ra_entry = pte_to_swp_entry(ptes[i]);
+		if (unlikely(non_swap_entry(ra_entry)))
+			continue;
+		if (swap_readahead_page(ra_entry, gfp_mask, vma, ra_addr))
 			break;
-		page_cache_release(page);
 	}
 	lru_add_drain();	/* Push any new pages onto the LRU now */
+skip:
 	return read_swap_cache_async(entry, gfp_mask, vma, addr);
 }
@@ -30,6 +30,8 @@
 #include <linux/capability.h>
 #include <linux/syscalls.h>
 #include <linux/memcontrol.h>
+#include <linux/cpu.h>
+#include <linux/percpu.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -39,12 +41,15 @@
 static bool swap_count_continued(struct swap_info_struct *, pgoff_t,
 				 unsigned char);
 static void free_swap_count_continuations(struct swap_info_struct *);
+static unsigned char swap_entry_free(struct swap_info_struct *, swp_entry_t,
+				     unsigned char);
 static sector_t map_swap_entry(swp_entry_t, struct block_device**);
 
 static DEFINE_SPINLOCK(swap_lock);
 static unsigned int nr_swapfiles;
 long nr_swap_pages;
 long total_swap_pages;
+atomic_t nr_rotate_swap = ATOMIC_INIT(0);
 static int least_priority;
 
 static const char Bad_file[] = "Bad swap file entry ";
@@ -207,6 +212,111 @@ static int wait_for_discard(void *word)
 #define SWAPFILE_CLUSTER	256
 #define LATENCY_LIMIT		256
 
+static inline struct swap_cluster_info *
+offset_to_cluster(struct swap_info_struct *si, unsigned long offset)
+{
+	return si->cluster_info + offset / SWAPFILE_CLUSTER;
+}
+
+/*
+ * Count a slot of a solid state device as used, taking its cluster off
+ * the free list if it was on it.  Called with swap_lock held.
+ */
+static void inc_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long offset)
+{
+	struct swap_cluster_info *ci;
+
+	if (!si->cluster_info)
+		return;
+	ci = offset_to_cluster(si, offset);
+	if (!ci->count++)
+		list_del_init(&ci->list);
+}
+
+/*
+ * Count a slot of a solid state device as free again; the cluster goes
+ * to the free list once all its slots are free.  Called with swap_lock
+ * held.
+ */
+static void dec_cluster_info_page(struct swap_info_struct *si,
+				  unsigned long offset)
+{
+	struct swap_cluster_info *ci;
+
+	if (!si->cluster_info)
+		return;
+	ci = offset_to_cluster(si, offset);
+	VM_BUG_ON(!ci->count);
+	if (!--ci->count)
+		list_add_tail(&ci->list, &si->free_clusters);
+}
+
+/*
+ * Tell the device that a free cluster is about to be reused, to help its
+ * wear-levelling.  The slots are marked bad meanwhile, so that racing
+ * scans stay off them while swap_lock is dropped.
+ */
+static void discard_free_cluster(struct swap_info_struct *si,
+				 struct swap_cluster_info *ci)
+{
+	unsigned long start = (ci - si->cluster_info) * SWAPFILE_CLUSTER;
+
+	memset(si->swap_map + start, SWAP_MAP_BAD, SWAPFILE_CLUSTER);
+	spin_unlock(&swap_lock);
+	discard_swap_cluster(si, start, SWAPFILE_CLUSTER);
+	spin_lock(&swap_lock);
+	memset(si->swap_map + start, 0, SWAPFILE_CLUSTER);
+}
+
+/*
+ * Find a free slot in the cluster this cpu allocates from, and take the
+ * next free cluster when that one is used up, so that every cpu writes
+ * out its pages sequentially.  Returns false when no free cluster is left,
+ * and the caller falls back to the first-free scan.
+ *
+ * Called with swap_lock held; drops it while discarding a new cluster.
+ */
+static bool scan_swap_map_cluster(struct swap_info_struct *si,
+				  unsigned long *offset)
+{
+	struct percpu_cluster *pcp;
+	struct swap_cluster_info *ci;
+	unsigned long tmp, end;
+
+	pcp = this_cpu_ptr(si->percpu_cluster);
+	for (;;) {
+		ci = pcp->cluster;
+		if (ci) {
+			tmp = (ci - si->cluster_info) * SWAPFILE_CLUSTER;
+			end = min_t(unsigned long, tmp + SWAPFILE_CLUSTER,
+				    si->max);
+			for (tmp = max_t(unsigned long, tmp, pcp->next);
+			     tmp < end; tmp++) {
+				if (!si->swap_map[tmp]) {
+					pcp->next = tmp + 1;
+					*offset = tmp;
+					return true;
+				}
+			}
+			pcp->cluster = NULL;
+		}
+
+		if (list_empty(&si->free_clusters))
+			return false;
+		ci = list_first_entry(&si->free_clusters,
+				      struct swap_cluster_info, list);
+		list_del_init(&ci->list);
+		if (si->flags & SWP_DISCARDABLE)
+			discard_free_cluster(si, ci);
+
+		/* We may have moved to another cpu while discarding */
+		pcp = this_cpu_ptr(si->percpu_cluster);
+		pcp->cluster = ci;
+		pcp->next = (ci - si->cluster_info) * SWAPFILE_CLUSTER;
+	}
+}
+
 static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 					  unsigned char usage)
 {
@@ -230,6 +340,12 @@ static inline unsigned long scan_swap_map(struct swap_info_struct *si,
 	si->flags += SWP_SCANNING;
 	scan_base = offset = si->cluster_next;
 
+	if (si->cluster_info) {
+		if (scan_swap_map_cluster(si, &offset))
+			scan_base = offset;
+		goto checks;
+	}
+
 	if (unlikely(!si->cluster_nr--)) {
 		if (si->pages - si->inuse_pages < SWAPFILE_CLUSTER) {
 			si->cluster_nr = SWAPFILE_CLUSTER - 1;
@@ -335,6 +451,7 @@ checks:
 	if (offset == si->highest_bit)
 		si->highest_bit--;
 	si->inuse_pages++;
+	inc_cluster_info_page(si, offset);
 	if (si->inuse_pages == si->pages) {
 		si->lowest_bit = si->max;
 		si->highest_bit = 0;
@@ -436,14 +553,16 @@ no_page:
 	return 0;
 }
 
-swp_entry_t get_swap_page(void)
+/*
+ * Allocate one swap slot for the swap cache.  Called with swap_lock held.
+ */
+static swp_entry_t __get_swap_page(void)
 {
 	struct swap_info_struct *si;
 	pgoff_t offset;
 	int type, next;
 	int wrapped = 0;
 
-	spin_lock(&swap_lock);
 	if (nr_swap_pages <= 0)
 		goto noswap;
 	nr_swap_pages--;
@@ -465,19 +584,126 @@ swp_entry_t get_swap_page(void)
 		swap_list.next = next;
 		/* This is called for allocating swap entry for cache */
 		offset = scan_swap_map(si, SWAP_HAS_CACHE);
-		if (offset) {
-			spin_unlock(&swap_lock);
+		if (offset)
 			return swp_entry(type, offset);
-		}
 		next = swap_list.next;
 	}
 
 	nr_swap_pages++;
 noswap:
-	spin_unlock(&swap_lock);
 	return (swp_entry_t) {0};
 }
 
+/*
+ * Every cpu keeps a batch of swap slots allocated in advance, so that
+ * swapping out takes swap_lock only once per SWAP_SLOTS_CACHE_SIZE pages
+ * instead of once per page.  On solid state devices the batch comes from
+ * the cpu's own cluster, and its pages are written out sequentially.
+ */
+#define SWAP_SLOTS_CACHE_SIZE	64
+
+struct swap_slots_cache {
+	struct mutex	alloc_lock;	/* protects the fields below */
+	int		cur;		/* next slot to hand out */
+	int		nr;		/* number of slots allocated */
+	swp_entry_t	slots[SWAP_SLOTS_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct swap_slots_cache, swap_slots);
+
+static void refill_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	int nr = 0;
+
+	spin_lock(&swap_lock);
+	/* Don't hide the last free slots in the caches of other cpus */
+	while (nr < SWAP_SLOTS_CACHE_SIZE &&
+	       nr_swap_pages > SWAP_SLOTS_CACHE_SIZE * num_online_cpus()) {
+		swp_entry_t entry = __get_swap_page();
+
+		if (!entry.val)
+			break;
+		cache->slots[nr++] = entry;
+	}
+	spin_unlock(&swap_lock);
+	cache->cur = 0;
+	cache->nr = nr;
+}
+
+static void drain_swap_slots_cache(struct swap_slots_cache *cache)
+{
+	mutex_lock(&cache->alloc_lock);
+	spin_lock(&swap_lock);
+	while (cache->cur < cache->nr) {
+		swp_entry_t entry = cache->slots[cache->cur++];
+
+		swap_entry_free(swap_info[swp_type(entry)], entry,
+				SWAP_HAS_CACHE);
+	}
+	spin_unlock(&swap_lock);
+	mutex_unlock(&cache->alloc_lock);
+}
+
+/*
+ * Give the slots cached by all cpus back, so that swapoff can find every
+ * slot of the area in use by a page.
+ */
+static void drain_swap_slots_caches(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		drain_swap_slots_cache(&per_cpu(swap_slots, cpu));
+}
+
+swp_entry_t get_swap_page(void)
+{
+	struct swap_slots_cache *cache;
+	swp_entry_t entry;
+
+	/*
+	 * Allocating slots may sleep, so preemption stays enabled.  If we
+	 * get migrated, we keep using the cache of the cpu we started on;
+	 * the mutex makes that safe.
+	 */
+	cache = &per_cpu(swap_slots, raw_smp_processor_id());
+	mutex_lock(&cache->alloc_lock);
+	if (cache->cur == cache->nr)
+		refill_swap_slots_cache(cache);
+	if (cache->cur < cache->nr) {
+		entry = cache->slots[cache->cur++];
+		mutex_unlock(&cache->alloc_lock);
+		return entry;
+	}
+	mutex_unlock(&cache->alloc_lock);
+
+	spin_lock(&swap_lock);
+	entry = __get_swap_page();
+	spin_unlock(&swap_lock);
+	return entry;
+}
+
+static int __cpuinit swap_slots_cpu_callback(struct notifier_block *nb,
+					     unsigned long action, void *hcpu)
+{
+	int cpu = (unsigned long)hcpu;
+
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_swap_slots_cache(&per_cpu(swap_slots, cpu));
+	return NOTIFY_OK;
+}
+
+static int __init swap_slots_cache_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		mutex_init(&per_cpu(swap_slots, cpu).alloc_lock);
+	hotcpu_notifier(swap_slots_cpu_callback, 0);
+	return 0;
+}
+__initcall(swap_slots_cache_init);
+
 /* The only caller of this function is now susupend routine */
 swp_entry_t get_swap_page_of_type(int type)
 {
@@ -583,6 +809,7 @@ static unsigned char swap_entry_free(struct swap_info_struct *p,
 			swap_list.next = p->type;
 		nr_swap_pages++;
 		p->inuse_pages--;
+		dec_cluster_info_page(p, offset);
 	}
 
 	return usage;
@@ -937,7 +1164,8 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd))
+		/* a huge pmd has no swap entries */
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
 		ret = unuse_pte_range(vma, pmd, addr, next, entry, page);
 		if (ret)
@@ -1525,6 +1753,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 {
 	struct swap_info_struct *p = NULL;
 	unsigned char *swap_map;
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster __percpu *percpu_cluster;
 	struct file *swap_file, *victim;
 	struct address_space *mapping;
 	struct inode *inode;
@@ -1587,6 +1817,8 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->flags &= ~SWP_WRITEOK;
 	spin_unlock(&swap_lock);
 
+	drain_swap_slots_caches();
+
 	current->flags |= PF_OOM_ORIGIN;
 	err = try_to_unuse(type);
 	current->flags &= ~PF_OOM_ORIGIN;
@@ -1639,10 +1871,18 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->max = 0;
 	swap_map = p->swap_map;
 	p->swap_map = NULL;
+	cluster_info = p->cluster_info;
+	p->cluster_info = NULL;
+	percpu_cluster = p->percpu_cluster;
+	p->percpu_cluster = NULL;
+	if (!(p->flags & SWP_SOLIDSTATE))
+		atomic_dec(&nr_rotate_swap);
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
+	vfree(cluster_info);
+	free_percpu(percpu_cluster);
 	/* Destroy swap account informatin */
 	swap_cgroup_swapoff(type);
 
@@ -1776,6 +2016,48 @@ static int __init max_swapfiles_check(void)
 late_initcall(max_swapfiles_check);
 #endif
 
+/*
+ * Count the bad slots and those past the end of the area against their
+ * clusters, so that only clusters that can be used in full are free.
+ */
+static int setup_swap_clusters(struct swap_info_struct *p,
+			       unsigned char *swap_map,
+			       struct swap_cluster_info **cluster_infop,
+			       struct percpu_cluster __percpu **percpu_clusterp)
+{
+	unsigned long nr_clusters = DIV_ROUND_UP(p->max, SWAPFILE_CLUSTER);
+	struct swap_cluster_info *cluster_info;
+	struct percpu_cluster __percpu *percpu_cluster;
+	unsigned long i, j;
+
+	cluster_info = vmalloc(nr_clusters * sizeof(*cluster_info));
+	if (!cluster_info)
+		return -ENOMEM;
+	percpu_cluster = alloc_percpu(struct percpu_cluster);
+	if (!percpu_cluster) {
+		vfree(cluster_info);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_clusters; i++) {
+		struct swap_cluster_info *ci = &cluster_info[i];
+
+		ci->count = 0;
+		INIT_LIST_HEAD(&ci->list);
+		for (j = i * SWAPFILE_CLUSTER;
+		     j < (i + 1) * SWAPFILE_CLUSTER; j++) {
+			if (j >= p->max || swap_map[j])
+				ci->count++;
+		}
+		if (!ci->count)
+			list_add_tail(&ci->list, &p->free_clusters);
+	}
+
+	*cluster_infop = cluster_info;
+	*percpu_clusterp = percpu_cluster;
+	return 0;
+}
+
 /*
  * Written 01/25/92 by Simmule Turner, heavily changed by Linus.
  *
@@ -1798,6 +2080,8 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	unsigned long maxpages;
 	unsigned long swapfilepages;
 	unsigned char *swap_map = NULL;
+	struct swap_cluster_info *cluster_info = NULL;
+	struct percpu_cluster __percpu *percpu_cluster = NULL;
 	struct page *page = NULL;
 	struct inode *inode = NULL;
 	int did_down = 0;
@@ -1839,6 +2123,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		 */
 	}
 	INIT_LIST_HEAD(&p->first_swap_extent.list);
+	INIT_LIST_HEAD(&p->free_clusters);
 	p->flags = SWP_USED;
 	p->next = -1;
 	spin_unlock(&swap_lock);
@@ -2028,6 +2313,13 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 			p->flags |= SWP_DISCARDABLE;
 	}
 
+	if (p->flags & SWP_SOLIDSTATE) {
+		error = setup_swap_clusters(p, swap_map, &cluster_info,
+					    &percpu_cluster);
+		if (error)
+			goto bad_swap;
+	}
+
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	if (swap_flags & SWAP_FLAG_PREFER)
@@ -2036,7 +2328,11 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	else
 		p->prio = --least_priority;
 	p->swap_map = swap_map;
+	p->cluster_info = cluster_info;
+	p->percpu_cluster = percpu_cluster;
 	p->flags |= SWP_WRITEOK;
+	if (!(p->flags & SWP_SOLIDSTATE))
+		atomic_inc(&nr_rotate_swap);
 	nr_swap_pages += nr_good_pages;
 	total_swap_pages += nr_good_pages;
 
@@ -2076,6 +2372,8 @@ bad_swap_2:
 	p->flags = 0;
 	spin_unlock(&swap_lock);
 	vfree(swap_map);
+	vfree(cluster_info);
+	free_percpu(percpu_cluster);
 	if (swap_file)
 		filp_close(swap_file, NULL);
 out:
@@ -2149,13 +2447,17 @@ static int __swap_duplicate(swp_entry_t entry, unsigned char usage)
 
 	if (usage == SWAP_HAS_CACHE) {
 
-		/* set SWAP_HAS_CACHE if there is no cache and entry is used */
-		if (!has_cache && count)
-			has_cache = SWAP_HAS_CACHE;
+		/*
+		 * set SWAP_HAS_CACHE if there is no cache and entry is used.
+		 * A slot without users may still have it set while it sits
+		 * in a swap slots cache, with no page ever coming.
+		 */
+		if (!count)			/* no users remaining */
+			err = -ENOENT;
 		else if (has_cache)		/* someone else added cache */
 			err = -EEXIST;
-		else				/* no users remaining */
-			err = -ENOENT;
+		else
+			has_cache = SWAP_HAS_CACHE;
 
 	} else if (count || has_cache) {
 
@@ -2246,10 +2548,14 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 	if (end > si->max)	/* don't go beyond end of map */
 		end = si->max;
 
-	/* Count contiguous allocated slots above our target */
+	/*
+	 * Count contiguous allocated slots above our target.  Slots that
+	 * only have SWAP_HAS_CACHE set are not in use: they are either
+	 * being freed or held in a swap slots cache.
+	 */
 	for (toff = target; ++toff < end; nr_pages++) {
 		/* Don't read in free or bad pages */
-		if (!si->swap_map[toff])
+		if (!swap_count(si->swap_map[toff]))
 			break;
 		if (swap_count(si->swap_map[toff]) == SWAP_MAP_BAD)
 			break;
@@ -2257,7 +2563,7 @@ int valid_swaphandles(swp_entry_t entry, unsigned long *offset)
 	/* Count contiguous allocated slots below our target */
 	for (toff = target; --toff >= base; nr_pages++) {
 		/* Don't read in free or bad pages */
-		if (!si->swap_map[toff])
+		if (!swap_count(si->swap_map[toff]))
 			break;
 		if (swap_count(si->swap_map[toff]) == SWAP_MAP_BAD)
 			break;
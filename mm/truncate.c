@@ -75,6 +75,7 @@ void cancel_dirty_page(struct page *page, unsigned int account_size)
 		struct address_space *mapping = page->mapping;
 		if (mapping && mapping_cap_account_dirty(mapping)) {
 			dec_zone_page_state(page, NR_FILE_DIRTY);
+			mem_cgroup_dec_page_stat(page, MEMCG_NR_FILE_DIRTY);
 			dec_bdi_stat(mapping->backing_dev_info,
 					BDI_RECLAIMABLE);
 			if (account_size)
@@ -182,6 +183,46 @@ int invalidate_inode_page(struct page *page)
 	return invalidate_complete_page(mapping, page);
 }
 
+/*
+ * Drop the shadow entries that evicted pages left in the range. Callers
+ * make sure there are no pages left in it to be reclaimed meanwhile.
+ */
+static void clear_shadow_entries(struct address_space *mapping,
+				 pgoff_t start, pgoff_t end)
+{
+	void **slots[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	unsigned int i, nr;
+
+	for (;;) {
+		spin_lock_irq(&mapping->tree_lock);
+		nr = 0;
+		if (mapping->nrshadows)
+			nr = radix_tree_gang_lookup_slot(&mapping->page_tree,
+						slots, indices, start,
+						PAGEVEC_SIZE);
+		/* Look at all entries before deleting moves any slot */
+		for (i = 0; i < nr; i++) {
+			void *entry = radix_tree_deref_slot(slots[i]);
+
+			if (!radix_tree_exceptional_entry(entry))
+				slots[i] = NULL;
+		}
+		for (i = 0; i < nr && indices[i] <= end; i++) {
+			if (!slots[i])
+				continue;
+			radix_tree_delete(&mapping->page_tree, indices[i]);
+			workingset_shadow_remove(mapping);
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+
+		if (!nr || indices[nr - 1] >= end)
+			break;
+		start = indices[nr - 1] + 1;
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -215,7 +256,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	pgoff_t next;
 	int i;
 
-	if (mapping->nrpages == 0)
+	if (mapping->nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -290,6 +331,14 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		pagevec_release(&pvec);
 		mem_cgroup_uncharge_end();
 	}
+
+	/*
+	 * Reclaim may have left shadow entries behind while the pages were
+	 * being truncated; they are all in the tree by the time the last
+	 * page is gone.
+	 */
+	if (mapping->nrshadows)
+		clear_shadow_entries(mapping, start, end);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
 
@@ -387,7 +436,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(page_has_private(page));
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	mem_cgroup_uncharge_cache_page(page);
 	page_cache_release(page);	/* pagecache ref */
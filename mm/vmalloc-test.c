@@ -0,0 +1,251 @@
+/*
+ * mm/vmalloc-test.c
+ *
+ * Stresses the vmap area allocator from one thread per online cpu.  Each
+ * thread keeps a random set of vmalloc(), vmap() and vm_map_ram() areas
+ * of random sizes alive, and keeps replacing random entries of that set,
+ * so that the address space gets fragmented and the lazy unmap path is
+ * exercised on every cpu at once.  Reports the operations per second and
+ * the number of failed allocations.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/cpu.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/random.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+
+static unsigned long loops = 100000;
+module_param(loops, ulong, 0444);
+MODULE_PARM_DESC(loops, "Number of operations per thread");
+
+static unsigned long keep = 512;
+module_param(keep, ulong, 0444);
+MODULE_PARM_DESC(keep, "Number of areas each thread keeps mapped");
+
+static unsigned long max_pages = 64;
+module_param(max_pages, ulong, 0444);
+MODULE_PARM_DESC(max_pages, "Largest area size, in pages");
+
+enum vtest_kind {
+	VTEST_VMALLOC,
+	VTEST_VMAP,
+	VTEST_MAP_RAM,
+	NR_VTEST_KINDS,
+};
+
+struct vtest_area {
+	void *addr;
+	unsigned int nr_pages;
+	enum vtest_kind kind;
+};
+
+struct vtest_thread {
+	struct vtest_area *areas;
+	struct page **pages;
+	unsigned long ops;
+	unsigned long failed;
+};
+
+static atomic_t vtest_running;
+static DECLARE_COMPLETION(vtest_all_done);
+
+static void vtest_free(struct vtest_area *area)
+{
+	switch (area->kind) {
+	case VTEST_VMALLOC:
+		vfree(area->addr);
+		break;
+	case VTEST_VMAP:
+		vunmap(area->addr);
+		break;
+	case VTEST_MAP_RAM:
+		vm_unmap_ram(area->addr, area->nr_pages);
+		break;
+	default:
+		BUG();
+	}
+	area->addr = NULL;
+}
+
+/*
+ * vmap() and vm_map_ram() map the same pages of the thread over and
+ * over: only the virtual side is under test.
+ */
+static void *vtest_alloc(struct vtest_thread *t, struct vtest_area *area)
+{
+	area->kind = random32() % NR_VTEST_KINDS;
+	area->nr_pages = random32() % max_pages + 1;
+
+	switch (area->kind) {
+	case VTEST_VMALLOC:
+		area->addr = vmalloc(area->nr_pages << PAGE_SHIFT);
+		break;
+	case VTEST_VMAP:
+		area->addr = vmap(t->pages, area->nr_pages, VM_MAP,
+				  PAGE_KERNEL);
+		break;
+	case VTEST_MAP_RAM:
+		area->addr = vm_map_ram(t->pages, area->nr_pages, -1,
+					PAGE_KERNEL);
+		break;
+	default:
+		BUG();
+	}
+	return area->addr;
+}
+
+static int vtest_thread_fn(void *data)
+{
+	struct vtest_thread *t = data;
+	unsigned long i;
+
+	for (i = 0; i < loops; i++) {
+		struct vtest_area *area = &t->areas[random32() % keep];
+
+		if (area->addr)
+			vtest_free(area);
+		if (!vtest_alloc(t, area))
+			t->failed++;
+		t->ops++;
+		if (!(i % 64))
+			cond_resched();
+	}
+
+	for (i = 0; i < keep; i++)
+		if (t->areas[i].addr)
+			vtest_free(&t->areas[i]);
+
+	if (atomic_dec_and_test(&vtest_running))
+		complete(&vtest_all_done);
+	return 0;
+}
+
+static struct vtest_thread *vtest_thread_alloc(void)
+{
+	struct vtest_thread *t;
+	unsigned long i;
+
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return NULL;
+	t->areas = vmalloc(keep * sizeof(*t->areas));
+	t->pages = kcalloc(max_pages, sizeof(*t->pages), GFP_KERNEL);
+	if (!t->areas || !t->pages)
+		goto fail;
+	memset(t->areas, 0, keep * sizeof(*t->areas));
+
+	for (i = 0; i < max_pages; i++) {
+		t->pages[i] = alloc_page(GFP_KERNEL);
+		if (!t->pages[i])
+			goto fail;
+	}
+	return t;
+fail:
+	if (t->pages)
+		for (i = 0; i < max_pages && t->pages[i]; i++)
+			__free_page(t->pages[i]);
+	kfree(t->pages);
+	vfree(t->areas);
+	kfree(t);
+	return NULL;
+}
+
+static void vtest_thread_free(struct vtest_thread *t)
+{
+	unsigned long i;
+
+	for (i = 0; i < max_pages; i++)
+		__free_page(t->pages[i]);
+	kfree(t->pages);
+	vfree(t->areas);
+	kfree(t);
+}
+
+static int __init vmalloc_test_init(void)
+{
+	struct vtest_thread **threads;
+	unsigned long ops = 0, failed = 0;
+	int cpu, nr = 0, i, ret = 0;
+	ktime_t start;
+	s64 ns;
+
+	if (!loops || !keep || !max_pages)
+		return -EINVAL;
+
+	threads = kcalloc(nr_cpu_ids, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		threads[nr] = vtest_thread_alloc();
+		if (!threads[nr]) {
+			ret = -ENOMEM;
+			break;
+		}
+		nr++;
+	}
+	if (ret)
+		goto out;
+
+	atomic_set(&vtest_running, nr);
+	start = ktime_get();
+	i = 0;
+	for_each_online_cpu(cpu) {
+		struct task_struct *p;
+
+		p = kthread_create(vtest_thread_fn, threads[i],
+				   "vmalloc_test/%d", cpu);
+		if (IS_ERR(p)) {
+			/* run it here instead, the count must drop to zero */
+			vtest_thread_fn(threads[i]);
+		} else {
+			kthread_bind(p, cpu);
+			wake_up_process(p);
+		}
+		i++;
+	}
+	wait_for_completion(&vtest_all_done);
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (ns <= 0)
+		ns = 1;
+	for (i = 0; i < nr; i++) {
+		ops += threads[i]->ops;
+		failed += threads[i]->failed;
+	}
+	pr_info("vmalloc_test: %d threads, %lu areas of up to %lu pages "
+		"each\n", nr, keep, max_pages);
+	pr_info("vmalloc_test: %llu ops/sec, %lu failed allocations\n",
+		(unsigned long long)div64_u64((u64)ops * NSEC_PER_SEC, ns),
+		failed);
+out:
+	put_online_cpus();
+	for (i = 0; i < nr; i++)
+		vtest_thread_free(threads[i]);
+	kfree(threads);
+	return ret;
+}
+module_init(vmalloc_test_init);
+
+static void __exit vmalloc_test_exit(void)
+{
+}
+module_exit(vmalloc_test_exit);
+
+MODULE_LICENSE("GPL");
@@ -259,6 +259,7 @@ struct vmap_area {
 	struct list_head purge_list;	/* "lazy purge" list */
 	void *private;
 	struct rcu_head rcu_head;
+	unsigned long subtree_max_size;	/* free tree: largest hole below */
 };
 
 static DEFINE_SPINLOCK(vmap_area_lock);
@@ -266,6 +267,23 @@ static struct rb_root vmap_area_root = RB_ROOT;
 static LIST_HEAD(vmap_area_list);
 static unsigned long vmap_area_pcpu_hole;
 
+/*
+ * The holes between vmap areas are kept in a second rbtree, sorted by
+ * address and augmented with the size of the largest hole in each
+ * subtree, so that the lowest hole fitting a request is found in
+ * O(log n) instead of by walking the areas in front of it.
+ *
+ * The holes span the whole address space, so that any vstart/vend
+ * window can be served.  Nodes of the free tree are separate objects:
+ * vmap areas are freed via RCU and cannot be reused right away.  They
+ * come from free_vmap_area_pool, which gets one node per vmap area
+ * allocated and gives one back per vmap area freed.  As there are never
+ * more holes than areas plus one, the pool cannot run dry while a hole
+ * is split or a new one is recorded under vmap_area_lock.
+ */
+static struct rb_root free_vmap_area_root = RB_ROOT;
+static LIST_HEAD(free_vmap_area_pool);
+
 static struct vmap_area *__find_vmap_area(unsigned long addr)
 {
 	struct rb_node *n = vmap_area_root.rb_node;
@@ -317,6 +335,272 @@ static void __insert_vmap_area(struct vmap_area *va)
 		list_add_rcu(&va->list, &vmap_area_list);
 }
 
+static unsigned long free_va_subtree_max(struct rb_node *n)
+{
+	if (!n)
+		return 0;
+	return rb_entry(n, struct vmap_area, rb_node)->subtree_max_size;
+}
+
+static unsigned long free_va_compute_max(struct vmap_area *va)
+{
+	unsigned long max_size = va->va_end - va->va_start;
+
+	max_size = max(max_size, free_va_subtree_max(va->rb_node.rb_left));
+	max_size = max(max_size, free_va_subtree_max(va->rb_node.rb_right));
+	return max_size;
+}
+
+static void free_va_augment_cb(struct rb_node *n, void *data)
+{
+	struct vmap_area *va = rb_entry(n, struct vmap_area, rb_node);
+
+	va->subtree_max_size = free_va_compute_max(va);
+}
+
+/* The size of @va changed in place: fix up the summaries above it */
+static void free_va_propagate(struct vmap_area *va)
+{
+	struct rb_node *n = &va->rb_node;
+	unsigned long max_size;
+
+	while (n) {
+		va = rb_entry(n, struct vmap_area, rb_node);
+		max_size = free_va_compute_max(va);
+		if (va->subtree_max_size == max_size)
+			break;
+		va->subtree_max_size = max_size;
+		n = rb_parent(n);
+	}
+}
+
+static void free_va_insert(struct vmap_area *va)
+{
+	struct rb_node **p = &free_vmap_area_root.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*p) {
+		struct vmap_area *tmp;
+
+		parent = *p;
+		tmp = rb_entry(parent, struct vmap_area, rb_node);
+		if (va->va_end <= tmp->va_start)
+			p = &(*p)->rb_left;
+		else if (va->va_start >= tmp->va_end)
+			p = &(*p)->rb_right;
+		else
+			BUG();
+	}
+
+	va->subtree_max_size = va->va_end - va->va_start;
+	rb_link_node(&va->rb_node, parent, p);
+	rb_insert_color(&va->rb_node, &free_vmap_area_root);
+	rb_augment_insert(&va->rb_node, free_va_augment_cb, NULL);
+}
+
+static void free_va_erase(struct vmap_area *va)
+{
+	struct rb_node *deepest = rb_augment_erase_begin(&va->rb_node);
+
+	rb_erase(&va->rb_node, &free_vmap_area_root);
+	rb_augment_erase_end(deepest, free_va_augment_cb, NULL);
+	list_add(&va->list, &free_vmap_area_pool);
+}
+
+static struct vmap_area *free_va_pool_get(void)
+{
+	struct vmap_area *va;
+
+	BUG_ON(list_empty(&free_vmap_area_pool));
+	va = list_first_entry(&free_vmap_area_pool, struct vmap_area, list);
+	list_del(&va->list);
+	return va;
+}
+
+/*
+ * The first page of each hole is left free as a guard page after the area
+ * below it, so that an overrun of one area faults rather than corrupting
+ * the next one.  The lowest address a block can start at in hole @va:
+ */
+static unsigned long free_va_base(struct vmap_area *va, unsigned long vstart)
+{
+	return max(va->va_start + PAGE_SIZE, vstart);
+}
+
+/* Does an aligned block of @size fit into the hole @va above @vstart? */
+static bool free_va_fits(struct vmap_area *va, unsigned long size,
+			 unsigned long align, unsigned long vstart)
+{
+	unsigned long base = free_va_base(va, vstart);
+	unsigned long addr = ALIGN(base, align);
+
+	if (addr < base || addr + size < addr)
+		return false;
+	return addr + size <= va->va_end;
+}
+
+/*
+ * Find the lowest hole above @vstart that fits an aligned block of @size.
+ * Only subtrees that have a hole of at least @length bytes are searched.
+ */
+static struct vmap_area *__find_lowest_free_va(unsigned long size,
+				unsigned long align, unsigned long vstart,
+				unsigned long length)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+	struct rb_node *parent;
+	struct vmap_area *va;
+
+	while (n) {
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (free_va_subtree_max(n->rb_left) >= length &&
+		    vstart < va->va_start) {
+			n = n->rb_left;
+			continue;
+		}
+
+		if (free_va_fits(va, size, align, vstart))
+			return va;
+
+		if (free_va_subtree_max(n->rb_right) >= length) {
+			n = n->rb_right;
+			continue;
+		}
+
+		/*
+		 * Dead end, because of @vstart or the alignment: go back
+		 * up to the first node we reached from its left subtree,
+		 * and carry on with that node and its right subtree.
+		 */
+		for (;;) {
+			parent = rb_parent(n);
+			if (!parent)
+				return NULL;
+			if (parent->rb_left != n) {
+				n = parent;
+				continue;
+			}
+			n = parent;
+			va = rb_entry(n, struct vmap_area, rb_node);
+			if (free_va_fits(va, size, align, vstart))
+				return va;
+			if (free_va_subtree_max(n->rb_right) >= length) {
+				n = n->rb_right;
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * A hole needs a guard page on top of the block.  Holes start on page
+ * boundaries, so any hole of size + align bytes above @vstart fits:
+ * looking for that much first keeps the search from descending into
+ * subtrees where only the alignment gets in the way.  Smaller holes may
+ * still fit when they happen to be aligned: they are only used when the
+ * first pass fails, so an aligned request can end up above such a hole.
+ */
+static struct vmap_area *find_lowest_free_va(unsigned long size,
+				unsigned long align, unsigned long vstart)
+{
+	struct vmap_area *va;
+
+	if (align <= PAGE_SIZE)
+		return __find_lowest_free_va(size, align, vstart,
+					     size + PAGE_SIZE);
+
+	va = __find_lowest_free_va(size, align, vstart, size + align);
+	if (!va)
+		va = __find_lowest_free_va(size, align, vstart,
+					   size + PAGE_SIZE);
+	return va;
+}
+
+/* Cut [addr, addr + size) out of the hole @va */
+static void free_va_clip(struct vmap_area *va, unsigned long addr,
+			 unsigned long size)
+{
+	unsigned long end = addr + size;
+	struct vmap_area *lva;
+
+	BUG_ON(addr < va->va_start || end > va->va_end);
+
+	if (va->va_start == addr && va->va_end == end) {
+		free_va_erase(va);
+	} else if (va->va_start == addr) {
+		va->va_start = end;
+		free_va_propagate(va);
+	} else if (va->va_end == end) {
+		va->va_end = addr;
+		free_va_propagate(va);
+	} else {
+		lva = free_va_pool_get();
+		lva->va_start = va->va_start;
+		lva->va_end = addr;
+		va->va_start = end;
+		free_va_propagate(va);
+		free_va_insert(lva);
+	}
+}
+
+/* Return [start, end) to the free tree, merging it with adjacent holes */
+static void free_va_add_range(unsigned long start, unsigned long end)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+	struct vmap_area *prev = NULL, *next = NULL, *va;
+
+	while (n) {
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (end <= va->va_start) {
+			next = va;
+			n = n->rb_left;
+		} else {
+			BUG_ON(va->va_end > start);
+			prev = va;
+			n = n->rb_right;
+		}
+	}
+
+	if (next && next->va_start == end) {
+		if (prev && prev->va_end == start) {
+			start = prev->va_start;
+			free_va_erase(prev);
+		}
+		next->va_start = start;
+		free_va_propagate(next);
+	} else if (prev && prev->va_end == start) {
+		prev->va_end = end;
+		free_va_propagate(prev);
+	} else {
+		va = free_va_pool_get();
+		va->va_start = start;
+		va->va_end = end;
+		free_va_insert(va);
+	}
+}
+
+/* Take [start, end), known to be free, out of the free tree */
+static void free_va_reserve_range(unsigned long start, unsigned long end)
+{
+	struct rb_node *n = free_vmap_area_root.rb_node;
+	struct vmap_area *va;
+
+	while (n) {
+		va = rb_entry(n, struct vmap_area, rb_node);
+		if (start < va->va_start)
+			n = n->rb_left;
+		else if (start >= va->va_end)
+			n = n->rb_right;
+		else {
+			free_va_clip(va, start, end - start);
+			return;
+		}
+	}
+	BUG();
+}
+
 static void purge_vmap_area_lazy(void);
 
 /*
@@ -328,9 +612,8 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				unsigned long vstart, unsigned long vend,
 				int node, gfp_t gfp_mask)
 {
-	struct vmap_area *va;
-	struct rb_node *n;
-	unsigned long addr;
+	struct vmap_area *va, *spare, *hole;
+	unsigned long addr = 0;
 	int purged = 0;
 
 	BUG_ON(!size);
@@ -338,76 +621,44 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 
 	va = kmalloc_node(sizeof(struct vmap_area),
 			gfp_mask & GFP_RECLAIM_MASK, node);
-	if (unlikely(!va))
+	spare = kmalloc_node(sizeof(struct vmap_area),
+			gfp_mask & GFP_RECLAIM_MASK, node);
+	if (unlikely(!va || !spare)) {
+		kfree(va);
+		kfree(spare);
 		return ERR_PTR(-ENOMEM);
-
-retry:
-	addr = ALIGN(vstart, align);
+	}
 
 	spin_lock(&vmap_area_lock);
-	if (addr + size - 1 < addr)
-		goto overflow;
-
-	/* XXX: could have a last_hole cache */
-	n = vmap_area_root.rb_node;
-	if (n) {
-		struct vmap_area *first = NULL;
-
-		do {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				if (!first && tmp->va_start < addr + size)
-					first = tmp;
-				n = n->rb_left;
-			} else {
-				first = tmp;
-				n = n->rb_right;
-			}
-		} while (n);
-
-		if (!first)
-			goto found;
-
-		if (first->va_end < addr) {
-			n = rb_next(&first->rb_node);
-			if (n)
-				first = rb_entry(n, struct vmap_area, rb_node);
-			else
-				goto found;
-		}
-
-		while (addr + size > first->va_start && addr + size <= vend) {
-			addr = ALIGN(first->va_end + PAGE_SIZE, align);
-			if (addr + size - 1 < addr)
-				goto overflow;
+	list_add(&spare->list, &free_vmap_area_pool);
+retry:
+	hole = find_lowest_free_va(size, align, vstart);
+	if (hole)
+		addr = ALIGN(free_va_base(hole, vstart), align);
 
-			n = rb_next(&first->rb_node);
-			if (n)
-				first = rb_entry(n, struct vmap_area, rb_node);
-			else
-				goto found;
-		}
-	}
-found:
-	if (addr + size > vend) {
-overflow:
+	if (!hole || addr + size > vend) {
 		spin_unlock(&vmap_area_lock);
 		if (!purged) {
 			purge_vmap_area_lazy();
 			purged = 1;
+			spin_lock(&vmap_area_lock);
 			goto retry;
 		}
 		if (printk_ratelimit())
 			printk(KERN_WARNING
 				"vmap allocation for size %lu failed: "
 				"use vmalloc=<size> to increase size.\n", size);
+		spin_lock(&vmap_area_lock);
+		spare = free_va_pool_get();
+		spin_unlock(&vmap_area_lock);
+		kfree(spare);
 		kfree(va);
 		return ERR_PTR(-EBUSY);
 	}
 
 	BUG_ON(addr & (align-1));
 
+	free_va_clip(hole, addr, size);
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
@@ -431,6 +682,9 @@ static void __free_vmap_area(struct vmap_area *va)
 	RB_CLEAR_NODE(&va->rb_node);
 	list_del_rcu(&va->list);
 
+	free_va_add_range(va->va_start, va->va_end);
+	kfree(free_va_pool_get());
+
 	/*
 	 * Track the highest possible candidate for pcpu area
 	 * allocation.  Areas outside of vmalloc area can be returned
@@ -509,6 +763,21 @@ static unsigned long lazy_max_pages(void)
 
 static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
 
+/*
+ * Lazily freed areas are queued per CPU, so that vunmap() does not have to
+ * take a global lock, and the purge does not have to walk every vmap area
+ * to find them.  Pages are accounted to vmap_lazy_nr in batches.
+ */
+#define VMAP_LAZY_BATCH		(256UL * 1024 / PAGE_SIZE)
+
+struct vmap_purge_queue {
+	spinlock_t lock;
+	struct list_head list;
+	unsigned long nr;		/* pages not yet in vmap_lazy_nr */
+};
+
+static DEFINE_PER_CPU(struct vmap_purge_queue, vmap_purge_queue);
+
 /* for per-CPU blocks */
 static void purge_fragmented_blocks_allcpus(void);
 
@@ -529,7 +798,9 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	LIST_HEAD(valist);
 	struct vmap_area *va;
 	struct vmap_area *n_va;
+	unsigned long unfolded = 0;
 	int nr = 0;
+	int cpu;
 
 	/*
 	 * If sync is 0 but force_flush is 1, we'll go sync anyway but callers
@@ -545,24 +816,31 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
-			if (va->va_start < *start)
-				*start = va->va_start;
-			if (va->va_end > *end)
-				*end = va->va_end;
-			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			unmap_vmap_area(va);
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
-		}
+	for_each_possible_cpu(cpu) {
+		struct vmap_purge_queue *vpq = &per_cpu(vmap_purge_queue, cpu);
+
+		if (list_empty(&vpq->list))
+			continue;
+		spin_lock(&vpq->lock);
+		list_splice_tail_init(&vpq->list, &valist);
+		unfolded += vpq->nr;
+		vpq->nr = 0;
+		spin_unlock(&vpq->lock);
 	}
-	rcu_read_unlock();
 
-	if (nr)
-		atomic_sub(nr, &vmap_lazy_nr);
+	list_for_each_entry(va, &valist, purge_list) {
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+		unmap_vmap_area(va);
+		va->flags |= VM_LAZY_FREEING;
+		va->flags &= ~VM_LAZY_FREE;
+	}
+
+	if (nr - unfolded)
+		atomic_sub(nr - unfolded, &vmap_lazy_nr);
 
 	if (nr || force_flush)
 		flush_tlb_kernel_range(*start, *end);
@@ -603,10 +881,27 @@ static void purge_vmap_area_lazy(void)
  */
 static void free_unmap_vmap_area_noflush(struct vmap_area *va)
 {
+	struct vmap_purge_queue *vpq;
+	unsigned long nr = 0;
+
 	va->flags |= VM_LAZY_FREE;
-	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
-	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
-		try_purge_vmap_area_lazy();
+
+	vpq = &get_cpu_var(vmap_purge_queue);
+	spin_lock(&vpq->lock);
+	list_add_tail(&va->purge_list, &vpq->list);
+	vpq->nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+	if (vpq->nr >= VMAP_LAZY_BATCH) {
+		nr = vpq->nr;
+		vpq->nr = 0;
+	}
+	spin_unlock(&vpq->lock);
+	put_cpu_var(vmap_purge_queue);
+
+	if (nr) {
+		atomic_add(nr, &vmap_lazy_nr);
+		if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
+			try_purge_vmap_area_lazy();
+	}
 }
 
 /*
@@ -1089,24 +1384,47 @@ void __init vmalloc_init(void)
 {
 	struct vmap_area *va;
 	struct vm_struct *tmp;
-	int i;
+	unsigned long addr = 0;
+	int i, nr = 0;
 
 	for_each_possible_cpu(i) {
 		struct vmap_block_queue *vbq;
+		struct vmap_purge_queue *vpq;
 
 		vbq = &per_cpu(vmap_block_queue, i);
 		spin_lock_init(&vbq->lock);
 		INIT_LIST_HEAD(&vbq->free);
+
+		vpq = &per_cpu(vmap_purge_queue, i);
+		spin_lock_init(&vpq->lock);
+		INIT_LIST_HEAD(&vpq->list);
 	}
 
 	/* Import existing vmlist entries. */
 	for (tmp = vmlist; tmp; tmp = tmp->next) {
 		va = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		if (!va)
+			panic("vmalloc_init: out of memory\n");
 		va->flags = tmp->flags | VM_VM_AREA;
 		va->va_start = (unsigned long)tmp->addr;
 		va->va_end = va->va_start + tmp->size;
 		__insert_vmap_area(va);
+		nr++;
+	}
+
+	/* The holes between them make up the free tree. */
+	for (i = 0; i <= nr; i++) {
+		va = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
+		if (!va)
+			panic("vmalloc_init: out of memory\n");
+		list_add(&va->list, &free_vmap_area_pool);
+	}
+	list_for_each_entry(va, &vmap_area_list, list) {
+		if (va->va_start > addr)
+			free_va_add_range(addr, va->va_start);
+		addr = va->va_end;
 	}
+	free_va_add_range(addr, ULONG_MAX);
 
 	vmap_area_pcpu_hole = VMALLOC_END;
 
@@ -1493,20 +1811,16 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 		return NULL;
 	}
 
-	for (i = 0; i < area->nr_pages; i++) {
-		struct page *page;
-
-		if (node < 0)
-			page = alloc_page(gfp_mask);
-		else
-			page = alloc_pages_node(node, gfp_mask, 0);
+	/* The array was zeroed, so the bulk allocator fills it from the start */
+	if (node < 0)
+		i = alloc_pages_bulk_array(gfp_mask, nr_pages, pages);
+	else
+		i = alloc_pages_bulk_array_node(node, gfp_mask, nr_pages, pages);
 
-		if (unlikely(!page)) {
-			/* Successfully allocated i pages, free them in __vunmap() */
-			area->nr_pages = i;
-			goto fail;
-		}
-		area->pages[i] = page;
+	if (unlikely(i < nr_pages)) {
+		/* Successfully allocated i pages, free them in __vunmap() */
+		area->nr_pages = i;
+		goto fail;
 	}
 
 	if (map_vm_area(area, prot, &pages))
@@ -2166,11 +2480,12 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 {
 	const unsigned long vmalloc_start = ALIGN(VMALLOC_START, align);
 	const unsigned long vmalloc_end = VMALLOC_END & ~(align - 1);
-	struct vmap_area **vas, *prev, *next;
+	struct vmap_area **vas, *prev, *next, *spare, *n_spare;
 	struct vm_struct **vms;
 	int area, area2, last_area, term_area;
 	unsigned long base, start, end, last_end;
 	bool purged = false;
+	LIST_HEAD(spares);
 
 	gfp_mask &= GFP_RECLAIM_MASK;
 
@@ -2216,6 +2531,12 @@ struct vm_struct **pcpu_get_vm_areas(const unsigned long *offsets,
 		vms[area] = kzalloc(sizeof(struct vm_struct), gfp_mask);
 		if (!vas[area] || !vms[area])
 			goto err_free;
+
+		/* and a node for the free tree for each of them */
+		spare = kmalloc(sizeof(struct vmap_area), gfp_mask);
+		if (!spare)
+			goto err_free;
+		list_add(&spare->list, &spares);
 	}
 retry:
 	spin_lock(&vmap_area_lock);
@@ -2293,6 +2614,10 @@ found:
 		__insert_vmap_area(va);
 	}
 
+	list_splice(&spares, &free_vmap_area_pool);
+	for (area = 0; area < nr_vms; area++)
+		free_va_reserve_range(vas[area]->va_start, vas[area]->va_end);
+
 	vmap_area_pcpu_hole = base + offsets[last_area];
 
 	spin_unlock(&vmap_area_lock);
@@ -2312,6 +2637,8 @@ err_free:
 		if (vms)
 			kfree(vms[area]);
 	}
+	list_for_each_entry_safe(spare, n_spare, &spares, list)
+		kfree(spare);
 	kfree(vas);
 	kfree(vms);
 	return NULL;
@@ -29,6 +29,7 @@
 #include <linux/pagevec.h>
 #include <linux/backing-dev.h>
 #include <linux/rmap.h>
+#include <linux/ksm.h>
 #include <linux/topology.h>
 #include <linux/cpu.h>
 #include <linux/cpuset.h>
@@ -40,6 +41,7 @@
 #include <linux/memcontrol.h>
 #include <linux/delayacct.h>
 #include <linux/sysctl.h>
+#include <linux/rcupdate.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -85,12 +87,6 @@ struct scan_control {
 	 * are scanned.
 	 */
 	nodemask_t	*nodemask;
-
-	/* Pluggable isolate pages callback */
-	unsigned long (*isolate_pages)(unsigned long nr, struct list_head *dst,
-			unsigned long *scanned, int order, int mode,
-			struct zone *z, struct mem_cgroup *mem_cont,
-			int active, int file);
 };
 
 #define lru_to_page(_head) (list_entry((_head)->prev, struct page, lru))
@@ -138,24 +134,6 @@ static DECLARE_RWSEM(shrinker_rwsem);
 #define scanning_global_lru(sc)	(1)
 #endif
 
-static struct zone_reclaim_stat *get_reclaim_stat(struct zone *zone,
-						  struct scan_control *sc)
-{
-	if (!scanning_global_lru(sc))
-		return mem_cgroup_get_reclaim_stat(sc->mem_cgroup, zone);
-
-	return &zone->reclaim_stat;
-}
-
-static unsigned long zone_nr_lru_pages(struct zone *zone,
-				struct scan_control *sc, enum lru_list lru)
-{
-	if (!scanning_global_lru(sc))
-		return mem_cgroup_zone_nr_pages(sc->mem_cgroup, zone, lru);
-
-	return zone_page_state(zone, NR_LRU_BASE + lru);
-}
-
 
 /*
  * Add a shrinker callback to be called from the vm
@@ -409,7 +387,8 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
  * Same as remove_mapping, but if the page is removed from the mapping, it
  * gets returned with a refcount of 0.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    bool reclaimed)
 {
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -454,7 +433,16 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		spin_unlock_irq(&mapping->tree_lock);
 		swapcache_free(swap, page);
 	} else {
-		__remove_from_page_cache(page);
+		void *shadow = NULL;
+
+		/*
+		 * Remember when reclaim evicted the page so that a refault
+		 * can tell whether it was part of the working set. Private
+		 * mappings without a host manage their trees themselves.
+		 */
+		if (reclaimed && page_is_file_cache(page) && mapping->host)
+			shadow = workingset_eviction(mapping, page);
+		__remove_from_page_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 		mem_cgroup_uncharge_cache_page(page);
 	}
@@ -474,7 +462,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, false)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -632,6 +620,8 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 	cond_resched();
 
 	pagevec_init(&freed_pvec, 1);
+	/* Pages reclaimed together mostly belong to the same memcg */
+	mem_cgroup_uncharge_start();
 	while (!list_empty(page_list)) {
 		enum page_references references;
 		struct address_space *mapping;
@@ -689,6 +679,30 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			; /* try to reclaim the page below */
 		}
 
+		/*
+		 * Anonymous memory released with MADV_FREE and not written
+		 * since is clean: unmap and free it without any swap I/O.
+		 * Pages with other references, e.g. get_user_pages(), may
+		 * still be written to and go the normal way.
+		 */
+		if (PageAnon(page) && !PageKsm(page) && !PageSwapCache(page) &&
+		    !PageDirty(page) && page_mapped(page) &&
+		    page_count(page) == page_mapcount(page) + 1) {
+			switch (try_to_unmap(page, TTU_UNMAP | TTU_FREE)) {
+			case SWAP_MLOCK:
+				goto cull_mlocked;
+			case SWAP_SUCCESS:
+				if (!PageDirty(page) && page_freeze_refs(page, 1)) {
+					__clear_page_locked(page);
+					count_vm_event(PGLAZYFREED);
+					goto free_it;
+				}
+				break;
+			default:
+				; /* not lazily freed, try swap below */
+			}
+		}
+
 		/*
 		 * Anonymous process memory has backing store?
 		 * Try to allocate it some swap space here.
@@ -793,7 +807,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, true))
 			goto keep_locked;
 
 		/*
@@ -832,6 +846,7 @@ keep:
 		list_add(&page->lru, &ret_pages);
 		VM_BUG_ON(PageLRU(page) || PageUnevictable(page));
 	}
+	mem_cgroup_uncharge_end();
 	list_splice(&ret_pages, page_list);
 	if (pagevec_count(&freed_pvec))
 		__pagevec_free(&freed_pvec);
@@ -839,11 +854,6 @@ keep:
 	return nr_reclaimed;
 }
 
-/* LRU Isolation modes. */
-#define ISOLATE_INACTIVE 0	/* Isolate inactive pages. */
-#define ISOLATE_ACTIVE 1	/* Isolate active pages. */
-#define ISOLATE_BOTH 2		/* Isolate both active and inactive pages. */
-
 /*
  * Attempt to remove the specified page from its LRU.  Only take this page
  * if it is of the appropriate PageActive status.  Pages which are being
@@ -858,9 +868,12 @@ int __isolate_lru_page(struct page *page, int mode, int file)
 {
 	int ret = -EINVAL;
 
-	/* Only take pages on the LRU. */
+	/*
+	 * A page on the list without PageLRU was claimed by somebody
+	 * who is about to take the lru_lock and move it.
+	 */
 	if (!PageLRU(page))
-		return ret;
+		return -EBUSY;
 
 	/*
 	 * When checking the active state, we need to be sure we are
@@ -889,39 +902,52 @@ int __isolate_lru_page(struct page *page, int mode, int file)
 		 * sure the page is not being freed elsewhere -- the
 		 * page release code relies on it.
 		 */
-		ClearPageLRU(page);
-		ret = 0;
+		if (TestClearPageLRU(page))
+			ret = 0;
+		else
+			put_page(page);
 	}
 
 	return ret;
 }
 
 /*
- * zone->lru_lock is heavily contended.  Some of the functions that
+ * The lru_lock is heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
  * and working on them outside the LRU lock.
  *
  * For pagecache intensive workloads, this function is the hottest
  * spot in the kernel (apart from copy_*_user functions).
  *
- * Appropriate locks must be held before calling this function.
+ * lruvec->lru_lock must be held before calling this function.  The
+ * zone statistics are left for the caller to adjust.
  *
  * @nr_to_scan:	The number of pages to look through on the list.
- * @src:	The LRU list to pull pages off.
+ * @lruvec:	The lruvec to pull pages off.
  * @dst:	The temp list to put pages on to.
  * @scanned:	The number of pages that were scanned.
  * @order:	The caller's attempted allocation order
  * @mode:	One of the LRU isolation modes
+ * @active:	True [1] if isolating from the active list
  * @file:	True [1] if isolating file [!anon] pages
  *
  * returns how many pages were moved onto *@dst.
  */
 static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
-		struct list_head *src, struct list_head *dst,
-		unsigned long *scanned, int order, int mode, int file)
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *scanned, int order, int mode,
+		int active, int file)
 {
+	struct list_head *src;
 	unsigned long nr_taken = 0;
 	unsigned long scan;
+	int lru = LRU_BASE;
+
+	if (active)
+		lru += LRU_ACTIVE;
+	if (file)
+		lru += LRU_FILE;
+	src = &lruvec->lists[lru];
 
 	for (scan = 0; scan < nr_to_scan && !list_empty(src); scan++) {
 		struct page *page;
@@ -933,19 +959,17 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		page = lru_to_page(src);
 		prefetchw_prev_lru_page(page, src, flags);
 
-		VM_BUG_ON(!PageLRU(page));
-
 		switch (__isolate_lru_page(page, mode, file)) {
 		case 0:
 			list_move(&page->lru, dst);
-			mem_cgroup_del_lru(page);
+			lruvec->count[page_lru(page)]--;
+			mem_cgroup_lru_del(page);
 			nr_taken++;
 			break;
 
 		case -EBUSY:
-			/* else it is being freed elsewhere */
+			/* else it is being freed or moved elsewhere */
 			list_move(&page->lru, src);
-			mem_cgroup_rotate_lru_list(page, page_lru(page));
 			continue;
 
 		default:
@@ -970,6 +994,7 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		end_pfn = pfn + (1 << order);
 		for (; pfn < end_pfn; pfn++) {
 			struct page *cursor_page;
+			struct lruvec *cursor_lruvec;
 
 			/* The target page is in the block, ignore it. */
 			if (unlikely(pfn == page_pfn))
@@ -985,6 +1010,17 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 			if (unlikely(page_zone_id(cursor_page) != zone_id))
 				continue;
 
+			/*
+			 * Only our own lock protects the page's list;
+			 * leave pages on other lruvecs alone.  The page is
+			 * not pinned, its cgroup may be going away.
+			 */
+			rcu_read_lock();
+			cursor_lruvec = page_lruvec(cursor_page);
+			rcu_read_unlock();
+			if (cursor_lruvec != lruvec)
+				continue;
+
 			/*
 			 * If we don't have enough swap space, reclaiming of
 			 * anon page which don't already have a swap slot is
@@ -996,7 +1032,8 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 
 			if (__isolate_lru_page(cursor_page, mode, file) == 0) {
 				list_move(&cursor_page->lru, dst);
-				mem_cgroup_del_lru(cursor_page);
+				lruvec->count[page_lru(cursor_page)]--;
+				mem_cgroup_lru_del(cursor_page);
 				nr_taken++;
 				scan++;
 			}
@@ -1007,22 +1044,6 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 	return nr_taken;
 }
 
-static unsigned long isolate_pages_global(unsigned long nr,
-					struct list_head *dst,
-					unsigned long *scanned, int order,
-					int mode, struct zone *z,
-					struct mem_cgroup *mem_cont,
-					int active, int file)
-{
-	int lru = LRU_BASE;
-	if (active)
-		lru += LRU_ACTIVE;
-	if (file)
-		lru += LRU_FILE;
-	return isolate_lru_pages(nr, &z->lru[lru].list, dst, scanned, order,
-								mode, file);
-}
-
 /*
  * clear_active_flags() is a helper for shrink_active_list(), clearing
  * any active bits from the pages in the list.
@@ -1076,18 +1097,19 @@ int isolate_lru_page(struct page *page)
 {
 	int ret = -EBUSY;
 
-	if (PageLRU(page)) {
-		struct zone *zone = page_zone(page);
-
-		spin_lock_irq(&zone->lru_lock);
-		if (PageLRU(page) && get_page_unless_zero(page)) {
-			int lru = page_lru(page);
-			ret = 0;
-			ClearPageLRU(page);
-
-			del_page_from_lru_list(zone, page, lru);
-		}
-		spin_unlock_irq(&zone->lru_lock);
+	/*
+	 * Clearing PageLRU first keeps the page on its lruvec until we
+	 * have taken it off, so page_lruvec() is stable.
+	 */
+	if (PageLRU(page) && TestClearPageLRU(page)) {
+		struct lruvec *lruvec;
+
+		get_page(page);
+		lruvec = page_lruvec(page);
+		spin_lock_irq(&lruvec->lru_lock);
+		del_page_from_lru_list(lruvec, page, page_lru(page));
+		spin_unlock_irq(&lruvec->lru_lock);
+		ret = 0;
 	}
 	return ret;
 }
@@ -1118,18 +1140,34 @@ static int too_many_isolated(struct zone *zone, int file,
 }
 
 /*
- * shrink_inactive_list() is a helper for shrink_zone().  It returns the number
- * of reclaimed pages
+ * Switch from the lru_lock held in @locked to the one of the lruvec
+ * @page is to be added to.  Interrupts stay disabled.
+ */
+static struct lruvec *relock_lru_add_lruvec(struct page *page,
+					    struct lruvec *locked)
+{
+	struct lruvec *lruvec = page_lru_add_lruvec(page);
+
+	if (lruvec != locked) {
+		spin_unlock(&locked->lru_lock);
+		spin_lock(&lruvec->lru_lock);
+	}
+	return lruvec;
+}
+
+/*
+ * shrink_inactive_list() is a helper for shrink_lruvec().  It returns the
+ * number of reclaimed pages
  */
 static unsigned long shrink_inactive_list(unsigned long max_scan,
-			struct zone *zone, struct scan_control *sc,
-			int priority, int file)
+			struct zone *zone, struct lruvec *lruvec,
+			struct scan_control *sc, int priority, int file)
 {
 	LIST_HEAD(page_list);
 	struct pagevec pvec;
 	unsigned long nr_scanned = 0;
 	unsigned long nr_reclaimed = 0;
-	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(zone, sc);
+	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
 	int lumpy_reclaim = 0;
 
 	while (unlikely(too_many_isolated(zone, file, sc))) {
@@ -1155,8 +1193,9 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 	pagevec_init(&pvec, 1);
 
 	lru_add_drain();
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 	do {
+		struct lruvec *locked;
 		struct page *page;
 		unsigned long nr_taken;
 		unsigned long nr_scan;
@@ -1167,9 +1206,8 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 		unsigned long nr_anon;
 		unsigned long nr_file;
 
-		nr_taken = sc->isolate_pages(SWAP_CLUSTER_MAX,
-			     &page_list, &nr_scan, sc->order, mode,
-				zone, sc->mem_cgroup, 0, file);
+		nr_taken = isolate_lru_pages(SWAP_CLUSTER_MAX, lruvec,
+				&page_list, &nr_scan, sc->order, mode, 0, file);
 
 		if (scanning_global_lru(sc)) {
 			zone->pages_scanned += nr_scan;
@@ -1204,7 +1242,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 		reclaim_stat->recent_scanned[0] += nr_anon;
 		reclaim_stat->recent_scanned[1] += nr_file;
 
-		spin_unlock_irq(&zone->lru_lock);
+		spin_unlock_irq(&lruvec->lru_lock);
 
 		nr_scanned += nr_scan;
 		nr_freed = shrink_page_list(&page_list, sc, PAGEOUT_IO_ASYNC);
@@ -1237,9 +1275,12 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 			__count_vm_events(KSWAPD_STEAL, nr_freed);
 		__count_zone_vm_events(PGSTEAL, zone, nr_freed);
 
-		spin_lock(&zone->lru_lock);
+		spin_lock(&lruvec->lru_lock);
+		locked = lruvec;
 		/*
-		 * Put back any unfreeable pages.
+		 * Put back any unfreeable pages.  They go to the lruvec of
+		 * the cgroup they are charged to now, which need not be the
+		 * one they were taken from.
 		 */
 		while (!list_empty(&page_list)) {
 			int lru;
@@ -1247,31 +1288,36 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 			VM_BUG_ON(PageLRU(page));
 			list_del(&page->lru);
 			if (unlikely(!page_evictable(page, NULL))) {
-				spin_unlock_irq(&zone->lru_lock);
+				spin_unlock_irq(&locked->lru_lock);
 				putback_lru_page(page);
-				spin_lock_irq(&zone->lru_lock);
+				spin_lock_irq(&locked->lru_lock);
 				continue;
 			}
-			SetPageLRU(page);
+			locked = relock_lru_add_lruvec(page, locked);
 			lru = page_lru(page);
-			add_page_to_lru_list(zone, page, lru);
+			add_page_to_lru_list(locked, page, lru);
+			SetPageLRU(page);
 			if (is_active_lru(lru)) {
 				int file = is_file_lru(lru);
-				reclaim_stat->recent_rotated[file]++;
+				locked->reclaim_stat.recent_rotated[file]++;
 			}
 			if (!pagevec_add(&pvec, page)) {
-				spin_unlock_irq(&zone->lru_lock);
+				spin_unlock_irq(&locked->lru_lock);
 				__pagevec_release(&pvec);
-				spin_lock_irq(&zone->lru_lock);
+				spin_lock_irq(&locked->lru_lock);
 			}
 		}
 		__mod_zone_page_state(zone, NR_ISOLATED_ANON, -nr_anon);
 		__mod_zone_page_state(zone, NR_ISOLATED_FILE, -nr_file);
 
+		if (locked != lruvec) {
+			spin_unlock(&locked->lru_lock);
+			spin_lock(&lruvec->lru_lock);
+		}
   	} while (nr_scanned < max_scan);
 
 done:
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 	pagevec_release(&pvec);
 	return nr_reclaimed;
 }
@@ -1297,9 +1343,9 @@ static inline void note_zone_scanning_priority(struct zone *zone, int priority)
  * processes, from rmap.
  *
  * If the pages are mostly unmapped, the processing is fast and it is
- * appropriate to hold zone->lru_lock across the whole operation.  But if
+ * appropriate to hold the lru_lock across the whole operation.  But if
  * the pages are mapped, the processing is slow (page_referenced()) so we
- * should drop zone->lru_lock around each page.  It's impossible to balance
+ * should drop the lru_lock around each page.  It's impossible to balance
  * this, so instead we remove the pages from the LRU while processing them.
  * It is safe to rely on PG_active against the non-LRU pages in here because
  * nobody will play with that bit on a non-LRU page.
@@ -1308,9 +1354,13 @@ static inline void note_zone_scanning_priority(struct zone *zone, int priority)
  * But we had to alter page->flags anyway.
  */
 
-static void move_active_pages_to_lru(struct zone *zone,
-				     struct list_head *list,
-				     enum lru_list lru)
+/*
+ * Called with @locked->lru_lock held and returns with the lru_lock of
+ * the lruvec that received the last page held instead.
+ */
+static struct lruvec *move_active_pages_to_lru(struct lruvec *locked,
+					       struct list_head *list,
+					       enum lru_list lru)
 {
 	unsigned long pgmoved = 0;
 	struct pagevec pvec;
@@ -1322,27 +1372,28 @@ static void move_active_pages_to_lru(struct zone *zone,
 		page = lru_to_page(list);
 
 		VM_BUG_ON(PageLRU(page));
+		list_del(&page->lru);
+		locked = relock_lru_add_lruvec(page, locked);
+		add_page_to_lru_list(locked, page, lru);
 		SetPageLRU(page);
-
-		list_move(&page->lru, &zone->lru[lru].list);
-		mem_cgroup_add_lru_list(page, lru);
 		pgmoved++;
 
 		if (!pagevec_add(&pvec, page) || list_empty(list)) {
-			spin_unlock_irq(&zone->lru_lock);
+			spin_unlock_irq(&locked->lru_lock);
 			if (buffer_heads_over_limit)
 				pagevec_strip(&pvec);
 			__pagevec_release(&pvec);
-			spin_lock_irq(&zone->lru_lock);
+			spin_lock_irq(&locked->lru_lock);
 		}
 	}
-	__mod_zone_page_state(zone, NR_LRU_BASE + lru, pgmoved);
 	if (!is_active_lru(lru))
 		__count_vm_events(PGDEACTIVATE, pgmoved);
+	return locked;
 }
 
 static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
-			struct scan_control *sc, int priority, int file)
+			struct lruvec *lruvec, struct scan_control *sc,
+			int priority, int file)
 {
 	unsigned long nr_taken;
 	unsigned long pgscanned;
@@ -1350,15 +1401,15 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 	LIST_HEAD(l_hold);	/* The pages which were snipped off */
 	LIST_HEAD(l_active);
 	LIST_HEAD(l_inactive);
+	struct lruvec *locked;
 	struct page *page;
-	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(zone, sc);
+	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
 	unsigned long nr_rotated = 0;
 
 	lru_add_drain();
-	spin_lock_irq(&zone->lru_lock);
-	nr_taken = sc->isolate_pages(nr_pages, &l_hold, &pgscanned, sc->order,
-					ISOLATE_ACTIVE, zone,
-					sc->mem_cgroup, 1, file);
+	spin_lock_irq(&lruvec->lru_lock);
+	nr_taken = isolate_lru_pages(nr_pages, lruvec, &l_hold, &pgscanned,
+				     sc->order, ISOLATE_ACTIVE, 1, file);
 	/*
 	 * zone->pages_scanned is used for detect zone's oom
 	 * mem_cgroup remembers nr_scan by itself.
@@ -1374,7 +1425,7 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 	else
 		__mod_zone_page_state(zone, NR_ACTIVE_ANON, -nr_taken);
 	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, nr_taken);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&lruvec->lru_lock);
 
 	while (!list_empty(&l_hold)) {
 		cond_resched();
@@ -1410,7 +1461,7 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 	/*
 	 * Move pages back to the lru list.
 	 */
-	spin_lock_irq(&zone->lru_lock);
+	spin_lock_irq(&lruvec->lru_lock);
 	/*
 	 * Count referenced pages from currently used mappings as rotated,
 	 * even though only some of them are actually re-activated.  This
@@ -1419,20 +1470,21 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 	 */
 	reclaim_stat->recent_rotated[file] += nr_rotated;
 
-	move_active_pages_to_lru(zone, &l_active,
+	locked = move_active_pages_to_lru(lruvec, &l_active,
 						LRU_ACTIVE + file * LRU_FILE);
-	move_active_pages_to_lru(zone, &l_inactive,
+	locked = move_active_pages_to_lru(locked, &l_inactive,
 						LRU_BASE   + file * LRU_FILE);
 	__mod_zone_page_state(zone, NR_ISOLATED_ANON + file, -nr_taken);
-	spin_unlock_irq(&zone->lru_lock);
+	spin_unlock_irq(&locked->lru_lock);
 }
 
-static int inactive_anon_is_low_global(struct zone *zone)
+static int inactive_anon_is_low_global(struct zone *zone,
+				       struct lruvec *lruvec)
 {
 	unsigned long active, inactive;
 
-	active = zone_page_state(zone, NR_ACTIVE_ANON);
-	inactive = zone_page_state(zone, NR_INACTIVE_ANON);
+	active = lruvec->count[LRU_ACTIVE_ANON];
+	inactive = lruvec->count[LRU_INACTIVE_ANON];
 
 	if (inactive * zone->inactive_ratio < active)
 		return 1;
@@ -1443,35 +1495,37 @@ static int inactive_anon_is_low_global(struct zone *zone)
 /**
  * inactive_anon_is_low - check if anonymous pages need to be deactivated
  * @zone: zone to check
+ * @lruvec: lruvec of @zone that is being scanned
  * @sc:   scan control of this context
  *
- * Returns true if the zone does not have enough inactive anon pages,
+ * Returns true if the lruvec does not have enough inactive anon pages,
  * meaning some active anon pages need to be deactivated.
  */
-static int inactive_anon_is_low(struct zone *zone, struct scan_control *sc)
+static int inactive_anon_is_low(struct zone *zone, struct lruvec *lruvec,
+				struct scan_control *sc)
 {
 	int low;
 
 	if (scanning_global_lru(sc))
-		low = inactive_anon_is_low_global(zone);
+		low = inactive_anon_is_low_global(zone, lruvec);
 	else
 		low = mem_cgroup_inactive_anon_is_low(sc->mem_cgroup);
 	return low;
 }
 
-static int inactive_file_is_low_global(struct zone *zone)
+static int inactive_file_is_low_global(struct lruvec *lruvec)
 {
 	unsigned long active, inactive;
 
-	active = zone_page_state(zone, NR_ACTIVE_FILE);
-	inactive = zone_page_state(zone, NR_INACTIVE_FILE);
+	active = lruvec->count[LRU_ACTIVE_FILE];
+	inactive = lruvec->count[LRU_INACTIVE_FILE];
 
 	return (active > inactive);
 }
 
 /**
  * inactive_file_is_low - check if file pages need to be deactivated
- * @zone: zone to check
+ * @lruvec: lruvec that is being scanned
  * @sc:   scan control of this context
  *
  * When the system is doing streaming IO, memory pressure here
@@ -1484,38 +1538,41 @@ static int inactive_file_is_low_global(struct zone *zone)
  * This uses a different ratio than the anonymous pages, because
  * the page cache uses a use-once replacement algorithm.
  */
-static int inactive_file_is_low(struct zone *zone, struct scan_control *sc)
+static int inactive_file_is_low(struct lruvec *lruvec, struct scan_control *sc)
 {
 	int low;
 
 	if (scanning_global_lru(sc))
-		low = inactive_file_is_low_global(zone);
+		low = inactive_file_is_low_global(lruvec);
 	else
 		low = mem_cgroup_inactive_file_is_low(sc->mem_cgroup);
 	return low;
 }
 
-static int inactive_list_is_low(struct zone *zone, struct scan_control *sc,
-				int file)
+static int inactive_list_is_low(struct zone *zone, struct lruvec *lruvec,
+				struct scan_control *sc, int file)
 {
 	if (file)
-		return inactive_file_is_low(zone, sc);
+		return inactive_file_is_low(lruvec, sc);
 	else
-		return inactive_anon_is_low(zone, sc);
+		return inactive_anon_is_low(zone, lruvec, sc);
 }
 
 static unsigned long shrink_list(enum lru_list lru, unsigned long nr_to_scan,
-	struct zone *zone, struct scan_control *sc, int priority)
+	struct zone *zone, struct lruvec *lruvec, struct scan_control *sc,
+	int priority)
 {
 	int file = is_file_lru(lru);
 
 	if (is_active_lru(lru)) {
-		if (inactive_list_is_low(zone, sc, file))
-		    shrink_active_list(nr_to_scan, zone, sc, priority, file);
+		if (inactive_list_is_low(zone, lruvec, sc, file))
+		    shrink_active_list(nr_to_scan, zone, lruvec, sc,
+				       priority, file);
 		return 0;
 	}
 
-	return shrink_inactive_list(nr_to_scan, zone, sc, priority, file);
+	return shrink_inactive_list(nr_to_scan, zone, lruvec, sc,
+				    priority, file);
 }
 
 /*
@@ -1527,24 +1584,26 @@ static unsigned long shrink_list(enum lru_list lru, unsigned long nr_to_scan,
  * percent[0] specifies how much pressure to put on ram/swap backed
  * memory, while percent[1] determines pressure on the file LRUs.
  */
-static void get_scan_ratio(struct zone *zone, struct scan_control *sc,
-					unsigned long *percent)
+static void get_scan_ratio(struct zone *zone, struct lruvec *lruvec,
+			   struct scan_control *sc, unsigned long *percent)
 {
 	unsigned long anon, file, free;
 	unsigned long anon_prio, file_prio;
 	unsigned long ap, fp;
-	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(zone, sc);
+	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
 
-	anon  = zone_nr_lru_pages(zone, sc, LRU_ACTIVE_ANON) +
-		zone_nr_lru_pages(zone, sc, LRU_INACTIVE_ANON);
-	file  = zone_nr_lru_pages(zone, sc, LRU_ACTIVE_FILE) +
-		zone_nr_lru_pages(zone, sc, LRU_INACTIVE_FILE);
+	anon  = lruvec->count[LRU_ACTIVE_ANON] +
+		lruvec->count[LRU_INACTIVE_ANON];
+	file  = lruvec->count[LRU_ACTIVE_FILE] +
+		lruvec->count[LRU_INACTIVE_FILE];
 
 	if (scanning_global_lru(sc)) {
 		free  = zone_page_state(zone, NR_FREE_PAGES);
 		/* If we have very few page cache pages,
 		   force-scan anon pages. */
-		if (unlikely(file + free <= high_wmark_pages(zone))) {
+		if (unlikely(zone_page_state(zone, NR_ACTIVE_FILE) +
+			     zone_page_state(zone, NR_INACTIVE_FILE) +
+			     free <= high_wmark_pages(zone))) {
 			percent[0] = 100;
 			percent[1] = 0;
 			return;
@@ -1563,17 +1622,17 @@ static void get_scan_ratio(struct zone *zone, struct scan_control *sc,
 	 * anon in [0], file in [1]
 	 */
 	if (unlikely(reclaim_stat->recent_scanned[0] > anon / 4)) {
-		spin_lock_irq(&zone->lru_lock);
+		spin_lock_irq(&lruvec->lru_lock);
 		reclaim_stat->recent_scanned[0] /= 2;
 		reclaim_stat->recent_rotated[0] /= 2;
-		spin_unlock_irq(&zone->lru_lock);
+		spin_unlock_irq(&lruvec->lru_lock);
 	}
 
 	if (unlikely(reclaim_stat->recent_scanned[1] > file / 4)) {
-		spin_lock_irq(&zone->lru_lock);
+		spin_lock_irq(&lruvec->lru_lock);
 		reclaim_stat->recent_scanned[1] /= 2;
 		reclaim_stat->recent_rotated[1] /= 2;
-		spin_unlock_irq(&zone->lru_lock);
+		spin_unlock_irq(&lruvec->lru_lock);
 	}
 
 	/*
@@ -1620,10 +1679,10 @@ static unsigned long nr_scan_try_batch(unsigned long nr_to_scan,
 }
 
 /*
- * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
+ * Reclaim from one set of LRU lists of a zone.
  */
-static void shrink_zone(int priority, struct zone *zone,
-				struct scan_control *sc)
+static void shrink_lruvec(int priority, struct zone *zone,
+			  struct lruvec *lruvec, struct scan_control *sc)
 {
 	unsigned long nr[NR_LRU_LISTS];
 	unsigned long nr_to_scan;
@@ -1631,7 +1690,7 @@ static void shrink_zone(int priority, struct zone *zone,
 	enum lru_list l;
 	unsigned long nr_reclaimed = sc->nr_reclaimed;
 	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
-	struct zone_reclaim_stat *reclaim_stat = get_reclaim_stat(zone, sc);
+	struct zone_reclaim_stat *reclaim_stat = &lruvec->reclaim_stat;
 	int noswap = 0;
 
 	/* If we have no swap space, do not bother scanning anon pages. */
@@ -1640,13 +1699,13 @@ static void shrink_zone(int priority, struct zone *zone,
 		percent[0] = 0;
 		percent[1] = 100;
 	} else
-		get_scan_ratio(zone, sc, percent);
+		get_scan_ratio(zone, lruvec, sc, percent);
 
 	for_each_evictable_lru(l) {
 		int file = is_file_lru(l);
 		unsigned long scan;
 
-		scan = zone_nr_lru_pages(zone, sc, l);
+		scan = lruvec->count[l];
 		if (priority || noswap) {
 			scan >>= priority;
 			scan = (scan * percent[file]) / 100;
@@ -1664,7 +1723,7 @@ static void shrink_zone(int priority, struct zone *zone,
 				nr[l] -= nr_to_scan;
 
 				nr_reclaimed += shrink_list(l, nr_to_scan,
-							    zone, sc, priority);
+						zone, lruvec, sc, priority);
 			}
 		}
 		/*
@@ -1685,8 +1744,45 @@ static void shrink_zone(int priority, struct zone *zone,
 	 * Even if we did not try to evict anon pages at all, we want to
 	 * rebalance the anon lru active/inactive ratio.
 	 */
-	if (inactive_anon_is_low(zone, sc) && nr_swap_pages > 0)
-		shrink_active_list(SWAP_CLUSTER_MAX, zone, sc, priority, 0);
+	if (inactive_anon_is_low(zone, lruvec, sc) && nr_swap_pages > 0)
+		shrink_active_list(SWAP_CLUSTER_MAX, zone, lruvec, sc,
+				   priority, 0);
+}
+
+/*
+ * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
+ *
+ * Limit reclaim only scans the lists of the cgroup over its limit, while
+ * global reclaim puts pressure on the lists of every cgroup in the zone.
+ */
+static void shrink_zone(int priority, struct zone *zone,
+				struct scan_control *sc)
+{
+	struct mem_cgroup_reclaim_cookie reclaim = {
+		.zone = zone,
+		.priority = priority,
+	};
+	struct mem_cgroup *mem;
+
+	if (!scanning_global_lru(sc)) {
+		shrink_lruvec(priority, zone,
+			mem_cgroup_zone_lruvec(zone, sc->mem_cgroup), sc);
+	} else {
+		/*
+		 * Stop once the target is met, and let the next pass go on
+		 * from there.  kswapd's target is unlimited: it balances
+		 * the zone as a whole and always visits every cgroup.
+		 */
+		mem = mem_cgroup_reclaim_iter(NULL, &reclaim);
+		do {
+			shrink_lruvec(priority, zone,
+				mem_cgroup_zone_lruvec(zone, mem), sc);
+			if (sc->nr_reclaimed >= sc->nr_to_reclaim) {
+				mem_cgroup_iter_break(mem);
+				break;
+			}
+		} while ((mem = mem_cgroup_reclaim_iter(mem, &reclaim)));
+	}
 
 	throttle_vm_writeout(sc->gfp_mask);
 }
@@ -1873,7 +1969,6 @@ unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 		.swappiness = vm_swappiness,
 		.order = order,
 		.mem_cgroup = NULL,
-		.isolate_pages = isolate_pages_global,
 		.nodemask = nodemask,
 	};
 
@@ -1894,7 +1989,6 @@ unsigned long mem_cgroup_shrink_node_zone(struct mem_cgroup *mem,
 		.swappiness = swappiness,
 		.order = 0,
 		.mem_cgroup = mem,
-		.isolate_pages = mem_cgroup_isolate_pages,
 	};
 	nodemask_t nm  = nodemask_of_node(nid);
 
@@ -1928,7 +2022,6 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *mem_cont,
 		.swappiness = swappiness,
 		.order = 0,
 		.mem_cgroup = mem_cont,
-		.isolate_pages = mem_cgroup_isolate_pages,
 		.nodemask = NULL, /* we don't care the placement */
 	};
 
@@ -1966,6 +2059,25 @@ static int sleeping_prematurely(pg_data_t *pgdat, int order, long remaining)
 	return 0;
 }
 
+/*
+ * Do some background aging of the anon lists of every cgroup in the
+ * zone, to give pages a chance to be referenced before reclaiming.
+ */
+static void age_active_anon(struct zone *zone, struct scan_control *sc,
+			    int priority)
+{
+	struct mem_cgroup *mem;
+
+	mem = mem_cgroup_iter(NULL);
+	do {
+		struct lruvec *lruvec = mem_cgroup_zone_lruvec(zone, mem);
+
+		if (inactive_anon_is_low(zone, lruvec, sc))
+			shrink_active_list(SWAP_CLUSTER_MAX, zone, lruvec,
+					   sc, priority, 0);
+	} while ((mem = mem_cgroup_iter(mem)));
+}
+
 /*
  * For kswapd, balance_pgdat() will work across all this node's zones until
  * they are all at high_wmark_pages(zone).
@@ -2006,7 +2118,6 @@ static unsigned long balance_pgdat(pg_data_t *pgdat, int order)
 		.swappiness = vm_swappiness,
 		.order = order,
 		.mem_cgroup = NULL,
-		.isolate_pages = isolate_pages_global,
 	};
 	/*
 	 * temp_priority is used to remember the scanning priority at which
@@ -2052,9 +2163,7 @@ loop_again:
 			 * Do some background aging of the anon list, to give
 			 * pages a chance to be referenced before reclaiming.
 			 */
-			if (inactive_anon_is_low(zone, &sc))
-				shrink_active_list(SWAP_CLUSTER_MAX, zone,
-							&sc, priority, 0);
+			age_active_anon(zone, &sc, priority);
 
 			if (!zone_watermark_ok(zone, order,
 					high_wmark_pages(zone), 0, 0)) {
@@ -2385,7 +2494,6 @@ unsigned long shrink_all_memory(unsigned long nr_to_reclaim)
 		.hibernation_mode = 1,
 		.swappiness = vm_swappiness,
 		.order = 0,
-		.isolate_pages = isolate_pages_global,
 	};
 	struct zonelist * zonelist = node_zonelist(numa_node_id(), sc.gfp_mask);
 	struct task_struct *p = current;
@@ -2570,7 +2678,6 @@ static int __zone_reclaim(struct zone *zone, gfp_t gfp_mask, unsigned int order)
 		.gfp_mask = gfp_mask,
 		.swappiness = vm_swappiness,
 		.order = order,
-		.isolate_pages = isolate_pages_global,
 	};
 	unsigned long slab_reclaimable;
 
@@ -2708,18 +2815,21 @@ int page_evictable(struct page *page, struct vm_area_struct *vma)
 }
 
 /**
- * check_move_unevictable_page - check page for evictability and move to appropriate zone lru list
+ * check_move_unevictable_page - check page for evictability and move to appropriate lru list
  * @page: page to check evictability and move to appropriate lru list
- * @zone: zone page is in
+ * @lruvec: lruvec the page is on
  *
  * Checks a page for evictability and moves the page to the appropriate
- * zone lru list.
+ * list of its lruvec.
  *
- * Restrictions: zone->lru_lock must be held, page must be on LRU and must
+ * Restrictions: lruvec->lru_lock must be held, page must be on LRU and must
  * have PageUnevictable set.
  */
-static void check_move_unevictable_page(struct page *page, struct zone *zone)
+static void check_move_unevictable_page(struct page *page,
+					struct lruvec *lruvec)
 {
+	struct zone *zone = page_zone(page);
+
 	VM_BUG_ON(PageActive(page));
 
 retry:
@@ -2728,8 +2838,9 @@ retry:
 		enum lru_list l = page_lru_base_type(page);
 
 		__dec_zone_state(zone, NR_UNEVICTABLE);
-		list_move(&page->lru, &zone->lru[l].list);
-		mem_cgroup_move_lists(page, LRU_UNEVICTABLE, l);
+		lruvec->count[LRU_UNEVICTABLE]--;
+		list_move(&page->lru, &lruvec->lists[l]);
+		lruvec->count[l]++;
 		__inc_zone_state(zone, NR_INACTIVE_ANON + l);
 		__count_vm_event(UNEVICTABLE_PGRESCUED);
 	} else {
@@ -2737,8 +2848,7 @@ retry:
 		 * rotate unevictable list
 		 */
 		SetPageUnevictable(page);
-		list_move(&page->lru, &zone->lru[LRU_UNEVICTABLE].list);
-		mem_cgroup_rotate_lru_list(page, LRU_UNEVICTABLE);
+		list_move(&page->lru, &lruvec->lists[LRU_UNEVICTABLE]);
 		if (page_evictable(page, NULL))
 			goto retry;
 	}
@@ -2756,7 +2866,7 @@ void scan_mapping_unevictable_pages(struct address_space *mapping)
 	pgoff_t next = 0;
 	pgoff_t end   = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1) >>
 			 PAGE_CACHE_SHIFT;
-	struct zone *zone;
+	struct lruvec *locked;
 	struct pagevec pvec;
 
 	if (mapping->nrpages == 0)
@@ -2768,30 +2878,38 @@ void scan_mapping_unevictable_pages(struct address_space *mapping)
 		int i;
 		int pg_scanned = 0;
 
-		zone = NULL;
+		locked = NULL;
 
+		/* The pages can move between cgroups until we lock them */
+		rcu_read_lock();
 		for (i = 0; i < pagevec_count(&pvec); i++) {
 			struct page *page = pvec.pages[i];
 			pgoff_t page_index = page->index;
-			struct zone *pagezone = page_zone(page);
+			struct lruvec *lruvec;
 
 			pg_scanned++;
 			if (page_index > next)
 				next = page_index;
 			next++;
 
-			if (pagezone != zone) {
-				if (zone)
-					spin_unlock_irq(&zone->lru_lock);
-				zone = pagezone;
-				spin_lock_irq(&zone->lru_lock);
+			lruvec = page_lruvec(page);
+			if (!lruvec)
+				continue;
+			if (lruvec != locked) {
+				if (locked)
+					spin_unlock_irq(&locked->lru_lock);
+				locked = lruvec;
+				spin_lock_irq(&locked->lru_lock);
 			}
 
-			if (PageLRU(page) && PageUnevictable(page))
-				check_move_unevictable_page(page, zone);
+			/* The page may have moved before we got the lock */
+			if (PageLRU(page) && PageUnevictable(page) &&
+			    page_lruvec(page) == locked)
+				check_move_unevictable_page(page, locked);
 		}
-		if (zone)
-			spin_unlock_irq(&zone->lru_lock);
+		if (locked)
+			spin_unlock_irq(&locked->lru_lock);
+		rcu_read_unlock();
 		pagevec_release(&pvec);
 
 		count_vm_events(UNEVICTABLE_PGSCANNED, pg_scanned);
@@ -2803,26 +2921,30 @@ void scan_mapping_unevictable_pages(struct address_space *mapping)
  * scan_zone_unevictable_pages - check unevictable list for evictable pages
  * @zone - zone of which to scan the unevictable list
  *
- * Scan @zone's unevictable LRU lists to check for pages that have become
- * evictable.  Move those that have to @zone's inactive list where they
- * become candidates for reclaim, unless shrink_inactive_zone() decides
- * to reactivate them.  Pages that are still unevictable are rotated
- * back onto @zone's unevictable list.
+ * Scan the unevictable LRU lists of @zone, those of every cgroup, to
+ * check for pages that have become evictable.  Move those that have to
+ * the inactive list where they become candidates for reclaim, unless
+ * shrink_inactive_zone() decides to reactivate them.  Pages that are
+ * still unevictable are rotated back onto the unevictable list.
  */
 #define SCAN_UNEVICTABLE_BATCH_SIZE 16UL /* arbitrary lock hold batch size */
-static void scan_zone_unevictable_pages(struct zone *zone)
+static void scan_lruvec_unevictable_pages(struct lruvec *lruvec)
 {
-	struct list_head *l_unevictable = &zone->lru[LRU_UNEVICTABLE].list;
+	struct list_head *l_unevictable = &lruvec->lists[LRU_UNEVICTABLE];
 	unsigned long scan;
-	unsigned long nr_to_scan = zone_page_state(zone, NR_UNEVICTABLE);
+	unsigned long nr_to_scan = lruvec->count[LRU_UNEVICTABLE];
 
 	while (nr_to_scan > 0) {
 		unsigned long batch_size = min(nr_to_scan,
 						SCAN_UNEVICTABLE_BATCH_SIZE);
 
-		spin_lock_irq(&zone->lru_lock);
+		spin_lock_irq(&lruvec->lru_lock);
 		for (scan = 0;  scan < batch_size; scan++) {
-			struct page *page = lru_to_page(l_unevictable);
+			struct page *page;
+
+			if (list_empty(l_unevictable))
+				break;
+			page = lru_to_page(l_unevictable);
 
 			if (!trylock_page(page))
 				continue;
@@ -2830,16 +2952,26 @@ static void scan_zone_unevictable_pages(struct zone *zone)
 			prefetchw_prev_lru_page(page, l_unevictable, flags);
 
 			if (likely(PageLRU(page) && PageUnevictable(page)))
-				check_move_unevictable_page(page, zone);
+				check_move_unevictable_page(page, lruvec);
 
 			unlock_page(page);
 		}
-		spin_unlock_irq(&zone->lru_lock);
+		spin_unlock_irq(&lruvec->lru_lock);
 
 		nr_to_scan -= batch_size;
 	}
 }
 
+static void scan_zone_unevictable_pages(struct zone *zone)
+{
+	struct mem_cgroup *mem;
+
+	mem = mem_cgroup_iter(NULL);
+	do {
+		scan_lruvec_unevictable_pages(mem_cgroup_zone_lruvec(zone, mem));
+	} while ((mem = mem_cgroup_iter(mem)));
+}
+
 
 /**
  * scan_all_zones_unevictable_pages - scan all unevictable lists for evictable pages
@@ -0,0 +1,301 @@
+/*
+ * linux/mm/workingset.c
+ *
+ * Working set detection for the file LRU lists.
+ *
+ * The file LRU is split into an inactive and an active list. Faulted pages
+ * start out on the inactive list and are promoted to the active list when
+ * they are referenced a second time while still resident. Pages are evicted
+ * from the tail of the inactive list, and active pages are demoted to it
+ * whenever it becomes too small compared to the active list.
+ *
+ * This only recognizes a page as frequently used if its second access
+ * happens within the time the inactive list takes to cycle. When a
+ * streaming read is larger than memory, the pages of the real working set
+ * are pushed out of the inactive list before their next access. They
+ * thrash in and out of the cache without ever being activated.
+ *
+ * To notice this, every zone keeps a counter, inactive_age. It advances
+ * on each eviction and on each activation, which are exactly the events
+ * that move a page towards the tail of the inactive list. When a page is
+ * evicted, the counter value is stored in the page's slot in the page
+ * cache radix tree as an exceptional "shadow" entry. If the page is
+ * faulted back in, the difference between the current counter and the
+ * stored value is the refault distance. This is the number of slots the
+ * inactive list would have needed beyond its current size for the page
+ * to still be resident at its second access.
+ *
+ * Every page that is active right now could be demoted and make room for
+ * that, so a refault distance no bigger than the active file list means
+ * that the page would have been kept with a better balanced list. Such a
+ * page is activated right away when it is faulted back in. It then
+ * competes with the current working set on equal terms. If it is not used
+ * again, it will be demoted like any other active page.
+ *
+ * Shadow entries are removed when the page comes back or when its range is
+ * truncated, and they go away with the inode otherwise. An inode that
+ * stays in use could collect them without bound, though, so a shrinker
+ * drops the ones that became too old to ever activate a page.
+ */
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+#include <linux/pagevec.h>
+#include <linux/percpu.h>
+#include <linux/radix-tree.h>
+
+/*
+ * The shadow entry packs the zone along with the eviction counter into
+ * an exceptional radix tree entry. The counter has fewer bits than the
+ * one in the zone, so refault distances are computed modulo its width.
+ */
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 NODES_SHIFT + ZONES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction, refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in @mapping->page_tree in place
+ * of the evicted @page so that a later refault can be detected.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Calculates and evaluates the refault distance of the previously
+ * evicted page in the context of the zone it was allocated in.
+ *
+ * Returns %true if the page should be activated, %false otherwise.
+ */
+bool workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Mappings with shadow entries are kept on shadow_mappings, in the order
+ * in which they got their first one. shadow_lock nests inside the
+ * tree_lock of the mappings, the shrinker only trylocks those.
+ */
+static LIST_HEAD(shadow_mappings);
+static DEFINE_SPINLOCK(shadow_lock);
+static DEFINE_PER_CPU(long, nr_shadows);
+
+/**
+ * workingset_shadow_add - account a shadow entry stored in a mapping
+ * @mapping: the mapping, with its tree_lock held
+ */
+void workingset_shadow_add(struct address_space *mapping)
+{
+	if (!mapping->nrshadows++) {
+		spin_lock(&shadow_lock);
+		list_add_tail(&mapping->shadow_list, &shadow_mappings);
+		spin_unlock(&shadow_lock);
+	}
+	this_cpu_inc(nr_shadows);
+}
+
+/**
+ * workingset_shadow_remove - account a shadow entry removed from a mapping
+ * @mapping: the mapping, with its tree_lock held
+ */
+void workingset_shadow_remove(struct address_space *mapping)
+{
+	if (!--mapping->nrshadows) {
+		spin_lock(&shadow_lock);
+		list_del_init(&mapping->shadow_list);
+		spin_unlock(&shadow_lock);
+	}
+	this_cpu_dec(nr_shadows);
+}
+
+/*
+ * A shadow entry whose refault distance exceeds the active file list
+ * would not get its page activated anymore.
+ */
+static bool shadow_is_stale(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	return refault_distance > zone_page_state(zone, NR_ACTIVE_FILE);
+}
+
+/*
+ * Every eviction advances the inactive_age of one zone, so no more shadow
+ * entries than there are active file pages can still be useful. Only the
+ * ones beyond that are offered to reclaim.
+ */
+static int count_stale_shadows(void)
+{
+	unsigned long active = global_page_state(NR_ACTIVE_FILE);
+	long shadows = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		shadows += per_cpu(nr_shadows, cpu);
+	if (shadows <= (long)active)
+		return 0;
+	return min_t(unsigned long, shadows - active, INT_MAX);
+}
+
+/*
+ * Drop the stale shadow entries among the next entries of @mapping from
+ * *@start on. Returns the number of entries looked at; *@start is set to
+ * where to continue, or 0 at the end of the mapping.
+ */
+static unsigned long scan_mapping_shadows(struct address_space *mapping,
+					  pgoff_t *start, unsigned long nr)
+{
+	void **slots[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	unsigned long scanned = 0;
+	unsigned int i, n;
+
+	while (mapping->nrshadows && scanned < nr) {
+		n = radix_tree_gang_lookup_slot(&mapping->page_tree, slots,
+						indices, *start, PAGEVEC_SIZE);
+		if (!n) {
+			*start = 0;
+			break;
+		}
+		/* Look at all entries before deleting moves any slot */
+		for (i = 0; i < n; i++) {
+			void *entry = radix_tree_deref_slot(slots[i]);
+
+			if (!radix_tree_exceptional_entry(entry) ||
+			    !shadow_is_stale(entry))
+				slots[i] = NULL;
+		}
+		for (i = 0; i < n; i++) {
+			if (!slots[i])
+				continue;
+			radix_tree_delete(&mapping->page_tree, indices[i]);
+			mapping->nrshadows--;
+			this_cpu_dec(nr_shadows);
+		}
+		scanned += n;
+		*start = indices[n - 1] + 1;
+		if (!*start)
+			break;
+	}
+	return scanned;
+}
+
+/*
+ * Walk the mappings round robin, resuming inside the first one where the
+ * previous call stopped.
+ */
+static int shrink_shadows(int nr_to_scan, gfp_t gfp_mask)
+{
+	static struct address_space *cursor_mapping;
+	static pgoff_t cursor;
+	struct address_space *mapping;
+	unsigned long scanned;
+
+	if (!nr_to_scan)
+		return count_stale_shadows();
+
+	spin_lock_irq(&shadow_lock);
+	while (nr_to_scan > 0 && !list_empty(&shadow_mappings)) {
+		mapping = list_first_entry(&shadow_mappings,
+					   struct address_space, shadow_list);
+		if (mapping != cursor_mapping) {
+			cursor_mapping = mapping;
+			cursor = 0;
+		}
+		if (!spin_trylock(&mapping->tree_lock)) {
+			nr_to_scan--;
+			cursor = 0;
+		} else {
+			scanned = scan_mapping_shadows(mapping, &cursor,
+						       nr_to_scan);
+			nr_to_scan -= max(scanned, 1UL);
+			if (!mapping->nrshadows)
+				list_del_init(&mapping->shadow_list);
+			spin_unlock(&mapping->tree_lock);
+			if (cursor)
+				continue;
+		}
+		if (!list_empty(&mapping->shadow_list))
+			list_move_tail(&mapping->shadow_list, &shadow_mappings);
+		cursor_mapping = NULL;
+	}
+	spin_unlock_irq(&shadow_lock);
+
+	return count_stale_shadows();
+}
+
+static struct shrinker workingset_shadow_shrinker = {
+	.shrink = shrink_shadows,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	register_shrinker(&workingset_shadow_shrinker);
+	return 0;
+}
+module_init(workingset_init);